@@ -42,6 +42,7 @@ struct encode_opts {
     bool copy_metadata;
     char **set_metadata;
     char **remove_metadata;
+    int pipeline_depth;
 };
 
 // interface for player core
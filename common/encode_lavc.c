@@ -20,6 +20,8 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdatomic.h>
+
 #include <libavutil/avutil.h>
 #include <libavutil/timestamp.h>
 
@@ -60,6 +62,37 @@ struct encode_priv {
 
     unsigned int frames;
     double audioseconds;
+
+    // Muxer thread (with --opipeline-depth). Uses encode_lavc_context.lock.
+    // While it runs, only the muxer thread accesses the muxer, and it does so
+    // without holding the lock.
+    mp_thread mux_thread;
+    mp_cond mux_wakeup;
+    bool mux_thread_running;
+    bool mux_terminate;
+    struct mux_packet *mux_queue;
+    int num_mux_queue;
+    int max_mux_queue;
+    int peak_mux_queue;
+    int64_t mux_bytes;  // output size, updated by the muxer thread
+};
+
+struct mux_packet {
+    struct mux_stream *dst;
+    AVPacket *pkt;
+};
+
+// Encoder thread (with --opipeline-depth).
+struct encoder_worker {
+    mp_thread thread;
+    mp_mutex lock;
+    mp_cond wakeup;
+    AVFrame **frames;   // FIFO; a NULL entry requests flushing
+    int num_frames;
+    int max_frames;
+    bool busy;          // worker is encoding a frame
+    bool failed;
+    bool terminate;
 };
 
 struct mux_stream {
@@ -71,6 +104,7 @@ struct mux_stream {
     AVStream *st;
     void (*on_ready)(void *ctx);    // when finishing muxer init
     void *on_ready_ctx;
+    atomic_int queued_frames;       // frames waiting in the encoder queue
 };
 
 #define OPT_BASE_STRUCT struct encode_opts
@@ -87,6 +121,7 @@ const struct m_sub_options encode_config = {
         {"ocopy-metadata", OPT_BOOL(copy_metadata)},
         {"oset-metadata", OPT_KEYVALUELIST(set_metadata)},
         {"oremove-metadata", OPT_STRINGLIST(remove_metadata)},
+        {"opipeline-depth", OPT_INT(pipeline_depth), M_RANGE(0, 256)},
         {0}
     },
     .size = sizeof(struct encode_opts),
@@ -108,6 +143,7 @@ struct encode_lavc_context *encode_lavc_init(struct mpv_global *global)
 
     struct encode_priv *p = ctx->priv;
     p->log = ctx->log;
+    mp_cond_init(&p->mux_wakeup);
 
     const char *filename = ctx->options->file;
 
@@ -181,6 +217,25 @@ void encode_lavc_set_metadata(struct encode_lavc_context *ctx,
     mp_mutex_unlock(&ctx->lock);
 }
 
+static void stop_mux_thread(struct encode_lavc_context *ctx)
+{
+    struct encode_priv *p = ctx->priv;
+
+    if (!p->mux_thread_running)
+        return;
+
+    // The thread writes all remaining packets before exiting.
+    mp_mutex_lock(&ctx->lock);
+    p->mux_terminate = true;
+    mp_cond_broadcast(&p->mux_wakeup);
+    mp_mutex_unlock(&ctx->lock);
+
+    mp_thread_join(p->mux_thread);
+    p->mux_thread_running = false;
+
+    MP_VERBOSE(p, "muxer queue peak: %d packets\n", p->peak_mux_queue);
+}
+
 bool encode_lavc_free(struct encode_lavc_context *ctx)
 {
     bool res = true;
@@ -189,6 +244,8 @@ bool encode_lavc_free(struct encode_lavc_context *ctx)
 
     struct encode_priv *p = ctx->priv;
 
+    stop_mux_thread(ctx);
+
     if (!p->failed && !p->header_written) {
         MP_FATAL(p, "no data written to target file\n");
         p->failed = true;
@@ -214,12 +271,101 @@ bool encode_lavc_free(struct encode_lavc_context *ctx)
 
     res = !p->failed;
 
+    mp_cond_destroy(&p->mux_wakeup);
     mp_mutex_destroy(&ctx->lock);
     talloc_free(ctx);
 
     return res;
 }
 
+// Prepare a packet for muxing, and update the statistics.
+// called locked
+static void prepare_packet(struct encode_lavc_context *ctx,
+                           struct mux_stream *dst, AVPacket *pkt)
+{
+    struct encode_priv *p = ctx->priv;
+
+    pkt->stream_index = dst->st->index;
+    assert(dst->st == p->muxer->streams[pkt->stream_index]);
+
+    av_packet_rescale_ts(pkt, dst->encoder_timebase, dst->st->time_base);
+
+    switch (dst->st->codecpar->codec_type) {
+    case AVMEDIA_TYPE_VIDEO:
+        p->vbytes += pkt->size;
+        p->frames += 1;
+        break;
+    case AVMEDIA_TYPE_AUDIO:
+        p->abytes += pkt->size;
+        p->audioseconds += pkt->duration
+            * (double)dst->st->time_base.num
+            / (double)dst->st->time_base.den;
+        break;
+    }
+}
+
+// Write a packet to the muxer. This will take over ownership of `pkt`.
+// called locked
+static void write_packet(struct encode_lavc_context *ctx,
+                         struct mux_stream *dst, AVPacket *pkt)
+{
+    struct encode_priv *p = ctx->priv;
+
+    if (p->failed) {
+        av_packet_unref(pkt);
+        return;
+    }
+
+    prepare_packet(ctx, dst, pkt);
+
+    if (av_interleaved_write_frame(p->muxer, pkt) < 0) {
+        MP_ERR(p, "Writing packet failed.\n");
+        p->failed = true;
+    }
+}
+
+static MP_THREAD_VOID muxer_thread(void *arg)
+{
+    struct encode_lavc_context *ctx = arg;
+    struct encode_priv *p = ctx->priv;
+    mp_thread_set_name("encode/mux");
+
+    mp_mutex_lock(&ctx->lock);
+    while (1) {
+        if (!p->num_mux_queue) {
+            if (p->mux_terminate)
+                break;
+            mp_cond_wait(&p->mux_wakeup, &ctx->lock);
+            continue;
+        }
+        struct mux_packet item = p->mux_queue[0];
+        MP_TARRAY_REMOVE_AT(p->mux_queue, p->num_mux_queue, 0);
+        mp_cond_broadcast(&p->mux_wakeup);
+        if (p->failed) {
+            av_packet_free(&item.pkt);
+            continue;
+        }
+        prepare_packet(ctx, item.dst, item.pkt);
+
+        // Don't block the encoders while writing.
+        mp_mutex_unlock(&ctx->lock);
+        bool ok = av_interleaved_write_frame(p->muxer, item.pkt) >= 0;
+        int64_t size = p->muxer->pb ? avio_tell(p->muxer->pb) : 0;
+        av_packet_free(&item.pkt);
+        mp_mutex_lock(&ctx->lock);
+
+        p->mux_bytes = size;
+        if (!ok) {
+            MP_ERR(p, "Writing packet failed.\n");
+            p->failed = true;
+            mp_cond_broadcast(&p->mux_wakeup);
+        }
+    }
+    mp_mutex_unlock(&ctx->lock);
+
+    MP_THREAD_RETURN();
+}
+
 // called locked
 static void maybe_init_muxer(struct encode_lavc_context *ctx)
 {
@@ -274,6 +420,15 @@ static void maybe_init_muxer(struct encode_lavc_context *ctx)
 
     p->header_written = true;
 
+    if (ctx->options->pipeline_depth > 0) {
+        p->max_mux_queue = ctx->options->pipeline_depth * p->num_streams;
+        if (mp_thread_create(&p->mux_thread, muxer_thread, ctx)) {
+            MP_WARN(p, "Failed to start muxer thread, muxing synchronously.\n");
+        } else {
+            p->mux_thread_running = true;
+        }
+    }
+
     for (int n = 0; n < p->num_streams; n++) {
         struct mux_stream *s = p->streams[n];
 
@@ -384,7 +539,8 @@ done:
     mp_mutex_unlock(&ctx->lock);
 }
 
-// Write a packet. This will take over ownership of `pkt`
+// Write a packet (or queue it for the muxer thread). This will take over
+// ownership of `pkt`.
 static void encode_lavc_add_packet(struct mux_stream *dst, AVPacket *pkt)
 {
     struct encode_lavc_context *ctx = dst->ctx;
@@ -403,27 +559,20 @@ static void encode_lavc_add_packet(struct mux_stream *dst, AVPacket *pkt)
         goto done;
     }
 
-    pkt->stream_index = dst->st->index;
-    assert(dst->st == p->muxer->streams[pkt->stream_index]);
-
-    av_packet_rescale_ts(pkt, dst->encoder_timebase, dst->st->time_base);
-
-    switch (dst->st->codecpar->codec_type) {
-    case AVMEDIA_TYPE_VIDEO:
-        p->vbytes += pkt->size;
-        p->frames += 1;
-        break;
-    case AVMEDIA_TYPE_AUDIO:
-        p->abytes += pkt->size;
-        p->audioseconds += pkt->duration
-            * (double)dst->st->time_base.num
-            / (double)dst->st->time_base.den;
-        break;
-    }
-
-    if (av_interleaved_write_frame(p->muxer, pkt) < 0) {
-        MP_ERR(p, "Writing packet failed.\n");
-        p->failed = true;
+    if (p->mux_thread_running) {
+        while (p->num_mux_queue >= p->max_mux_queue && !p->failed)
+            mp_cond_wait(&p->mux_wakeup, &ctx->lock);
+        if (p->failed)
+            goto done;
+        AVPacket *copy = av_packet_alloc();
+        MP_HANDLE_OOM(copy);
+        av_packet_move_ref(copy, pkt);
+        MP_TARRAY_APPEND(p, p->mux_queue, p->num_mux_queue,
+                         (struct mux_packet){dst, copy});
+        p->peak_mux_queue = MPMAX(p->peak_mux_queue, p->num_mux_queue);
+        mp_cond_broadcast(&p->mux_wakeup);
+    } else {
+        write_packet(ctx, dst, pkt);
     }
 
     pkt = NULL;
@@ -675,18 +824,40 @@ int encode_lavc_getstatus(struct encode_lavc_context *ctx,
     }
 
     minutes = (now - p->t0) / 60.0 * (1 - f) / f;
-    megabytes = p->muxer->pb ? (avio_size(p->muxer->pb) / 1048576.0 / f) : 0;
+    int64_t bytes = 0;
+    if (p->mux_thread_running) {
+        bytes = p->mux_bytes;
+    } else if (p->muxer->pb) {
+        bytes = avio_size(p->muxer->pb);
+    }
+    megabytes = bytes / 1048576.0 / f;
     fps = p->frames / (now - p->t0);
     x = p->audioseconds / (now - p->t0);
+
+    // Queue fill levels of the encoder and muxer threads.
+    char queues[80] = "";
+    if (p->mux_thread_running) {
+        int len = 0;
+        for (int n = 0; n < p->num_streams && len < (int)sizeof(queues); n++) {
+            struct mux_stream *s = p->streams[n];
+            len += snprintf(queues + len, sizeof(queues) - len, " %c:%d",
+                            s->name[0], atomic_load(&s->queued_frames));
+        }
+        if (len < (int)sizeof(queues)) {
+            snprintf(queues + len, sizeof(queues) - len, " mux:%d",
+                     p->num_mux_queue);
+        }
+    }
+
     if (p->frames) {
-        snprintf(buf, bufsize, "{%.1fmin %.1ffps %.1fMB}",
-                 minutes, fps, megabytes);
+        snprintf(buf, bufsize, "{%.1fmin %.1ffps %.1fMB%s}",
+                 minutes, fps, megabytes, queues);
     } else if (p->audioseconds) {
-        snprintf(buf, bufsize, "{%.1fmin %.2fx %.1fMB}",
-                 minutes, x, megabytes);
+        snprintf(buf, bufsize, "{%.1fmin %.2fx %.1fMB%s}",
+                 minutes, x, megabytes, queues);
     } else {
-        snprintf(buf, bufsize, "{%.1fmin %.1fMB}",
-                 minutes, megabytes);
+        snprintf(buf, bufsize, "{%.1fmin %.1fMB%s}",
+                 minutes, megabytes, queues);
     }
     buf[bufsize - 1] = 0;
 
@@ -705,10 +876,31 @@ bool encode_lavc_didfail(struct encode_lavc_context *ctx)
     return fail;
 }
 
+static void stop_encoder_worker(struct encoder_context *p)
+{
+    struct encoder_worker *w = p->worker;
+    if (!w)
+        return;
+
+    mp_mutex_lock(&w->lock);
+    w->terminate = true;
+    mp_cond_broadcast(&w->wakeup);
+    mp_mutex_unlock(&w->lock);
+
+    mp_thread_join(w->thread);
+
+    for (int n = 0; n < w->num_frames; n++)
+        av_frame_free(&w->frames[n]);
+    mp_cond_destroy(&w->wakeup);
+    mp_mutex_destroy(&w->lock);
+    TA_FREEP(&p->worker);
+}
+
 static void encoder_destroy(void *ptr)
 {
     struct encoder_context *p = ptr;
 
+    stop_encoder_worker(p);
     av_packet_free(&p->pkt);
     avcodec_parameters_free(&p->info.codecpar);
     avcodec_free_context(&p->encoder);
@@ -836,6 +1028,58 @@ static void encoder_2pass_prepare(struct encoder_context *p)
     talloc_free(filename);
 }
 
+static bool encode_frame(struct encoder_context *p, AVFrame *frame);
+
+static MP_THREAD_VOID encoder_thread(void *arg)
+{
+    struct encoder_context *p = arg;
+    struct encoder_worker *w = p->worker;
+    mp_thread_set_name(p->type == STREAM_VIDEO ? "encode/video" : "encode/audio");
+
+    mp_mutex_lock(&w->lock);
+    while (1) {
+        if (!w->num_frames) {
+            if (w->terminate)
+                break;
+            mp_cond_wait(&w->wakeup, &w->lock);
+            continue;
+        }
+        AVFrame *frame = w->frames[0];
+        MP_TARRAY_REMOVE_AT(w->frames, w->num_frames, 0);
+        atomic_store(&p->mux_stream->queued_frames, w->num_frames);
+        w->busy = true;
+        mp_cond_broadcast(&w->wakeup);
+        mp_mutex_unlock(&w->lock);
+
+        bool ok = w->failed || encode_frame(p, frame);
+        av_frame_free(&frame);
+
+        mp_mutex_lock(&w->lock);
+        w->failed |= !ok;
+        w->busy = false;
+        mp_cond_broadcast(&w->wakeup);
+    }
+    mp_mutex_unlock(&w->lock);
+
+    MP_THREAD_RETURN();
+}
+
+static void start_encoder_worker(struct encoder_context *p)
+{
+    struct encoder_worker *w = talloc_zero(p, struct encoder_worker);
+    w->max_frames = p->options->pipeline_depth;
+    mp_mutex_init(&w->lock);
+    mp_cond_init(&w->wakeup);
+    p->worker = w;
+
+    if (mp_thread_create(&w->thread, encoder_thread, p)) {
+        MP_WARN(p, "Failed to start encoder thread, encoding synchronously.\n");
+        mp_cond_destroy(&w->wakeup);
+        mp_mutex_destroy(&w->lock);
+        TA_FREEP(&p->worker);
+    }
+}
+
 bool encoder_init_codec_and_muxer(struct encoder_context *p,
                                   void (*on_ready)(void *ctx), void *ctx)
 {
@@ -897,6 +1141,9 @@ bool encoder_init_codec_and_muxer(struct encoder_context *p,
     if (!p->mux_stream)
         goto fail;
 
+    if (p->options->pipeline_depth > 0)
+        start_encoder_worker(p);
+
     return true;
 
 fail:
@@ -904,7 +1151,7 @@ fail:
     return false;
 }
 
-bool encoder_encode(struct encoder_context *p, AVFrame *frame)
+static bool encode_frame(struct encoder_context *p, AVFrame *frame)
 {
     int status = avcodec_send_frame(p->encoder, frame);
     if (status < 0) {
@@ -940,6 +1187,37 @@ fail:
     return false;
 }
 
+bool encoder_encode(struct encoder_context *p, AVFrame *frame)
+{
+    struct encoder_worker *w = p->worker;
+    if (!w)
+        return encode_frame(p, frame);
+
+    AVFrame *copy = NULL;
+    if (frame) {
+        copy = av_frame_clone(frame);
+        MP_HANDLE_OOM(copy);
+    }
+
+    mp_mutex_lock(&w->lock);
+    while (w->num_frames >= w->max_frames && !w->failed)
+        mp_cond_wait(&w->wakeup, &w->lock);
+    if (!w->failed) {
+        MP_TARRAY_APPEND(w, w->frames, w->num_frames, copy);
+        atomic_store(&p->mux_stream->queued_frames, w->num_frames);
+        copy = NULL;
+        mp_cond_broadcast(&w->wakeup);
+    }
+    // Flushing is synchronous, so that the caller can tear down afterwards.
+    while (!frame && (w->num_frames || w->busy))
+        mp_cond_wait(&w->wakeup, &w->lock);
+    bool ok = !w->failed;
+    mp_mutex_unlock(&w->lock);
+
+    av_frame_free(&copy);
+    return ok;
+}
+
 void encoder_update_log(struct mpv_global *global)
 {
     struct encode_opts *options = mp_get_config_group(NULL, global, &encode_config);
@@ -86,6 +86,7 @@ struct encoder_context {
     // (essentially private)
     struct stream *twopass_bytebuffer;
     AVPacket *pkt;
+    struct encoder_worker *worker; // with --opipeline-depth
 };
 
 // Free with talloc_free(). (Keep in mind actual deinitialization requires
@@ -105,6 +106,10 @@ bool encoder_init_codec_and_muxer(struct encoder_context *p,
                                   void (*on_ready)(void *ctx), void *ctx);
 
 // Encode the frame and write the packet. frame is ref'ed as need.
+// With --opipeline-depth, the frame is only queued for encoding on a worker
+// thread, and this blocks only if the queue is full. Encoding errors are then
+// reported by a later call. Passing frame==NULL flushes the encoder and waits
+// until all queued frames have been encoded.
 bool encoder_encode(struct encoder_context *p, AVFrame *frame);
 
 // Return muxer timebase (only available after on_ready() has been called).
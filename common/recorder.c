@@ -23,9 +23,13 @@
 #include "common/common.h"
 #include "common/global.h"
 #include "common/msg.h"
+#include "common/stats.h"
 #include "demux/demux.h"
 #include "demux/packet.h"
 #include "demux/stheader.h"
+#include "options/m_config.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
 
 #include "recorder.h"
 
@@ -58,6 +62,29 @@ struct mp_recorder {
     double rebase_ts;
 
     AVFormatContext *mux;
+
+    struct stats_ctx *stats;
+
+    // Write-behind queue (--stream-record-buffer). If the writer thread is
+    // running, only it accesses the mux context. Fields are protected by lock.
+    mp_thread writer;
+    bool writer_running;
+    mp_mutex lock;
+    mp_cond wakeup;
+    bool writer_exit;
+    AVPacket **queue;
+    int num_queue;
+    int64_t queue_bytes;
+    int64_t max_queue_bytes;
+    int overflow;           // RECORD_OVERFLOW_*
+    int64_t peak_queue_bytes;
+    int64_t max_write_ns;
+    int64_t dropped;
+};
+
+enum {
+    RECORD_OVERFLOW_BLOCK,
+    RECORD_OVERFLOW_DROP,
 };
 
 struct mp_recorder_sink {
@@ -68,10 +95,13 @@ struct mp_recorder_sink {
     double max_out_pts;
     bool discont;
     bool proper_eof;
+    bool dropping;          // queue overflowed, drop until next keyframe
     struct demux_packet **packets;
     int num_packets;
 };
 
+static MP_THREAD_VOID writer_thread(void *arg);
+
 static int add_stream(struct mp_recorder *priv, struct sh_stream *sh)
 {
     enum AVMediaType av_type = mp_to_av_stream_type(sh->type);
@@ -137,6 +167,9 @@ struct mp_recorder *mp_recorder_create(struct mpv_global *global,
 
     priv->global = global;
     priv->log = mp_log_new(priv, global->log, "recorder");
+    priv->stats = stats_ctx_create(priv, global, "recorder");
+    mp_mutex_init(&priv->lock);
+    mp_cond_init(&priv->wakeup);
 
     if (!num_streams) {
         MP_ERR(priv, "No streams.\n");
@@ -210,6 +243,19 @@ struct mp_recorder *mp_recorder_create(struct mpv_global *global,
     priv->opened = true;
     priv->muxing_from_start = true;
 
+    struct demux_opts *opts = mp_get_config_group(NULL, global, &demux_conf);
+    priv->max_queue_bytes = opts->record_buffer;
+    priv->overflow = opts->record_overflow;
+    talloc_free(opts);
+
+    if (priv->max_queue_bytes > 0) {
+        if (mp_thread_create(&priv->writer, writer_thread, priv)) {
+            MP_WARN(priv, "Failed to start writer thread, writing synchronously.\n");
+        } else {
+            priv->writer_running = true;
+        }
+    }
+
     priv->base_ts = MP_NOPTS_VALUE;
     priv->rebase_ts = 0;
 
@@ -224,6 +270,118 @@ error:
     return NULL;
 }
 
+static void write_packet(struct mp_recorder *priv, AVPacket *pkt)
+{
+    stats_time_start(priv->stats, "write");
+    int64_t start = mp_time_ns();
+
+    if (av_interleaved_write_frame(priv->mux, pkt) < 0)
+        MP_ERR(priv, "Failed writing packet.\n");
+
+    int64_t duration = mp_time_ns() - start;
+    stats_time_end(priv->stats, "write");
+
+    mp_mutex_lock(&priv->lock);
+    priv->max_write_ns = MPMAX(priv->max_write_ns, duration);
+    int64_t max_write_ns = priv->max_write_ns;
+    mp_mutex_unlock(&priv->lock);
+    stats_value(priv->stats, "write-max-ms", max_write_ns / 1e6);
+}
+
+static MP_THREAD_VOID writer_thread(void *arg)
+{
+    struct mp_recorder *priv = arg;
+    mp_thread_set_name("recorder");
+
+    mp_mutex_lock(&priv->lock);
+    while (1) {
+        if (!priv->num_queue) {
+            if (priv->writer_exit)
+                break;
+            mp_cond_wait(&priv->wakeup, &priv->lock);
+            continue;
+        }
+        AVPacket *pkt = priv->queue[0];
+        MP_TARRAY_REMOVE_AT(priv->queue, priv->num_queue, 0);
+        priv->queue_bytes -= pkt->size;
+        stats_size_value(priv->stats, "queue-bytes", priv->queue_bytes);
+        stats_value(priv->stats, "queue-packets", priv->num_queue);
+        mp_cond_broadcast(&priv->wakeup);
+        mp_mutex_unlock(&priv->lock);
+
+        write_packet(priv, pkt);
+        av_packet_free(&pkt);
+
+        mp_mutex_lock(&priv->lock);
+    }
+    mp_mutex_unlock(&priv->lock);
+
+    MP_THREAD_RETURN();
+}
+
+// Write all queued packets and terminate the writer thread.
+static void stop_writer(struct mp_recorder *priv)
+{
+    if (!priv->writer_running)
+        return;
+
+    mp_mutex_lock(&priv->lock);
+    priv->writer_exit = true;
+    mp_cond_broadcast(&priv->wakeup);
+    mp_mutex_unlock(&priv->lock);
+
+    mp_thread_join(priv->writer);
+    priv->writer_running = false;
+
+    MP_VERBOSE(priv, "Write queue peak: %"PRId64" bytes, slowest write: "
+               "%.1f ms, dropped packets: %"PRId64"\n", priv->peak_queue_bytes,
+               priv->max_write_ns / 1e6, priv->dropped);
+}
+
+// Write the packet, or queue it for the writer thread. Takes ownership of pkt.
+static void queue_packet(struct mp_recorder_sink *rst, AVPacket *pkt)
+{
+    struct mp_recorder *priv = rst->owner;
+
+    if (!priv->writer_running) {
+        write_packet(priv, pkt);
+        av_packet_free(&pkt);
+        return;
+    }
+
+    mp_mutex_lock(&priv->lock);
+
+    if (rst->dropping && (pkt->flags & AV_PKT_FLAG_KEY))
+        rst->dropping = false;
+
+    bool full = priv->num_queue &&
+                priv->queue_bytes + pkt->size > priv->max_queue_bytes;
+    if (full && priv->overflow == RECORD_OVERFLOW_BLOCK) {
+        while (priv->num_queue &&
+               priv->queue_bytes + pkt->size > priv->max_queue_bytes)
+            mp_cond_wait(&priv->wakeup, &priv->lock);
+    } else if ((full || rst->dropping) && rst->sh->type != STREAM_SUB) {
+        // Resume only at a keyframe, or the output would be corrupted.
+        if (!rst->dropping)
+            MP_WARN(priv, "Write queue full, dropping packets.\n");
+        rst->dropping = true;
+        priv->dropped++;
+        stats_event(priv->stats, "dropped");
+        mp_mutex_unlock(&priv->lock);
+        av_packet_free(&pkt);
+        return;
+    }
+
+    MP_TARRAY_APPEND(priv, priv->queue, priv->num_queue, pkt);
+    priv->queue_bytes += pkt->size;
+    priv->peak_queue_bytes = MPMAX(priv->peak_queue_bytes, priv->queue_bytes);
+    stats_size_value(priv->stats, "queue-bytes", priv->queue_bytes);
+    stats_value(priv->stats, "queue-packets", priv->num_queue);
+    mp_cond_broadcast(&priv->wakeup);
+
+    mp_mutex_unlock(&priv->lock);
+}
+
 static void flush_packets(struct mp_recorder *priv)
 {
     for (int n = 0; n < priv->num_streams; n++) {
@@ -259,10 +417,7 @@ static void mux_packet(struct mp_recorder_sink *rst,
         return;
     }
 
-    if (av_interleaved_write_frame(priv->mux, new_packet) < 0)
-        MP_ERR(priv, "Failed writing packet.\n");
-
-    av_packet_free(&new_packet);
+    queue_packet(rst, new_packet);
 }
 
 // Write all packets available in the stream queue
@@ -332,6 +487,8 @@ void mp_recorder_destroy(struct mp_recorder *priv)
             mp_free_av_packet(&rst->avpkt);
         }
 
+        stop_writer(priv);
+
         if (av_write_trailer(priv->mux) < 0)
             MP_ERR(priv, "Writing trailer failed.\n");
     }
@@ -344,6 +501,8 @@ void mp_recorder_destroy(struct mp_recorder *priv)
     }
 
     flush_packets(priv);
+    mp_cond_destroy(&priv->wakeup);
+    mp_mutex_destroy(&priv->lock);
     talloc_free(priv);
 }
 
@@ -108,6 +108,10 @@ const struct m_sub_options demux_conf = {
         {"mf-type", OPT_STRING(mf_type)},
         {"sub-create-cc-track", OPT_BOOL(create_ccs)},
         {"stream-record", OPT_STRING(record_file)},
+        {"stream-record-buffer", OPT_BYTE_SIZE(record_buffer),
+            M_RANGE(0, M_MAX_MEM_BYTES)},
+        {"stream-record-overflow", OPT_CHOICE(record_overflow,
+            {"block", 0}, {"drop", 1})},
         {"video-backward-overlap", OPT_CHOICE(video_back_preroll, {"auto", -1}),
             M_RANGE(0, 1024)},
         {"audio-backward-overlap", OPT_CHOICE(audio_back_preroll, {"auto", -1}),
@@ -194,6 +198,7 @@ struct demux_internal {
     bool hyst_active;
     size_t max_bytes;
     size_t max_bytes_bw;
+    size_t max_bytes_limit;     // demux_set_max_bytes(), 0 if unset
     bool seekable_cache;
     bool using_network_cache_opts;
     char *record_filename;
@@ -2461,6 +2466,8 @@ static void update_opts(struct demuxer *demuxer)
     in->hyst_secs = opts->hyst_secs;
     in->max_bytes = opts->max_bytes;
     in->max_bytes_bw = opts->max_bytes_bw;
+    if (in->max_bytes_limit)
+        in->max_bytes = MPMIN(in->max_bytes, in->max_bytes_limit);
 
     int seekable = opts->seekable_cache;
     bool is_streaming = in->d_thread->is_streaming;
@@ -2518,6 +2525,20 @@ static void update_opts(struct demuxer *demuxer)
     free_empty_cached_ranges(in);
 }
 
+// Limit the forward cache to max_bytes, or to --demuxer-max-bytes if that is
+// lower. 0 removes the limit.
+void demux_set_max_bytes(struct demuxer *demuxer, int64_t max_bytes)
+{
+    struct demux_internal *in = demuxer->in;
+    assert(demuxer == in->d_user);
+
+    mp_mutex_lock(&in->lock);
+    in->max_bytes_limit = MPMAX(max_bytes, 0);
+    update_opts(demuxer);
+    mp_cond_signal(&in->wakeup);
+    mp_mutex_unlock(&in->lock);
+}
+
 // Make demuxing progress. Return whether progress was made.
 static bool thread_work(struct demux_internal *in)
 {
@@ -80,6 +80,8 @@ struct demux_opts {
     char *mf_type;
     bool create_ccs;
     char *record_file;
+    int64_t record_buffer;
+    int record_overflow;
     int video_back_preroll;
     int audio_back_preroll;
     int back_batch[STREAM_TYPE_COUNT];
@@ -313,6 +315,7 @@ void demux_start_thread(struct demuxer *demuxer);
 void demux_stop_thread(struct demuxer *demuxer);
 void demux_set_wakeup_cb(struct demuxer *demuxer, void (*cb)(void *ctx), void *ctx);
 void demux_start_prefetch(struct demuxer *demuxer);
+void demux_set_max_bytes(struct demuxer *demuxer, int64_t max_bytes);
 
 bool demux_cancel_test(struct demuxer *demuxer);
 
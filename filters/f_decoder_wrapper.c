@@ -207,6 +207,9 @@ struct priv {
     struct mp_frame decoded_coverart;
     int coverart_returned; // 0: no, 1: coverart frame itself, 2: EOF returned
 
+    bool want_preroll;          // see mp_decoder_wrapper_preroll()
+    struct mp_frame preroll_frame;
+
     int play_dir;
 
     // --- The following fields can be accessed only from the mp_decoder_wrapper
@@ -329,6 +332,9 @@ static void decf_reset(struct mp_filter *f)
 
     p->coverart_returned = 0;
 
+    p->want_preroll = false;
+    mp_frame_unref(&p->preroll_frame);
+
     for (int n = 0; n < p->num_reverse_queue; n++)
         mp_frame_unref(&p->reverse_queue[n]);
     p->num_reverse_queue = 0;
@@ -531,6 +537,15 @@ bool mp_decoder_wrapper_get_pts_reset(struct mp_decoder_wrapper *d)
     return res;
 }
 
+void mp_decoder_wrapper_preroll(struct mp_decoder_wrapper *d)
+{
+    struct priv *p = d->f->priv;
+    thread_lock(p);
+    p->want_preroll = true;
+    mp_filter_wakeup(p->decf);
+    thread_unlock(p);
+}
+
 void mp_decoder_wrapper_set_play_dir(struct mp_decoder_wrapper *d, int dir)
 {
     struct priv *p = d->f->priv;
@@ -963,7 +978,18 @@ static void read_frame(struct priv *p)
     struct mp_pin *pin = p->decf->ppins[0];
     struct mp_frame frame = {0};
 
-    if (!p->decoder || !mp_pin_in_needs_data(pin))
+    if (!p->decoder)
+        return;
+
+    bool needs_data = mp_pin_in_needs_data(pin);
+    if (p->preroll_frame.type) {
+        if (needs_data) {
+            mp_pin_in_write(pin, p->preroll_frame);
+            p->preroll_frame = MP_NO_FRAME;
+        }
+        return;
+    }
+    if (!needs_data && !p->want_preroll)
         return;
 
     if (p->decoded_coverart.type) {
@@ -1056,6 +1082,12 @@ static void read_frame(struct priv *p)
 
 output_frame:
     process_output_frame(p, frame);
+    if (!needs_data) {
+        // Prerolling, so nobody reads the output yet.
+        p->preroll_frame = frame;
+        p->want_preroll = false;
+        return;
+    }
     mp_pin_in_write(pin, frame);
 }
 
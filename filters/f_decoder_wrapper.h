@@ -60,6 +60,11 @@ bool mp_decoder_wrapper_get_pts_reset(struct mp_decoder_wrapper *d);
 
 void mp_decoder_wrapper_set_play_dir(struct mp_decoder_wrapper *d, int dir);
 
+// Decode the first frame even though the output is not read yet, and keep it
+// until it is. This hides the decoder startup latency if the wrapper is
+// created long before its output is connected. Undone by a reset.
+void mp_decoder_wrapper_preroll(struct mp_decoder_wrapper *d);
+
 struct mp_decoder_list *video_decoder_list(void);
 struct mp_decoder_list *audio_decoder_list(void);
 
@@ -520,6 +520,26 @@ double mp_output_get_measured_total_delay(struct mp_output_chain *c)
     return delay;
 }
 
+int mp_output_chain_get_stats(struct mp_output_chain *c, void *ta_parent,
+                              struct mp_output_chain_stats **out)
+{
+    struct chain *p = c->f->priv;
+
+    struct mp_output_chain_stats *res =
+        talloc_array(ta_parent, struct mp_output_chain_stats, p->num_all_filters);
+    for (int n = 0; n < p->num_all_filters; n++) {
+        struct mp_user_filter *u = p->all_filters[n];
+        res[n] = (struct mp_output_chain_stats){
+            .name = talloc_strdup(res, u->name),
+            .label = talloc_strdup(res, u->label),
+        };
+        mp_filter_get_stats(u->wrapper, &res[n].stats);
+    }
+
+    *out = res;
+    return p->num_all_filters;
+}
+
 bool mp_output_chain_deinterlace_active(struct mp_output_chain *c)
 {
     struct chain *p = c->f->priv;
@@ -86,5 +86,17 @@ void mp_output_chain_set_audio_speed(struct mp_output_chain *p,
 // Makes sense for audio only.
 double mp_output_get_measured_total_delay(struct mp_output_chain *p);
 
+struct mp_output_chain_stats {
+    const char *name;   // filter name, or internal name like "convert"
+    const char *label;  // filter label (possibly generated), or NULL
+    struct mp_filter_stats stats;
+};
+
+// Return the counters of all filters in the chain (including internal ones) in
+// data flow order. Each entry covers the user filter including its internal
+// sub-filters. The result is allocated with ta_parent as parent.
+int mp_output_chain_get_stats(struct mp_output_chain *p, void *ta_parent,
+                              struct mp_output_chain_stats **out);
+
 // Check if deinterlace user filter is inserted
 bool mp_output_chain_deinterlace_active(struct mp_output_chain *p);
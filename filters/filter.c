@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <math.h>
 #include <stdatomic.h>
 
@@ -6,6 +7,7 @@
 #include "common/common.h"
 #include "common/global.h"
 #include "common/msg.h"
+#include "misc/thread_pool.h"
 #include "osdep/threads.h"
 #include "osdep/timer.h"
 #include "video/hwdec.h"
@@ -60,6 +62,21 @@ struct mp_pin {
     bool data_requested;            // true if out wants new data
     struct mp_frame data;           // possibly buffered frame (MP_FRAME_NONE if
                                     // empty, usually only temporary)
+
+    // For filter_runner.stats only, also used for the final output pin only.
+    int64_t data_time;              // when data was written
+    int64_t data_wait;              // queue wait of the last read frame
+};
+
+// A set of filters which can be processed independently from all other sets
+// of the same filter graph. See mp_filter_graph_set_threads().
+struct filter_region {
+    struct filter_runner *runner;
+
+    // Like filter_runner.pending, for filters with mp_filter_internal.region
+    // set to this region. Only accessed by the thread processing the region.
+    struct mp_filter **pending;
+    int num_pending;
 };
 
 // Root filters create this, all other filters reference it.
@@ -86,7 +103,33 @@ struct filter_runner {
     int num_pending;
 
     // Any outside pins have changed state.
-    bool external_pending;
+    atomic_bool external_pending;
+
+    // Collect mp_filter_stats (except calls and CPU time, which are always
+    // collected).
+    bool stats;
+
+    // Maximum number of threads processing regions concurrently.
+    int num_threads;
+    struct mp_thread_pool *pool;
+
+    // If num_regions > 0, filters are partitioned into regions, and each
+    // filter's mp_filter_internal.region is set. (Except for the root filter,
+    // and filters created since the regions were computed.)
+    struct filter_region **regions;
+    int num_regions;
+
+    // Set if the regions need to be recomputed (topology changed).
+    atomic_bool regions_dirty;
+
+    // Regions are being processed concurrently. Filters without region can
+    // not be added to pending[] while this is set.
+    bool in_round;
+    int64_t round_end_time;
+
+    mp_mutex run_lock;
+    mp_cond run_done;
+    int running; // number of regions still processed; protected by run_lock
 
     // For async notifications only. We don't bother making this fine grained
     // across filters.
@@ -118,8 +161,15 @@ struct mp_filter_internal {
     bool pending;
     bool async_pending;
     bool failed;
+
+    struct filter_region *region;
+    int region_index; // temporary for update_regions()
+
+    struct mp_filter_stats stats;
 };
 
+static void filter_wakeup(struct mp_filter *f, bool mark_only);
+
 // Called when new work needs to be done on a pin belonging to the filter:
 //  - new data was requested
 //  - new data has been queued
@@ -133,10 +183,26 @@ static void add_pending(struct mp_filter *f)
     if (f->in->pending)
         return;
 
+    struct filter_region *reg = r->num_regions ? f->in->region : NULL;
+    if (!reg && r->in_round) {
+        // Not owned by any region (e.g. the root filter), and pending[] is
+        // not touched while regions are processed. Defer it to the end of
+        // the round.
+        filter_wakeup(f, true);
+        return;
+    }
+
     // This should probably really be some sort of priority queue, but for now
     // something naive and dumb does the job too.
     f->in->pending = true;
-    if (f->in->high_priority) {
+    if (reg) {
+        // (not using a talloc parent for thread safety reasons)
+        if (f->in->high_priority) {
+            MP_TARRAY_INSERT_AT(NULL, reg->pending, reg->num_pending, 0, f);
+        } else {
+            MP_TARRAY_APPEND(NULL, reg->pending, reg->num_pending, f);
+        }
+    } else if (f->in->high_priority) {
         MP_TARRAY_INSERT_AT(r, r->pending, r->num_pending, 0, f);
     } else {
         MP_TARRAY_APPEND(r, r->pending, r->num_pending, f);
@@ -155,7 +221,7 @@ static void add_pending_pin(struct mp_pin *p)
 
     // Need to tell user that something changed.
     if (f == f->in->runner->root_filter && p != f->in->runner->recursive)
-        f->in->runner->external_pending = true;
+        atomic_store(&f->in->runner->external_pending, true);
 }
 
 // Possibly enter recursive filtering. This is done as convenience for
@@ -179,7 +245,8 @@ static void filter_recursive(struct mp_pin *p)
 
     // Also don't lose the pending state, which the user may or may not
     // care about.
-    r->external_pending |= mp_filter_graph_run(r->root_filter);
+    if (mp_filter_graph_run(r->root_filter))
+        atomic_store(&r->external_pending, true);
 
     assert(r->recursive == p);
     r->recursive = NULL;
@@ -207,6 +274,296 @@ static void flush_async_notifications(struct filter_runner *r)
     mp_mutex_unlock(&r->async_lock);
 }
 
+// Like flush_async_notifications(), but only for filters of the given region.
+// Used by the thread processing the region.
+static void flush_region_notifications(struct filter_region *reg)
+{
+    struct filter_runner *r = reg->runner;
+    mp_mutex_lock(&r->async_lock);
+    for (int n = r->num_async_pending - 1; n >= 0; n--) {
+        struct mp_filter *f = r->async_pending[n];
+        if (f->in->region == reg) {
+            add_pending(f);
+            f->in->async_pending = false;
+            MP_TARRAY_REMOVE_AT(r->async_pending, r->num_async_pending, n);
+        }
+    }
+    mp_mutex_unlock(&r->async_lock);
+}
+
+static void process_filter(struct mp_filter *f, mp_thread_id thread)
+{
+    f->in->pending = false;
+    if (!f->in->info->process)
+        return;
+
+    struct mp_filter_stats *st = &f->in->stats;
+    bool stats = f->in->runner->stats;
+    int64_t start = 0, cpu_start = 0;
+    if (stats) {
+        start = mp_time_ns();
+        cpu_start = mp_thread_cpu_time_ns(thread);
+    }
+    f->in->info->process(f);
+    if (stats) {
+        st->cpu_time_ns += mp_thread_cpu_time_ns(thread) - cpu_start;
+        st->wall_time_ns += mp_time_ns() - start;
+    }
+    st->calls += 1;
+}
+
+static void collect_filters(struct mp_filter *f, struct mp_filter ***list,
+                            int *num)
+{
+    f->in->region_index = *num;
+    MP_TARRAY_APPEND(NULL, *list, *num, f);
+    for (int n = 0; n < f->in->num_children; n++)
+        collect_filters(f->in->children[n], list, num);
+}
+
+static void set_region(struct mp_filter *f, struct filter_region *reg)
+{
+    f->in->region = reg;
+    for (int n = 0; n < f->in->num_children; n++)
+        set_region(f->in->children[n], reg);
+}
+
+static int region_find(int *set, int i)
+{
+    while (set[i] != i) {
+        set[i] = set[set[i]];
+        i = set[i];
+    }
+    return i;
+}
+
+// Put a and b into the same region. The root filter is ignored, because
+// everything is connected to it.
+static void region_link(struct filter_runner *r, int *set,
+                        struct mp_filter *a, struct mp_filter *b)
+{
+    if (!a || !b || a == r->root_filter || b == r->root_filter)
+        return;
+    set[region_find(set, a->in->region_index)] =
+        region_find(set, b->in->region_index);
+}
+
+static void region_link_pin(struct filter_runner *r, int *set,
+                            struct mp_filter *f, struct mp_pin *p)
+{
+    region_link(r, set, f, p->manual_connection);
+    if (p->user_conn)
+        region_link(r, set, f, p->user_conn->owner);
+    if (p->conn) {
+        region_link(r, set, f, p->conn->owner);
+        region_link(r, set, f, p->conn->manual_connection);
+    }
+}
+
+// Drop the partition; pending filters are moved back to the runner.
+static void release_regions(struct filter_runner *r)
+{
+    for (int n = 0; n < r->num_regions; n++) {
+        struct filter_region *reg = r->regions[n];
+        for (int i = 0; i < reg->num_pending; i++)
+            MP_TARRAY_APPEND(r, r->pending, r->num_pending, reg->pending[i]);
+        talloc_free(reg->pending);
+        talloc_free(reg);
+    }
+    r->num_regions = 0;
+    set_region(r->root_filter, NULL);
+}
+
+// Partition the filter graph into regions, which are the largest sets of
+// filters that interact with each other. Filters interact if they are
+// connected by pins, or are parent/child of each other (except for the root
+// filter). Filters which communicate through other means, such as async
+// queues, end up in different regions.
+static void update_regions(struct filter_runner *r)
+{
+    if (r->num_threads < 2) {
+        if (r->num_regions)
+            release_regions(r);
+        return;
+    }
+
+    if (!atomic_exchange(&r->regions_dirty, false))
+        return;
+
+    release_regions(r);
+
+    struct mp_filter **list = NULL;
+    int num = 0;
+    collect_filters(r->root_filter, &list, &num);
+
+    int *set = talloc_array(NULL, int, num);
+    for (int n = 0; n < num; n++)
+        set[n] = n;
+
+    for (int n = 1; n < num; n++) {
+        struct mp_filter *f = list[n];
+        region_link(r, set, f, f->in->parent);
+        region_link(r, set, f, f->in->error_handler);
+        for (int i = 0; i < f->num_pins; i++) {
+            region_link_pin(r, set, f, f->pins[i]);
+            region_link_pin(r, set, f, f->ppins[i]);
+        }
+    }
+
+    struct filter_region **map = talloc_zero_array(NULL, struct filter_region *, num);
+    for (int n = 1; n < num; n++) {
+        int id = region_find(set, n);
+        if (!map[id]) {
+            map[id] = talloc_ptrtype(NULL, map[id]);
+            *map[id] = (struct filter_region){ .runner = r };
+            MP_TARRAY_APPEND(r, r->regions, r->num_regions, map[id]);
+        }
+        list[n]->in->region = map[id];
+    }
+
+    talloc_free(map);
+    talloc_free(set);
+    talloc_free(list);
+
+    // Not worth it.
+    if (r->num_regions < 2)
+        release_regions(r);
+
+    MP_DBG(r->root_filter, "filter graph has %d independent regions\n",
+               r->num_regions);
+}
+
+static void run_region(struct filter_region *reg)
+{
+    struct filter_runner *r = reg->runner;
+    mp_thread_id thread = mp_thread_current_id();
+
+    // Same as the main loop in mp_filter_graph_run(), but the interrupt flag
+    // is reset by the main thread only.
+    while (1) {
+        bool exit_req = atomic_load(&r->interrupt_flag);
+
+        if (!reg->num_pending) {
+            flush_region_notifications(reg);
+            if (!reg->num_pending)
+                break;
+        }
+
+        struct mp_filter *next = NULL;
+
+        if (reg->pending[0]->in->high_priority) {
+            next = reg->pending[0];
+            MP_TARRAY_REMOVE_AT(reg->pending, reg->num_pending, 0);
+        } else if (!exit_req) {
+            next = reg->pending[reg->num_pending - 1];
+            reg->num_pending -= 1;
+        }
+
+        if (!next)
+            break;
+
+        process_filter(next, thread);
+
+        if (r->round_end_time && mp_time_ns() >= r->round_end_time)
+            mp_filter_graph_interrupt(r->root_filter);
+    }
+}
+
+static void region_worker(void *ptr)
+{
+    struct filter_region *reg = ptr;
+    struct filter_runner *r = reg->runner;
+
+    run_region(reg);
+
+    mp_mutex_lock(&r->run_lock);
+    r->running -= 1;
+    if (!r->running)
+        mp_cond_signal(&r->run_done);
+    mp_mutex_unlock(&r->run_lock);
+}
+
+// Process the regions concurrently, in rounds. Filters without region are
+// processed on the caller's thread between rounds.
+static void run_regions(struct filter_runner *r, int64_t end_time)
+{
+    mp_thread_id thread = mp_thread_current_id();
+
+    if (!r->pool) {
+        r->pool = mp_thread_pool_create(r, 0, r->num_threads - 1,
+                                        r->num_threads - 1);
+    }
+
+    // Move filters which were added before the regions were known.
+    struct mp_filter **pending = r->pending;
+    int num_pending = r->num_pending;
+    r->pending = NULL;
+    r->num_pending = 0;
+    for (int n = 0; n < num_pending; n++) {
+        pending[n]->in->pending = false;
+        add_pending(pending[n]);
+    }
+    talloc_free(pending);
+
+    while (1) {
+        flush_async_notifications(r);
+
+        while (r->num_pending) {
+            struct mp_filter *next = r->pending[0];
+            MP_TARRAY_REMOVE_AT(r->pending, r->num_pending, 0);
+            process_filter(next, thread);
+        }
+
+        struct filter_region *first = NULL;
+        r->round_end_time = end_time;
+        r->in_round = true;
+
+        for (int n = 0; n < r->num_regions; n++) {
+            struct filter_region *reg = r->regions[n];
+            if (!reg->num_pending)
+                continue;
+            if (!first) {
+                first = reg;
+                continue;
+            }
+            mp_mutex_lock(&r->run_lock);
+            r->running += 1;
+            mp_mutex_unlock(&r->run_lock);
+            if (!mp_thread_pool_queue(r->pool, region_worker, reg))
+                region_worker(reg);
+        }
+
+        if (first)
+            run_region(first);
+
+        mp_mutex_lock(&r->run_lock);
+        while (r->running)
+            mp_cond_wait(&r->run_done, &r->run_lock);
+        mp_mutex_unlock(&r->run_lock);
+
+        r->in_round = false;
+
+        if (atomic_exchange_explicit(&r->interrupt_flag, false,
+                                     memory_order_acq_rel))
+        {
+            mp_mutex_lock(&r->async_lock);
+            if (!r->async_wakeup_sent && r->wakeup_cb)
+                r->wakeup_cb(r->wakeup_ctx);
+            r->async_wakeup_sent = true;
+            mp_mutex_unlock(&r->async_lock);
+            break;
+        }
+
+        if (!first) {
+            mp_mutex_lock(&r->async_lock);
+            bool idle = !r->num_async_pending;
+            mp_mutex_unlock(&r->async_lock);
+            if (idle && !r->num_pending)
+                break;
+        }
+    }
+}
+
 bool mp_filter_graph_run(struct mp_filter *filter)
 {
     struct filter_runner *r = filter->in->runner;
@@ -222,6 +579,15 @@ bool mp_filter_graph_run(struct mp_filter *filter)
 
     r->filtering = true;
 
+    update_regions(r);
+
+    if (r->num_regions) {
+        run_regions(r, end_time);
+        goto done;
+    }
+
+    mp_thread_id thread = mp_thread_current_id();
+
     flush_async_notifications(r);
 
     bool exit_req = false;
@@ -257,19 +623,16 @@ bool mp_filter_graph_run(struct mp_filter *filter)
         if (!next)
             break;
 
-        next->in->pending = false;
-        if (next->in->info->process)
-            next->in->info->process(next);
+        process_filter(next, thread);
 
         if (end_time && mp_time_ns() >= end_time)
             mp_filter_graph_interrupt(r->root_filter);
     }
 
+done:
     r->filtering = false;
 
-    bool externals = r->external_pending;
-    r->external_pending = false;
-    return externals;
+    return atomic_exchange(&r->external_pending, false);
 }
 
 bool mp_pin_can_transfer_data(struct mp_pin *dst, struct mp_pin *src)
@@ -303,6 +666,8 @@ bool mp_pin_in_write(struct mp_pin *p, struct mp_frame frame)
     assert(p->conn->data.type == MP_FRAME_NONE);
     p->conn->data = frame;
     p->conn->data_requested = false;
+    if (p->owner->in->runner->stats)
+        p->conn->data_time = mp_time_ns();
     add_pending_pin(p->conn);
     filter_recursive(p);
     return true;
@@ -335,12 +700,51 @@ void mp_pin_out_request_data_next(struct mp_pin *p)
         add_pending_pin(p->conn);
 }
 
+static bool is_public_pin(struct mp_pin *p)
+{
+    for (int n = 0; n < p->owner->num_pins; n++) {
+        if (p->owner->pins[n] == p)
+            return true;
+    }
+    return false;
+}
+
+// Add the frame to the stats of all filters the connection ending in p (the
+// final output pin) passes through. sign is -1 to revert this for unread
+// frames.
+static void account_frame(struct mp_pin *p, struct mp_frame frame, int sign)
+{
+    if (frame.type == MP_FRAME_EOF || !p->owner->in->runner->stats)
+        return;
+
+    int64_t size = mp_frame_approx_size(frame) * (int64_t)sign;
+    if (sign > 0)
+        p->data_wait = mp_time_ns() - p->data_time;
+    int64_t wait = p->data_wait * sign;
+
+    // Same iteration as in init_connection(). All visited pins have
+    // dir==MP_PIN_IN, and are either the public input pin of their owner,
+    // or the private end of the owner's public output pin.
+    for (struct mp_pin *cur = p->conn; cur; cur = cur->other->user_conn) {
+        struct mp_filter_stats *st = &cur->owner->in->stats;
+        if (is_public_pin(cur)) {
+            st->frames_in += sign;
+            st->bytes_in += size;
+            st->queue_wait_ns += wait;
+        } else {
+            st->frames_out += sign;
+            st->bytes_out += size;
+        }
+    }
+}
+
 struct mp_frame mp_pin_out_read(struct mp_pin *p)
 {
     if (!mp_pin_out_request_data(p))
         return MP_NO_FRAME;
     struct mp_frame res = p->data;
     p->data = MP_NO_FRAME;
+    account_frame(p, res, 1);
     return res;
 }
 
@@ -354,6 +758,7 @@ void mp_pin_out_unread(struct mp_pin *p, struct mp_frame frame)
     assert(!mp_pin_out_has_data(p));
     assert(!p->data_requested);
     p->data = frame;
+    account_frame(p, frame, -1);
 }
 
 void mp_pin_out_repeat_eof(struct mp_pin *p)
@@ -428,6 +833,8 @@ static void init_connection(struct mp_pin *p)
     out->conn = in;
     out->within_conn = false;
 
+    atomic_store(&runner->regions_dirty, true);
+
     // Scheduling so far will be messed up.
     add_pending(in->manual_connection);
     add_pending(out->manual_connection);
@@ -559,6 +966,7 @@ struct mp_pin *mp_filter_get_named_pin(struct mp_filter *f, const char *name)
 void mp_filter_set_error_handler(struct mp_filter *f, struct mp_filter *handler)
 {
     f->in->error_handler = handler;
+    atomic_store(&f->in->runner->regions_dirty, true);
 }
 
 void mp_filter_internal_mark_failed(struct mp_filter *f)
@@ -738,6 +1146,45 @@ void mp_filter_graph_set_max_run_time(struct mp_filter *f, double seconds)
     r->max_run_time = seconds;
 }
 
+void mp_filter_graph_set_threads(struct mp_filter *f, int threads)
+{
+    struct filter_runner *r = f->in->runner;
+    assert(f == r->root_filter); // user is supposed to call this on root only
+    assert(!r->filtering);
+
+    threads = MPMAX(threads, 1);
+    if (r->num_threads == threads)
+        return;
+
+    TA_FREEP(&r->pool);
+    r->num_threads = threads;
+    atomic_store(&r->regions_dirty, true);
+}
+
+void mp_filter_graph_set_stats(struct mp_filter *f, bool enable)
+{
+    struct filter_runner *r = f->in->runner;
+    assert(f == r->root_filter); // user is supposed to call this on root only
+    assert(!r->filtering);
+    r->stats = enable;
+}
+
+static void add_stats(struct mp_filter *f, struct mp_filter_stats *st)
+{
+    st->calls += f->in->stats.calls;
+    st->wall_time_ns += f->in->stats.wall_time_ns;
+    st->cpu_time_ns += f->in->stats.cpu_time_ns;
+    for (int n = 0; n < f->in->num_children; n++)
+        add_stats(f->in->children[n], st);
+}
+
+void mp_filter_get_stats(struct mp_filter *f, struct mp_filter_stats *st)
+{
+    *st = f->in->stats;
+    st->calls = st->wall_time_ns = st->cpu_time_ns = 0;
+    add_stats(f, st);
+}
+
 void mp_filter_graph_interrupt(struct mp_filter *f)
 {
     struct filter_runner *r = f->in->runner;
@@ -767,15 +1214,34 @@ static void filter_destructor(void *p)
 
     // Just make sure the filter is not still in the async notifications set.
     // There will be no more new notifications at this point (due to destroy()).
-    flush_async_notifications(r);
+    // (Other filters' notifications are left alone, as this may run on a
+    // thread processing a region.)
+    mp_mutex_lock(&r->async_lock);
+    for (int n = 0; f->in->async_pending && n < r->num_async_pending; n++) {
+        if (r->async_pending[n] == f) {
+            MP_TARRAY_REMOVE_AT(r->async_pending, r->num_async_pending, n);
+            f->in->async_pending = false;
+        }
+    }
+    mp_mutex_unlock(&r->async_lock);
 
-    for (int n = 0; n < r->num_pending; n++) {
+    struct filter_region *reg = r->num_regions ? f->in->region : NULL;
+    for (int n = 0; reg && f->in->pending && n < reg->num_pending; n++) {
+        if (reg->pending[n] == f) {
+            MP_TARRAY_REMOVE_AT(reg->pending, reg->num_pending, n);
+            f->in->pending = false;
+        }
+    }
+
+    for (int n = 0; f->in->pending && n < r->num_pending; n++) {
         if (r->pending[n] == f) {
             MP_TARRAY_REMOVE_AT(r->pending, r->num_pending, n);
-            break;
+            f->in->pending = false;
         }
     }
 
+    atomic_store(&r->regions_dirty, true);
+
     if (f->in->parent) {
         struct mp_filter_internal *p_in = f->in->parent->in;
         for (int n = 0; n < p_in->num_children; n++) {
@@ -788,6 +1254,10 @@ static void filter_destructor(void *p)
 
     if (r->root_filter == f) {
         assert(!f->in->parent);
+        talloc_free(r->pool);
+        release_regions(r);
+        mp_cond_destroy(&r->run_done);
+        mp_mutex_destroy(&r->run_lock);
         mp_mutex_destroy(&r->async_lock);
         talloc_free(r->async_pending);
         talloc_free(r);
@@ -809,6 +1279,7 @@ struct mp_filter *mp_filter_create_with_params(struct mp_filter_params *params)
         .info = params->info,
         .parent = params->parent,
         .runner = params->parent ? params->parent->in->runner : NULL,
+        .region = params->parent ? params->parent->in->region : NULL,
     };
 
     if (!f->in->runner) {
@@ -819,10 +1290,15 @@ struct mp_filter *mp_filter_create_with_params(struct mp_filter_params *params)
             .global = params->global,
             .root_filter = f,
             .max_run_time = INFINITY,
+            .num_threads = 1,
         };
         mp_mutex_init(&f->in->runner->async_lock);
+        mp_mutex_init(&f->in->runner->run_lock);
+        mp_cond_init(&f->in->runner->run_done);
     }
 
+    atomic_store(&f->in->runner->regions_dirty, true);
+
     if (!f->global)
         f->global = f->in->runner->global;
 
@@ -901,8 +1377,16 @@ static void dump_pin_state(struct mp_filter *f, struct mp_pin *pin)
 
 void mp_filter_dump_states(struct mp_filter *f)
 {
-    MP_WARN(f, "%s[%p] (%s[%p])\n", filt_name(f), f,
-            filt_name(f->in->parent), f->in->parent);
+    struct mp_filter_stats *st = &f->in->stats;
+    MP_WARN(f, "%s[%p] (%s[%p]) region=%p calls=%"PRId64"\n",
+            filt_name(f), f, filt_name(f->in->parent), f->in->parent,
+            f->in->region, st->calls);
+    if (f->in->runner->stats) {
+        MP_WARN(f, "  wall=%.3fms cpu=%.3fms in=%"PRId64"/%"PRId64"B out=%"
+                PRId64"/%"PRId64"B wait=%.3fms\n", st->wall_time_ns / 1e6,
+                st->cpu_time_ns / 1e6, st->frames_in, st->bytes_in,
+                st->frames_out, st->bytes_out, st->queue_wait_ns / 1e6);
+    }
     for (int n = 0; n < f->num_pins; n++) {
         dump_pin_state(f, f->pins[n]);
         dump_pin_state(f, f->ppins[n]);
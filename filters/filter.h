@@ -420,6 +420,42 @@ struct mp_hwdec_ctx *mp_filter_load_hwdec_device(struct mp_filter *f, int imgfmt
 // Can be called on the root filter only.
 bool mp_filter_graph_run(struct mp_filter *root);
 
+// Process independent parts ("regions") of the filter graph concurrently,
+// using up to the given number of threads (including the caller's). Regions
+// are the largest sets of filters connected by pins or parent relations,
+// ignoring the root filter, e.g. separate audio and video chains. Filters which
+// communicate through async queues naturally end up in different regions.
+// The default is 1, which processes all filters on the calling thread.
+// Can be called on the root filter only, and not from within
+// mp_filter_graph_run().
+void mp_filter_graph_set_threads(struct mp_filter *root, int threads);
+
+// Counters for a single filter. calls is always collected, everything else
+// only if enabled with mp_filter_graph_set_stats().
+// Frames are counted on the filter's public pins, whenever a frame passing
+// through them is read at the end of the connection. EOF is not counted.
+struct mp_filter_stats {
+    int64_t calls;          // number of process() calls
+    int64_t wall_time_ns;   // time spent in process()
+    int64_t cpu_time_ns;    // thread CPU time spent in process()
+    int64_t frames_in;
+    int64_t frames_out;
+    int64_t bytes_in;       // approximate, see mp_frame_approx_size()
+    int64_t bytes_out;
+    int64_t queue_wait_ns;  // sum of times input frames were buffered
+};
+
+// Enable collecting all fields of mp_filter_stats. This adds some overhead to
+// each frame transfer. Disabling it keeps the current values.
+// Can be called on the root filter only, and not from within
+// mp_filter_graph_run().
+void mp_filter_graph_set_stats(struct mp_filter *root, bool enable);
+
+// Return the counters of f. calls and times include all child filters of f
+// (as process() calls never nest, this adds up), while the other fields
+// refer to the pins of f itself.
+void mp_filter_get_stats(struct mp_filter *f, struct mp_filter_stats *st);
+
 // Set the maximum time mp_filter_graph_run() should block. If the maximum time
 // expires, the effect is the same as calling mp_filter_graph_interrupt() while
 // the function is running. See that function for further details.
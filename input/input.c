@@ -37,6 +37,7 @@
 #include "osdep/timer.h"
 #include "common/msg.h"
 #include "common/global.h"
+#include "common/stats.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
 #include "options/path.h"
@@ -56,6 +57,9 @@
 
 #define MP_MAX_KEY_DOWN 16
 
+// Minimum time between two deliveries of mouse and touch motion.
+#define MOTION_INTERVAL MP_TIME_MS_TO_NS(8)
+
 struct cmd_bind {
     int keys[MP_MAX_KEY_DOWN];
     int num_keys;
@@ -64,12 +68,25 @@ struct cmd_bind {
     char *desc;         // human readable description
     bool is_builtin;
     struct cmd_bind_section *owner;
+    struct mp_cmd *parsed;  // cmd parsed on first use, copied for each trigger
+};
+
+// Index of the binds of a section. Each level of the trie matches one more key
+// from the end of the key sequence, because that is how the key history is
+// matched: the root's children are the last keys of the binds.
+struct bind_node {
+    int key;
+    int binds[2];       // index into cmd_bind_section.binds of the user and the
+                        // builtin bind ending at this node, -1 if none
+    struct bind_node *children; // sorted by key
+    int num_children;
 };
 
 struct cmd_bind_section {
     char *owner;
     struct cmd_bind *binds;
     int num_binds;
+    struct bind_node *trie;     // index of binds, NULL if binds changed
     bstr section;
     struct mp_rect mouse_area;  // set at runtime, if at all
     bool mouse_area_set;        // mouse_area is valid and should be tested
@@ -100,6 +117,7 @@ struct input_ctx {
     mp_mutex mutex;
     struct mp_log *log;
     struct mpv_global *global;
+    struct stats_ctx *stats;
     struct m_config_cache *opts_cache;
     struct input_opts *opts;
 
@@ -135,6 +153,11 @@ struct input_ctx {
     // Unlike mouse_x/y, this can be used to resolve mouse click bindings.
     int mouse_vo_x, mouse_vo_y;
 
+    // Motion not delivered to the consumer yet, see read_motion().
+    bool mouse_move_pending;    // mouse moved to mouse_vo_x/y
+    bool touch_update_pending;  // touch_points changed
+    int64_t motion_deadline;    // next motion delivery, 0 if none is due
+
     bool mouse_mangle, mouse_src_mangle;
     struct mp_rect mouse_src, mouse_dst;
 
@@ -171,6 +194,7 @@ static int parse_config(struct input_ctx *ictx, bool builtin, bstr data,
                         const char *location, const bstr restrict_section);
 static void close_input_sources(struct input_ctx *ictx);
 static bool test_mouse(struct input_ctx *ictx, int x, int y, int rej_flags);
+static void flush_motion(struct input_ctx *ictx);
 
 #define OPT_BASE_STRUCT struct input_opts
 struct input_opts {
@@ -302,6 +326,8 @@ static void queue_cmd(struct input_ctx *ictx, mp_cmd_t *cmd)
 {
     if (!cmd)
         return;
+    // Pending motion happened before this command.
+    flush_motion(ictx);
     queue_add_tail(&ictx->cmd_queue, cmd);
     mp_input_wakeup(ictx);
 }
@@ -402,6 +428,51 @@ static void key_buf_add(int *buf, int code)
     buf[0] = code;
 }
 
+static struct bind_node *find_bind_node(struct bind_node *node, int key,
+                                        int *pos)
+{
+    int lo = 0, hi = node->num_children;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (node->children[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (pos)
+        *pos = lo;
+    if (lo < node->num_children && node->children[lo].key == key)
+        return &node->children[lo];
+    return NULL;
+}
+
+static void build_bind_trie(struct cmd_bind_section *bs)
+{
+    struct bind_node *root = talloc_ptrtype(bs, root);
+    *root = (struct bind_node){ .binds = {-1, -1} };
+
+    for (int n = 0; n < bs->num_binds; n++) {
+        struct cmd_bind *b = &bs->binds[n];
+        struct bind_node *node = root;
+        for (int i = b->num_keys - 1; i >= 0; i--) {
+            int pos;
+            struct bind_node *child = find_bind_node(node, b->keys[i], &pos);
+            if (!child) {
+                struct bind_node new = { .key = b->keys[i], .binds = {-1, -1} };
+                MP_TARRAY_INSERT_AT(root, node->children, node->num_children,
+                                    pos, new);
+                child = &node->children[pos];
+            }
+            node = child;
+        }
+        if (node->binds[b->is_builtin] < 0)
+            node->binds[b->is_builtin] = n;
+    }
+
+    bs->trie = root;
+}
+
 static struct cmd_bind *find_bind_for_key_section(struct input_ctx *ictx,
                                                   bstr section, int code)
 {
@@ -410,30 +481,26 @@ static struct cmd_bind *find_bind_for_key_section(struct input_ctx *ictx,
     if (!bs->num_binds)
         return NULL;
 
+    if (!bs->trie)
+        build_bind_trie(bs);
+
+    // we have: keys=[key2 key1 keyX ...]
+    // and the binds: keys=[key1 key2] (and may be just a prefix)
     int keys[MP_MAX_KEY_DOWN];
     memcpy(keys, ictx->key_history, sizeof(keys));
     key_buf_add(keys, code);
 
+    // The longest match wins. Prefer user-defined keys over builtin bindings
+    // of the same length.
     struct cmd_bind *best = NULL;
-
-    // Prefer user-defined keys over builtin bindings
-    for (int builtin = 0; builtin < 2; builtin++) {
-        if (builtin && !ictx->opts->default_bindings)
-            break;
-        for (int n = 0; n < bs->num_binds; n++) {
-            if (bs->binds[n].is_builtin == (bool)builtin) {
-                struct cmd_bind *b = &bs->binds[n];
-                // we have: keys=[key2 key1 keyX ...]
-                // and: b->keys=[key1 key2] (and may be just a prefix)
-                for (int i = 0; i < b->num_keys; i++) {
-                    if (b->keys[i] != keys[b->num_keys - 1 - i])
-                        goto skip;
-                }
-                if (!best || b->num_keys > best->num_keys)
-                    best = b;
-            skip: ;
-            }
-        }
+    struct bind_node *node = bs->trie;
+    for (int i = 0; node; i++) {
+        int n = node->binds[0];
+        if (n < 0 && ictx->opts->default_bindings)
+            n = node->binds[1];
+        if (n >= 0)
+            best = &bs->binds[n];
+        node = i < MP_MAX_KEY_DOWN ? find_bind_node(node, keys[i], NULL) : NULL;
     }
     return best;
 }
@@ -509,7 +576,11 @@ static mp_cmd_t *get_cmd_from_keys(struct input_ctx *ictx, bstr force_section,
         talloc_free(key_buf);
         return NULL;
     }
-    mp_cmd_t *ret = mp_input_parse_cmd(ictx, bstr0(cmd->cmd), cmd->location);
+    if (!cmd->parsed) {
+        cmd->parsed = mp_input_parse_cmd(ictx, bstr0(cmd->cmd), cmd->location);
+        talloc_steal(cmd->owner->binds, cmd->parsed);
+    }
+    mp_cmd_t *ret = mp_cmd_clone(cmd->parsed);
     if (ret) {
         ret->input_section = cmd->owner->section;
         ret->key_name = talloc_steal(ret, mp_input_get_key_combo_name(&code, 1));
@@ -583,6 +654,77 @@ static bool should_drop_cmd(struct input_ctx *ictx, struct mp_cmd *cmd)
     return queue_count_cmds(queue) >= ictx->opts->key_fifo_size;
 }
 
+// Turn all pending mouse and touch motion into a single command, instead of
+// resolving a binding for every event. Devices with high polling rates send
+// 1000 events per second.
+static struct mp_cmd *get_motion_cmd(struct input_ctx *ictx)
+{
+    bool mouse = ictx->mouse_move_pending;
+    bool touch = ictx->touch_update_pending;
+    ictx->mouse_move_pending = ictx->touch_update_pending = false;
+
+    struct mp_cmd *cmd = NULL;
+    if (mouse) {
+        update_mouse_section(ictx);
+        cmd = get_cmd_from_keys(ictx, (bstr){0}, MP_KEY_MOUSE_MOVE);
+        if (!cmd)
+            cmd = mp_input_parse_cmd(ictx, bstr0("ignore"), "<internal>");
+        if (cmd) {
+            cmd->mouse_move = true;
+            cmd->mouse_x = ictx->mouse_vo_x;
+            cmd->mouse_y = ictx->mouse_vo_y;
+            if (should_drop_cmd(ictx, cmd)) {
+                TA_FREEP(&cmd);
+            } else {
+                // Coalesce with previous mouse move events (i.e. replace it)
+                struct mp_cmd *tail = queue_peek_tail(&ictx->cmd_queue);
+                if (tail && tail->mouse_move) {
+                    queue_remove(&ictx->cmd_queue, tail);
+                    talloc_free(tail);
+                }
+            }
+        }
+    } else if (touch) {
+        // dummy cmd so that touch-pos can notify observers
+        cmd = mp_input_parse_cmd(ictx, bstr0("ignore"), "<internal>");
+    }
+
+    if (touch)
+        stats_event(ictx->stats, "touch-delivered");
+    return cmd;
+}
+
+// Queue pending motion. This is done before other events are processed, so
+// the order of events is kept.
+static void flush_motion(struct input_ctx *ictx)
+{
+    queue_cmd(ictx, get_motion_cmd(ictx));
+}
+
+// Wake up the consumer for new motion. While a motion deadline is set, the
+// consumer comes back on its own, see read_motion().
+static void wakeup_motion(struct input_ctx *ictx)
+{
+    if (!ictx->motion_deadline)
+        mp_input_wakeup(ictx);
+}
+
+// Return pending motion to the consumer, at most once per MOTION_INTERVAL.
+// Otherwise, a 1000 Hz mouse would wake up the core 1000 times per second.
+// Until the interval has passed, mp_input_get_delay() makes the consumer come
+// back at the deadline.
+static struct mp_cmd *read_motion(struct input_ctx *ictx)
+{
+    int64_t now = mp_time_ns();
+    if (ictx->motion_deadline && now < ictx->motion_deadline)
+        return NULL;
+    ictx->motion_deadline = 0;
+    if (!ictx->mouse_move_pending && !ictx->touch_update_pending)
+        return NULL;
+    ictx->motion_deadline = now + MOTION_INTERVAL;
+    return get_motion_cmd(ictx);
+}
+
 static struct mp_cmd *resolve_key(struct input_ctx *ictx, int code)
 {
     update_mouse_section(ictx);
@@ -751,6 +893,8 @@ static void feed_key(struct input_ctx *ictx, int code, double scale,
 {
     struct input_opts *opts = ictx->opts;
 
+    flush_motion(ictx);
+
     code = mp_normalize_keycode(code);
     int unmod = code & ~MP_KEY_MODIFIER_MASK;
     if (code == MP_INPUT_RELEASE_ALL) {
@@ -888,6 +1032,7 @@ bool mp_input_vo_keyboard_enabled(struct input_ctx *ictx)
 static void set_mouse_pos(struct input_ctx *ictx, int x, int y)
 {
     MP_TRACE(ictx, "mouse move %d/%d\n", x, y);
+    stats_event(ictx->stats, "mouse-move-received");
 
     if (ictx->mouse_raw_x == x && ictx->mouse_raw_y == y) {
         return;
@@ -911,26 +1056,10 @@ static void set_mouse_pos(struct input_ctx *ictx, int x, int y)
     ictx->mouse_vo_x = x;
     ictx->mouse_vo_y = y;
 
-    update_mouse_section(ictx);
-    struct mp_cmd *cmd = get_cmd_from_keys(ictx, (bstr){0}, MP_KEY_MOUSE_MOVE);
-    if (!cmd)
-        cmd = mp_input_parse_cmd(ictx, bstr0("ignore"), "<internal>");
-
-    if (cmd) {
-        cmd->mouse_move = true;
-        cmd->mouse_x = x;
-        cmd->mouse_y = y;
-        if (should_drop_cmd(ictx, cmd)) {
-            talloc_free(cmd);
-        } else {
-            // Coalesce with previous mouse move events (i.e. replace it)
-            struct mp_cmd *tail = queue_peek_tail(&ictx->cmd_queue);
-            if (tail && tail->mouse_move) {
-                queue_remove(&ictx->cmd_queue, tail);
-                talloc_free(tail);
-            }
-            queue_cmd(ictx, cmd);
-        }
+    // The binding is resolved by get_motion_cmd().
+    if (!ictx->mouse_move_pending) {
+        ictx->mouse_move_pending = true;
+        wakeup_motion(ictx);
     }
 
     bool mouse_outside_dragging_deadzone =
@@ -940,6 +1069,7 @@ static void set_mouse_pos(struct input_ctx *ictx, int x, int y)
         ictx->opts->builtin_dragging)
     {
         // Begin built-in VO dragging if the mouse moves while the dragging button is down.
+        flush_motion(ictx);
         ictx->dragging_button_down = false;
         // Prevent activation of MBTN_LEFT key binding if VO dragging begins.
         release_down_cmd(ictx, true);
@@ -976,9 +1106,12 @@ static int find_touch_point_index(struct input_ctx *ictx, int id)
 
 static void notify_touch_update(struct input_ctx *ictx)
 {
-    // queue dummy cmd so that touch-pos can notify observers
-    mp_cmd_t *cmd = mp_input_parse_cmd(ictx, bstr0("ignore"), "<internal>");
-    queue_cmd(ictx, cmd);
+    // touch-pos observers are notified by get_motion_cmd()
+    stats_event(ictx->stats, "touch-received");
+    if (!ictx->touch_update_pending) {
+        ictx->touch_update_pending = true;
+        wakeup_motion(ictx);
+    }
 }
 
 static void update_touch_point(struct input_ctx *ictx, int idx, int id, int x, int y)
@@ -1167,6 +1300,10 @@ double mp_input_get_delay(struct input_ctx *ictx)
     input_lock(ictx);
     double seconds = INFINITY;
     adjust_max_wait_time(ictx, &seconds);
+    if (ictx->motion_deadline) {
+        int64_t wait = MPMAX(ictx->motion_deadline - mp_time_ns(), 0);
+        seconds = MPMIN(seconds, wait / 1e9);
+    }
     input_unlock(ictx);
     return seconds;
 }
@@ -1180,11 +1317,14 @@ mp_cmd_t *mp_input_read_cmd(struct input_ctx *ictx)
 {
     input_lock(ictx);
     struct mp_cmd *ret = queue_remove_head(&ictx->cmd_queue);
+    if (!ret)
+        ret = read_motion(ictx);
     if (!ret)
         ret = check_autorepeat(ictx);
     if (ret && ret->mouse_move) {
         ictx->mouse_x = ret->mouse_x;
         ictx->mouse_y = ret->mouse_y;
+        stats_event(ictx->stats, "mouse-move-delivered");
     }
     input_unlock(ictx);
     return ret;
@@ -1280,11 +1420,13 @@ static void bind_dealloc(struct cmd_bind *bind)
     talloc_free(bind->cmd);
     talloc_free(bind->location);
     talloc_free(bind->desc);
+    talloc_free(bind->parsed);
 }
 
 // builtin: if true, remove all builtin binds, else remove all user binds
 static void remove_binds(struct cmd_bind_section *bs, bool builtin)
 {
+    TA_FREEP(&bs->trie);
     for (int n = bs->num_binds - 1; n >= 0; n--) {
         if (bs->binds[n].is_builtin == builtin) {
             bind_dealloc(&bs->binds[n]);
@@ -1366,6 +1508,7 @@ static void bind_keys(struct input_ctx *ictx, bool builtin, bstr section,
         struct cmd_bind empty = {{0}};
         MP_TARRAY_APPEND(bs, bs->binds, bs->num_binds, empty);
         bind = &bs->binds[bs->num_binds - 1];
+        TA_FREEP(&bs->trie);
     }
 
     bind_dealloc(bind);
@@ -1500,6 +1643,7 @@ struct input_ctx *mp_input_init(struct mpv_global *global,
         .global = global,
         .ar_state = -1,
         .log = mp_log_new(ictx, global->log, "input"),
+        .stats = stats_ctx_create(ictx, global, "input"),
         .mouse_section = bstr0("default"),
         .opts_cache = m_config_cache_alloc(ictx, global, &input_config),
         .wakeup_cb = wakeup_cb,
@@ -89,7 +89,7 @@ static void mpv_format_command_reply(void *ta_parent, mpv_event *event,
 
 char *mp_json_encode_event(mpv_event *event)
 {
-    void *ta_parent = talloc_new(NULL);
+    void *ta_parent = talloc_new_arena(NULL);
 
     struct mpv_node event_node;
     if (event->event_id == MPV_EVENT_COMMAND_REPLY) {
@@ -389,7 +389,8 @@ static char *text_execute_command(struct mpv_handle *client, void *tmp, char *sr
 
 char *mp_ipc_consume_next_command(struct mpv_handle *client, void *ctx, bstr *buf)
 {
-    void *tmp = talloc_new(NULL);
+    // The parsed command consists of many small allocations.
+    void *tmp = talloc_new_arena(NULL);
 
     bstr rest;
     bstr line = bstr_getline(*buf, &rest);
@@ -0,0 +1,633 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/file.h>
+#endif
+
+#include "mpv_talloc.h"
+
+#include "common/common.h"
+#include "common/msg.h"
+#include "misc/io_utils.h"
+#include "misc/path_utils.h"
+#include "osdep/io.h"
+
+#include "kvdb.h"
+
+// File layout: FILE_MAGIC, followed by records. Each record is:
+//  REC_MAGIC, key length, value length, checksum (all 32 bit little endian),
+//  key bytes, value bytes
+// A value length of REC_DELETED marks a deletion and has no value bytes. The
+// checksum covers the lengths, the key and the value.
+#define FILE_MAGIC "mpvkvdb1"
+#define FILE_MAGIC_LEN 8
+#define REC_MAGIC "mpvr"
+#define REC_HEADER_LEN 16
+#define REC_DELETED UINT32_MAX
+
+// Sanity limits; anything above is treated as corrupted data.
+#define MAX_KEY_LEN 4096
+#define MAX_VALUE_LEN (64 * 1024 * 1024)
+
+// Compact when dead records take up more than half of the file, and at least
+// this many bytes.
+#define COMPACT_MIN_DEAD (64 * 1024)
+
+struct kvdb_entry {
+    char *key;
+    uint32_t hash;
+    int64_t pos;            // position of the value, -1 if deleted
+    uint32_t len;           // value length
+    uint32_t rec_size;      // size of the record containing the value
+};
+
+struct kvdb {
+    struct mp_log *log;
+    char *path;
+    int fd;                 // -1 if the file does not exist yet
+    bool writable;
+    int64_t end;            // end of the last complete record
+
+    void *keys;             // arena for entry keys
+    struct kvdb_entry *entries;
+    int num_entries;
+    int *index;             // entry index + 1 (0 for unused slots)
+    int index_size;         // power of 2
+
+    int live;
+    int64_t dead_bytes;
+    bool compact_failed;
+};
+
+static uint32_t hash_bytes(uint32_t h, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    for (size_t n = 0; n < size; n++)
+        h = (h ^ p[n]) * 16777619u;
+    return h;
+}
+
+static uint32_t key_hash(const char *key)
+{
+    return hash_bytes(2166136261u, key, strlen(key));
+}
+
+static void write_u32(uint8_t *p, uint32_t v)
+{
+    for (int n = 0; n < 4; n++)
+        p[n] = v >> (n * 8);
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t rec_checksum(const uint8_t *lengths, const void *key,
+                             size_t key_len, const void *val, size_t val_len)
+{
+    uint32_t h = hash_bytes(2166136261u, lengths, 8);
+    h = hash_bytes(h, key, key_len);
+    return hash_bytes(h, val, val_len);
+}
+
+// Append a record to *buf (a talloc char array of *len bytes).
+static void add_record(char **buf, size_t *len, const char *key, bstr *val)
+{
+    size_t key_len = strlen(key);
+    size_t val_len = val ? val->len : 0;
+    uint8_t hdr[REC_HEADER_LEN];
+    memcpy(hdr, REC_MAGIC, 4);
+    write_u32(hdr + 4, key_len);
+    write_u32(hdr + 8, val ? val_len : REC_DELETED);
+    write_u32(hdr + 12, rec_checksum(hdr + 4, key, key_len,
+                                     val ? val->start : NULL, val_len));
+
+    size_t size = *len + REC_HEADER_LEN + key_len + val_len;
+    MP_TARRAY_GROW(NULL, *buf, size);
+    memcpy(*buf + *len, hdr, REC_HEADER_LEN);
+    memcpy(*buf + *len + REC_HEADER_LEN, key, key_len);
+    if (val_len)
+        memcpy(*buf + *len + REC_HEADER_LEN + key_len, val->start, val_len);
+    *len = size;
+}
+
+static bool read_full(int fd, int64_t pos, void *data, size_t size)
+{
+    if (lseek(fd, pos, SEEK_SET) != pos)
+        return false;
+    char *p = data;
+    while (size) {
+        ssize_t r = read(fd, p, size);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size) {
+        ssize_t r = write(fd, p, size);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+
+static struct kvdb_entry *find_entry(struct kvdb *db, const char *key,
+                                     uint32_t hash)
+{
+    if (!db->index_size)
+        return NULL;
+    uint32_t mask = db->index_size - 1;
+    for (uint32_t i = hash & mask; db->index[i]; i = (i + 1) & mask) {
+        struct kvdb_entry *e = &db->entries[db->index[i] - 1];
+        if (e->hash == hash && strcmp(e->key, key) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+static void index_insert(struct kvdb *db, int n)
+{
+    uint32_t mask = db->index_size - 1;
+    uint32_t i = db->entries[n].hash & mask;
+    while (db->index[i])
+        i = (i + 1) & mask;
+    db->index[i] = n + 1;
+}
+
+// Keys are never removed from the table (only marked as deleted), so the
+// table only changes size here.
+static struct kvdb_entry *add_entry(struct kvdb *db, bstr key, uint32_t hash)
+{
+    if ((db->num_entries + 1) * 2 > db->index_size) {
+        db->index_size = MPMAX(db->index_size * 2, 64);
+        talloc_free(db->index);
+        db->index = talloc_zero_array(db, int, db->index_size);
+        for (int n = 0; n < db->num_entries; n++)
+            index_insert(db, n);
+    }
+    MP_TARRAY_GROW(db, db->entries, db->num_entries);
+    int n = db->num_entries++;
+    db->entries[n] = (struct kvdb_entry){
+        .key = bstrdup0(db->keys, key),
+        .hash = hash,
+        .pos = -1,
+    };
+    index_insert(db, n);
+    return &db->entries[n];
+}
+
+static void apply_record(struct kvdb *db, bstr key, int64_t val_pos,
+                         uint32_t val_len, uint32_t rec_size)
+{
+    char tmp[MAX_KEY_LEN + 1];
+    memcpy(tmp, key.start, key.len);
+    tmp[key.len] = '\0';
+    uint32_t hash = key_hash(tmp);
+
+    struct kvdb_entry *e = find_entry(db, tmp, hash);
+    if (e && e->pos >= 0) {
+        db->dead_bytes += e->rec_size;
+        db->live -= 1;
+        e->pos = -1;
+    }
+    if (val_len == REC_DELETED) {
+        db->dead_bytes += rec_size;
+        return;
+    }
+    if (!e)
+        e = add_entry(db, key, hash);
+    e->pos = val_pos;
+    e->len = val_len;
+    e->rec_size = rec_size;
+    db->live += 1;
+}
+
+// Return the size of the record at rec, or 0 if there is no complete and
+// valid record.
+static size_t check_record(const uint8_t *rec, size_t avail)
+{
+    if (avail < REC_HEADER_LEN || memcmp(rec, REC_MAGIC, 4) != 0)
+        return 0;
+    uint32_t key_len = read_u32(rec + 4);
+    uint32_t val_len = read_u32(rec + 8);
+    uint32_t data_len = val_len == REC_DELETED ? 0 : val_len;
+    if (!key_len || key_len > MAX_KEY_LEN || data_len > MAX_VALUE_LEN)
+        return 0;
+    size_t rec_size = REC_HEADER_LEN + key_len + data_len;
+    if (avail < rec_size)
+        return 0;
+    const uint8_t *key = rec + REC_HEADER_LEN;
+    if (rec_checksum(rec + 4, key, key_len, key + key_len, data_len) !=
+        read_u32(rec + 12))
+        return 0;
+    return rec_size;
+}
+
+// Parse the records in data, which starts at file position pos. Data that is
+// not a valid record is skipped if a valid record follows; it was cut off by
+// a crash, or is otherwise corrupted. Without a following record, it may also
+// be a record that is still being written, and is left for the next call.
+static void parse_records(struct kvdb *db, const uint8_t *data, size_t size,
+                          int64_t pos)
+{
+    size_t p = 0;
+    while (p < size) {
+        size_t rec_size = check_record(data + p, size - p);
+        if (!rec_size) {
+            size_t next = p + 1;
+            while (next < size && !check_record(data + next, size - next)) {
+                const uint8_t *m = memchr(data + next + 1, REC_MAGIC[0],
+                                          size - next - 1);
+                next = m ? m - data : size;
+            }
+            if (next == size)
+                break;
+            MP_WARN(db, "Skipped %zu bytes of corrupted data in %s.\n",
+                    next - p, db->path);
+            db->dead_bytes += next - p;
+            p = next;
+            continue;
+        }
+        const uint8_t *key = data + p + REC_HEADER_LEN;
+        uint32_t key_len = read_u32(data + p + 4);
+        apply_record(db, (bstr){(unsigned char *)key, key_len},
+                     pos + p + REC_HEADER_LEN + key_len,
+                     read_u32(data + p + 8), rec_size);
+        p += rec_size;
+    }
+    db->end = pos + p;
+}
+
+static void reset(struct kvdb *db)
+{
+    if (db->fd >= 0)
+        close(db->fd);
+    db->fd = -1;
+    db->writable = false;
+    db->end = 0;
+    TA_FREEP(&db->keys);
+    TA_FREEP(&db->entries);
+    TA_FREEP(&db->index);
+    db->num_entries = db->index_size = 0;
+    db->live = 0;
+    db->dead_bytes = 0;
+}
+
+static bool load(struct kvdb *db)
+{
+    reset(db);
+    db->keys = talloc_new_arena(db);
+
+    db->writable = true;
+    db->fd = open(db->path, O_RDWR | O_APPEND | O_BINARY | O_CLOEXEC);
+    if (db->fd < 0 && errno == EACCES) {
+        db->writable = false;
+        db->fd = open(db->path, O_RDONLY | O_BINARY | O_CLOEXEC);
+    }
+    if (db->fd < 0) {
+        if (errno == ENOENT)
+            return true;
+        MP_ERR(db, "Can't open %s: %s\n", db->path, mp_strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(db->fd, &st) != 0)
+        return false;
+    if (st.st_size == 0) {
+        // Created by another process, which has not written the header yet.
+        return true;
+    }
+    uint8_t *data = talloc_size(NULL, st.st_size);
+    bool ok = read_full(db->fd, 0, data, st.st_size);
+    if (!ok) {
+        MP_ERR(db, "Can't read %s\n", db->path);
+    } else if (st.st_size < FILE_MAGIC_LEN ||
+               memcmp(data, FILE_MAGIC, FILE_MAGIC_LEN) != 0)
+    {
+        MP_ERR(db, "%s is not a database file.\n", db->path);
+        ok = false;
+    } else {
+        parse_records(db, data + FILE_MAGIC_LEN, st.st_size - FILE_MAGIC_LEN,
+                      FILE_MAGIC_LEN);
+    }
+    talloc_free(data);
+    return ok;
+}
+
+static void destroy(void *ptr)
+{
+    struct kvdb *db = ptr;
+    reset(db);
+}
+
+struct kvdb *kvdb_open(void *ta_parent, struct mp_log *log, const char *path)
+{
+    struct kvdb *db = talloc_zero(ta_parent, struct kvdb);
+    talloc_set_destructor(db, destroy);
+    db->log = log;
+    db->path = talloc_strdup(db, path);
+    db->fd = -1;
+    if (!load(db)) {
+        talloc_free(db);
+        return NULL;
+    }
+    return db;
+}
+
+// Whether db->fd is still the file at db->path. The file is replaced on
+// compaction (possibly by another process). Sets *st_fd to the state of db->fd.
+static bool is_current(struct kvdb *db, struct stat *st_fd)
+{
+    struct stat st;
+    return stat(db->path, &st) == 0 && fstat(db->fd, st_fd) == 0 &&
+           st.st_dev == st_fd->st_dev && st.st_ino == st_fd->st_ino;
+}
+
+// Read the records appended to db->fd after db->end, which is st_size bytes.
+static void read_appended(struct kvdb *db, int64_t st_size)
+{
+    int64_t start = db->end;
+    if (st_size <= start)
+        return;
+    size_t size = st_size - start;
+    uint8_t *data = talloc_size(NULL, size);
+    if (read_full(db->fd, start, data, size))
+        parse_records(db, data, size, start);
+    talloc_free(data);
+}
+
+void kvdb_refresh(struct kvdb *db)
+{
+    if (db->fd < 0) {
+        load(db);
+        return;
+    }
+
+    struct stat st;
+    if (!is_current(db, &st) || st.st_size < db->end) {
+        load(db);
+        return;
+    }
+
+    if (!db->end) {
+        // The header was missing on the last load.
+        if (st.st_size)
+            load(db);
+        return;
+    }
+    read_appended(db, st.st_size);
+}
+
+static struct kvdb_entry *lookup(struct kvdb *db, const char *key)
+{
+    struct kvdb_entry *e = find_entry(db, key, key_hash(key));
+    return e && e->pos >= 0 ? e : NULL;
+}
+
+bool kvdb_has(struct kvdb *db, const char *key)
+{
+    return lookup(db, key);
+}
+
+char *kvdb_get(void *ta_parent, struct kvdb *db, const char *key)
+{
+    struct kvdb_entry *e = lookup(db, key);
+    if (!e)
+        return NULL;
+    char *res = talloc_size(ta_parent, e->len + 1);
+    if (!read_full(db->fd, e->pos, res, e->len)) {
+        MP_ERR(db, "Can't read %s\n", db->path);
+        talloc_free(res);
+        return NULL;
+    }
+    res[e->len] = '\0';
+    return res;
+}
+
+// Writers hold an advisory lock on the file, so that a compaction can't drop
+// records appended concurrently. Not supported on all systems; appends still
+// can't corrupt each other there.
+static void lock_file(struct kvdb *db, bool lock)
+{
+#if HAVE_POSIX
+    while (flock(db->fd, lock ? LOCK_EX : LOCK_UN) != 0 && errno == EINTR) {}
+#endif
+}
+
+// Open the file for writing (creating it if needed), and lock it. If this
+// succeeds, the caller must unlock it with lock_file().
+static bool lock_for_writing(struct kvdb *db)
+{
+    while (1) {
+        if (db->fd >= 0 && !db->writable) {
+            MP_ERR(db, "%s is read-only.\n", db->path);
+            return false;
+        }
+        if (db->fd < 0) {
+            reset(db);
+            db->keys = talloc_new_arena(db);
+            db->fd = open(db->path, O_RDWR | O_APPEND | O_CREAT | O_BINARY |
+                                    O_CLOEXEC, 0666);
+            if (db->fd < 0) {
+                MP_ERR(db, "Can't create %s: %s\n", db->path,
+                       mp_strerror(errno));
+                return false;
+            }
+            db->writable = true;
+        }
+        lock_file(db, true);
+
+        // Writing to a file replaced by a compaction would lose the record.
+        // Likewise if the header was written by somebody else in the meantime.
+        struct stat st;
+        if (!is_current(db, &st) || (!db->end && st.st_size > 0)) {
+            lock_file(db, false);
+            if (!load(db))
+                return false;
+            continue;
+        }
+        if (!db->end) {
+            if (!write_full(db->fd, FILE_MAGIC, FILE_MAGIC_LEN)) {
+                lock_file(db, false);
+                return false;
+            }
+            db->end = FILE_MAGIC_LEN;
+        }
+        return true;
+    }
+}
+
+static void maybe_compact(struct kvdb *db)
+{
+    if (db->compact_failed || db->dead_bytes < COMPACT_MIN_DEAD ||
+        db->dead_bytes < db->end / 2)
+        return;
+    // Don't try again on every write if it doesn't work.
+    db->compact_failed = !kvdb_compact(db);
+}
+
+static bool append(struct kvdb *db, const char *key, bstr *val)
+{
+    size_t key_len = strlen(key);
+    if (!key_len || key_len > MAX_KEY_LEN || (val && val->len > MAX_VALUE_LEN))
+        return false;
+    if (!lock_for_writing(db))
+        return false;
+
+    char *buf = NULL;
+    size_t len = 0;
+    add_record(&buf, &len, key, val);
+    // A single write, so that appends by writers which don't lock the file
+    // can't interleave with it.
+    bool ok = write_full(db->fd, buf, len);
+    talloc_free(buf);
+    if (!ok)
+        MP_ERR(db, "Can't write %s: %s\n", db->path, mp_strerror(errno));
+
+    // Other processes may have appended records too, so the position of the
+    // new record is not known without reading back the file.
+    struct stat st;
+    if (fstat(db->fd, &st) == 0)
+        read_appended(db, st.st_size);
+    lock_file(db, false);
+    if (!ok)
+        return false;
+    maybe_compact(db);
+    return true;
+}
+
+bool kvdb_put(struct kvdb *db, const char *key, bstr value)
+{
+    return append(db, key, &value);
+}
+
+bool kvdb_delete(struct kvdb *db, const char *key)
+{
+    if (!lookup(db, key))
+        return true;
+    return append(db, key, NULL);
+}
+
+// Make the rename of a file in the directory of path durable.
+static bool sync_dir(const char *path)
+{
+#if HAVE_POSIX
+    char *dir = bstrto0(NULL, mp_dirname(path));
+    int fd = open(dir, O_RDONLY | O_CLOEXEC);
+    talloc_free(dir);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+#else
+    return true;
+#endif
+}
+
+bool kvdb_compact(struct kvdb *db)
+{
+    kvdb_refresh(db);
+    if (db->fd < 0 || !db->writable)
+        return false;
+    if (!lock_for_writing(db))
+        return false;
+    // Records appended before the lock was taken.
+    struct stat st;
+    if (fstat(db->fd, &st) == 0)
+        read_appended(db, st.st_size);
+
+    char *tmp = talloc_asprintf(NULL, "%s.XXXXXX", db->path);
+    int fd = mp_mkostemps(tmp, 0, O_BINARY | O_CLOEXEC);
+    if (fd < 0) {
+        MP_ERR(db, "Can't create %s: %s\n", tmp, mp_strerror(errno));
+        lock_file(db, false);
+        talloc_free(tmp);
+        return false;
+    }
+
+    uint8_t *data = talloc_size(NULL, db->end);
+    bool ok = read_full(db->fd, 0, data, db->end);
+    char *buf = talloc_memdup(NULL, FILE_MAGIC, FILE_MAGIC_LEN);
+    size_t len = FILE_MAGIC_LEN;
+    for (int n = 0; n < db->num_entries && ok; n++) {
+        struct kvdb_entry *e = &db->entries[n];
+        if (e->pos >= 0)
+            add_record(&buf, &len, e->key, &(bstr){data + e->pos, e->len});
+    }
+    ok = ok && write_full(fd, buf, len);
+    talloc_free(buf);
+    talloc_free(data);
+    // The new file must be complete on disk before it replaces the old one.
+#if HAVE_POSIX
+    ok = ok && fsync(fd) == 0;
+#endif
+    ok = close(fd) == 0 && ok;
+#if HAVE_POSIX
+    // Keep the lock until the file is replaced. Writers waiting for it then
+    // notice the new file, and append to that.
+    ok = ok && rename(tmp, db->path) == 0;
+    if (ok && !sync_dir(db->path))
+        MP_WARN(db, "Can't sync the directory of %s\n", db->path);
+    reset(db);
+#else
+    // Can't replace open files on some systems.
+    reset(db);
+    ok = ok && rename(tmp, db->path) == 0;
+#endif
+    if (!ok) {
+        MP_ERR(db, "Can't compact %s\n", db->path);
+        unlink(tmp);
+    } else {
+        MP_VERBOSE(db, "Compacted %s.\n", db->path);
+    }
+    ok = load(db) && ok;
+    talloc_free(tmp);
+    return ok;
+}
+
+void kvdb_get_stats(struct kvdb *db, struct kvdb_stats *st)
+{
+    *st = (struct kvdb_stats){
+        .entries = db->live,
+        .file_size = db->end,
+        .dead_bytes = db->dead_bytes,
+    };
+}
@@ -0,0 +1,62 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "misc/bstr.h"
+
+struct mp_log;
+
+// A key/value store kept in a single append-only file. Every put or delete
+// appends one checksummed record, so an interrupted write can only lose that
+// record. The file is read once when opening it, and an in-memory hash table
+// maps each key to the position of its latest value. Overwritten and deleted
+// values are dropped by rewriting the file when they take up most of it.
+// Writers lock the file, so that multiple processes can share it.
+struct kvdb;
+
+// Open the database at path. The file is created by the first write, and its
+// directory must exist by then. Returns NULL if path is not a database file.
+// Free with talloc_free().
+struct kvdb *kvdb_open(void *ta_parent, struct mp_log *log, const char *path);
+
+// Pick up records written by other processes since the last call. Lookups do
+// not check the file by themselves.
+void kvdb_refresh(struct kvdb *db);
+
+bool kvdb_has(struct kvdb *db, const char *key);
+
+// Return the value of key, or NULL if there is none (or it can't be read).
+// The value is always 0-terminated.
+char *kvdb_get(void *ta_parent, struct kvdb *db, const char *key);
+
+bool kvdb_put(struct kvdb *db, const char *key, bstr value);
+bool kvdb_delete(struct kvdb *db, const char *key);
+
+// Rewrite the file with only the live records.
+bool kvdb_compact(struct kvdb *db);
+
+struct kvdb_stats {
+    int entries;            // live keys
+    int64_t file_size;
+    int64_t dead_bytes;     // overwritten, deleted and corrupted records
+};
+
+void kvdb_get_stats(struct kvdb *db, struct kvdb_stats *st);
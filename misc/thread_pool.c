@@ -221,3 +221,89 @@ bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 {
     return thread_pool_add(pool, fn, fn_ctx, false);
 }
+
+struct run_all {
+    void (*fn)(void *ctx, int index);
+    void *fn_ctx;
+    int count;
+
+    mp_mutex lock;
+    mp_cond wakeup;
+    int next;       // next item to pick up
+    int done;       // number of finished items
+    // The caller and queued workers. A worker might only start after all items
+    // are done and the caller returned, so it can't live on the caller's stack.
+    int refs;
+};
+
+// Called and returns with r->lock held.
+static void run_all_items(struct run_all *r)
+{
+    while (r->next < r->count) {
+        int index = r->next++;
+        mp_mutex_unlock(&r->lock);
+        r->fn(r->fn_ctx, index);
+        mp_mutex_lock(&r->lock);
+        r->done += 1;
+        if (r->done == r->count)
+            mp_cond_broadcast(&r->wakeup);
+    }
+}
+
+// Called with r->lock held, which is released.
+static void run_all_unref(struct run_all *r)
+{
+    bool last = --r->refs == 0;
+    mp_mutex_unlock(&r->lock);
+    if (last) {
+        mp_cond_destroy(&r->wakeup);
+        mp_mutex_destroy(&r->lock);
+        talloc_free(r);
+    }
+}
+
+static void run_all_worker(void *ctx)
+{
+    struct run_all *r = ctx;
+
+    mp_mutex_lock(&r->lock);
+    run_all_items(r);
+    run_all_unref(r);
+}
+
+void mp_thread_pool_run_all(struct mp_thread_pool *pool,
+                            void (*fn)(void *ctx, int index), void *fn_ctx,
+                            int count)
+{
+    struct run_all *r = talloc_ptrtype(NULL, r);
+    *r = (struct run_all){
+        .fn = fn,
+        .fn_ctx = fn_ctx,
+        .count = count,
+        .refs = 1,
+    };
+    mp_mutex_init(&r->lock);
+    mp_cond_init(&r->wakeup);
+
+    for (int n = 1; n < count && pool; n++) {
+        mp_mutex_lock(&r->lock);
+        bool all_taken = r->next >= r->count;
+        if (!all_taken)
+            r->refs += 1;
+        mp_mutex_unlock(&r->lock);
+        if (all_taken)
+            break;
+        if (!mp_thread_pool_run(pool, run_all_worker, r)) {
+            mp_mutex_lock(&r->lock);
+            r->refs -= 1;
+            mp_mutex_unlock(&r->lock);
+            break;
+        }
+    }
+
+    mp_mutex_lock(&r->lock);
+    run_all_items(r);
+    while (r->done < r->count)
+        mp_cond_wait(&r->wakeup, &r->lock);
+    run_all_unref(r);
+}
@@ -32,4 +32,15 @@ bool mp_thread_pool_queue(struct mp_thread_pool *pool, void (*fn)(void *ctx),
 bool mp_thread_pool_run(struct mp_thread_pool *pool, void (*fn)(void *ctx),
                         void *fn_ctx);
 
+// Call fn(fn_ctx, n) for each n in [0, count), spread over the calling thread
+// and worker threads added with mp_thread_pool_run(). The calling thread picks
+// up items too, and never waits for an item nobody has started, so this works
+// (serially at worst) if all workers are busy, or if pool is NULL. Items are
+// not called in any particular order. Returns once all items are done.
+// Unlike waiting on mp_thread_pool_queue() items, this is safe to call from
+// a worker of the same pool.
+void mp_thread_pool_run_all(struct mp_thread_pool *pool,
+                            void (*fn)(void *ctx, int index), void *fn_ctx,
+                            int count);
+
 #endif
@@ -32,6 +32,16 @@
 #include "options/m_option.h"
 #include "osdep/threads.h"
 
+// Number of most recent option changes remembered by m_config_shadow.
+#define MAX_CHANGES 256
+
+// An option write, for m_config_shadow.changes[].
+struct opt_change {
+    uint64_t ts;        // value of m_config_shadow.ts after the write
+    int group_index;
+    int opt_index;
+};
+
 // For use with m_config_cache.
 struct m_config_shadow {
     mp_mutex lock;
@@ -48,6 +58,9 @@ struct m_config_shadow {
     struct m_config_data *data; // protected shadow copy of the option data
     struct config_cache **listeners;
     int num_listeners;
+    // Option change with timestamp ts is at changes[ts % MAX_CHANGES]. Lets
+    // caches visit only changed options, instead of comparing all of them.
+    struct opt_change changes[MAX_CHANGES];
 };
 
 // Represents a sub-struct (OPT_SUBSTRUCT()).
@@ -83,9 +96,12 @@ struct config_cache {
     struct m_config_shadow *shadow; // global metadata
     int group_start, group_end;     // derived from data->group_index etc.
     uint64_t ts;                    // timestamp of this data copy
+    uint64_t done_ts;               // all changes up to this ts were applied
     bool in_list;                   // part of m_config_shadow->listeners[]
     int upd_group;                  // for "incremental" change notification
     int upd_opt;
+    uint64_t upd_change;            // next m_config_shadow.changes[] entry,
+                                    // or 0 to compare all options
 
 
     // --- Implicitly synchronized by setting/unsetting wakeup_cb.
@@ -107,6 +123,8 @@ struct force_update {
 struct m_group_data {
     char *udata;                        // pointer to group user option struct
     uint64_t ts;                        // timestamp of the data copy
+    uint64_t *opt_ts;                   // timestamp of each option's last write
+                                        // (only for m_config_shadow.data)
     struct force_update **force_update; // tracks opts that are written with force update
     int force_update_len;
 };
@@ -355,6 +373,9 @@ static void alloc_group(struct m_config_data *data, int group_index,
         .ts = copy_gdata ? copy_gdata->ts : 0,
     };
 
+    if (!copy)
+        gdata->opt_ts = talloc_zero_array(data, uint64_t, group->opt_count);
+
     if (opts->defaults)
         memcpy(gdata->udata, opts->defaults, opts->size);
 
@@ -587,6 +608,7 @@ struct m_config_cache *m_config_cache_from_shadow(void *ta_parent,
 
     mp_mutex_lock(&shadow->lock);
     in->data = allocate_option_data(cache, shadow, group_index, in->src);
+    in->ts = in->done_ts = atomic_load(&shadow->ts);
     mp_mutex_unlock(&shadow->lock);
 
     cache->opts = in->data->gdata[0].udata;
@@ -635,9 +657,50 @@ static bool check_force_update(struct m_group_data *gdata, const char *opt_name,
     return false;
 }
 
+// Copy the option from the global data if it changed. Returns whether it did.
+static bool update_opt(struct m_config_cache *cache, int group_index,
+                       int opt_index)
+{
+    struct config_cache *in = cache->internal;
+    struct m_config_data *dst = in->data;
+    struct m_group_data *gsrc = m_config_gdata(in->src, group_index);
+    struct m_group_data *gdst = m_config_gdata(dst, group_index);
+    const struct m_option *opt =
+        &dst->shadow->groups[group_index].group->opts[opt_index];
+    void *dsrc = gsrc->udata + opt->offset;
+    void *ddst = gdst->udata + opt->offset;
+
+    if (opt->offset < 0 || !opt->type->size)
+        return false;
+
+    bool opt_equal = m_option_equal(opt, ddst, dsrc);
+    bool force_update = opt->force_update &&
+                        check_force_update(gsrc, opt->name, in->ts);
+    if (opt_equal && !force_update)
+        return false;
+
+    uint64_t ch = get_opt_change_mask(dst->shadow, group_index,
+                                      dst->group_index, opt);
+
+    if (cache->debug && !opt_equal) {
+        char *vdst = m_option_print(opt, ddst);
+        char *vsrc = m_option_print(opt, dsrc);
+        mp_warn(cache->debug, "Option '%s' changed from "
+                "'%s' to' %s' (flags = 0x%"PRIx64")\n",
+                opt->name, vdst, vsrc, ch);
+        talloc_free(vdst);
+        talloc_free(vsrc);
+    }
+
+    m_option_copy(opt, ddst, dsrc);
+    cache->change_flags |= ch;
+    return true;
+}
+
 static void update_next_option(struct m_config_cache *cache, void **p_opt)
 {
     struct config_cache *in = cache->internal;
+    struct m_config_shadow *shadow = in->shadow;
     struct m_config_data *dst = in->data;
     struct m_config_data *src = in->src;
 
@@ -645,6 +708,36 @@ static void update_next_option(struct m_config_cache *cache, void **p_opt)
 
     *p_opt = NULL;
 
+    // Visit the options written since the last update, in order.
+    while (in->upd_change) {
+        uint64_t ts = in->upd_change;
+        if (ts > in->ts) {
+            in->upd_change = 0;
+            in->upd_group = -1;
+            in->done_ts = in->ts;
+            return;
+        }
+        const struct opt_change *c = &shadow->changes[ts % MAX_CHANGES];
+        if (c->ts != ts) {
+            // Too many changes since the last update; compare everything.
+            in->upd_change = 0;
+            break;
+        }
+        in->upd_change++;
+
+        struct m_group_data *gdst = m_config_gdata(dst, c->group_index);
+        if (!gdst || gdst->ts >= ts)
+            continue;
+        // All changes to this group up to ts are applied after this.
+        gdst->ts = ts;
+        if (update_opt(cache, c->group_index, c->opt_index)) {
+            const struct m_option *opt =
+                &shadow->groups[c->group_index].group->opts[c->opt_index];
+            *p_opt = gdst->udata + opt->offset;
+            return;
+        }
+    }
+
     while (in->upd_group < dst->group_index + dst->num_gdata) {
         struct m_group_data *gsrc = m_config_gdata(src, in->upd_group);
         struct m_group_data *gdst = m_config_gdata(dst, in->upd_group);
@@ -655,38 +748,14 @@ static void update_next_option(struct m_config_cache *cache, void **p_opt)
             const struct m_option *opts = g->group->opts;
 
             while (opts && opts[in->upd_opt].name) {
-                const struct m_option *opt = &opts[in->upd_opt];
-                void *dsrc = gsrc->udata + opt->offset;
-                void *ddst = gdst->udata + opt->offset;
-
-                if (opt->offset >= 0 && opt->type->size) {
-                    bool opt_equal = m_option_equal(opt, ddst, dsrc);
-                    bool force_update = opt->force_update &&
-                                        check_force_update(gsrc, opt->name, in->ts);
-                    if (!opt_equal || force_update) {
-                        uint64_t ch = get_opt_change_mask(dst->shadow,
-                                        in->upd_group, dst->group_index, opt);
-
-                        if (cache->debug && !opt_equal) {
-                            char *vdst = m_option_print(opt, ddst);
-                            char *vsrc = m_option_print(opt, dsrc);
-                            mp_warn(cache->debug, "Option '%s' changed from "
-                                    "'%s' to' %s' (flags = 0x%"PRIx64")\n",
-                                    opt->name, vdst, vsrc, ch);
-                            talloc_free(vdst);
-                            talloc_free(vsrc);
-                        }
-
-                        m_option_copy(opt, ddst, dsrc);
-                        cache->change_flags |= ch;
-
-                        in->upd_opt++; // skip this next time
-                        *p_opt = ddst;
-                        return;
-                    }
+                int opt_index = in->upd_opt++;
+                // Options not written since the last update can't differ.
+                if (gsrc->opt_ts[opt_index] > gdst->ts &&
+                    update_opt(cache, in->upd_group, opt_index))
+                {
+                    *p_opt = gdst->udata + opts[opt_index].offset;
+                    return;
                 }
-
-                in->upd_opt++;
             }
 
             gdst->ts = gsrc->ts;
@@ -697,6 +766,7 @@ static void update_next_option(struct m_config_cache *cache, void **p_opt)
     }
 
     in->upd_group = -1;
+    in->done_ts = in->ts;
 }
 
 static bool cache_check_update(struct m_config_cache *cache)
@@ -713,6 +783,7 @@ static bool cache_check_update(struct m_config_cache *cache)
     in->ts = new_ts;
     in->upd_group = in->data->group_index;
     in->upd_opt = 0;
+    in->upd_change = in->done_ts + 1;
     return true;
 }
 
@@ -804,7 +875,14 @@ bool m_config_cache_write_opt(struct m_config_cache *cache, void *ptr)
     if (changed) {
         m_option_copy(opt, gsrc->udata + opt->offset, ptr);
 
-        gsrc->ts = atomic_fetch_add(&shadow->ts, 1) + 1;
+        uint64_t ts = atomic_fetch_add(&shadow->ts, 1) + 1;
+        gsrc->ts = ts;
+        gsrc->opt_ts[opt_idx] = ts;
+        shadow->changes[ts % MAX_CHANGES] = (struct opt_change){
+            .ts = ts,
+            .group_index = group_idx,
+            .opt_index = opt_idx,
+        };
 
         for (int n = 0; n < shadow->num_listeners; n++) {
             struct config_cache *listener = shadow->listeners[n];
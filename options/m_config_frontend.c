@@ -272,16 +272,43 @@ void m_config_backup_watch_later_opts(struct m_config *config)
         ensure_backup(&config->watch_later_backup_opts, 0, &config->opts[n]);
 }
 
+// FNV-1a
+static uint32_t name_hash(struct bstr name)
+{
+    uint32_t h = 2166136261u;
+    for (size_t n = 0; n < name.len; n++)
+        h = (h ^ (unsigned char)name.start[n]) * 16777619u;
+    return h;
+}
+
+static void build_opt_index(struct m_config *config)
+{
+    int size = 16;
+    while (size < config->num_opts * 2)
+        size *= 2;
+    config->opt_index = talloc_zero_array(config, int, size);
+    config->opt_index_size = size;
+    // Options with the same name are found in opts[] order.
+    for (int n = 0; n < config->num_opts; n++) {
+        uint32_t i = name_hash(bstr0(config->opts[n].name)) & (size - 1);
+        while (config->opt_index[i])
+            i = (i + 1) & (size - 1);
+        config->opt_index[i] = n + 1;
+    }
+}
+
 struct m_config_option *m_config_get_co_raw(const struct m_config *config,
                                             struct bstr name)
 {
-    if (!name.len)
+    if (!name.len || !config->opt_index_size)
         return NULL;
 
-    for (int n = 0; n < config->num_opts; n++) {
-        struct m_config_option *co = &config->opts[n];
-        struct bstr coname = bstr0(co->name);
-        if (bstrcmp(coname, name) == 0)
+    uint32_t mask = config->opt_index_size - 1;
+    for (uint32_t i = name_hash(name) & mask; config->opt_index[i];
+         i = (i + 1) & mask)
+    {
+        struct m_config_option *co = &config->opts[config->opt_index[i] - 1];
+        if (bstr_equals0(name, co->name))
             return co;
     }
 
@@ -547,6 +574,9 @@ struct m_config *m_config_new(void *talloc_ctx, struct mp_log *log,
         config->optstruct = config->cache->opts;
     }
 
+    // Avoid a separate allocation for each of the (many) option names.
+    void *names = talloc_new_arena(config);
+
     int32_t optid = -1;
     while (m_config_shadow_get_next_opt(config->shadow, &optid)) {
         char buf[M_CONFIG_MAX_OPT_NAME_LEN];
@@ -554,7 +584,7 @@ struct m_config *m_config_new(void *talloc_ctx, struct mp_log *log,
             m_config_shadow_get_opt_name(config->shadow, optid, buf, sizeof(buf));
 
         struct m_config_option co = {
-            .name = talloc_strdup(config, opt_name),
+            .name = talloc_strdup(names, opt_name),
             .opt = m_config_shadow_get_opt(config->shadow, optid),
             .opt_id = optid,
         };
@@ -565,6 +595,8 @@ struct m_config *m_config_new(void *talloc_ctx, struct mp_log *log,
         MP_TARRAY_APPEND(config, config->opts, config->num_opts, co);
     }
 
+    build_opt_index(config);
+
     return config;
 }
 
@@ -680,13 +712,15 @@ static struct m_config_option *m_config_mogrify_cli_opt(struct m_config *config,
     if (co && co->opt->type == &m_option_type_cli_alias)
         *name = bstr0((char *)co->opt->priv);
 
-    // Might be a suffix "action", like "--vf-add". Expensively check for
-    // matches. (We don't allow you to combine them with "--no-".)
-    for (int n = 0; n < config->num_opts; n++) {
-        co = &config->opts[n];
-        struct bstr basename = bstr0(co->name);
-
-        if (!bstr_startswith(*name, basename))
+    // Might be a suffix "action", like "--vf-add". Check all possible splits
+    // into option name and action. (We don't allow you to combine them with
+    // "--no-".)
+    for (int n = (int)name->len - 1; n > 0; n--) {
+        if (name->start[n] != '-')
+            continue;
+        struct bstr basename = bstr_splice(*name, 0, n);
+        co = m_config_get_co_raw(config, basename);
+        if (!co)
             continue;
 
         // Aliased option + a suffix action, e.g. --opengl-shaders-append
@@ -919,13 +953,44 @@ char **m_config_list_options(void *ta_parent, const struct m_config *config)
 
 struct m_profile *m_config_get_profile(const struct m_config *config, bstr name)
 {
-    for (struct m_profile *p = config->profiles; p; p = p->next) {
+    if (!config->profile_index_size)
+        return NULL;
+
+    uint32_t mask = config->profile_index_size - 1;
+    for (uint32_t i = name_hash(name) & mask; config->profile_index[i];
+         i = (i + 1) & mask)
+    {
+        struct m_profile *p = config->profile_index[i];
         if (bstr_equals0(name, p->name))
             return p;
     }
     return NULL;
 }
 
+static void insert_profile_index(struct m_config *config, struct m_profile *p)
+{
+    uint32_t mask = config->profile_index_size - 1;
+    uint32_t i = name_hash(bstr0(p->name)) & mask;
+    while (config->profile_index[i])
+        i = (i + 1) & mask;
+    config->profile_index[i] = p;
+}
+
+// p must have been added to config->profiles already.
+static void add_profile_index(struct m_config *config, struct m_profile *p)
+{
+    if (config->num_profiles * 2 <= config->profile_index_size) {
+        insert_profile_index(config, p);
+        return;
+    }
+    int size = MPMAX(config->profile_index_size * 2, 16);
+    talloc_free(config->profile_index);
+    config->profile_index = talloc_zero_array(config, struct m_profile *, size);
+    config->profile_index_size = size;
+    for (struct m_profile *o = config->profiles; o; o = o->next)
+        insert_profile_index(config, o);
+}
+
 struct m_profile *m_config_get_profile0(const struct m_config *config,
                                         char *name)
 {
@@ -943,6 +1008,8 @@ struct m_profile *m_config_add_profile(struct m_config *config, char *name)
     p->name = talloc_strdup(p, name);
     p->next = config->profiles;
     config->profiles = p;
+    config->num_profiles += 1;
+    add_profile_index(config, p);
     return p;
 }
 
@@ -971,7 +1038,7 @@ int m_config_set_profile_option(struct m_config *config, struct m_profile *p,
                                     M_SETOPT_FROM_CONFIG_FILE);
     if (i < 0)
         return i;
-    p->opts = talloc_realloc(p, p->opts, char *, 2 * (p->num_opts + 2));
+    MP_TARRAY_GROW(p, p->opts, 2 * (p->num_opts + 2) - 1);
     p->opts[p->num_opts * 2] = bstrto0(p, name);
     p->opts[p->num_opts * 2 + 1] = bstrto0(p, val);
     p->num_opts++;
@@ -67,6 +67,7 @@ typedef struct m_config {
 
     // List of defined profiles.
     struct m_profile *profiles;
+    int num_profiles;
     // Depth when recursively including profiles.
     int profile_depth;
     // Temporary during profile application.
@@ -101,6 +102,14 @@ typedef struct m_config {
 
     // Private. Thread-safe shadow memory; only set for the main m_config.
     struct m_config_shadow *shadow;
+
+    // Private. Hash tables (open addressing, size is a power of 2) to look up
+    // options and profiles by name. opt_index[] contains opts[] indexes + 1,
+    // and 0 for unused entries.
+    int *opt_index;
+    int opt_index_size;
+    struct m_profile **profile_index;
+    int profile_index_size;
 } m_config_t;
 
 // Create a new config object.
@@ -45,6 +45,7 @@
 #include "video/filter/refqueue.h"
 #include "video/hwdec.h"
 #include "video/image_writer.h"
+#include "video/mp_image_buffers.h"
 #include "sub/osd.h"
 #include "sub/sd.h"
 #include "player/core.h"
@@ -327,6 +328,7 @@ const struct m_sub_options mp_subtitle_sub_opts = {
         {"sub-ass-scale-with-window", OPT_BOOL(ass_scale_with_window)},
         {"sub", OPT_SUBSTRUCT(sub_style, sub_style_conf)},
         {"sub-clear-on-seek", OPT_BOOL(sub_clear_on_seek)},
+        {"sub-async", OPT_BOOL(sub_async)},
         {"teletext-page", OPT_INT(teletext_page), M_RANGE(-1, 999), .flags = UPDATE_SUB_FILT},
         {"sub-past-video-end", OPT_BOOL(sub_past_video_end)},
         {"sub-ass-force-style", OPT_REPLACED("sub-ass-style-overrides")},
@@ -611,6 +613,18 @@ static const m_option_t mp_opts[] = {
         {"yes", 1}, {"always", 2})},
 
     {"lavfi-complex", OPT_STRING(lavfi_complex), .flags = UPDATE_LAVFI_COMPLEX},
+    {"filter-threads", OPT_INT(filter_threads), M_RANGE(1, 64)},
+    {"filter-stats", OPT_BOOL(filter_stats)},
+    {"image-buffer-cache-size", OPT_BYTE_SIZE(image_buffer_cache_size),
+        M_RANGE(0, M_MAX_MEM_BYTES)},
+    {"image-buffer-cache-age", OPT_DOUBLE(image_buffer_cache_age),
+        M_RANGE(0, 3600)},
+    {"image-buffer-alloc", OPT_CHOICE(image_buffer_alloc,
+        {"default", MP_IMAGE_BUFFERS_ALLOC_DEFAULT},
+        {"thp", MP_IMAGE_BUFFERS_ALLOC_THP},
+        {"hugetlb", MP_IMAGE_BUFFERS_ALLOC_HUGETLB})},
+    {"image-buffer-numa", OPT_BOOL(image_buffer_numa)},
+    {"image-copy-threads", OPT_INT(image_copy_threads), M_RANGE(1, 64)},
 
     {"audio-display", OPT_CHOICE(audio_display, {"no", 0},
         {"embedded-first", 1}, {"external-first", 2})},
@@ -631,7 +645,14 @@ static const m_option_t mp_opts[] = {
     {"demuxer-thread", OPT_BOOL(demuxer_thread)},
     {"demuxer-termination-timeout", OPT_DOUBLE(demux_termination_timeout)},
     {"demuxer-cache-wait", OPT_BOOL(demuxer_cache_wait)},
-    {"prefetch-playlist", OPT_BOOL(prefetch_open)},
+    {"prefetch-playlist", OPT_CHOICE(prefetch_open,
+        {"no", 0},
+        {"yes", 1},
+        {"preroll", 2})},
+    {"prefetch-playlist-count", OPT_INT(prefetch_count), M_RANGE(1, 16)},
+    {"prefetch-playlist-prev", OPT_BOOL(prefetch_prev)},
+    {"prefetch-playlist-max-bytes", OPT_BYTE_SIZE(prefetch_max_bytes),
+        M_RANGE(0, M_MAX_MEM_BYTES)},
     {"cache-pause", OPT_BOOL(cache_pause)},
     {"cache-pause-initial", OPT_BOOL(cache_pause_initial)},
     {"cache-pause-wait", OPT_FLOAT(cache_pause_wait), M_RANGE(0, DBL_MAX)},
@@ -690,6 +711,7 @@ static const m_option_t mp_opts[] = {
     {"external-files", OPT_PATHLIST(external_files), .flags = M_OPT_FILE},
     {"external-file", OPT_CLI_ALIAS("external-files-append")},
     {"autoload-files", OPT_BOOL(autoload_files)},
+    {"fast-start", OPT_BOOL(fast_start)},
 
     {"sub-auto", OPT_CHOICE(sub_auto,
         {"no", -1}, {"exact", 0}, {"fuzzy", 1}, {"all", 2})},
@@ -807,6 +829,7 @@ static const m_option_t mp_opts[] = {
     {"watch-later-dir", OPT_STRING(watch_later_dir),
         .flags = M_OPT_FILE},
     {"watch-later-directory", OPT_ALIAS("watch-later-dir")},
+    {"watch-later-db", OPT_BOOL(watch_later_db)},
     {"watch-later-options", OPT_STRINGLIST(watch_later_options)},
 
     {"ordered-chapters", OPT_BOOL(ordered_chapters)},
@@ -871,6 +894,7 @@ static const m_option_t mp_opts[] = {
         .flags = M_OPT_FILE},
     {"screenshot-directory", OPT_ALIAS("screenshot-dir")},
     {"screenshot-sw", OPT_BOOL(screenshot_sw)},
+    {"screenshot-workers", OPT_INT(screenshot_workers), M_RANGE(0, 64)},
 
     {"", OPT_SUBSTRUCT(resample_opts, resample_conf)},
 
@@ -986,7 +1010,11 @@ static const struct MPOpts mp_default_opts = {
     .position_resume = true,
     .autoload_files = true,
     .demuxer_thread = true,
+    .prefetch_count = 1,
     .demux_termination_timeout = 0.1,
+    .filter_threads = 1,
+    .image_buffer_cache_age = 5.0,
+    .image_copy_threads = 1,
     .hls_bitrate = INT_MAX,
     .cache_pause = true,
     .cache_pause_wait = 1.0,
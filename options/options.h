@@ -122,6 +122,7 @@ struct mp_subtitle_opts {
     double ass_prune_delay;
     bool ass_justify;
     bool sub_clear_on_seek;
+    bool sub_async;
     int teletext_page;
     bool sub_past_video_end;
     char **sub_avopts;
@@ -274,12 +275,20 @@ typedef struct MPOpts {
     bool write_filename_in_watch_later_config;
     bool ignore_path_in_watch_later_config;
     char *watch_later_dir;
+    bool watch_later_db;
     char **watch_later_options;
     bool pause;
     int keep_open;
     bool keep_open_pause;
     double image_display_duration;
     char *lavfi_complex;
+    int filter_threads;
+    bool filter_stats;
+    int64_t image_buffer_cache_size;
+    double image_buffer_cache_age;
+    int image_buffer_alloc;
+    bool image_buffer_numa;
+    int image_copy_threads;
     int stream_id[2][STREAM_TYPE_COUNT];
     char **stream_lang[STREAM_TYPE_COUNT];
     bool stream_auto_sel;
@@ -295,7 +304,10 @@ typedef struct MPOpts {
     bool demuxer_thread;
     double demux_termination_timeout;
     bool demuxer_cache_wait;
-    bool prefetch_open;
+    int prefetch_open;
+    int prefetch_count;
+    bool prefetch_prev;
+    int64_t prefetch_max_bytes;
     char *audio_demuxer_name;
     char *sub_demuxer_name;
 
@@ -307,6 +319,7 @@ typedef struct MPOpts {
     char *screenshot_template;
     char *screenshot_dir;
     bool screenshot_sw;
+    int screenshot_workers;
 
     struct m_channels audio_output_channels;
     int audio_output_format;
@@ -324,6 +337,7 @@ typedef struct MPOpts {
     char **coverart_files;
     char **external_files;
     bool autoload_files;
+    bool fast_start;
     int sub_auto;
     char **sub_auto_exts;
     int audiofile_auto;
@@ -62,6 +62,8 @@
 #include "video/out/vo.h"
 #include "video/csputils.h"
 #include "video/hwdec.h"
+#include "video/memcpy_pic.h"
+#include "video/mp_image_buffers.h"
 #include "audio/aframe.h"
 #include "audio/format.h"
 #include "audio/out/ao.h"
@@ -80,6 +82,10 @@
 
 #include "core.h"
 
+#if HAVE_ZIMG
+#include "video/zimg.h"
+#endif
+
 #ifdef _WIN32
 #include <windows.h>
 #endif
@@ -1405,6 +1411,65 @@ static int mp_property_filter_metadata(void *ctx, struct m_property *prop,
     return M_PROPERTY_NOT_IMPLEMENTED;
 }
 
+static void add_filter_stats(struct mpv_node *list, const char *name,
+                             const char *label, struct mp_filter_stats *st)
+{
+    struct mpv_node *e = node_array_add(list, MPV_FORMAT_NODE_MAP);
+    node_map_add_string(e, "name", name);
+    if (label)
+        node_map_add_string(e, "label", label);
+    node_map_add_int64(e, "calls", st->calls);
+    node_map_add_int64(e, "frames-in", st->frames_in);
+    node_map_add_int64(e, "frames-out", st->frames_out);
+    node_map_add_int64(e, "bytes-in", st->bytes_in);
+    node_map_add_int64(e, "bytes-out", st->bytes_out);
+    node_map_add_double(e, "wall-time", st->wall_time_ns / 1e9);
+    node_map_add_double(e, "cpu-time", st->cpu_time_ns / 1e9);
+    node_map_add_double(e, "queue-wait", st->queue_wait_ns / 1e9);
+}
+
+static void add_chain_stats(struct mpv_node *r, const char *key,
+                            struct mp_output_chain *chain)
+{
+    struct mpv_node *list = node_map_add(r, key, MPV_FORMAT_NODE_ARRAY);
+    if (!chain)
+        return;
+    struct mp_output_chain_stats *st;
+    int num = mp_output_chain_get_stats(chain, NULL, &st);
+    for (int n = 0; n < num; n++)
+        add_filter_stats(list, st[n].name, st[n].label, &st[n].stats);
+    talloc_free(st);
+}
+
+static int mp_property_filter_stats(void *ctx, struct m_property *prop,
+                                    int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    if (!mpctx->filter_root || !mpctx->opts->filter_stats)
+        return M_PROPERTY_UNAVAILABLE;
+
+    switch (action) {
+    case M_PROPERTY_GET_TYPE:
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    case M_PROPERTY_GET: {
+        struct mpv_node *r = arg;
+        node_init(r, MPV_FORMAT_NODE_MAP, NULL);
+        add_chain_stats(r, "vf", mpctx->vo_chain ? mpctx->vo_chain->filter : NULL);
+        add_chain_stats(r, "af", mpctx->ao_chain ? mpctx->ao_chain->filter : NULL);
+        struct mpv_node *list =
+            node_map_add(r, "lavfi-complex", MPV_FORMAT_NODE_ARRAY);
+        if (mpctx->lavfi) {
+            struct mp_filter_stats st;
+            mp_filter_get_stats(mpctx->lavfi, &st);
+            add_filter_stats(list, "lavfi", NULL, &st);
+        }
+        return M_PROPERTY_OK;
+    }
+    }
+    return M_PROPERTY_NOT_IMPLEMENTED;
+}
+
 static int mp_property_core_idle(void *ctx, struct m_property *prop,
                                  int action, void *arg)
 {
@@ -1533,6 +1598,38 @@ static int mp_property_demuxer_cache_idle(void *ctx, struct m_property *prop,
     return m_property_bool_ro(action, arg, s.idle);
 }
 
+static int mp_property_startup_timing(void *ctx, struct m_property *prop,
+                                      int action, void *arg)
+{
+    MPContext *mpctx = ctx;
+    int64_t *t = mpctx->startup_times;
+    if (!t[STARTUP_BEGIN])
+        return M_PROPERTY_UNAVAILABLE;
+
+    if (action == M_PROPERTY_GET_TYPE) {
+        *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
+        return M_PROPERTY_OK;
+    }
+    if (action != M_PROPERTY_GET)
+        return M_PROPERTY_NOT_IMPLEMENTED;
+
+    static const char *const names[STARTUP_STAGE_COUNT] = {
+        [STARTUP_OPENED] = "open",
+        [STARTUP_TRACKS] = "tracks",
+        [STARTUP_LOADED] = "init",
+        [STARTUP_FIRST_FRAME] = "first-frame",
+    };
+
+    struct mpv_node *r = (struct mpv_node *)arg;
+    node_init(r, MPV_FORMAT_NODE_MAP, NULL);
+    int n = STARTUP_BEGIN + 1;
+    for (; n < STARTUP_STAGE_COUNT && t[n]; n++)
+        node_map_add_double(r, names[n], (t[n] - t[n - 1]) / 1e9);
+    if (n == STARTUP_STAGE_COUNT)
+        node_map_add_double(r, "total", (t[n - 1] - t[STARTUP_BEGIN]) / 1e9);
+    return M_PROPERTY_OK;
+}
+
 static int mp_property_demuxer_cache_state(void *ctx, struct m_property *prop,
                                            int action, void *arg)
 {
@@ -2906,6 +3003,27 @@ static int mp_property_vo_passes(void *ctx, struct m_property *prop,
     return M_PROPERTY_OK;
 }
 
+// Statistics of process-wide caches, which are read only when they're shown.
+static void update_cache_stats(struct MPContext *mpctx)
+{
+    struct mp_image_buffers_stats bst;
+    mp_image_buffers_get_stats(&bst);
+    uint64_t requests = bst.hits + bst.misses;
+    stats_value(mpctx->stats, "image-buffers-hit-rate",
+                requests ? bst.hits * 100.0 / requests : 0);
+    stats_size_value(mpctx->stats, "image-buffers-retained", bst.retained);
+    stats_size_value(mpctx->stats, "image-buffers-in-use", bst.in_use);
+
+#if HAVE_ZIMG
+    struct mp_zimg_cache_stats zst;
+    mp_zimg_cache_get_stats(&zst);
+    requests = zst.hits + zst.misses;
+    stats_value(mpctx->stats, "zimg-cache-hit-rate",
+                requests ? zst.hits * 100.0 / requests : 0);
+    stats_value(mpctx->stats, "zimg-cache-entries", zst.entries);
+#endif
+}
+
 static int mp_property_perf_info(void *ctx, struct m_property *p, int action,
                                  void *arg)
 {
@@ -2916,6 +3034,7 @@ static int mp_property_perf_info(void *ctx, struct m_property *p, int action,
         *(struct m_option *)arg = (struct m_option){.type = CONF_TYPE_NODE};
         return M_PROPERTY_OK;
     case M_PROPERTY_GET: {
+        update_cache_stats(mpctx);
         stats_global_query(mpctx->global, (struct mpv_node *)arg);
         return M_PROPERTY_OK;
     }
@@ -4241,6 +4360,7 @@ static const struct m_property mp_properties_base[] = {
     {"chapter-metadata", mp_property_chapter_metadata},
     {"vf-metadata", mp_property_filter_metadata, .priv = "vf"},
     {"af-metadata", mp_property_filter_metadata, .priv = "af"},
+    {"filter-stats", mp_property_filter_stats},
     {"core-idle", mp_property_core_idle},
     {"eof-reached", mp_property_eof_reached},
     {"seeking", mp_property_seeking},
@@ -4251,6 +4371,7 @@ static const struct m_property mp_properties_base[] = {
     {"demuxer-cache-idle", mp_property_demuxer_cache_idle},
     {"demuxer-start-time", mp_property_demuxer_start_time},
     {"demuxer-cache-state", mp_property_demuxer_cache_state},
+    {"startup-timing", mp_property_startup_timing},
     {"cache-buffering-state", mp_property_cache_buffering},
     {"paused-for-cache", mp_property_paused_for_cache},
     {"demuxer-via-network", mp_property_demuxer_is_network},
@@ -6262,6 +6383,10 @@ static void cmd_rescan_external_files(void *p)
         struct track *s = select_default_track(mpctx, 0, STREAM_SUB);
         if (s && s->is_external)
             mp_switch_track(mpctx, STREAM_SUB, s, 0);
+        // External cover art, if there was no video.
+        struct track *v = select_default_track(mpctx, 0, STREAM_VIDEO);
+        if (v && v->is_external && !mpctx->current_track[0][STREAM_VIDEO])
+            mp_switch_track(mpctx, STREAM_VIDEO, v, 0);
 
         print_track_list(mpctx, "Track list:");
     }
@@ -7795,6 +7920,23 @@ void mp_option_change_callback(void *ctx, struct m_config_option *co, int flags,
     if (opt_ptr == &opts->vf_settings)
         set_filters(mpctx, STREAM_VIDEO, opts->vf_settings);
 
+    if (init || opt_ptr == &opts->image_buffer_cache_size ||
+        opt_ptr == &opts->image_buffer_cache_age ||
+        opt_ptr == &opts->image_buffer_alloc ||
+        opt_ptr == &opts->image_buffer_numa)
+    {
+        mp_image_buffers_configure(mpctx, opts->image_buffer_cache_size,
+                                   opts->image_buffer_cache_age,
+                                   opts->image_buffer_alloc,
+                                   opts->image_buffer_numa);
+    }
+
+    if (init || opt_ptr == &opts->image_copy_threads)
+        memcpy_pic_configure(mpctx, opts->image_copy_threads);
+
+    if (opt_ptr == &opts->filter_stats && mpctx->filter_root)
+        mp_filter_graph_set_stats(mpctx->filter_root, opts->filter_stats);
+
     if (opt_ptr == &opts->af_settings)
         set_filters(mpctx, STREAM_AUDIO, opts->af_settings);
 
@@ -37,6 +37,7 @@
 #include "common/encode.h"
 #include "common/msg.h"
 #include "misc/ctype.h"
+#include "misc/kvdb.h"
 #include "options/path.h"
 #include "options/m_config.h"
 #include "options/m_config_frontend.h"
@@ -170,6 +171,7 @@ void mp_load_auto_profiles(struct MPContext *mpctx)
 }
 
 #define MP_WATCH_LATER_CONF "watch_later"
+#define MP_WATCH_LATER_DB "watch_later.db"
 
 static bool check_mtime(const char *f1, const char *f2)
 {
@@ -197,19 +199,22 @@ static bool copy_mtime(const char *f1, const char *f2)
     return true;
 }
 
-static char *mp_get_playback_resume_dir(struct MPContext *mpctx)
+static char *mp_get_playback_resume_dir(void *ta_parent, struct MPContext *mpctx)
 {
     char *wl_dir = mpctx->opts->watch_later_dir;
     if (wl_dir && wl_dir[0]) {
-        wl_dir = mp_get_user_path(mpctx, mpctx->global, wl_dir);
+        wl_dir = mp_get_user_path(ta_parent, mpctx->global, wl_dir);
     } else {
-        wl_dir = mp_find_user_file(mpctx, mpctx->global, "state", MP_WATCH_LATER_CONF);
+        wl_dir = mp_find_user_file(ta_parent, mpctx->global, "state",
+                                   MP_WATCH_LATER_CONF);
     }
     return wl_dir;
 }
 
-static char *mp_get_playback_resume_config_filename(struct MPContext *mpctx,
-                                                    const char *fname)
+// Return the name of the resume config for fname, which is the file name in
+// the watch later directory, or the key in the database.
+static char *get_resume_name(void *ta_parent, struct MPContext *mpctx,
+                             const char *fname)
 {
     struct MPOpts *opts = mpctx->opts;
     char *res = NULL;
@@ -226,19 +231,59 @@ static char *mp_get_playback_resume_config_filename(struct MPContext *mpctx,
     }
     uint8_t md5[16];
     av_md5_sum(md5, path, strlen(path));
-    char *conf = talloc_strdup(tmp, "");
+    res = talloc_strdup(ta_parent, "");
     for (int i = 0; i < 16; i++)
-        conf = talloc_asprintf_append(conf, "%02X", md5[i]);
-
-    char *wl_dir = mp_get_playback_resume_dir(mpctx);
-    if (wl_dir && wl_dir[0])
-        res = mp_path_join(NULL, wl_dir, conf);
+        res = talloc_asprintf_append(res, "%02X", md5[i]);
 
 exit:
     talloc_free(tmp);
     return res;
 }
 
+static char *mp_get_playback_resume_config_filename(struct MPContext *mpctx,
+                                                    const char *fname)
+{
+    char *res = NULL;
+    char *conf = get_resume_name(NULL, mpctx, fname);
+    if (!conf)
+        return NULL;
+    char *wl_dir = mp_get_playback_resume_dir(conf, mpctx);
+    if (wl_dir && wl_dir[0])
+        res = mp_path_join(NULL, wl_dir, conf);
+    talloc_free(conf);
+    return res;
+}
+
+// Return the watch later database, or NULL if resume configs are stored as
+// separate files.
+static struct kvdb *get_watch_later_db(struct MPContext *mpctx)
+{
+    if (!mpctx->opts->watch_later_db)
+        return NULL;
+
+    char *wl_dir = mp_get_playback_resume_dir(NULL, mpctx);
+    char *path = NULL;
+    if (wl_dir && wl_dir[0])
+        path = mp_path_join(NULL, wl_dir, MP_WATCH_LATER_DB);
+    talloc_free(wl_dir);
+    if (!path)
+        return NULL;
+
+    if (mpctx->watch_later_db &&
+        strcmp(mpctx->watch_later_db_path, path) == 0)
+    {
+        talloc_free(path);
+        kvdb_refresh(mpctx->watch_later_db);
+        return mpctx->watch_later_db;
+    }
+
+    TA_FREEP(&mpctx->watch_later_db);
+    talloc_free(mpctx->watch_later_db_path);
+    mpctx->watch_later_db_path = talloc_steal(mpctx, path);
+    mpctx->watch_later_db = kvdb_open(mpctx, mpctx->log, path);
+    return mpctx->watch_later_db;
+}
+
 // Should follow what parser-cfg.c does/needs
 static bool needs_config_quoting(const char *s)
 {
@@ -252,7 +297,7 @@ static bool needs_config_quoting(const char *s)
     return false;
 }
 
-static void write_filename(struct MPContext *mpctx, FILE *file, char *filename)
+static void write_filename(struct MPContext *mpctx, char **conf, char *filename)
 {
     if (mpctx->opts->ignore_path_in_watch_later_config && !mp_is_url(bstr0(filename)))
         filename = mp_basename(filename);
@@ -261,30 +306,72 @@ static void write_filename(struct MPContext *mpctx, FILE *file, char *filename)
         char write_name[1024] = {0};
         for (int n = 0; filename[n] && n < sizeof(write_name) - 1; n++)
             write_name[n] = (unsigned char)filename[n] < 32 ? '_' : filename[n];
-        fprintf(file, "# %s\n", write_name);
+        *conf = talloc_asprintf_append_buffer(*conf, "# %s\n", write_name);
     }
 }
 
-static void write_redirect(struct MPContext *mpctx, char *path)
+// With the database, the mtime of the resume config can't be used, and the
+// mtime of the file is stored in a comment instead.
+#define MTIME_COMMENT "# mtime: "
+
+// Store the resume config for path. Returns false if it could not be written.
+static bool write_conf(struct MPContext *mpctx, struct kvdb *db, char *path,
+                       char *conf)
 {
-    char *conffile = mp_get_playback_resume_config_filename(mpctx, path);
-    if (conffile) {
-        FILE *file = fopen(conffile, "wb");
-        if (file) {
-            fprintf(file, "# redirect entry\n");
-            write_filename(mpctx, file, path);
-            fclose(file);
+    bool check_mtime = mpctx->opts->position_check_mtime &&
+                       !mp_is_url(bstr0(path));
+
+    if (db) {
+        char *name = get_resume_name(NULL, mpctx, path);
+        if (!name)
+            return false;
+        char *val = talloc_strdup(name, "");
+        struct stat st;
+        if (check_mtime) {
+            if (stat(path, &st) == 0) {
+                val = talloc_asprintf_append_buffer(val, MTIME_COMMENT "%lld\n",
+                                                    (long long)st.st_mtime);
+            } else {
+                MP_WARN(mpctx, "Can't get mtime of %s\n", path);
+            }
         }
+        val = talloc_strdup_append_buffer(val, conf);
+        bool ok = kvdb_put(db, name, bstr0(val));
+        if (!ok)
+            MP_WARN(mpctx, "Can't write %s\n", mpctx->watch_later_db_path);
+        talloc_free(name);
+        return ok;
+    }
 
-        if (mpctx->opts->position_check_mtime &&
-            !mp_is_url(bstr0(path)) && !copy_mtime(path, conffile))
-            MP_WARN(mpctx, "Can't copy mtime from %s to %s\n", path, conffile);
-
+    char *conffile = mp_get_playback_resume_config_filename(mpctx, path);
+    if (!conffile)
+        return false;
+    FILE *file = fopen(conffile, "wb");
+    if (!file) {
+        MP_WARN(mpctx, "Can't open %s for writing\n", conffile);
         talloc_free(conffile);
+        return false;
     }
+    fputs(conf, file);
+    fclose(file);
+
+    if (check_mtime && !copy_mtime(path, conffile))
+        MP_WARN(mpctx, "Can't copy mtime from %s to %s\n", path, conffile);
+
+    talloc_free(conffile);
+    return true;
+}
+
+static void write_redirect(struct MPContext *mpctx, struct kvdb *db, char *path)
+{
+    char *conf = talloc_strdup(NULL, "# redirect entry\n");
+    write_filename(mpctx, &conf, path);
+    write_conf(mpctx, db, path, conf);
+    talloc_free(conf);
 }
 
-static void write_redirects_for_parent_dirs(struct MPContext *mpctx, char *path)
+static void write_redirects_for_parent_dirs(struct MPContext *mpctx,
+                                            struct kvdb *db, char *path)
 {
     if (mp_is_url(bstr0(path)) || mpctx->opts->ignore_path_in_watch_later_config)
         return;
@@ -300,7 +387,7 @@ static void write_redirects_for_parent_dirs(struct MPContext *mpctx, char *path)
     while (dir.len > 1 && dir.len < strlen(path)) {
         path[dir.len] = '\0';
         mp_path_strip_trailing_separator(path);
-        write_redirect(mpctx, path);
+        write_redirect(mpctx, db, path);
         dir = mp_dirname(path);
     }
 }
@@ -308,7 +395,6 @@ static void write_redirects_for_parent_dirs(struct MPContext *mpctx, char *path)
 void mp_write_watch_later_conf(struct MPContext *mpctx)
 {
     struct playlist_entry *cur = mpctx->playing;
-    char *conffile = NULL;
     void *ctx = talloc_new(NULL);
 
     if (!cur)
@@ -320,22 +406,19 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
 
     struct demuxer *demux = mpctx->demuxer;
 
-    conffile = mp_get_playback_resume_config_filename(mpctx, path);
-    if (!conffile)
+    char *wl_dir = mp_get_playback_resume_dir(ctx, mpctx);
+    if (!wl_dir || !wl_dir[0])
         goto exit;
-
-    char *wl_dir = mp_get_playback_resume_dir(mpctx);
     mp_mkdirp(wl_dir);
 
-    MP_INFO(mpctx, "Saving state.\n");
-
-    FILE *file = fopen(conffile, "wb");
-    if (!file) {
-        MP_WARN(mpctx, "Can't open %s for writing\n", conffile);
+    struct kvdb *db = get_watch_later_db(mpctx);
+    if (mpctx->opts->watch_later_db && !db)
         goto exit;
-    }
 
-    write_filename(mpctx, file, path);
+    MP_INFO(mpctx, "Saving state.\n");
+
+    char *conf = talloc_strdup(ctx, "");
+    write_filename(mpctx, &conf, path);
 
     bool write_start = true;
     double pos = get_playback_time(mpctx);
@@ -351,7 +434,7 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
         char *pname = watch_later_options[i];
         // Always save start if we have it in the array.
         if (write_start && strcmp(pname, "start") == 0) {
-            fprintf(file, "%s=%f\n", pname, pos);
+            conf = talloc_asprintf_append_buffer(conf, "%s=%f\n", pname, pos);
             continue;
         }
         // Only store it if it's different from the initial value.
@@ -360,23 +443,19 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
             mp_property_do(pname, M_PROPERTY_GET_STRING, &val, mpctx);
             if (needs_config_quoting(val)) {
                 // e.g. '%6%STRING'
-                fprintf(file, "%s=%%%d%%%s\n", pname, (int)strlen(val), val);
+                conf = talloc_asprintf_append_buffer(conf, "%s=%%%d%%%s\n",
+                                                     pname, (int)strlen(val), val);
             } else {
-                fprintf(file, "%s=%s\n", pname, val);
+                conf = talloc_asprintf_append_buffer(conf, "%s=%s\n", pname, val);
             }
             talloc_free(val);
         }
     }
-    fclose(file);
 
-    if (mpctx->opts->position_check_mtime && !mp_is_url(bstr0(path)) &&
-        !copy_mtime(path, conffile))
-    {
-        MP_WARN(mpctx, "Can't copy mtime from %s to %s\n", cur->filename,
-                conffile);
-    }
+    if (!write_conf(mpctx, db, path, conf))
+        goto exit;
 
-    write_redirects_for_parent_dirs(mpctx, path);
+    write_redirects_for_parent_dirs(mpctx, db, path);
 
     // Also write redirect entries for a playlist that mpv expanded if the
     // current entry is a URL, this is mostly useful for playing multiple
@@ -385,15 +464,30 @@ void mp_write_watch_later_conf(struct MPContext *mpctx)
     // URL.
     if (cur->playlist_path && mp_is_url(bstr0(path))) {
         char *playlist_path = mp_normalize_path(ctx, cur->playlist_path);
-        write_redirect(mpctx, playlist_path);
-        write_redirects_for_parent_dirs(mpctx, playlist_path);
+        write_redirect(mpctx, db, playlist_path);
+        write_redirects_for_parent_dirs(mpctx, db, playlist_path);
     }
 
 exit:
-    talloc_free(conffile);
     talloc_free(ctx);
 }
 
+static void delete_conf(struct MPContext *mpctx, struct kvdb *db,
+                        const char *path)
+{
+    if (db) {
+        char *name = get_resume_name(NULL, mpctx, path);
+        if (name)
+            kvdb_delete(db, name);
+        talloc_free(name);
+    } else {
+        char *fname = mp_get_playback_resume_config_filename(mpctx, path);
+        if (fname)
+            unlink(fname);
+        talloc_free(fname);
+    }
+}
+
 void mp_delete_watch_later_conf(struct MPContext *mpctx, const char *file)
 {
     void *ctx = talloc_new(NULL);
@@ -401,12 +495,11 @@ void mp_delete_watch_later_conf(struct MPContext *mpctx, const char *file)
     if (!path)
         goto exit;
 
-    char *fname = mp_get_playback_resume_config_filename(mpctx, path);
-    if (!fname)
+    struct kvdb *db = get_watch_later_db(mpctx);
+    if (mpctx->opts->watch_later_db && !db)
         goto exit;
 
-    unlink(fname);
-    talloc_free(fname);
+    delete_conf(mpctx, db, path);
 
     if (mp_is_url(bstr0(path)) || mpctx->opts->ignore_path_in_watch_later_config)
         goto exit;
@@ -415,11 +508,7 @@ void mp_delete_watch_later_conf(struct MPContext *mpctx, const char *file)
     while (dir.len > 1 && dir.len < strlen(path)) {
         path[dir.len] = '\0';
         mp_path_strip_trailing_separator(path);
-        fname = mp_get_playback_resume_config_filename(mpctx, path);
-        if (!fname)
-            break;
-        unlink(fname);
-        talloc_free(fname);
+        delete_conf(mpctx, db, path);
         dir = mp_dirname(path);
     }
 
@@ -427,11 +516,50 @@ exit:
     talloc_free(ctx);
 }
 
+static bool load_resume_db(struct MPContext *mpctx, struct kvdb *db,
+                           const char *file)
+{
+    char *name = get_resume_name(NULL, mpctx, file);
+    char *conf = name ? kvdb_get(name, db, name) : NULL;
+    if (!conf) {
+        talloc_free(name);
+        return false;
+    }
+
+    if (mpctx->opts->position_check_mtime && !mp_is_url(bstr0(file))) {
+        struct stat st;
+        long long mtime;
+        if (stat(file, &st) != 0 ||
+            sscanf(conf, MTIME_COMMENT "%lld", &mtime) != 1 ||
+            mtime != st.st_mtime)
+        {
+            talloc_free(name);
+            return false;
+        }
+    }
+
+    // Never apply the saved start position to following files
+    m_config_backup_opt(mpctx->mconfig, "start");
+    MP_INFO(mpctx, "Resuming playback. This behavior can "
+           "be disabled with --no-resume-playback.\n");
+    char *location = talloc_asprintf(name, "%s:%s",
+                                     mpctx->watch_later_db_path, name);
+    MP_VERBOSE(mpctx, "Loading config '%s'\n", location);
+    m_config_parse(mpctx->mconfig, location, bstr0(conf), NULL,
+                   M_SETOPT_PRESERVE_CMDLINE);
+    talloc_free(name);
+    return true;
+}
+
 bool mp_load_playback_resume(struct MPContext *mpctx, const char *file)
 {
     bool resume = false;
     if (!mpctx->opts->position_resume)
         return resume;
+    if (mpctx->opts->watch_later_db) {
+        struct kvdb *db = get_watch_later_db(mpctx);
+        return db && load_resume_db(mpctx, db, file);
+    }
     char *fname = mp_get_playback_resume_config_filename(mpctx, file);
     if (fname && mp_path_exists(fname)) {
         if (mpctx->opts->position_check_mtime &&
@@ -462,14 +590,29 @@ struct playlist_entry *mp_check_playlist_resume(struct MPContext *mpctx,
 {
     if (!mpctx->opts->position_resume)
         return NULL;
-    for (int n = 0; n < playlist->num_entries; n++) {
+    // With the database, this needs no file system accesses per entry.
+    struct kvdb *db = get_watch_later_db(mpctx);
+    if (mpctx->opts->watch_later_db && !db)
+        return NULL;
+    char *wl_dir = db ? NULL : mp_get_playback_resume_dir(NULL, mpctx);
+    if (!db && (!wl_dir || !wl_dir[0])) {
+        talloc_free(wl_dir);
+        return NULL;
+    }
+    struct playlist_entry *res = NULL;
+    for (int n = 0; n < playlist->num_entries && !res; n++) {
         struct playlist_entry *e = playlist->entries[n];
-        char *conf = mp_get_playback_resume_config_filename(mpctx, e->filename);
-        bool exists = conf && mp_path_exists(conf);
-        talloc_free(conf);
-        if (exists)
-            return e;
+        char *name = get_resume_name(NULL, mpctx, e->filename);
+        if (name && db) {
+            if (kvdb_has(db, name))
+                res = e;
+        } else if (name) {
+            char *conf = mp_path_join(name, wl_dir, name);
+            if (mp_path_exists(conf))
+                res = e;
+        }
+        talloc_free(name);
     }
-    return NULL;
+    talloc_free(wl_dir);
+    return res;
 }
-
@@ -48,6 +48,16 @@ enum stop_play_reason {
     PT_ERROR,           // play next playlist entry (due to an error)
 };
 
+// Points in time while starting playback of a file, see startup_times.
+enum startup_stage {
+    STARTUP_BEGIN,          // loading started
+    STARTUP_OPENED,         // main demuxer opened
+    STARTUP_TRACKS,         // external files loaded, tracks selected
+    STARTUP_LOADED,         // decoders and outputs initialized
+    STARTUP_FIRST_FRAME,    // first playback restart completed
+    STARTUP_STAGE_COUNT
+};
+
 enum mp_osd_seek_info {
     OSD_SEEK_INFO_BAR           = 1,
     OSD_SEEK_INFO_TEXT          = 2,
@@ -254,6 +264,7 @@ typedef struct MPContext {
     int64_t outstanding_async;
 
     struct mp_thread_pool *thread_pool; // for coarse I/O, often during loading
+    struct external_files_cache *external_files_cache;
 
     struct mp_log *statusline;
     struct osd_state *osd;
@@ -424,6 +435,13 @@ typedef struct MPContext {
     int max_frames;
     bool playing_msg_shown;
 
+    // mp_time_ns() at each startup stage of the current file, or 0 if the
+    // stage has not been reached yet.
+    int64_t startup_times[STARTUP_STAGE_COUNT];
+    // With --fast-start, external files are autoloaded after the first
+    // playback restart instead of before playback.
+    bool autoload_deferred;
+
     int remaining_file_loops;
     int remaining_ab_loops;
 
@@ -443,6 +461,10 @@ typedef struct MPContext {
 
     struct mp_ipc_ctx *ipc_ctx;
 
+    // Opened on first use if --watch-later-db is enabled.
+    struct kvdb *watch_later_db;
+    char *watch_later_db_path;
+
     int64_t builtin_script_ids[6];
 
     mp_mutex abort_lock;
@@ -452,21 +474,13 @@ typedef struct MPContext {
     int num_abort_list;
     bool abort_all; // during final termination
 
-    // --- Owned by MPContext
-    mp_thread open_thread;
-    bool open_active; // open_thread is a valid thread handle, all setup
-    atomic_bool open_done;
-    // --- All fields below are immutable while open_active is true.
-    //     Otherwise, they're owned by MPContext.
-    struct mp_cancel *open_cancel;
-    char *open_url;
-    char *open_format;
-    int open_url_flags;
-    bool open_for_prefetch;
-    // --- All fields below are owned by open_thread, unless open_done was set
-    //     to true.
-    struct demuxer *open_res_demuxer;
-    int open_res_error;
+    // Playlist entries opened ahead of time (--prefetch-playlist), nearest
+    // first. See loadfile.c.
+    struct open_ctx **opens;
+    int num_opens;
+
+    // Decoders prerolled for the prefetched entry (--prefetch-playlist=preroll).
+    struct preroll *preroll;
 } MPContext;
 
 // Contains information about an asynchronous work item, how it can be aborted,
@@ -551,6 +565,12 @@ void autoload_external_files(struct MPContext *mpctx, struct mp_cancel *cancel);
 struct track *select_default_track(struct MPContext *mpctx, int order,
                                    enum stream_type type);
 void prefetch_next(struct MPContext *mpctx);
+void update_preroll(struct MPContext *mpctx);
+struct mp_decoder_wrapper *take_preroll_decoder(struct MPContext *mpctx,
+                                                struct track *track);
+void cancel_preroll(struct MPContext *mpctx);
+void mp_mark_startup(struct MPContext *mpctx, enum startup_stage stage);
+void mp_load_deferred(struct MPContext *mpctx);
 void update_lavfi_complex(struct MPContext *mpctx);
 
 // main.c
@@ -18,14 +18,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "osdep/io.h"
+#include "osdep/threads.h"
 
 #include "common/common.h"
 #include "common/global.h"
 #include "common/msg.h"
 #include "misc/charset_conv.h"
 #include "misc/language.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
 #include "options/options.h"
 #include "options/path.h"
 #include "player/core.h"
@@ -67,6 +72,134 @@ void mp_update_subtitle_exts(struct MPOpts *opts)
     sub_exts = opts->sub_auto_exts;
 }
 
+// Number of directory listings kept by struct external_files_cache.
+#define MAX_CACHED_DIRS 16
+
+struct dir_listing {
+    char *path;
+    time_t mtime;
+    char **names;
+    int num_names;
+};
+
+struct external_files_cache {
+    mp_mutex lock;
+    // Most recently used first.
+    struct dir_listing **dirs;
+    int num_dirs;
+};
+
+static void cache_destroy(void *p)
+{
+    struct external_files_cache *cache = p;
+    mp_mutex_destroy(&cache->lock);
+}
+
+struct external_files_cache *external_files_cache_create(void *ta_parent)
+{
+    struct external_files_cache *cache =
+        talloc_zero(ta_parent, struct external_files_cache);
+    mp_mutex_init(&cache->lock);
+    talloc_set_destructor(cache, cache_destroy);
+    return cache;
+}
+
+static char **copy_names(void *ta_parent, char **names, int num_names)
+{
+    char **res = talloc_array(ta_parent, char *, num_names);
+    for (int n = 0; n < num_names; n++)
+        res[n] = talloc_strdup(res, names[n]);
+    return res;
+}
+
+// Return the names of all entries in the directory, or NULL if it can't be
+// read. The listing is reused as long as the directory mtime doesn't change.
+static char **list_dir(void *ta_parent, struct external_files_cache *cache,
+                       struct mp_cancel *cancel, const char *path,
+                       int *num_names)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    if (cache) {
+        mp_mutex_lock(&cache->lock);
+        for (int n = 0; n < cache->num_dirs; n++) {
+            struct dir_listing *dir = cache->dirs[n];
+            if (strcmp(dir->path, path) != 0)
+                continue;
+            if (dir->mtime != st.st_mtime) {
+                talloc_free(dir);
+                MP_TARRAY_REMOVE_AT(cache->dirs, cache->num_dirs, n);
+                break;
+            }
+            MP_TARRAY_REMOVE_AT(cache->dirs, cache->num_dirs, n);
+            MP_TARRAY_INSERT_AT(cache, cache->dirs, cache->num_dirs, 0, dir);
+            char **names = copy_names(ta_parent, dir->names, dir->num_names);
+            *num_names = dir->num_names;
+            mp_mutex_unlock(&cache->lock);
+            return names;
+        }
+        mp_mutex_unlock(&cache->lock);
+    }
+
+    // The mtime has only a resolution of seconds (or worse), so a directory
+    // changed in the same second as it was listed could look unchanged later.
+    time_t now = time(NULL);
+
+    DIR *d = opendir(path);
+    if (!d)
+        return NULL;
+    char **names = NULL;
+    int num = 0;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        MP_TARRAY_APPEND(ta_parent, names, num, NULL);
+        names[num - 1] = talloc_strdup(names, de->d_name);
+    }
+    closedir(d);
+
+    if (cache && now > st.st_mtime + 1 && !mp_cancel_test(cancel)) {
+        struct dir_listing *dir = talloc_zero(NULL, struct dir_listing);
+        dir->path = talloc_strdup(dir, path);
+        dir->mtime = st.st_mtime;
+        dir->names = copy_names(dir, names, num);
+        dir->num_names = num;
+
+        mp_mutex_lock(&cache->lock);
+        if (cache->num_dirs == MAX_CACHED_DIRS) {
+            talloc_free(cache->dirs[cache->num_dirs - 1]);
+            cache->num_dirs -= 1;
+        }
+        MP_TARRAY_INSERT_AT(cache, cache->dirs, cache->num_dirs, 0, dir);
+        talloc_steal(cache, dir);
+        mp_mutex_unlock(&cache->lock);
+    }
+
+    *num_names = num;
+    return names;
+}
+
+// A directory to look for external files in.
+struct scan_dir {
+    char *path;
+    int limit_fuzziness;
+    int limit_type;
+    // Results of scanning it.
+    struct subfn *list;
+    int num;
+};
+
+struct scan_ctx {
+    struct mpv_global *global;
+    struct MPOpts *opts;
+    const char *fname;
+    struct external_files_cache *cache;
+    struct mp_cancel *cancel;
+    struct scan_dir *dirs;
+    int num_dirs;
+};
+
 static int compare_sub_filename(const void *a, const void *b)
 {
     const struct subfn *s1 = a;
@@ -85,13 +218,21 @@ static int compare_sub_priority(const void *a, const void *b)
     return strcoll(s1->fname, s2->fname);
 }
 
-static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
-                                 struct subfn **slist, int *nsub,
-                                 struct bstr path, const char *fname,
-                                 int limit_fuzziness, int limit_type)
+// Scan one directory, run concurrently for each entry in ctx->dirs.
+static void append_dir_subtitles(void *p, int index)
 {
+    struct scan_ctx *ctx = p;
+    struct scan_dir *dir = &ctx->dirs[index];
+    struct MPOpts *opts = ctx->opts;
+    const char *fname = ctx->fname;
+    int limit_fuzziness = dir->limit_fuzziness;
+    int limit_type = dir->limit_type;
+
+    if (mp_cancel_test(ctx->cancel))
+        return;
+
     void *tmpmem = talloc_new(NULL);
-    struct mp_log *log = mp_log_new(tmpmem, global->log, "find_files");
+    struct mp_log *log = mp_log_new(tmpmem, ctx->global->log, "find_files");
 
     struct bstr f_fbname = bstr0(mp_basename(fname));
     struct bstr f_fname = mp_iconv_to_utf8(log, f_fbname,
@@ -102,19 +243,22 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
     if (f_fbname.start != f_fname.start)
         talloc_steal(tmpmem, f_fname.start);
 
-    char *path0 = bstrdup0(tmpmem, path);
+    struct bstr path = bstr0(dir->path);
+    char *path0 = dir->path;
 
     if (mp_is_url(bstr0(path0)))
         goto out;
 
-    DIR *d = opendir(path0);
-    if (!d)
+    int num_names = 0;
+    char **names = list_dir(tmpmem, ctx->cache, ctx->cancel, path0, &num_names);
+    if (!names)
         goto out;
     mp_verbose(log, "Loading external files in %.*s\n", BSTR_P(path));
-    struct dirent *de;
-    while ((de = readdir(d))) {
+    for (int i = 0; i < num_names; i++) {
+        if (mp_cancel_test(ctx->cancel))
+            break;
         void *tmpmem2 = talloc_new(tmpmem);
-        struct bstr den = bstr0(de->d_name);
+        struct bstr den = bstr0(names[i]);
         struct bstr dename = mp_iconv_to_utf8(log, den,
                                               "UTF-8-MAC", MP_NO_LATIN1_FALLBACK);
         // retrieve various parts of the filename
@@ -184,13 +328,13 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
             prio |= 1;
 
         mp_trace(log, "Potential external file: \"%s\"  Priority: %d\n",
-               de->d_name, prio);
+               names[i], prio);
 
         if (prio) {
-            char *subpath = mp_path_join_bstr(*slist, path, dename);
+            char *subpath = mp_path_join_bstr(tmpmem2, path, dename);
             if (mp_path_exists(subpath)) {
-                MP_TARRAY_GROW(NULL, *slist, *nsub);
-                struct subfn *sub = *slist + (*nsub)++;
+                MP_TARRAY_GROW(NULL, dir->list, dir->num);
+                struct subfn *sub = dir->list + dir->num++;
 
                 // annoying and redundant
                 if (strncmp(subpath, "./", 2) == 0)
@@ -198,16 +342,14 @@ static void append_dir_subtitles(struct mpv_global *global, struct MPOpts *opts,
 
                 sub->type     = type;
                 sub->priority = prio;
-                sub->fname    = subpath;
-                sub->lang     = lang.len ? bstrdup0(*slist, lang) : NULL;
-            } else
-                talloc_free(subpath);
+                sub->fname    = talloc_strdup(dir->list, subpath);
+                sub->lang     = lang.len ? bstrdup0(dir->list, lang) : NULL;
+            }
         }
 
     next_sub:
         talloc_free(tmpmem2);
     }
-    closedir(d);
 
  out:
     talloc_free(tmpmem);
@@ -240,50 +382,79 @@ static void filter_subidx(struct subfn **slist, int *nsub)
     }
 }
 
-static void load_paths(struct mpv_global *global, struct MPOpts *opts,
-                       struct subfn **slist, int *nsubs, const char *fname,
-                       char **paths, char *cfg_path, int type)
+static void add_scan_dir(struct scan_ctx *ctx, char *path,
+                         int limit_fuzziness, int limit_type)
+{
+    struct scan_dir dir = {
+        .path = path,
+        .limit_fuzziness = limit_fuzziness,
+        .limit_type = limit_type,
+    };
+    MP_TARRAY_APPEND(ctx, ctx->dirs, ctx->num_dirs, dir);
+}
+
+static void load_paths(struct scan_ctx *ctx, char **paths, char *cfg_path,
+                       int type)
 {
     for (int i = 0; paths && paths[i]; i++) {
-        char *expanded_path = mp_get_user_path(NULL, global, paths[i]);
+        char *expanded_path = mp_get_user_path(NULL, ctx->global, paths[i]);
         char *path = mp_path_join_bstr(
-            *slist, mp_dirname(fname),
+            ctx, mp_dirname(ctx->fname),
             bstr0(expanded_path ? expanded_path : paths[i]));
-        append_dir_subtitles(global, opts, slist, nsubs, bstr0(path),
-                             fname, 0, type);
+        add_scan_dir(ctx, path, 0, type);
         talloc_free(expanded_path);
     }
 
     // Load subtitles in ~/.mpv/sub (or similar) limiting sub fuzziness
-    char *mp_subdir = mp_find_config_file(NULL, global, cfg_path);
-    if (mp_subdir) {
-        append_dir_subtitles(global, opts, slist, nsubs, bstr0(mp_subdir),
-                             fname, 1, type);
-    }
-    talloc_free(mp_subdir);
+    char *mp_subdir = mp_find_config_file(ctx, ctx->global, cfg_path);
+    if (mp_subdir)
+        add_scan_dir(ctx, mp_subdir, 1, type);
 }
 
 // Return a list of subtitles and audio files found, sorted by priority.
 // Last element is terminated with a fname==NULL entry.
+// The directories are scanned concurrently on pool (can be NULL). cache can be
+// NULL to always list the directories.
 struct subfn *find_external_files(struct mpv_global *global, const char *fname,
-                                  struct MPOpts *opts)
+                                  struct MPOpts *opts,
+                                  struct external_files_cache *cache,
+                                  struct mp_thread_pool *pool,
+                                  struct mp_cancel *cancel)
 {
-    struct subfn *slist = talloc_array_ptrtype(NULL, slist, 1);
-    int n = 0;
+    struct scan_ctx *ctx = talloc_ptrtype(NULL, ctx);
+    *ctx = (struct scan_ctx){
+        .global = global,
+        .opts = opts,
+        .fname = fname,
+        .cache = cache,
+        .cancel = cancel,
+    };
 
     // Load subtitles from current media directory
-    append_dir_subtitles(global, opts, &slist, &n, mp_dirname(fname), fname, 0, -1);
+    add_scan_dir(ctx, bstrdup0(ctx, mp_dirname(fname)), 0, -1);
 
     // Load subtitles in dirs specified by sub-paths option
-    if (opts->sub_auto >= 0) {
-        load_paths(global, opts, &slist, &n, fname, opts->sub_paths, "sub",
-                   STREAM_SUB);
-    }
+    if (opts->sub_auto >= 0)
+        load_paths(ctx, opts->sub_paths, "sub", STREAM_SUB);
+
+    if (opts->audiofile_auto >= 0)
+        load_paths(ctx, opts->audiofile_paths, "audio", STREAM_AUDIO);
+
+    mp_thread_pool_run_all(pool, append_dir_subtitles, ctx, ctx->num_dirs);
 
-    if (opts->audiofile_auto >= 0) {
-        load_paths(global, opts, &slist, &n, fname, opts->audiofile_paths,
-                   "audio", STREAM_AUDIO);
+    struct subfn *slist = talloc_array_ptrtype(NULL, slist, 1);
+    int n = 0;
+    for (int i = 0; i < ctx->num_dirs; i++) {
+        struct scan_dir *dir = &ctx->dirs[i];
+        for (int j = 0; j < dir->num; j++) {
+            struct subfn sub = dir->list[j];
+            sub.fname = talloc_strdup(slist, sub.fname);
+            sub.lang = talloc_strdup(slist, sub.lang);
+            MP_TARRAY_APPEND(NULL, slist, n, sub);
+        }
+        talloc_free(dir->list);
     }
+    talloc_free(ctx);
 
     // Sort by name for filter_subidx()
     qsort(slist, n, sizeof(*slist), compare_sub_filename);
@@ -29,8 +29,20 @@ struct subfn {
 
 struct mpv_global;
 struct MPOpts;
+struct mp_cancel;
+struct mp_thread_pool;
+struct external_files_cache;
+
+// Directory listings shared between find_external_files() calls, so files in
+// the same directory (as with most playlists) don't list it again and again.
+// Free with talloc_free().
+struct external_files_cache *external_files_cache_create(void *ta_parent);
+
 struct subfn *find_external_files(struct mpv_global *global, const char *fname,
-                                  struct MPOpts *opts);
+                                  struct MPOpts *opts,
+                                  struct external_files_cache *cache,
+                                  struct mp_thread_pool *pool,
+                                  struct mp_cancel *cancel);
 
 bool mp_might_be_subtitle_file(const char *filename);
 void mp_update_subtitle_exts(struct MPOpts *opts);
@@ -43,6 +43,7 @@
 #include "common/common.h"
 #include "common/encode.h"
 #include "common/stats.h"
+#include "input/cmd.h"
 #include "input/input.h"
 #include "misc/language.h"
 
@@ -818,47 +819,56 @@ bool mp_remove_track(struct MPContext *mpctx, struct track *track)
     return true;
 }
 
-// Add the given file as additional track. The filter argument controls how or
-// if tracks are auto-selected at any point.
-// To be run on a worker thread, locked (temporarily unlocks core).
-// cancel will generally be used to abort the loading process, but on success
-// the demuxer is changed to be slaved to mpctx->playback_abort instead.
-int mp_add_external_file(struct MPContext *mpctx, char *filename,
-                         enum stream_type filter, struct mp_cancel *cancel,
-                         bool cover_art)
+// An external file to open with add_external_files().
+struct external_file {
+    char *filename;
+    enum stream_type filter;
+    bool cover_art;
+    // Result: index of the first track added, see mp_add_external_file(),
+    // and the end of the added tracks.
+    int first_track;
+    int tracks_end;
+
+    struct demuxer_params params;
+    struct demuxer *demuxer;
+};
+
+struct open_external_ctx {
+    struct MPContext *mpctx;
+    struct mp_cancel *cancel;
+    struct external_file *files;
+};
+
+// Run concurrently for each file, unlocked.
+static void open_external_demuxer(void *p, int index)
+{
+    struct open_external_ctx *ctx = p;
+    struct external_file *f = &ctx->files[index];
+
+    if (!f->filename || mp_cancel_test(ctx->cancel))
+        return;
+
+    f->demuxer = demux_open_url(f->filename, &f->params, ctx->cancel,
+                                ctx->mpctx->global);
+    if (f->demuxer)
+        enable_demux_thread(ctx->mpctx, f->demuxer);
+}
+
+// Add the tracks of an opened external file. Locked.
+static int add_external_demuxer(struct MPContext *mpctx, struct external_file *f,
+                                struct mp_cancel *cancel)
 {
     struct MPOpts *opts = mpctx->opts;
-    if (!filename || mp_cancel_test(cancel))
+    struct demuxer *demuxer = f->demuxer;
+    char *filename = f->filename;
+    enum stream_type filter = f->filter;
+    if (!filename)
         return -1;
 
     char *disp_filename = filename;
     if (strncmp(disp_filename, "memory://", 9) == 0)
         disp_filename = "memory://"; // avoid noise
 
-    struct demuxer_params params = {
-        .is_top_level = true,
-        .stream_flags = STREAM_ORIGIN_DIRECT,
-        .allow_playlist_create = false,
-    };
-
-    switch (filter) {
-    case STREAM_SUB:
-        params.force_format = opts->sub_demuxer_name;
-        break;
-    case STREAM_AUDIO:
-        params.force_format = opts->audio_demuxer_name;
-        break;
-    }
-
-    mp_core_unlock(mpctx);
-
-    struct demuxer *demuxer =
-        demux_open_url(filename, &params, cancel, mpctx->global);
-    if (demuxer)
-        enable_demux_thread(mpctx, demuxer);
-
-    mp_core_lock(mpctx);
-
     // The command could have overlapped with playback exiting. (We don't care
     // if playback has started again meanwhile - weird, but not a problem.)
     if (mpctx->stop_play)
@@ -901,7 +911,7 @@ int mp_add_external_file(struct MPContext *mpctx, char *filename,
         t->no_default = sh->type != filter;
         t->no_auto_select = t->no_default;
         // if we found video, and we are loading cover art, flag as such.
-        t->attached_picture = t->type == STREAM_VIDEO && cover_art;
+        t->attached_picture = t->type == STREAM_VIDEO && f->cover_art;
         if (first_num < 0 && (filter == STREAM_TYPE_COUNT || sh->type == filter))
             first_num = mpctx->num_tracks - 1;
     }
@@ -917,18 +927,102 @@ err_out:
     return -1;
 }
 
+// Open all files concurrently (on mpctx->thread_pool, as far as threads are
+// free), and add their tracks in the order of the files array, so that track
+// IDs don't depend on which file happened to open first. The result is in
+// first_track of each file.
+// To be run on a worker thread, locked (temporarily unlocks core).
+static void add_external_files(struct MPContext *mpctx,
+                               struct external_file *files, int num_files,
+                               struct mp_cancel *cancel)
+{
+    struct MPOpts *opts = mpctx->opts;
+
+    for (int n = 0; n < num_files; n++) {
+        struct external_file *f = &files[n];
+        f->first_track = -1;
+        f->demuxer = NULL;
+        f->params = (struct demuxer_params){
+            .is_top_level = true,
+            .stream_flags = STREAM_ORIGIN_DIRECT,
+            .allow_playlist_create = false,
+        };
+        switch (f->filter) {
+        case STREAM_SUB:
+            f->params.force_format = opts->sub_demuxer_name;
+            break;
+        case STREAM_AUDIO:
+            f->params.force_format = opts->audio_demuxer_name;
+            break;
+        }
+    }
+
+    mp_core_unlock(mpctx);
+
+    struct open_external_ctx ctx = {mpctx, cancel, files};
+    mp_thread_pool_run_all(mpctx->thread_pool, open_external_demuxer, &ctx,
+                           num_files);
+
+    mp_core_lock(mpctx);
+
+    for (int n = 0; n < num_files; n++) {
+        files[n].first_track = add_external_demuxer(mpctx, &files[n], cancel);
+        files[n].tracks_end = mpctx->num_tracks;
+    }
+}
+
+// Add the given file as additional track. The filter argument controls how or
+// if tracks are auto-selected at any point.
+// To be run on a worker thread, locked (temporarily unlocks core).
+// cancel will generally be used to abort the loading process, but on success
+// the demuxer is changed to be slaved to mpctx->playback_abort instead.
+int mp_add_external_file(struct MPContext *mpctx, char *filename,
+                         enum stream_type filter, struct mp_cancel *cancel,
+                         bool cover_art)
+{
+    if (!filename || mp_cancel_test(cancel))
+        return -1;
+
+    struct external_file f = {
+        .filename = filename,
+        .filter = filter,
+        .cover_art = cover_art,
+    };
+    add_external_files(mpctx, &f, 1, cancel);
+    return f.first_track;
+}
+
 // to be run on a worker thread, locked (temporarily unlocks core)
-static void open_external_files(struct MPContext *mpctx, char **files,
-                                enum stream_type filter)
+static void open_external_files(struct MPContext *mpctx)
 {
-    // Need a copy, because the option value could be mutated during iteration.
+    struct MPOpts *opts = mpctx->opts;
+    struct {
+        char **files;
+        enum stream_type filter;
+    } lists[] = {
+        {opts->audio_files, STREAM_AUDIO},
+        {opts->sub_name, STREAM_SUB},
+        // when given filter is set to video, we are loading up cover art
+        {opts->coverart_files, STREAM_VIDEO},
+        {opts->external_files, STREAM_TYPE_COUNT},
+    };
+
+    // Need a copy, because the option value could be mutated while unlocked.
     void *tmp = talloc_new(NULL);
-    files = mp_dup_str_array(tmp, files);
+    struct external_file *files = NULL;
+    int num_files = 0;
+    for (int i = 0; i < MP_ARRAY_SIZE(lists); i++) {
+        for (int n = 0; lists[i].files && lists[i].files[n]; n++) {
+            struct external_file f = {
+                .filename = talloc_strdup(tmp, lists[i].files[n]),
+                .filter = lists[i].filter,
+                .cover_art = lists[i].filter == STREAM_VIDEO,
+            };
+            MP_TARRAY_APPEND(tmp, files, num_files, f);
+        }
+    }
 
-    for (int n = 0; files && files[n]; n++)
-        // when given filter is set to video, we are loading up cover art
-        mp_add_external_file(mpctx, files[n], filter, mpctx->playback_abort,
-                             filter == STREAM_VIDEO);
+    add_external_files(mpctx, files, num_files, mpctx->playback_abort);
 
     talloc_free(tmp);
 }
@@ -944,7 +1038,9 @@ void autoload_external_files(struct MPContext *mpctx, struct mp_cancel *cancel)
         return;
 
     void *tmp = talloc_new(NULL);
-    struct subfn *list = find_external_files(mpctx->global, mpctx->filename, opts);
+    struct subfn *list = find_external_files(mpctx->global, mpctx->filename,
+                                             opts, mpctx->external_files_cache,
+                                             mpctx->thread_pool, cancel);
     talloc_steal(tmp, list);
 
     int sc[STREAM_TYPE_COUNT] = {0};
@@ -953,6 +1049,9 @@ void autoload_external_files(struct MPContext *mpctx, struct mp_cancel *cancel)
             sc[mpctx->tracks[n]->type]++;
     }
 
+    struct external_file *files = NULL;
+    struct subfn **entries = NULL;
+    int num_files = 0, num_entries = 0;
     for (int i = 0; list && list[i].fname; i++) {
         struct subfn *e = &list[i];
 
@@ -961,6 +1060,10 @@ void autoload_external_files(struct MPContext *mpctx, struct mp_cancel *cancel)
             if (t->demuxer && strcmp(t->demuxer->filename, e->fname) == 0)
                 goto skip;
         }
+        for (int n = 0; n < num_files; n++) {
+            if (strcmp(files[n].filename, e->fname) == 0)
+                goto skip;
+        }
         if (e->type == STREAM_SUB && !sc[STREAM_VIDEO] && !sc[STREAM_AUDIO])
             goto skip;
         if (e->type == STREAM_AUDIO && !sc[STREAM_VIDEO])
@@ -969,18 +1072,27 @@ void autoload_external_files(struct MPContext *mpctx, struct mp_cancel *cancel)
             goto skip;
 
         // when given filter is set to video, we are loading up cover art
-        int first = mp_add_external_file(mpctx, e->fname, e->type, cancel,
-                                         e->type == STREAM_VIDEO);
-        if (first < 0)
-            goto skip;
+        struct external_file f = {
+            .filename = e->fname,
+            .filter = e->type,
+            .cover_art = e->type == STREAM_VIDEO,
+        };
+        MP_TARRAY_APPEND(tmp, files, num_files, f);
+        MP_TARRAY_APPEND(tmp, entries, num_entries, e);
+    skip:;
+    }
+
+    add_external_files(mpctx, files, num_files, cancel);
 
-        for (int n = first; n < mpctx->num_tracks; n++) {
+    for (int i = 0; i < num_files; i++) {
+        if (files[i].first_track < 0)
+            continue;
+        for (int n = files[i].first_track; n < files[i].tracks_end; n++) {
             struct track *t = mpctx->tracks[n];
             t->auto_loaded = true;
             if (!t->lang)
-                t->lang = talloc_strdup(t, e->lang);
+                t->lang = talloc_strdup(t, entries[i]->lang);
         }
-    skip:;
     }
 
     talloc_free(tmp);
@@ -1095,161 +1207,323 @@ static void load_per_file_options(m_config_t *conf,
     }
 }
 
+// Opening a playlist entry in a separate thread. Used for the entry about to
+// be played, and for the entries prefetched with --prefetch-playlist.
+struct open_ctx {
+    struct MPContext *mpctx;
+    mp_thread thread;
+    atomic_bool done;
+    // --- All fields below are immutable while the thread runs.
+    struct mp_cancel *cancel;
+    char *url;
+    char *format;
+    int url_flags;
+    bool for_prefetch;
+    bool allow_playlist_create;
+    // --- Owned by MPContext. max_bytes is also read by the thread until done
+    //     was set to true.
+    int distance;       // position relative to the current entry
+    int64_t max_bytes;  // prefetch share of --prefetch-playlist-max-bytes
+    // --- All fields below are owned by the thread, unless done was set to true.
+    struct demuxer *res_demuxer;
+    int res_error;
+};
+
+// Decoders for the next playlist entry, created and fed from the prefetched
+// demuxer while the current entry is still playing. The graph they live in
+// becomes the filter_root of the next entry, so the chains can take them over.
+struct preroll {
+    struct demuxer *demuxer;    // open_ctx.res_demuxer, not owned
+    struct mp_filter *root;
+    bool adopted;               // root is mpctx->filter_root
+    bool rebased;               // demux_set_ts_offset() was applied
+    struct sh_stream *sh[STREAM_TYPE_COUNT];
+    struct mp_decoder_wrapper *dec[STREAM_TYPE_COUNT];
+};
+
 static MP_THREAD_VOID open_demux_thread(void *ctx)
 {
-    struct MPContext *mpctx = ctx;
+    struct open_ctx *o = ctx;
+    struct MPContext *mpctx = o->mpctx;
 
     mp_thread_set_name("opener");
 
     struct demuxer_params p = {
-        .force_format = mpctx->open_format,
-        .stream_flags = mpctx->open_url_flags,
+        .force_format = o->format,
+        .stream_flags = o->url_flags,
         .stream_record = true,
         .is_top_level = true,
-        .allow_playlist_create = mpctx->playlist->num_entries <= 1 &&
-                                 !mpctx->playlist->playlist_dir,
+        .allow_playlist_create = o->allow_playlist_create,
     };
     struct demuxer *demux =
-        demux_open_url(mpctx->open_url, &p, mpctx->open_cancel, mpctx->global);
-    mpctx->open_res_demuxer = demux;
+        demux_open_url(o->url, &p, o->cancel, mpctx->global);
+    o->res_demuxer = demux;
 
     if (demux) {
-        MP_VERBOSE(mpctx, "Opening done: %s\n", mpctx->open_url);
+        MP_VERBOSE(mpctx, "Opening done: %s\n", o->url);
 
-        if (mpctx->open_for_prefetch && !demux->fully_read) {
+        if (o->for_prefetch && !demux->fully_read) {
             int num_streams = demux_get_num_stream(demux);
             for (int n = 0; n < num_streams; n++) {
                 struct sh_stream *sh = demux_get_stream(demux, n);
                 demuxer_select_track(demux, sh, MP_NOPTS_VALUE, true);
             }
 
+            demux_set_max_bytes(demux, o->max_bytes);
             demux_set_wakeup_cb(demux, wakeup_demux, mpctx);
             demux_start_thread(demux);
             demux_start_prefetch(demux);
         }
     } else {
-        MP_VERBOSE(mpctx, "Opening failed or was aborted: %s\n", mpctx->open_url);
+        MP_VERBOSE(mpctx, "Opening failed or was aborted: %s\n", o->url);
 
         if (p.demuxer_failed) {
-            mpctx->open_res_error = MPV_ERROR_UNKNOWN_FORMAT;
+            o->res_error = MPV_ERROR_UNKNOWN_FORMAT;
         } else {
-            mpctx->open_res_error = MPV_ERROR_LOADING_FAILED;
+            o->res_error = MPV_ERROR_LOADING_FAILED;
         }
     }
 
-    atomic_store(&mpctx->open_done, true);
+    atomic_store(&o->done, true);
     mp_wakeup_core(mpctx);
     MP_THREAD_RETURN();
 }
 
-static void cancel_open(struct MPContext *mpctx)
+static void cancel_open(struct MPContext *mpctx, struct open_ctx *o)
 {
-    if (mpctx->open_cancel)
-        mp_cancel_trigger(mpctx->open_cancel);
-
-    if (mpctx->open_active)
-        mp_thread_join(mpctx->open_thread);
-    mpctx->open_active = false;
+    if (!o)
+        return;
 
-    if (mpctx->open_res_demuxer)
-        demux_cancel_and_free(mpctx->open_res_demuxer);
-    mpctx->open_res_demuxer = NULL;
+    mp_cancel_trigger(o->cancel);
+    mp_thread_join(o->thread);
 
-    TA_FREEP(&mpctx->open_cancel);
-    TA_FREEP(&mpctx->open_url);
-    TA_FREEP(&mpctx->open_format);
+    if (o->res_demuxer) {
+        if (mpctx->preroll && mpctx->preroll->demuxer == o->res_demuxer)
+            cancel_preroll(mpctx);
+        demux_cancel_and_free(o->res_demuxer);
+    }
 
-    atomic_store(&mpctx->open_done, false);
+    talloc_free(o);
 }
 
-// Setup all the field to open this url, and make sure a thread is running.
-static void start_open(struct MPContext *mpctx, char *url, int url_flags,
-                       bool for_prefetch)
+static void cancel_prefetch(struct MPContext *mpctx)
 {
-    cancel_open(mpctx);
-
-    assert(!mpctx->open_active);
-    assert(!mpctx->open_cancel);
-    assert(!mpctx->open_res_demuxer);
-    assert(!atomic_load(&mpctx->open_done));
-
-    mpctx->open_cancel = mp_cancel_new(NULL);
-    mpctx->open_url = talloc_strdup(NULL, url);
-    mpctx->open_format = talloc_strdup(NULL, mpctx->opts->demuxer_name);
-    mpctx->open_url_flags = url_flags;
-    mpctx->open_for_prefetch = for_prefetch && mpctx->opts->demuxer_thread;
+    for (int n = 0; n < mpctx->num_opens; n++)
+        cancel_open(mpctx, mpctx->opens[n]);
+    mpctx->num_opens = 0;
+}
 
+// Start a thread that opens this url. Returns NULL on failure.
+static struct open_ctx *start_open(struct MPContext *mpctx, char *url,
+                                   int url_flags, bool for_prefetch,
+                                   int64_t max_bytes)
+{
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
     // Don't allow to open local paths or stdin during fuzzing
-    bstr open_url = bstr0(mpctx->open_url);
+    bstr open_url = bstr0(url);
     if (bstr_startswith0(open_url, "/") ||
         bstr_startswith0(open_url, ".") ||
         bstr_equals0(open_url, "-"))
-    {
-        cancel_open(mpctx);
-        return;
-    }
+        return NULL;
 #endif
 
-    if (mp_thread_create(&mpctx->open_thread, open_demux_thread, mpctx)) {
-        cancel_open(mpctx);
+    struct open_ctx *o = talloc_zero(NULL, struct open_ctx);
+    o->mpctx = mpctx;
+    o->cancel = mp_cancel_new(o);
+    o->url = talloc_strdup(o, url);
+    o->format = talloc_strdup(o, mpctx->opts->demuxer_name);
+    o->url_flags = url_flags;
+    o->for_prefetch = for_prefetch && mpctx->opts->demuxer_thread;
+    o->max_bytes = max_bytes;
+    o->allow_playlist_create = mpctx->playlist->num_entries <= 1 &&
+                               !mpctx->playlist->playlist_dir;
+
+    if (mp_thread_create(&o->thread, open_demux_thread, o)) {
+        talloc_free(o);
+        return NULL;
+    }
+
+    return o;
+}
+
+// Like mp_next_file(), but without changing any state. Returns NULL if the
+// entry after e (or after the current entry if e is NULL) can't be predicted.
+static struct playlist_entry *peek_next_file(struct MPContext *mpctx,
+                                             struct playlist_entry *e,
+                                             int direction)
+{
+    struct playlist *pl = mpctx->playlist;
+    struct playlist_entry *next = e ? playlist_entry_get_rel(e, direction)
+                                    : playlist_get_next(pl, direction);
+    // Looping with --shuffle reshuffles the playlist first.
+    if (!next && mpctx->opts->loop_times != 1 &&
+        !(direction > 0 && mpctx->opts->shuffle))
+        next = direction > 0 ? playlist_get_first(pl) : playlist_get_last(pl);
+    return next;
+}
+
+// --prefetch-playlist-count plus the previous entry.
+#define MAX_PREFETCH 17
+
+struct prefetch_list {
+    struct playlist_entry *entries[MAX_PREFETCH];
+    int distances[MAX_PREFETCH];
+    int num;
+};
+
+static void add_prefetch_entry(struct MPContext *mpctx, struct prefetch_list *l,
+                               struct playlist_entry *e, int distance)
+{
+    if (!e || e == mpctx->playlist->current || !e->filename)
         return;
+    for (int n = 0; n < l->num; n++) {
+        if (strcmp(l->entries[n]->filename, e->filename) == 0)
+            return;
+    }
+    assert(l->num < MAX_PREFETCH);
+    l->entries[l->num] = e;
+    l->distances[l->num] = distance;
+    l->num++;
+}
+
+// Get the entries that should be prefetched, nearest first.
+static void get_prefetch_entries(struct MPContext *mpctx,
+                                 struct prefetch_list *l)
+{
+    struct MPOpts *opts = mpctx->opts;
+    l->num = 0;
+    if (!opts->prefetch_open || !mpctx->playlist->current)
+        return;
+
+    bool prev = opts->prefetch_prev;
+    struct playlist_entry *e = NULL;
+    for (int n = 0; n < opts->prefetch_count; n++) {
+        e = peek_next_file(mpctx, e, +1);
+        if (!e || e == mpctx->playlist->current)
+            break;
+        add_prefetch_entry(mpctx, l, e, n + 1);
+        // The previous entry is as near as the next one.
+        if (prev) {
+            add_prefetch_entry(mpctx, l, peek_next_file(mpctx, NULL, -1), -1);
+            prev = false;
+        }
     }
+    if (prev)
+        add_prefetch_entry(mpctx, l, peek_next_file(mpctx, NULL, -1), -1);
+}
 
-    mpctx->open_active = true;
+// Make the prefetched entries match the playlist position: cancel those that
+// are not near the current entry anymore, start the missing ones if start is
+// set, and divide the byte budget between them. Nearer entries get a larger
+// share, so the next entry has the most data cached when it starts.
+static void update_prefetch(struct MPContext *mpctx, bool start)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct prefetch_list l;
+    get_prefetch_entries(mpctx, &l);
+
+    int64_t budget = opts->prefetch_max_bytes;
+    if (!budget)
+        budget = opts->demux_opts->max_bytes;
+    int64_t weights = l.num * (l.num + 1) / 2;
+
+    struct open_ctx *opens[MAX_PREFETCH] = {0};
+    for (int n = 0; n < mpctx->num_opens; n++) {
+        struct open_ctx *o = mpctx->opens[n];
+        int i = 0;
+        while (i < l.num && strcmp(l.entries[i]->filename, o->url) != 0)
+            i++;
+        if (i < l.num && !opens[i]) {
+            o->distance = l.distances[i];
+            opens[i] = o;
+            continue;
+        }
+        if (atomic_load(&o->done)) {
+            MP_VERBOSE(mpctx, "Dropping finished prefetch of %s.\n", o->url);
+        } else {
+            MP_VERBOSE(mpctx, "Aborting ongoing prefetch of %s.\n", o->url);
+        }
+        cancel_open(mpctx, o);
+    }
+
+    mpctx->num_opens = 0;
+    for (int n = 0; n < l.num; n++) {
+        struct open_ctx *o = opens[n];
+        int64_t max_bytes = budget * (l.num - n) / weights;
+        if (!o && start) {
+            struct playlist_entry *e = l.entries[n];
+            MP_VERBOSE(mpctx, "Prefetching: %s\n", e->filename);
+            o = start_open(mpctx, e->filename, e->stream_flags, true,
+                           max_bytes);
+            if (o)
+                o->distance = l.distances[n];
+        } else if (o && atomic_load(&o->done) && o->res_demuxer &&
+                   o->max_bytes != max_bytes)
+        {
+            o->max_bytes = max_bytes;
+            demux_set_max_bytes(o->res_demuxer, max_bytes);
+        }
+        if (o)
+            MP_TARRAY_APPEND(mpctx, mpctx->opens, mpctx->num_opens, o);
+    }
 }
 
 static void open_demux_reentrant(struct MPContext *mpctx)
 {
     char *url = mpctx->stream_open_filename;
 
-    if (mpctx->open_active) {
-        bool done = atomic_load(&mpctx->open_done);
-        bool failed = done && !mpctx->open_res_demuxer;
-        bool correct_url = strcmp(mpctx->open_url, url) == 0;
+    struct open_ctx *o = NULL;
+    for (int n = 0; n < mpctx->num_opens; n++) {
+        if (strcmp(mpctx->opens[n]->url, url) == 0) {
+            o = mpctx->opens[n];
+            MP_TARRAY_REMOVE_AT(mpctx->opens, mpctx->num_opens, n);
+            break;
+        }
+    }
 
-        if (correct_url && !failed) {
+    if (o) {
+        bool failed = atomic_load(&o->done) && !o->res_demuxer;
+        if (!failed) {
             MP_VERBOSE(mpctx, "Using prefetched/prefetching URL.\n");
-        } else if (correct_url && failed) {
-            MP_VERBOSE(mpctx, "Prefetched URL failed, retrying.\n");
-            cancel_open(mpctx);
         } else {
-            if (done) {
-                MP_VERBOSE(mpctx, "Dropping finished prefetch of wrong URL.\n");
-            } else {
-                MP_VERBOSE(mpctx, "Aborting ongoing prefetch of wrong URL.\n");
-            }
-            cancel_open(mpctx);
+            MP_VERBOSE(mpctx, "Prefetched URL failed, retrying.\n");
+            cancel_open(mpctx, o);
+            o = NULL;
         }
     }
 
-    if (!mpctx->open_active)
-        start_open(mpctx, url, mpctx->playing->stream_flags, false);
+    // The playlist position changed.
+    update_prefetch(mpctx, false);
+
+    if (!o)
+        o = start_open(mpctx, url, mpctx->playing->stream_flags, false, 0);
 
     // If thread failed to start, cancel the playback
-    if (!mpctx->open_active)
-        goto cancel;
+    if (!o)
+        return;
 
     // User abort should cancel the opener now.
-    mp_cancel_set_parent(mpctx->open_cancel, mpctx->playback_abort);
+    mp_cancel_set_parent(o->cancel, mpctx->playback_abort);
 
-    while (!atomic_load(&mpctx->open_done)) {
+    while (!atomic_load(&o->done)) {
         mp_idle(mpctx);
 
         if (mpctx->stop_play)
             mp_abort_playback_async(mpctx);
     }
 
-    if (mpctx->open_res_demuxer) {
-        mpctx->demuxer = mpctx->open_res_demuxer;
-        mpctx->open_res_demuxer = NULL;
+    if (o->res_demuxer) {
+        mpctx->demuxer = o->res_demuxer;
+        o->res_demuxer = NULL;
         mp_cancel_set_parent(mpctx->demuxer->cancel, mpctx->playback_abort);
+        // Only the prefetch shares the byte budget.
+        if (o->for_prefetch)
+            demux_set_max_bytes(mpctx->demuxer, 0);
     } else {
-        mpctx->error_playing = mpctx->open_res_error;
+        mpctx->error_playing = o->res_error;
     }
 
-cancel:
-    cancel_open(mpctx); // cleanup
+    cancel_open(mpctx, o); // cleanup
 }
 
 void prefetch_next(struct MPContext *mpctx)
@@ -1257,13 +1531,219 @@ void prefetch_next(struct MPContext *mpctx)
     if (!mpctx->opts->prefetch_open)
         return;
 
-    struct playlist_entry *new_entry = mp_next_file(mpctx, +1, false);
-    if (new_entry && !mpctx->open_active && new_entry->filename) {
-        MP_VERBOSE(mpctx, "Prefetching: %s\n", new_entry->filename);
-        start_open(mpctx, new_entry->filename, new_entry->stream_flags, true);
+    update_prefetch(mpctx, true);
+}
+
+static struct mp_filter *create_filter_root(struct MPContext *mpctx)
+{
+    struct MPOpts *opts = mpctx->opts;
+    struct mp_filter *root = mp_filter_create_root(mpctx->global);
+    mp_filter_graph_set_wakeup_cb(root, mp_wakeup_core_cb, mpctx);
+    mp_filter_graph_set_max_run_time(root, 0.1);
+    mp_filter_graph_set_threads(root, opts->filter_threads);
+    mp_filter_graph_set_stats(root, opts->filter_stats);
+    return root;
+}
+
+// Guess which stream the track selection will pick. A wrong guess only wastes
+// the preroll of that type.
+static struct sh_stream *select_preroll_stream(struct demuxer *demuxer,
+                                               enum stream_type type)
+{
+    struct sh_stream *res = NULL;
+    for (int n = 0; n < demux_get_num_stream(demuxer); n++) {
+        struct sh_stream *sh = demux_get_stream(demuxer, n);
+        if (sh->type != type || sh->attached_picture || sh->still_image)
+            continue;
+        if (!res || (sh->default_track && !res->default_track))
+            res = sh;
+    }
+    return res;
+}
+
+static void start_preroll(struct MPContext *mpctx, struct open_ctx *o)
+{
+    struct preroll *pr = talloc_zero(NULL, struct preroll);
+    pr->demuxer = o->res_demuxer;
+    pr->root = create_filter_root(mpctx);
+    mpctx->preroll = pr;
+
+    MP_VERBOSE(mpctx, "Prerolling: %s\n", o->url);
+
+    // The decoded timestamps must be the same as play_current_file() will use.
+    pr->rebased = mpctx->opts->rebase_start_time;
+    if (pr->rebased)
+        demux_set_ts_offset(pr->demuxer, -pr->demuxer->start_time);
+
+    for (int t = 0; t < STREAM_TYPE_COUNT; t++) {
+        if (t != STREAM_VIDEO && t != STREAM_AUDIO)
+            continue;
+        struct sh_stream *sh = select_preroll_stream(pr->demuxer, t);
+        if (!sh)
+            continue;
+
+        // Give the video decoder the hwdec and DR interfaces of the VO, like
+        // the video chain would. Only the decoder itself may use them, see
+        // init_video_decoder().
+        struct mp_stream_info *info = NULL;
+        if (t == STREAM_VIDEO) {
+            if (!mpctx->video_out)
+                continue;
+            info = talloc_zero(NULL, struct mp_stream_info);
+            info->hwdec_devs = mpctx->video_out->hwdec_devs;
+            info->dr_vo = mpctx->video_out;
+            pr->root->stream_info = info;
+        }
+        struct mp_decoder_wrapper *dec = mp_decoder_wrapper_create(pr->root, sh);
+        pr->root->stream_info = NULL;
+        if (!dec) {
+            talloc_free(info);
+            continue;
+        }
+        // The wrapper looks it up again whenever it recreates the decoder
+        // (e.g. on hwdec changes), so it must live as long as the wrapper.
+        if (info) {
+            talloc_steal(dec->f, info);
+            dec->f->stream_info = info;
+        }
+
+        // Same as for a track with an audio chain.
+        if (t == STREAM_AUDIO)
+            mp_decoder_wrapper_set_spdif_flag(dec, true);
+
+        if (!mp_decoder_wrapper_reinit(dec)) {
+            talloc_free(dec->f);
+            continue;
+        }
+        mp_decoder_wrapper_preroll(dec);
+        pr->sh[t] = sh;
+        pr->dec[t] = dec;
     }
 }
 
+// Whether the decoders of a preroll could be used by the chains with the
+// current options. (--lavfi-complex connects tracks to its own pads.)
+static bool preroll_possible(struct MPContext *mpctx)
+{
+    char *graph = mpctx->opts->lavfi_complex;
+    return mpctx->play_dir > 0 && !mpctx->encode_lavc_ctx &&
+           !(graph && graph[0]);
+}
+
+// Start and run the preroll for the prefetched next entry. Called by the
+// playloop.
+void update_preroll(struct MPContext *mpctx)
+{
+    struct preroll *pr = mpctx->preroll;
+    if (!pr) {
+        struct open_ctx *o = mpctx->num_opens ? mpctx->opens[0] : NULL;
+        // The demuxer must be seekable, so that packets read by decoders
+        // which end up unused can be read again (see discard_preroll_dec()).
+        if (mpctx->opts->prefetch_open == 2 && o && o->distance == 1 &&
+            o->for_prefetch && atomic_load(&o->done) && o->res_demuxer &&
+            o->res_demuxer->seekable && !o->res_demuxer->partially_seekable &&
+            preroll_possible(mpctx))
+            start_preroll(mpctx, o);
+        return;
+    }
+
+    if (!pr->adopted && mp_filter_graph_run(pr->root))
+        mp_wakeup_core(mpctx);
+}
+
+// Let the chains of the current entry use the prerolled decoders.
+static void adopt_preroll(struct MPContext *mpctx)
+{
+    struct preroll *pr = mpctx->preroll;
+    if (!pr)
+        return;
+
+    if (pr->demuxer != mpctx->demuxer) {
+        cancel_preroll(mpctx);
+        return;
+    }
+
+    // Per-file options can change these.
+    if (pr->rebased != mpctx->opts->rebase_start_time ||
+        !preroll_possible(mpctx))
+    {
+        MP_VERBOSE(mpctx, "Dropping preroll with different options.\n");
+        cancel_preroll(mpctx);
+        demux_set_ts_offset(mpctx->demuxer, 0);
+        return;
+    }
+
+    // Nothing was added to the new filter graph yet.
+    talloc_free(mpctx->filter_root);
+    mpctx->filter_root = pr->root;
+    pr->adopted = true;
+}
+
+// Free the prerolled decoder of the given type. The decoder already read the
+// first packets of its stream, so if the stream is still selected, make the
+// demuxer return them again, like on a track switch. This must happen before
+// anything else reads from the stream.
+static void discard_preroll_dec(struct preroll *pr, enum stream_type t)
+{
+    talloc_free(pr->dec[t]->f);
+    pr->dec[t] = NULL;
+
+    struct sh_stream *sh = pr->sh[t];
+    if (demux_stream_is_selected(sh)) {
+        double start = pr->rebased ? 0 : pr->demuxer->start_time;
+        demuxer_select_track(pr->demuxer, sh, MP_NOPTS_VALUE, false);
+        demuxer_select_track(pr->demuxer, sh, start, true);
+    }
+}
+
+// Return the prerolled decoder for the track, or NULL.
+struct mp_decoder_wrapper *take_preroll_decoder(struct MPContext *mpctx,
+                                                struct track *track)
+{
+    struct preroll *pr = mpctx->preroll;
+    if (!pr || !pr->adopted || !track->stream)
+        return NULL;
+
+    enum stream_type t = track->type;
+    if (!pr->dec[t] || pr->sh[t] != track->stream)
+        return NULL;
+    // Used differently than the preroll assumed. A new decoder will read the
+    // stream, so the packets the prerolled one consumed are needed again.
+    if ((t == STREAM_VIDEO && (!track->vo_c || track->attached_picture)) ||
+        (t == STREAM_AUDIO && !track->ao_c))
+    {
+        discard_preroll_dec(pr, t);
+        return NULL;
+    }
+
+    struct mp_decoder_wrapper *dec = pr->dec[t];
+    pr->dec[t] = NULL;
+    // Decoders created from now on use the video chain's interfaces, as if
+    // dec was its child (see init_video_decoder()). The chain frees dec
+    // before itself.
+    if (t == STREAM_VIDEO)
+        dec->f->stream_info = mp_filter_find_stream_info(track->vo_c->filter->f);
+    MP_VERBOSE(mpctx, "Using prerolled %s decoder.\n", stream_type_name(t));
+    return dec;
+}
+
+// Free the prerolled decoders nobody took, and the graph too if it was not
+// adopted by the current entry.
+void cancel_preroll(struct MPContext *mpctx)
+{
+    struct preroll *pr = mpctx->preroll;
+    if (!pr)
+        return;
+
+    for (int t = 0; t < STREAM_TYPE_COUNT; t++) {
+        if (pr->dec[t])
+            discard_preroll_dec(pr, t);
+    }
+    if (!pr->adopted)
+        talloc_free(pr->root);
+    TA_FREEP(&mpctx->preroll);
+}
+
 static void clear_playlist_paths(struct MPContext *mpctx)
 {
     TA_FREEP(&mpctx->playlist_paths);
@@ -1490,11 +1970,12 @@ static void load_external_opts_thread(void *p)
     mp_core_lock(mpctx);
 
     load_chapters(mpctx);
-    open_external_files(mpctx, mpctx->opts->audio_files, STREAM_AUDIO);
-    open_external_files(mpctx, mpctx->opts->sub_name, STREAM_SUB);
-    open_external_files(mpctx, mpctx->opts->coverart_files, STREAM_VIDEO);
-    open_external_files(mpctx, mpctx->opts->external_files, STREAM_TYPE_COUNT);
-    autoload_external_files(mpctx, mpctx->playback_abort);
+    open_external_files(mpctx);
+    if (mpctx->opts->fast_start) {
+        mpctx->autoload_deferred = true;
+    } else {
+        autoload_external_files(mpctx, mpctx->playback_abort);
+    }
 
     mp_waiter_wakeup(waiter, 0);
     mp_wakeup_core(mpctx);
@@ -1521,6 +2002,32 @@ static void load_external_opts(struct MPContext *mpctx)
     mp_waiter_wait(&wait);
 }
 
+void mp_mark_startup(struct MPContext *mpctx, enum startup_stage stage)
+{
+    if (stage == STARTUP_BEGIN) {
+        for (int n = 0; n < STARTUP_STAGE_COUNT; n++)
+            mpctx->startup_times[n] = 0;
+    }
+    if (mpctx->startup_times[stage])
+        return;
+    mpctx->startup_times[stage] = mp_time_ns();
+    mp_notify_property(mpctx, "startup-timing");
+}
+
+// Run the work skipped by --fast-start. Called once playback has started.
+void mp_load_deferred(struct MPContext *mpctx)
+{
+    if (!mpctx->autoload_deferred)
+        return;
+    mpctx->autoload_deferred = false;
+
+    // This runs asynchronously, and is aborted when playback ends.
+    const char *args[] = {"rescan-external-files", "reselect", NULL};
+    struct mp_cmd *cmd = mp_input_parse_cmd_strv(mpctx->log, args);
+    if (cmd)
+        run_command(mpctx, cmd, NULL, NULL, NULL);
+}
+
 // Start playing the current playlist entry.
 // Handle initialization and deinitialization.
 static void play_current_file(struct MPContext *mpctx)
@@ -1542,6 +2049,7 @@ static void play_current_file(struct MPContext *mpctx)
     };
 
     mp_notify(mpctx, MPV_EVENT_START_FILE, &start_event);
+    mp_mark_startup(mpctx, STARTUP_BEGIN);
 
     mp_cancel_reset(mpctx->playback_abort);
 
@@ -1554,6 +2062,7 @@ static void play_current_file(struct MPContext *mpctx)
     mpctx->last_chapter = -2;
     mpctx->paused = false;
     mpctx->playing_msg_shown = false;
+    mpctx->autoload_deferred = false;
     mpctx->max_frames = -1;
     mpctx->video_speed = mpctx->audio_speed = opts->playback_speed;
     mpctx->speed_factor_a = mpctx->speed_factor_v = 1.0;
@@ -1562,9 +2071,7 @@ static void play_current_file(struct MPContext *mpctx)
     // let get_current_time() show 0 as start time (before playback_pts is set)
     mpctx->last_seek_pts = 0.0;
     mpctx->seek = (struct seek_params){ 0 };
-    mpctx->filter_root = mp_filter_create_root(mpctx->global);
-    mp_filter_graph_set_wakeup_cb(mpctx->filter_root, mp_wakeup_core_cb, mpctx);
-    mp_filter_graph_set_max_run_time(mpctx->filter_root, 0.1);
+    mpctx->filter_root = create_filter_root(mpctx);
 
     reset_playback_state(mpctx);
 
@@ -1641,6 +2148,10 @@ static void play_current_file(struct MPContext *mpctx)
     if (!mpctx->demuxer || mpctx->stop_play)
         goto terminate_playback;
 
+    adopt_preroll(mpctx);
+
+    mp_mark_startup(mpctx, STARTUP_OPENED);
+
     struct playlist *pl = mpctx->demuxer->playlist;
     if (pl) {
         // pl->playlist_dir indicates that the playlist was auto-created from
@@ -1725,6 +2236,8 @@ static void play_current_file(struct MPContext *mpctx)
             if (mpctx->tracks[n]->type == t)
                 reselect_demux_stream(mpctx, mpctx->tracks[n], false);
 
+    mp_mark_startup(mpctx, STARTUP_TRACKS);
+
     update_demuxer_properties(mpctx);
 
     update_playback_speed(mpctx);
@@ -1732,6 +2245,7 @@ static void play_current_file(struct MPContext *mpctx)
     reinit_video_chain(mpctx);
     reinit_audio_chain(mpctx);
     reinit_sub_all(mpctx);
+    cancel_preroll(mpctx);
 
     if (mpctx->encode_lavc_ctx) {
         if (mpctx->vo_chain)
@@ -1762,6 +2276,7 @@ static void play_current_file(struct MPContext *mpctx)
     mpctx->playing->playlist_prev_attempt = false;
     mpctx->playlist->playlist_completed = false;
     mpctx->playlist->playlist_started = true;
+    mp_mark_startup(mpctx, STARTUP_LOADED);
     mp_notify(mpctx, MPV_EVENT_FILE_LOADED, NULL);
     update_screensaver_state(mpctx);
     clear_playlist_paths(mpctx);
@@ -1841,6 +2356,9 @@ terminate_playback:
 
     mpctx->playback_initialized = false;
 
+    // (A preroll started during playback is for the next entry.)
+    if (mpctx->preroll && mpctx->preroll->adopted)
+        cancel_preroll(mpctx);
     uninit_demuxer(mpctx);
 
     // Possibly stop ongoing async commands.
@@ -2016,7 +2534,7 @@ void mp_play_files(struct MPContext *mpctx)
             break;
     }
 
-    cancel_open(mpctx);
+    cancel_prefetch(mpctx);
 
     if (mpctx->encode_lavc_ctx) {
         // Make sure all streams get finished.
@@ -61,11 +61,14 @@
 #include "audio/out/ao.h"
 #include "misc/thread_tools.h"
 #include "sub/osd.h"
+#include "video/memcpy_pic.h"
+#include "video/mp_image_buffers.h"
 #include "video/out/vo.h"
 
 #include "core.h"
 #include "client.h"
 #include "command.h"
+#include "external_files.h"
 #include "screenshot.h"
 
 static const char def_config[] =
@@ -80,6 +83,10 @@ static const char def_config[] =
 #include "osdep/mac/app_bridge.h"
 #endif
 
+#if HAVE_ZIMG
+#include "video/zimg.h"
+#endif
+
 #ifndef FULLCONFIG
 #define FULLCONFIG "(missing)\n"
 #endif
@@ -177,6 +184,9 @@ void mp_destroy(struct MPContext *mpctx)
     uninit_audio_out(mpctx);
     uninit_video_out(mpctx);
 
+    if (mpctx->screenshot_ctx)
+        screenshot_flush(mpctx);
+
     // If it's still set here, it's an error.
     encode_lavc_free(mpctx->encode_lavc_ctx);
     mpctx->encode_lavc_ctx = NULL;
@@ -199,6 +209,13 @@ void mp_destroy(struct MPContext *mpctx)
     mp_input_uninit(mpctx->input);
     mp_clipboard_destroy(mpctx->clipboard);
 
+    // Frames still referenced elsewhere return their buffers later.
+    mp_image_buffers_unconfigure(mpctx);
+    memcpy_pic_unconfigure(mpctx);
+#if HAVE_ZIMG
+    mp_zimg_cache_unref();
+#endif
+
     uninit_libav(mpctx->global);
 
     mp_msg_uninit(mpctx->global);
@@ -266,6 +283,9 @@ struct MPContext *mp_create(void)
 
     mp_time_init();
     mp_rand_seed(0);
+#if HAVE_ZIMG
+    mp_zimg_cache_ref();
+#endif
 
     struct MPContext *mpctx = talloc(NULL, MPContext);
     *mpctx = (struct MPContext){
@@ -276,6 +296,7 @@ struct MPContext *mp_create(void)
         .dispatch = mp_dispatch_create(mpctx),
         .playback_abort = mp_cancel_new(mpctx),
         .thread_pool = mp_thread_pool_create(mpctx, 0, 1, 30),
+        .external_files_cache = external_files_cache_create(mpctx),
         .stop_play = PT_NEXT_ENTRY,
         .play_dir = 1,
     };
@@ -1168,6 +1168,8 @@ static void handle_playback_restart(struct MPContext *mpctx)
         mpctx->playing_msg_shown = true;
         mp_wakeup_core(mpctx);
         update_ab_loop_clip(mpctx);
+        mp_mark_startup(mpctx, STARTUP_FIRST_FRAME);
+        mp_load_deferred(mpctx);
         MP_VERBOSE(mpctx, "playback restart complete @ %f, audio=%s, video=%s%s\n",
                    mpctx->playback_pts, mp_status_str(mpctx->audio_status),
                    mp_status_str(mpctx->video_status),
@@ -1270,6 +1272,8 @@ void run_playloop(struct MPContext *mpctx)
     if (mp_filter_graph_run(mpctx->filter_root))
         mp_wakeup_core(mpctx);
 
+    update_preroll(mpctx);
+
     mp_wait_events(mpctx);
 
     handle_update_cache(mpctx);
@@ -31,8 +31,10 @@
 #include "misc/bstr.h"
 #include "misc/dispatch.h"
 #include "misc/node.h"
+#include "misc/thread_pool.h"
 #include "misc/thread_tools.h"
 #include "common/msg.h"
+#include "osdep/threads.h"
 #include "options/path.h"
 #include "video/mp_image.h"
 #include "video/mp_image_pool.h"
@@ -46,6 +48,15 @@
 #define MODE_FULL_WINDOW 1
 #define MODE_SUBTITLES 2
 
+// Each-frame screenshots written by the worker pool (--screenshot-workers).
+struct screenshot_job {
+    struct screenshot_ctx *ctx;
+    struct mp_image *image;
+    char *filename;
+    struct image_writer_opts opts;
+    bool done, ok;
+};
+
 typedef struct screenshot_ctx {
     struct MPContext *mpctx;
     struct mp_log *log;
@@ -55,8 +66,26 @@ typedef struct screenshot_ctx {
 
     int frameno;
     uint64_t last_frame_count;
+
+    struct mp_thread_pool *pool;
+    int pool_size;
+
+    // Protects jobs. Jobs are kept in submission order, and are reported and
+    // removed only in that order.
+    mp_mutex lock;
+    mp_cond wakeup;
+    struct screenshot_job **jobs;
+    int num_jobs;
 } screenshot_ctx;
 
+static void screenshot_destroy(void *p)
+{
+    screenshot_ctx *ctx = p;
+    talloc_free(ctx->pool); // waits for all jobs
+    mp_cond_destroy(&ctx->wakeup);
+    mp_mutex_destroy(&ctx->lock);
+}
+
 void screenshot_init(struct MPContext *mpctx)
 {
     mpctx->screenshot_ctx = talloc(mpctx, screenshot_ctx);
@@ -65,6 +94,111 @@ void screenshot_init(struct MPContext *mpctx)
         .frameno = 1,
         .log = mp_log_new(mpctx, mpctx->log, "screenshot")
     };
+    mp_mutex_init(&mpctx->screenshot_ctx->lock);
+    mp_cond_init(&mpctx->screenshot_ctx->wakeup);
+    talloc_set_destructor(mpctx->screenshot_ctx, screenshot_destroy);
+}
+
+void screenshot_flush(struct MPContext *mpctx)
+{
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+    mp_mutex_lock(&ctx->lock);
+    while (ctx->num_jobs)
+        mp_cond_wait(&ctx->wakeup, &ctx->lock);
+    mp_mutex_unlock(&ctx->lock);
+}
+
+static void run_screenshot_job(void *p)
+{
+    struct screenshot_job *job = p;
+    screenshot_ctx *ctx = job->ctx;
+
+    bool ok = write_image(job->image, &job->opts, job->filename,
+                          ctx->mpctx->global, ctx->log, false);
+    TA_FREEP(&job->image);
+
+    mp_mutex_lock(&ctx->lock);
+    job->ok = ok;
+    job->done = true;
+    // Report completion in submission order.
+    while (ctx->num_jobs && ctx->jobs[0]->done) {
+        struct screenshot_job *first = ctx->jobs[0];
+        if (first->ok) {
+            MP_VERBOSE(ctx, "Screenshot: '%s'\n", first->filename);
+        } else {
+            MP_ERR(ctx, "Error writing screenshot '%s'!\n", first->filename);
+        }
+        MP_TARRAY_REMOVE_AT(ctx->jobs, ctx->num_jobs, 0);
+        talloc_free(first);
+    }
+    // Once the lock is released, screenshot_flush() can return, and mpctx may
+    // be destroyed. This must not touch it afterwards.
+    mp_wakeup_core(ctx->mpctx);
+    mp_cond_broadcast(&ctx->wakeup);
+    mp_mutex_unlock(&ctx->lock);
+}
+
+// Hand the image to the worker pool. Takes ownership of image. Blocks while
+// too many screenshots are in flight, to bound memory usage.
+// Called with the core locked; unlocks it while waiting.
+static bool queue_screenshot(struct MPContext *mpctx, struct mp_image *image,
+                             const char *filename)
+{
+    screenshot_ctx *ctx = mpctx->screenshot_ctx;
+    int workers = mpctx->opts->screenshot_workers;
+
+    if (ctx->pool_size != workers) {
+        screenshot_flush(mpctx);
+        TA_FREEP(&ctx->pool);
+        ctx->pool_size = 0;
+        ctx->pool = mp_thread_pool_create(ctx, workers, workers, workers);
+        if (!ctx->pool) {
+            talloc_free(image);
+            return false;
+        }
+        ctx->pool_size = workers;
+    }
+
+    struct screenshot_job *job = talloc_ptrtype(NULL, job);
+    *job = (struct screenshot_job){
+        .ctx = ctx,
+        .image = talloc_steal(job, image),
+        .filename = talloc_strdup(job, filename),
+        .opts = *mpctx->opts->screenshot_image_opts,
+    };
+    // The option strings may be freed by the core while the job is pending.
+    job->opts.avif_encoder = talloc_strdup(job, job->opts.avif_encoder);
+    job->opts.avif_pixfmt = talloc_strdup(job, job->opts.avif_pixfmt);
+    char **avif_opts = job->opts.avif_opts;
+    job->opts.avif_opts = NULL;
+    for (int n = 0; avif_opts && avif_opts[n]; n++) {
+        job->opts.avif_opts = talloc_realloc(job, job->opts.avif_opts, char *, n + 2);
+        job->opts.avif_opts[n] = talloc_strdup(job, avif_opts[n]);
+        job->opts.avif_opts[n + 1] = NULL;
+    }
+
+    mp_core_unlock(mpctx);
+    mp_mutex_lock(&ctx->lock);
+    while (ctx->num_jobs >= workers * 2)
+        mp_cond_wait(&ctx->wakeup, &ctx->lock);
+    MP_TARRAY_APPEND(ctx, ctx->jobs, ctx->num_jobs, job);
+    mp_mutex_unlock(&ctx->lock);
+    mp_core_lock(mpctx);
+
+    if (!mp_thread_pool_queue(ctx->pool, run_screenshot_job, job))
+        run_screenshot_job(job);
+    return true;
+}
+
+// Whether a queued screenshot is going to be written to this file.
+static bool screenshot_pending(screenshot_ctx *ctx, const char *filename)
+{
+    bool r = false;
+    mp_mutex_lock(&ctx->lock);
+    for (int n = 0; n < ctx->num_jobs; n++)
+        r |= strcmp(ctx->jobs[n]->filename, filename) == 0;
+    mp_mutex_unlock(&ctx->lock);
+    return r;
 }
 
 static char *stripext(void *talloc_ctx, const char *s)
@@ -310,7 +444,7 @@ static char *gen_fname(struct mp_cmd_ctx *cmd, const char *file_ext)
             mp_mkdirp(full_dir);
         }
 
-        if (!mp_path_exists(fname))
+        if (!mp_path_exists(fname) && !screenshot_pending(ctx, fname))
             return fname;
 
         if (sequence == prev_sequence) {
@@ -536,7 +670,15 @@ void cmd_screenshot(void *p)
 
     if (image) {
         char *filename = gen_fname(cmd, image_writer_file_ext(opts));
-        if (filename) {
+        if (filename && each_frame_mode && mpctx->opts->screenshot_workers > 0) {
+            mp_cmd_msg(cmd, MSGL_V, "Queuing screenshot: '%s'", filename);
+            cmd->success = queue_screenshot(mpctx, image, filename);
+            image = NULL;
+            if (cmd->success) {
+                node_init(res, MPV_FORMAT_NODE_MAP, NULL);
+                node_map_add_string(res, "filename", filename);
+            }
+        } else if (filename) {
             cmd->success = write_screenshot(cmd, image, filename, NULL, false);
             if (cmd->success) {
                 node_init(res, MPV_FORMAT_NODE_MAP, NULL);
@@ -202,6 +202,8 @@ static bool init_subdec(struct MPContext *mpctx, struct track *track)
     if (!track->d_sub)
         return false;
 
+    sub_set_wakeup_cb(track->d_sub, mp_wakeup_core_cb, mpctx);
+
     struct track *vtrack = mpctx->current_track[0][STREAM_VIDEO];
     struct mp_codec_params *v_c =
         vtrack && vtrack->stream ? vtrack->stream->codec : NULL;
@@ -128,6 +128,8 @@ void reset_video_state(struct MPContext *mpctx)
 void uninit_video_out(struct MPContext *mpctx)
 {
     uninit_video_chain(mpctx);
+    // A prerolled video decoder uses the VO.
+    cancel_preroll(mpctx);
     if (mpctx->video_out) {
         vo_destroy(mpctx->video_out);
         mpctx->video_out = NULL;
@@ -184,6 +186,10 @@ int init_video_decoder(struct MPContext *mpctx, struct track *track)
     if (track->vo_c)
         parent = track->vo_c->filter->f;
 
+    track->dec = take_preroll_decoder(mpctx, track);
+    if (track->dec)
+        return 1;
+
     track->dec = mp_decoder_wrapper_create(parent, track->stream);
     if (!track->dec)
         goto err_out;
@@ -32,6 +32,7 @@
 #include "common/recorder.h"
 #include "misc/dispatch.h"
 #include "osdep/threads.h"
+#include "video/mp_image.h"
 
 extern const struct sd_functions sd_ass;
 extern const struct sd_functions sd_lavc;
@@ -42,6 +43,29 @@ static const struct sd_functions *const sd_list[] = {
     NULL
 };
 
+// Number of bitmaps rendered ahead of time that are kept around.
+#define PRERENDER_CACHE_SIZE 4
+// Maximum number of pending pre-render requests.
+#define PRERENDER_MAX_JOBS 2
+// How far ahead (in seconds) the start of the next event is pre-rendered.
+#define PRERENDER_LOOKAHEAD 2.0
+// Maximum number of cached packets checked for the next event start.
+#define PRERENDER_MAX_SCAN 16
+
+struct prerender_job {
+    double pts; // subtitle time
+    struct mp_osd_res dim;
+    int format;
+};
+
+struct prerender_entry {
+    int64_t ts; // subtitle time in milliseconds (libass resolution)
+    struct mp_osd_res dim;
+    int format;
+    struct sub_bitmaps *res; // NULL if nothing was visible
+    int64_t render_id;
+};
+
 struct dec_sub {
     mp_mutex lock;
 
@@ -75,6 +99,36 @@ struct dec_sub {
     struct demux_packet **cached_pkts;
     int cached_pkt_pos;
     int num_cached_pkts;
+
+    void (*wakeup_cb)(void *ctx);
+    void *wakeup_ctx;
+
+    // Background worker (--sub-async). All fields are protected by lock.
+    mp_thread worker;
+    mp_cond worker_wakeup;
+    bool worker_running;
+    bool worker_exit;
+
+    bool preload_pending;       // worker should start preloading
+    bool preloading;            // worker is inside the preload loop
+    bool preload_cancel;
+    bool preload_updated;       // packets were decoded since sub_read_packets()
+    double preload_pts;         // pts of the last preloaded packet
+    double preload_wait_pts;    // wake up the player once this is reached
+    struct mp_dispatch_queue *preload_waiter;
+
+    struct prerender_job prerender_jobs[PRERENDER_MAX_JOBS];
+    int num_prerender_jobs;
+    struct prerender_entry prerender_cache[PRERENDER_CACHE_SIZE];
+    int num_prerender_cache;
+    int prerender_cache_next;
+    // Identifies the bitmaps last rendered by the decoder. It only changes if
+    // they are different from the previous ones, so equal bitmaps rendered
+    // for different times (or by different threads) have the same ID.
+    int64_t render_id;
+    bool render_valid;          // render_id can be compared with the next one
+    int64_t returned_render_id; // of the last bitmaps returned to the VO
+    struct mp_image_params video_params;
 };
 
 static void update_subtitle_speed(struct dec_sub *sub)
@@ -134,16 +188,78 @@ static void destroy_cached_pkts(struct dec_sub *sub)
     sub->num_cached_pkts = 0;
 }
 
+// Drop all pre-rendered bitmaps and pending pre-render requests. This must be
+// called whenever the decoder state changes in a way that affects rendering.
+// Called locked.
+static void prerender_flush(struct dec_sub *sub)
+{
+    for (int n = 0; n < sub->num_prerender_cache; n++)
+        TA_FREEP(&sub->prerender_cache[n].res);
+    sub->num_prerender_cache = 0;
+    sub->prerender_cache_next = 0;
+    sub->num_prerender_jobs = 0;
+    sub->render_valid = false;
+}
+
+// Render with the decoder, and update render_id. Called locked.
+static struct sub_bitmaps *render_bitmaps(struct dec_sub *sub,
+                                          struct mp_osd_res dim, int format,
+                                          double pts)
+{
+    struct sub_bitmaps *res =
+        sub->sd->driver->get_bitmaps(sub->sd, dim, format, pts);
+    // change_id is relative to whatever the decoder rendered before.
+    if (!res || res->change_id || !sub->render_valid)
+        sub->render_id++;
+    sub->render_valid = !!res;
+    return res;
+}
+
+// Make the worker leave the preload loop, and wait until it did.
+// Called locked.
+static void preload_cancel(struct dec_sub *sub)
+{
+    if (!sub->preload_pending && !sub->preloading)
+        return;
+    sub->preload_cancel = true;
+    sub->preload_pending = false;
+    while (sub->preloading) {
+        mp_dispatch_interrupt(sub->preload_waiter);
+        mp_cond_wait(&sub->worker_wakeup, &sub->lock);
+    }
+    sub->preload_cancel = false;
+    // Allow the player to restart preloading.
+    sub->preload_attempted = false;
+}
+
+static void stop_worker(struct dec_sub *sub)
+{
+    mp_mutex_lock(&sub->lock);
+    bool running = sub->worker_running;
+    if (running) {
+        preload_cancel(sub);
+        sub->worker_exit = true;
+        mp_cond_broadcast(&sub->worker_wakeup);
+    }
+    mp_mutex_unlock(&sub->lock);
+    if (running)
+        mp_thread_join(sub->worker);
+    sub->worker_running = false;
+}
+
 void sub_destroy(struct dec_sub *sub)
 {
     if (!sub)
         return;
+    stop_worker(sub);
     demux_set_stream_wakeup_cb(sub->sh, NULL, NULL);
     if (sub->sd) {
         sub_reset(sub);
         sub->sd->driver->uninit(sub->sd);
     }
     talloc_free(sub->sd);
+    prerender_flush(sub);
+    mp_cond_destroy(&sub->worker_wakeup);
     mp_mutex_destroy(&sub->lock);
     talloc_free(sub);
 }
@@ -205,6 +321,7 @@ struct dec_sub *sub_create(struct mpv_global *global, struct track *track,
     sub->opts = sub->opts_cache->opts;
     sub->shared_opts = sub->shared_opts_cache->opts;
     mp_mutex_init(&sub->lock);
+    mp_cond_init(&sub->worker_wakeup);
 
     sub->sd = init_decoder(sub);
     if (sub->sd) {
@@ -229,6 +346,7 @@ static void update_segment(struct dec_sub *sub)
         sub->start = sub->new_segment->start;
         sub->end = sub->new_segment->end;
         struct sd *new = init_decoder(sub);
+        prerender_flush(sub);
         if (new) {
             sub->sd->driver->uninit(sub->sd);
             talloc_free(sub->sd);
@@ -254,29 +372,141 @@ bool sub_can_preload(struct dec_sub *sub)
     return r;
 }
 
-void sub_preload(struct dec_sub *sub)
+// Read and decode all packets of the stream. Called locked; with the
+// asynchronous worker, the lock is released while waiting for the demuxer.
+static void preload_packets(struct dec_sub *sub,
+                            struct mp_dispatch_queue *demux_waiter, bool async)
 {
-    mp_mutex_lock(&sub->lock);
-
-    struct mp_dispatch_queue *demux_waiter = mp_dispatch_create(NULL);
     demux_set_stream_wakeup_cb(sub->sh, wakeup_demux, demux_waiter);
 
-    sub->preload_attempted = true;
-
-    for (;;) {
+    while (!sub->preload_cancel) {
         struct demux_packet *pkt = NULL;
         int r = demux_read_packet_async(sub->sh, &pkt);
         if (r == 0) {
+            if (async)
+                mp_mutex_unlock(&sub->lock);
             mp_dispatch_queue_process(demux_waiter, INFINITY);
+            if (async)
+                mp_mutex_lock(&sub->lock);
             continue;
         }
         if (!pkt)
             break;
         sub->sd->driver->decode(sub->sd, pkt);
         MP_TARRAY_APPEND(sub, sub->cached_pkts, sub->num_cached_pkts, pkt);
+        if (async) {
+            sub->preload_updated = true;
+            prerender_flush(sub);
+            if (pkt->pts != MP_NOPTS_VALUE)
+                sub->preload_pts = MPMAX(sub->preload_pts, pkt->pts);
+            if (sub->preload_wait_pts != MP_NOPTS_VALUE &&
+                sub->preload_pts > sub->preload_wait_pts)
+            {
+                sub->preload_wait_pts = MP_NOPTS_VALUE;
+                if (sub->wakeup_cb)
+                    sub->wakeup_cb(sub->wakeup_ctx);
+            }
+        }
     }
 
     demux_set_stream_wakeup_cb(sub->sh, NULL, NULL);
+}
+
+static void run_prerender_job(struct dec_sub *sub, struct prerender_job *job)
+{
+    int64_t ts = llrint(job->pts * 1000);
+    for (int n = 0; n < sub->num_prerender_cache; n++) {
+        struct prerender_entry *e = &sub->prerender_cache[n];
+        if (e->ts == ts && e->format == job->format && osd_res_equals(e->dim, job->dim))
+            return;
+    }
+
+    struct sub_bitmaps *res = NULL;
+    if (!(sub->end != MP_NOPTS_VALUE && job->pts >= sub->end))
+        res = render_bitmaps(sub, job->dim, job->format, job->pts);
+
+    struct prerender_entry *e = &sub->prerender_cache[sub->prerender_cache_next];
+    if (sub->prerender_cache_next == sub->num_prerender_cache) {
+        sub->num_prerender_cache++;
+    } else {
+        talloc_free(e->res);
+    }
+    *e = (struct prerender_entry){
+        .ts = ts,
+        .dim = job->dim,
+        .format = job->format,
+        .res = talloc_steal(sub, res),
+        .render_id = sub->render_id,
+    };
+    sub->prerender_cache_next = (sub->prerender_cache_next + 1) % PRERENDER_CACHE_SIZE;
+}
+
+static MP_THREAD_VOID sub_worker(void *arg)
+{
+    struct dec_sub *sub = arg;
+    mp_thread_set_name("sub");
+
+    mp_mutex_lock(&sub->lock);
+    while (!sub->worker_exit) {
+        if (sub->preload_pending) {
+            sub->preload_pending = false;
+            sub->preloading = true;
+            preload_packets(sub, sub->preload_waiter, true);
+            sub->preloading = false;
+            sub->preload_updated = true;
+            sub->preload_wait_pts = MP_NOPTS_VALUE;
+            mp_cond_broadcast(&sub->worker_wakeup);
+            if (sub->wakeup_cb)
+                sub->wakeup_cb(sub->wakeup_ctx);
+            continue;
+        }
+        if (sub->num_prerender_jobs) {
+            struct prerender_job job = sub->prerender_jobs[0];
+            MP_TARRAY_REMOVE_AT(sub->prerender_jobs, sub->num_prerender_jobs, 0);
+            run_prerender_job(sub, &job);
+            continue;
+        }
+        mp_cond_wait(&sub->worker_wakeup, &sub->lock);
+    }
+    mp_mutex_unlock(&sub->lock);
+
+    MP_THREAD_RETURN();
+}
+
+// Called locked.
+static bool start_worker(struct dec_sub *sub)
+{
+    if (sub->worker_running)
+        return true;
+    if (!sub->preload_waiter)
+        sub->preload_waiter = mp_dispatch_create(sub);
+    sub->worker_exit = false;
+    if (mp_thread_create(&sub->worker, sub_worker, sub)) {
+        MP_ERR(sub, "Failed to start subtitle worker thread.\n");
+        return false;
+    }
+    sub->worker_running = true;
+    return true;
+}
+
+void sub_preload(struct dec_sub *sub)
+{
+    mp_mutex_lock(&sub->lock);
+
+    sub->preload_attempted = true;
+
+    if (sub->opts->sub_async && start_worker(sub)) {
+        sub->preload_pending = true;
+        sub->preload_updated = false;
+        sub->preload_pts = MP_NOPTS_VALUE;
+        sub->preload_wait_pts = MP_NOPTS_VALUE;
+        mp_cond_broadcast(&sub->worker_wakeup);
+        mp_mutex_unlock(&sub->lock);
+        return;
+    }
+
+    struct mp_dispatch_queue *demux_waiter = mp_dispatch_create(NULL);
+    preload_packets(sub, demux_waiter, false);
     talloc_free(demux_waiter);
 
     mp_mutex_unlock(&sub->lock);
@@ -335,6 +565,20 @@ void sub_read_packets(struct dec_sub *sub, double video_pts, bool force,
     *packets_read = true;
     mp_mutex_lock(&sub->lock);
     video_pts = pts_to_subtitle(sub, video_pts);
+    if (sub->preload_pending || sub->preloading) {
+        // The worker is reading all packets; wait only until it is past the
+        // current position.
+        if (sub->wakeup_cb && (sub->preload_pts == MP_NOPTS_VALUE ||
+                               sub->preload_pts <= video_pts))
+        {
+            *packets_read = false;
+            sub->preload_wait_pts = video_pts;
+        }
+        *sub_updated = sub->preload_updated;
+        sub->preload_updated = false;
+        mp_mutex_unlock(&sub->lock);
+        return;
+    }
     while (1) {
         bool read_more = true;
         if (sub->sd->driver->accepts_packet)
@@ -381,14 +625,20 @@ void sub_read_packets(struct dec_sub *sub, double video_pts, bool force,
             break;
         }
 
-        if (!(sub->preload_attempted && sub->sd->preload_ok))
+        if (!(sub->preload_attempted && sub->sd->preload_ok)) {
+            prerender_flush(sub);
             sub->sd->driver->decode(sub->sd, pkt);
+        }
     }
     if (sub->cached_pkts && sub->num_cached_pkts) {
         bool visible = is_packet_visible(sub->cached_pkts[sub->cached_pkt_pos], video_pts);
         *sub_updated = update_pkt_cache(sub, video_pts) || sub->sub_visible != visible;
         sub->sub_visible = visible;
     }
+    if (sub->preload_updated) {
+        *sub_updated = true;
+        sub->preload_updated = false;
+    }
     mp_mutex_unlock(&sub->lock);
 }
 
@@ -397,6 +647,7 @@ void sub_read_packets(struct dec_sub *sub, double video_pts, bool force,
 void sub_redecode_cached_packets(struct dec_sub *sub)
 {
     mp_mutex_lock(&sub->lock);
+    prerender_flush(sub);
     int index = sub->cached_pkt_pos;
     while (index < sub->num_cached_pkts) {
         sub->sd->driver->decode(sub->sd, sub->cached_pkts[index]);
@@ -405,6 +656,55 @@ void sub_redecode_cached_packets(struct dec_sub *sub)
     mp_mutex_unlock(&sub->lock);
 }
 
+// Return a pre-rendered result in *out if there is one, and its render_id in
+// *out_id. Called locked.
+static bool prerender_lookup(struct dec_sub *sub, struct mp_osd_res dim,
+                             int format, double pts, struct sub_bitmaps **out,
+                             int64_t *out_id)
+{
+    int64_t ts = llrint(pts * 1000);
+    for (int n = 0; n < sub->num_prerender_cache; n++) {
+        struct prerender_entry *e = &sub->prerender_cache[n];
+        if (e->ts == ts && e->format == format && osd_res_equals(e->dim, dim)) {
+            // Only a new reference to the packed bitmaps.
+            *out = e->res ? sub_bitmaps_copy(NULL, e->res) : NULL;
+            *out_id = e->render_id;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Ask the worker to render the next video frame and the start of the next
+// event ahead of time. The latter mostly serves to warm up libass caches at
+// sign transitions, whose exact frame pts is not known. Called locked.
+static void prerender_queue(struct dec_sub *sub, struct mp_osd_res dim,
+                            int format, double pts)
+{
+    if (pts == MP_NOPTS_VALUE || sub->play_dir != 1 || sub->video_fps <= 0 ||
+        !start_worker(sub))
+        return;
+
+    double next_pts = pts + 1.0 / (sub->video_fps * sub->sub_speed);
+    sub->num_prerender_jobs = 0;
+    sub->prerender_jobs[sub->num_prerender_jobs++] =
+        (struct prerender_job){next_pts, dim, format};
+
+    int end = MPMIN(sub->num_cached_pkts, sub->cached_pkt_pos + PRERENDER_MAX_SCAN);
+    for (int n = sub->cached_pkt_pos; n < end; n++) {
+        struct demux_packet *pkt = sub->cached_pkts[n];
+        if (!pkt || pkt->pts == MP_NOPTS_VALUE || pkt->pts <= next_pts)
+            continue;
+        if (pkt->pts < pts + PRERENDER_LOOKAHEAD) {
+            sub->prerender_jobs[sub->num_prerender_jobs++] =
+                (struct prerender_job){pkt->pts, dim, format};
+        }
+        break;
+    }
+
+    mp_cond_broadcast(&sub->worker_wakeup);
+}
+
 // Unref sub_bitmaps.rc to free the result. May return NULL.
 struct sub_bitmaps *sub_get_bitmaps(struct dec_sub *sub, struct mp_osd_res dim,
                                     int format, double pts)
@@ -420,7 +720,21 @@ struct sub_bitmaps *sub_get_bitmaps(struct dec_sub *sub, struct mp_osd_res dim,
 
     if (!(sub->end != MP_NOPTS_VALUE && pts >= sub->end) &&
         sub->sd->driver->get_bitmaps)
-        res = sub->sd->driver->get_bitmaps(sub->sd, dim, format, pts);
+    {
+        bool prerender = sub->opts->sub_async && sub->sd->driver == &sd_ass;
+        int64_t id;
+        if (!(prerender && prerender_lookup(sub, dim, format, pts, &res, &id))) {
+            res = render_bitmaps(sub, dim, format, pts);
+            id = sub->render_id;
+        }
+        // The decoder's change_id is relative to its last render, which the
+        // VO might not have seen, so compare render IDs instead.
+        if (res)
+            res->change_id = id != sub->returned_render_id;
+        sub->returned_render_id = id;
+        if (prerender)
+            prerender_queue(sub, dim, format, pts);
+    }
 
     mp_mutex_unlock(&sub->lock);
     return res;
@@ -477,6 +791,8 @@ struct sd_times sub_get_times(struct dec_sub *sub, double pts)
 void sub_reset(struct dec_sub *sub)
 {
     mp_mutex_lock(&sub->lock);
+    preload_cancel(sub);
+    prerender_flush(sub);
     if (sub->sd->driver->reset)
         sub->sd->driver->reset(sub->sd);
     sub->last_pkt_pts = MP_NOPTS_VALUE;
@@ -500,6 +816,15 @@ int sub_control(struct dec_sub *sub, enum sd_ctrl cmd, void *arg)
     mp_mutex_lock(&sub->lock);
     bool propagate = false;
     switch (cmd) {
+    case SD_CTRL_SET_VIDEO_PARAMS: {
+        struct mp_image_params *params = arg;
+        if (!mp_image_params_equal(&sub->video_params, params)) {
+            sub->video_params = *params;
+            prerender_flush(sub);
+        }
+        propagate = true;
+        break;
+    }
     case SD_CTRL_SET_VIDEO_DEF_FPS:
         sub->video_fps = *(double *)arg;
         update_subtitle_speed(sub);
@@ -507,6 +832,7 @@ int sub_control(struct dec_sub *sub, enum sd_ctrl cmd, void *arg)
     case SD_CTRL_SUB_STEP: {
         double *a = arg;
         double arg2[2] = {a[0], a[1]};
+        prerender_flush(sub);
         arg2[0] = pts_to_subtitle(sub, arg2[0]);
         if (sub->sd->driver->control)
             r = sub->sd->driver->control(sub->sd, cmd, arg2);
@@ -516,6 +842,7 @@ int sub_control(struct dec_sub *sub, enum sd_ctrl cmd, void *arg)
     }
     case SD_CTRL_UPDATE_OPTS: {
         int flags = (uintptr_t)arg;
+        prerender_flush(sub);
         if (m_config_cache_update(sub->opts_cache))
             update_subtitle_speed(sub);
         m_config_cache_update(sub->shared_opts_cache);
@@ -544,6 +871,16 @@ void sub_set_recorder_sink(struct dec_sub *sub, struct mp_recorder_sink *sink)
     mp_mutex_unlock(&sub->lock);
 }
 
+// The callback is invoked from the worker thread when asynchronously
+// preloaded packets become available.
+void sub_set_wakeup_cb(struct dec_sub *sub, void (*cb)(void *ctx), void *ctx)
+{
+    mp_mutex_lock(&sub->lock);
+    sub->wakeup_cb = cb;
+    sub->wakeup_ctx = ctx;
+    mp_mutex_unlock(&sub->lock);
+}
+
 void sub_set_play_dir(struct dec_sub *sub, int dir)
 {
     mp_mutex_lock(&sub->lock);
@@ -55,6 +55,7 @@ struct sd_times sub_get_times(struct dec_sub *sub, double pts);
 void sub_reset(struct dec_sub *sub);
 void sub_select(struct dec_sub *sub, bool selected);
 void sub_set_recorder_sink(struct dec_sub *sub, struct mp_recorder_sink *sink);
+void sub_set_wakeup_cb(struct dec_sub *sub, void (*cb)(void *ctx), void *ctx);
 void sub_set_play_dir(struct dec_sub *sub, int dir);
 bool sub_is_primary_visible(struct dec_sub *sub);
 bool sub_is_secondary_visible(struct dec_sub *sub);
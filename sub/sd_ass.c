@@ -37,6 +37,7 @@
 #include "dec_sub.h"
 #include "ass_mp.h"
 #include "sd.h"
+#include "seen_packets.h"
 
 struct sd_ass_priv {
     struct ass_library *ass_library;
@@ -55,18 +56,12 @@ struct sd_ass_priv {
     struct mp_image_params video_params;
     struct mp_image_params last_params;
     struct mp_osd_res osd;
-    struct seen_packet *seen_packets;
-    int num_seen_packets;
+    struct seen_packets *seen_packets;
     int *packets_animated;
     int num_packets_animated;
     bool check_animated;
 };
 
-struct seen_packet {
-    int64_t pos;
-    double pts;
-};
-
 #undef OPT_BASE_STRUCT
 #define OPT_BASE_STRUCT struct mp_sub_filter_opts
 
@@ -292,6 +287,7 @@ static int init(struct sd *sd)
 {
     struct sd_ass_priv *ctx = talloc_zero(sd, struct sd_ass_priv);
     sd->priv = ctx;
+    ctx->seen_packets = seen_packets_create(ctx);
 
     // Note: accept "null" as alias for "ass", so EDL delay_open subtitle
     //       streams work.
@@ -389,7 +385,7 @@ static void filter_and_add(struct sd *sd, struct demux_packet *pkt)
                 if (ctx->check_animated && pkt->animated != 1)
                     pkt->animated = is_animated(event->Text);
             }
-            MP_TARRAY_APPEND(ctx, ctx->packets_animated, ctx->num_packets_animated, pkt->animated);
+            ctx->packets_animated[pkt->seen_pos] = pkt->animated;
         } else {
             if (ctx->check_animated && ctx->packets_animated[pkt->seen_pos] == -1) {
                 for (int n = track->n_events - 1; n >= 0; n--) {
@@ -409,31 +405,23 @@ static void filter_and_add(struct sd *sd, struct demux_packet *pkt)
         talloc_free(pkt);
 }
 
+static void clear_seen_packets(struct sd_ass_priv *priv)
+{
+    seen_packets_clear(priv->seen_packets);
+    priv->num_packets_animated = 0;
+}
+
 // Test if the packet with the given file position and pts was already consumed.
 // Return false if the packet is new (and add it to the internal list), and
-// return true if it was already seen.
+// return true if it was already seen. packet->seen_pos is set to the index
+// of the packet in the order it was first seen.
 static bool check_packet_seen(struct sd *sd, struct demux_packet *packet)
 {
     struct sd_ass_priv *priv = sd->priv;
-    int a = 0;
-    int b = priv->num_seen_packets;
-    while (a < b) {
-        int mid = a + (b - a) / 2;
-        struct seen_packet *seen_packet = &priv->seen_packets[mid];
-        if (packet->pos == seen_packet->pos && packet->pts == seen_packet->pts) {
-            packet->seen_pos = mid;
-            return true;
-        }
-        if (packet->pos > seen_packet->pos ||
-            (packet->pos == seen_packet->pos && packet->pts > seen_packet->pts)) {
-            a = mid + 1;
-        } else {
-            b = mid;
-        }
-    }
-    packet->seen_pos = a;
-    MP_TARRAY_INSERT_AT(priv, priv->seen_packets, priv->num_seen_packets, a,
-                        (struct seen_packet){packet->pos, packet->pts});
+    if (seen_packets_add(priv->seen_packets, packet->pos, packet->pts,
+                         &packet->seen_pos))
+        return true;
+    MP_TARRAY_APPEND(priv, priv->packets_animated, priv->num_packets_animated, -1);
     return false;
 }
 
@@ -979,7 +967,7 @@ static void reset(struct sd *sd)
     struct sd_ass_priv *ctx = sd->priv;
     if (sd->opts->sub_clear_on_seek || ctx->clear_once) {
         ass_flush_events(ctx->ass_track);
-        ctx->num_seen_packets = 0;
+        clear_seen_packets(ctx);
         sd->preload_ok = false;
         ctx->clear_once = false;
     }
@@ -0,0 +1,110 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "common/common.h"
+#include "mpv_talloc.h"
+#include "seen_packets.h"
+
+struct seen_packet {
+    int64_t pos;
+    double pts;
+};
+
+struct seen_packets {
+    struct seen_packet *packets;    // in the order they were added
+    int num_packets;
+    int *hash;                      // 1-based indexes into packets, 0 if empty
+    int hash_size;                  // power of 2, or 0
+};
+
+static unsigned int hash_packet(int64_t pos, double pts)
+{
+    uint64_t bits = 0;
+    if (pts != 0) // -0.0 and 0.0 compare equal, so they must hash equally
+        memcpy(&bits, &pts, sizeof(bits));
+    uint64_t h = (uint64_t)pos * 0x9E3779B97F4A7C15ULL;
+    h ^= bits + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return (unsigned int)h;
+}
+
+static void hash_insert(struct seen_packets *s, int index)
+{
+    struct seen_packet *p = &s->packets[index];
+    unsigned int mask = s->hash_size - 1;
+    unsigned int slot = hash_packet(p->pos, p->pts) & mask;
+    while (s->hash[slot])
+        slot = (slot + 1) & mask;
+    s->hash[slot] = index + 1;
+}
+
+static void hash_rebuild(struct seen_packets *s, int size)
+{
+    talloc_free(s->hash);
+    s->hash = talloc_zero_array(s, int, size);
+    s->hash_size = size;
+    for (int n = 0; n < s->num_packets; n++)
+        hash_insert(s, n);
+}
+
+struct seen_packets *seen_packets_create(void *ta_parent)
+{
+    return talloc_zero(ta_parent, struct seen_packets);
+}
+
+bool seen_packets_add(struct seen_packets *s, int64_t pos, double pts,
+                      int *index)
+{
+    if (s->hash_size) {
+        unsigned int mask = s->hash_size - 1;
+        unsigned int slot = hash_packet(pos, pts) & mask;
+        while (s->hash[slot]) {
+            int n = s->hash[slot] - 1;
+            if (s->packets[n].pos == pos && s->packets[n].pts == pts) {
+                *index = n;
+                return true;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+    *index = s->num_packets;
+    MP_TARRAY_APPEND(s, s->packets, s->num_packets,
+                     (struct seen_packet){pos, pts});
+    // Keep the load factor at or below 1/2.
+    if (s->num_packets * 2 > s->hash_size) {
+        hash_rebuild(s, MPMAX(s->hash_size * 2, 64));
+    } else {
+        hash_insert(s, *index);
+    }
+    return false;
+}
+
+int seen_packets_count(struct seen_packets *s)
+{
+    return s->num_packets;
+}
+
+void seen_packets_clear(struct seen_packets *s)
+{
+    s->num_packets = 0;
+    if (s->hash)
+        memset(s->hash, 0, s->hash_size * sizeof(s->hash[0]));
+}
@@ -0,0 +1,38 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The set of subtitle packets that were already decoded, identified by their
+// file position and pts. Packets are numbered in the order they were first
+// added. Lookups and insertions are amortized O(1).
+struct seen_packets;
+
+struct seen_packets *seen_packets_create(void *ta_parent);
+
+// Add the packet to the set, unless it is already in it. *index is set to the
+// number of the packet. Returns true if the packet was already in the set.
+bool seen_packets_add(struct seen_packets *s, int64_t pos, double pts,
+                      int *index);
+
+// Number of packets in the set. Packet numbers are below this.
+int seen_packets_count(struct seen_packets *s);
+
+void seen_packets_clear(struct seen_packets *s);
@@ -14,6 +14,7 @@
  */
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,6 +23,10 @@
 #define TA_NO_WRAPPERS
 #include "ta.h"
 
+// Set in ta_header.size_flags if the header is preceded by a struct
+// arena_link. The other bits are the size of the user allocation.
+#define HAS_LINK ((size_t)1 << (sizeof(size_t) * 8 - 1))
+
 #if !defined(TA_MEMORY_DEBUGGING)
     #if !defined(NDEBUG)
         #define TA_MEMORY_DEBUGGING 1
@@ -31,7 +36,7 @@
 #endif
 
 struct ta_header {
-    size_t size;                // size of the user allocation
+    size_t size_flags;          // size of the user allocation | HAS_LINK
     // Invariant: parent!=NULL => prev==NULL
     struct ta_header *prev;     // siblings list (by destructor order)
     struct ta_header *next;
@@ -63,7 +68,52 @@ union aligned_header {
 #define PTR_TO_HEADER(ptr) (&((union aligned_header *)(ptr) - 1)->ta)
 #define PTR_FROM_HEADER(h) ((void *)((union aligned_header *)(h) + 1))
 
-#define MAX_ALLOC (((size_t)-1) - sizeof(union aligned_header))
+// Arena state of an allocation. To keep ta_header small, this is stored in
+// front of the header, and only for allocations related to an arena.
+struct arena_link {
+    struct ta_arena *arena;
+    unsigned char flags;        // ARENA_* flags
+};
+
+union aligned_link {
+    struct arena_link l;
+    char align_min[(sizeof(struct arena_link) + MIN_ALIGN - 1) & ~(MIN_ALIGN - 1)];
+};
+
+#define LINK_FROM_HEADER(h) (&((union aligned_link *)(h) - 1)->l)
+#define HEADER_FROM_LINK(l) ((struct ta_header *)((union aligned_link *)(l) + 1))
+
+#define MAX_ALLOC (((size_t)-1 >> 1) - sizeof(union aligned_link) - \
+                   sizeof(union aligned_header) - MIN_ALIGN)
+
+// Memory of the allocation (header included) is part of the arena.
+#define ARENA_MEM       1
+// Children are allocated from the arena. Set on the arena context itself, and
+// on allocations from the arena which are (indirectly) its children.
+#define ARENA_CHILDREN  2
+// The allocation keeps the arena alive. Set on the arena context itself, and
+// on allocations from the arena which were moved out of the arena context.
+#define ARENA_REF       4
+
+// Arena chunks start with this size, and grow up to ARENA_CHUNK_MAX.
+#define ARENA_CHUNK_MIN (4 * 1024)
+#define ARENA_CHUNK_MAX (64 * 1024)
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;                // usable size
+    union aligned_header data[];
+};
+
+struct ta_arena {
+    atomic_int refs;
+    // Only accessed by allocations with ARENA_CHILDREN set, i.e. the tree of
+    // the arena context, which has the same thread-safety rules as all TA
+    // trees. Allocations moved out of it never access these fields.
+    struct arena_chunk *chunks; // list of all chunks (current one first)
+    char *cur, *end;            // free space in the current chunk
+    struct ta_arena_stats stats;
+};
 
 static void ta_dbg_add(struct ta_header *h);
 static void ta_dbg_check_header(struct ta_header *h);
@@ -76,21 +126,148 @@ static struct ta_header *get_header(void *ptr)
     return h;
 }
 
-/* Set the parent allocation of ptr. If parent==NULL, remove the parent.
- * Setting parent==NULL (with ptr!=NULL) unsets the parent of ptr.
- * With ptr==NULL, the function does nothing.
- *
- * Warning: if ta_parent is a direct or indirect child of ptr, things will go
- *          wrong. The function will apparently succeed, but creates circular
- *          parent links, which are not allowed.
- */
-void ta_set_parent(void *ptr, void *ta_parent)
+static size_t header_size(struct ta_header *h)
 {
-    struct ta_header *ch = get_header(ptr);
-    if (!ch)
+    return h->size_flags & ~HAS_LINK;
+}
+
+static void set_header_size(struct ta_header *h, size_t size)
+{
+    h->size_flags = (h->size_flags & HAS_LINK) | size;
+}
+
+static bool has_link(struct ta_header *h)
+{
+    return h->size_flags & HAS_LINK;
+}
+
+static int arena_flags(struct ta_header *h)
+{
+    return has_link(h) ? LINK_FROM_HEADER(h)->flags : 0;
+}
+
+// Start of the memory block h was allocated in.
+static void *header_block(struct ta_header *h)
+{
+    return has_link(h) ? (void *)LINK_FROM_HEADER(h) : (void *)h;
+}
+
+// Size of an arena allocation, including the link and the header.
+static size_t arena_size(size_t size)
+{
+    size_t a = MIN_ALIGN - 1;
+    return (sizeof(union aligned_link) + sizeof(union aligned_header) + size + a)
+           & ~a;
+}
+
+static struct arena_chunk *arena_new_chunk(struct ta_arena *a, size_t size)
+{
+    struct arena_chunk *c = malloc(sizeof(*c) + size);
+    if (!c)
+        return NULL;
+    c->size = size;
+    a->stats.chunks += 1;
+    a->stats.bytes += size;
+    return c;
+}
+
+// Allocate memory for a header and size bytes of user data.
+static struct ta_header *arena_alloc(struct ta_arena *a, size_t size)
+{
+    size_t need = arena_size(size);
+    char *ptr;
+    if (need <= (size_t)(a->end - a->cur)) {
+        ptr = a->cur;
+        a->cur += need;
+    } else if (need > ARENA_CHUNK_MAX / 4) {
+        // Large allocations get their own chunk, so that the free space in the
+        // current chunk can still be used.
+        struct arena_chunk *c = arena_new_chunk(a, need);
+        if (!c)
+            return NULL;
+        if (a->chunks) {
+            c->next = a->chunks->next;
+            a->chunks->next = c;
+        } else {
+            c->next = NULL;
+            a->chunks = c;
+        }
+        ptr = (char *)c->data;
+    } else {
+        size_t chunk_size = a->chunks ? a->chunks->size * 2 : ARENA_CHUNK_MIN;
+        while (chunk_size < need)
+            chunk_size *= 2;
+        if (chunk_size > ARENA_CHUNK_MAX)
+            chunk_size = ARENA_CHUNK_MAX;
+        struct arena_chunk *c = arena_new_chunk(a, chunk_size);
+        if (!c)
+            return NULL;
+        c->next = a->chunks;
+        a->chunks = c;
+        ptr = (char *)c->data;
+        a->cur = ptr + need;
+        a->end = ptr + chunk_size;
+    }
+    a->stats.allocs += 1;
+    return HEADER_FROM_LINK(ptr);
+}
+
+// Try to resize the most recent allocation in place.
+static bool arena_resize(struct ta_arena *a, struct ta_header *h, size_t size)
+{
+    char *start = header_block(h);
+    char *end = start + arena_size(header_size(h));
+    size_t need = arena_size(size);
+    if (end != a->cur || need - arena_size(header_size(h)) > (size_t)(a->end - a->cur))
+        return false;
+    a->cur = start + need;
+    return true;
+}
+
+static void arena_unref(struct ta_arena *a)
+{
+    if (atomic_fetch_add(&a->refs, -1) > 1)
         return;
-    struct ta_header *new_parent = get_header(ta_parent);
-    // Unlink from previous parent
+    struct arena_chunk *c = a->chunks;
+    while (c) {
+        struct arena_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    free(a);
+}
+
+// Called if h is moved out of the arena context, or out of the allocation
+// which kept the arena alive so far.
+static void arena_escape(struct ta_header *h)
+{
+    struct arena_link *l = LINK_FROM_HEADER(h);
+    if (!(l->flags & ARENA_REF)) {
+        atomic_fetch_add(&l->arena->refs, 1);
+        l->flags |= ARENA_REF;
+    }
+    // Nothing in this sub-tree must allocate from the arena anymore, because
+    // it can be used independently (and concurrently) from the arena context.
+    struct ta_header *stack[64];
+    int num = 0;
+    stack[num++] = h;
+    while (num) {
+        struct ta_header *cur = stack[--num];
+        LINK_FROM_HEADER(cur)->flags &= ~ARENA_CHILDREN;
+        for (struct ta_header *c = cur->child; c; c = c->next) {
+            if (!(arena_flags(c) & ARENA_CHILDREN))
+                continue;
+            if (num < 64) {
+                stack[num++] = c;
+            } else {
+                arena_escape(c);
+            }
+        }
+    }
+}
+
+static void unlink_header(struct ta_header *ch)
+{
     if (ch->prev)
         ch->prev->next = ch->next;
     if (ch->next)
@@ -105,6 +282,45 @@ void ta_set_parent(void *ptr, void *ta_parent)
         }
     }
     ch->next = ch->prev = ch->parent = NULL;
+}
+
+// Update all links to h after it was moved in memory.
+static void relink_header(struct ta_header *h)
+{
+    // Relink parent
+    if (h->parent)
+        h->parent->child = h;
+    // Relink siblings
+    if (h->next)
+        h->next->prev = h;
+    if (h->prev)
+        h->prev->next = h;
+    // Relink children
+    if (h->child)
+        h->child->parent = h;
+}
+
+/* Set the parent allocation of ptr. If parent==NULL, remove the parent.
+ * Setting parent==NULL (with ptr!=NULL) unsets the parent of ptr.
+ * With ptr==NULL, the function does nothing.
+ *
+ * Warning: if ta_parent is a direct or indirect child of ptr, things will go
+ *          wrong. The function will apparently succeed, but creates circular
+ *          parent links, which are not allowed.
+ */
+void ta_set_parent(void *ptr, void *ta_parent)
+{
+    struct ta_header *ch = get_header(ptr);
+    if (!ch)
+        return;
+    struct ta_header *new_parent = get_header(ta_parent);
+    // Memory from an arena must stay valid as long as ch lives.
+    if ((arena_flags(ch) & ARENA_MEM) &&
+        !(new_parent && (arena_flags(new_parent) & ARENA_CHILDREN) &&
+          LINK_FROM_HEADER(new_parent)->arena == LINK_FROM_HEADER(ch)->arena))
+        arena_escape(ch);
+    // Unlink from previous parent
+    unlink_header(ch);
     // Link to new parent - insert at start of list (LIFO destructor order)
     if (new_parent) {
         ch->next = new_parent->child;
@@ -136,10 +352,24 @@ void *ta_alloc_size(void *ta_parent, size_t size)
 {
     if (size >= MAX_ALLOC)
         return NULL;
-    struct ta_header *h = malloc(sizeof(union aligned_header) + size);
-    if (!h)
-        return NULL;
-    *h = (struct ta_header) {.size = size};
+    struct ta_header *parent = get_header(ta_parent);
+    struct ta_header *h;
+    if (parent && (arena_flags(parent) & ARENA_CHILDREN)) {
+        struct ta_arena *a = LINK_FROM_HEADER(parent)->arena;
+        h = arena_alloc(a, size);
+        if (!h)
+            return NULL;
+        *h = (struct ta_header) {.size_flags = size | HAS_LINK};
+        *LINK_FROM_HEADER(h) = (struct arena_link) {
+            .arena = a,
+            .flags = ARENA_MEM | ARENA_CHILDREN,
+        };
+    } else {
+        h = malloc(sizeof(union aligned_header) + size);
+        if (!h)
+            return NULL;
+        *h = (struct ta_header) {.size_flags = size};
+    }
     ta_dbg_add(h);
     void *ptr = PTR_FROM_HEADER(h);
     ta_set_parent(ptr, ta_parent);
@@ -153,16 +383,72 @@ void *ta_zalloc_size(void *ta_parent, size_t size)
 {
     if (size >= MAX_ALLOC)
         return NULL;
+    struct ta_header *parent = get_header(ta_parent);
+    if (parent && (arena_flags(parent) & ARENA_CHILDREN)) {
+        void *ptr = ta_alloc_size(ta_parent, size);
+        if (ptr)
+            memset(ptr, 0, size);
+        return ptr;
+    }
     struct ta_header *h = calloc(1, sizeof(union aligned_header) + size);
     if (!h)
         return NULL;
-    *h = (struct ta_header) {.size = size};
+    *h = (struct ta_header) {.size_flags = size};
     ta_dbg_add(h);
     void *ptr = PTR_FROM_HEADER(h);
     ta_set_parent(ptr, ta_parent);
     return ptr;
 }
 
+/* Create an empty (size 0) TA allocation like ta_new_context(), which allocates
+ * its children (and their children, recursively) from an arena. The memory is
+ * taken from larger chunks, and is released all at once when the arena context
+ * is freed. Freeing an allocation from the arena runs its destructor and frees
+ * its children as usual, but its memory is not reused.
+ *
+ * This is meant for short-lived trees with many small allocations, such as
+ * temporary data used to handle a single request.
+ *
+ * All TA functions work as usual. Allocations can be moved out of the arena
+ * context with ta_set_parent(); then they (and all other memory of the arena)
+ * stay valid until they are freed, and their new children are allocated
+ * normally. Freeing the children of the arena context with ta_free_children()
+ * makes its memory available for reuse if no such allocations exist.
+ *
+ * Returns NULL on OOM.
+ */
+void *ta_new_arena(void *ta_parent)
+{
+    struct ta_arena *a = calloc(1, sizeof(*a));
+    if (!a)
+        return NULL;
+    atomic_init(&a->refs, 1);
+    union aligned_link *l = malloc(sizeof(*l) + sizeof(union aligned_header));
+    if (!l) {
+        free(a);
+        return NULL;
+    }
+    l->l = (struct arena_link) {.arena = a, .flags = ARENA_CHILDREN | ARENA_REF};
+    struct ta_header *h = HEADER_FROM_LINK(l);
+    *h = (struct ta_header) {.size_flags = HAS_LINK};
+    ta_dbg_add(h);
+    void *ptr = PTR_FROM_HEADER(h);
+    ta_set_parent(ptr, ta_parent);
+    return ptr;
+}
+
+/* Return statistics about the arena used by the given arena context (as
+ * returned by ta_new_arena()). Returns false if ptr is not an arena context.
+ */
+bool ta_get_arena_stats(void *ptr, struct ta_arena_stats *st)
+{
+    struct ta_header *h = get_header(ptr);
+    if (!h || arena_flags(h) != (ARENA_CHILDREN | ARENA_REF))
+        return false;
+    *st = LINK_FROM_HEADER(h)->arena->stats;
+    return true;
+}
+
 /* Reallocate the allocation given by ptr and return a new pointer. Much like
  * realloc(), the returned pointer can be different, and on OOM, NULL is
  * returned.
@@ -187,27 +473,45 @@ void *ta_realloc_size(void *ta_parent, void *ptr, size_t size)
         return ta_alloc_size(ta_parent, size);
     struct ta_header *h = get_header(ptr);
     struct ta_header *old_h = h;
-    if (h->size == size)
+    if (header_size(h) == size)
         return ptr;
-    ta_dbg_remove(h);
-    h = realloc(h, sizeof(union aligned_header) + size);
-    ta_dbg_add(h ? h : old_h);
-    if (!h)
-        return NULL;
-    h->size = size;
-    if (h != old_h) {
-        // Relink parent
-        if (h->parent)
-            h->parent->child = h;
-        // Relink siblings
-        if (h->next)
-            h->next->prev = h;
-        if (h->prev)
-            h->prev->next = h;
-        // Relink children
-        if (h->child)
-            h->child->parent = h;
+    size_t link_size = has_link(h) ? sizeof(union aligned_link) : 0;
+    int flags = arena_flags(h);
+    if (flags & ARENA_MEM) {
+        struct ta_arena *a = LINK_FROM_HEADER(h)->arena;
+        if (size < header_size(h) ||
+            ((flags & ARENA_CHILDREN) && arena_resize(a, h, size)))
+        {
+            set_header_size(h, size);
+            return ptr;
+        }
+        // Allocations which can't access the arena anymore move to malloc().
+        if (flags & ARENA_CHILDREN) {
+            h = arena_alloc(a, size);
+        } else {
+            void *block = malloc(link_size + sizeof(union aligned_header) + size);
+            h = block ? HEADER_FROM_LINK(block) : NULL;
+        }
+        if (!h)
+            return NULL;
+        ta_dbg_remove(old_h);
+        memcpy(LINK_FROM_HEADER(h), LINK_FROM_HEADER(old_h),
+               link_size + sizeof(union aligned_header) + header_size(old_h));
+        if (!(flags & ARENA_CHILDREN))
+            LINK_FROM_HEADER(h)->flags &= ~ARENA_MEM;
+        ta_dbg_add(h);
+    } else {
+        ta_dbg_remove(h);
+        char *block = realloc(header_block(h),
+                              link_size + sizeof(union aligned_header) + size);
+        h = block ? (struct ta_header *)(block + link_size) : NULL;
+        ta_dbg_add(h ? h : old_h);
+        if (!h)
+            return NULL;
     }
+    set_header_size(h, size);
+    if (h != old_h)
+        relink_header(h);
     return PTR_FROM_HEADER(h);
 }
 
@@ -218,7 +522,7 @@ void *ta_realloc_size(void *ta_parent, void *ptr, size_t size)
 size_t ta_get_size(void *ptr)
 {
     struct ta_header *h = get_header(ptr);
-    return h ? h->size : 0;
+    return h ? header_size(h) : 0;
 }
 
 /* Free all allocations that (recursively) have ptr as parent allocation, but
@@ -229,6 +533,24 @@ void ta_free_children(void *ptr)
     struct ta_header *h = get_header(ptr);
     while (h && h->child)
         ta_free(PTR_FROM_HEADER(h->child));
+    // Reuse the arena memory, unless allocations moved out of it still use it.
+    if (h && arena_flags(h) == (ARENA_CHILDREN | ARENA_REF) &&
+        atomic_load(&LINK_FROM_HEADER(h)->arena->refs) == 1)
+    {
+        struct ta_arena *a = LINK_FROM_HEADER(h)->arena;
+        struct arena_chunk *c = a->chunks;
+        while (c && c->next) {
+            struct arena_chunk *next = c->next->next;
+            a->stats.bytes -= c->next->size;
+            free(c->next);
+            c->next = next;
+        }
+        if (c) {
+            a->cur = (char *)c->data;
+            a->end = a->cur + c->size;
+            a->stats.chunks = 1;
+        }
+    }
 }
 
 /* Free the given allocation, and all of its direct and indirect children.
@@ -241,9 +563,15 @@ void ta_free(void *ptr)
     if (h->destructor)
         h->destructor(ptr);
     ta_free_children(ptr);
-    ta_set_parent(ptr, NULL);
+    unlink_header(h);
     ta_dbg_remove(h);
-    free(h);
+    struct arena_link l = {0};
+    if (has_link(h))
+        l = *LINK_FROM_HEADER(h);
+    if (!(l.flags & ARENA_MEM))
+        free(header_block(h));
+    if (l.flags & ARENA_REF)
+        arena_unref(l.arena);
 }
 
 /* Set a destructor that is to be called when the given allocation is freed.
@@ -313,7 +641,7 @@ static size_t get_children_size(struct ta_header *h)
 {
     size_t size = 0;
     for (struct ta_header *s = h->child; s; s = s->next)
-        size += s->size + get_children_size(s);
+        size += header_size(s) + get_children_size(s);
     return size;
 }
 
@@ -336,16 +664,16 @@ static void print_leak_report(void)
                     snprintf(name, sizeof(name), "%s", cur->name);
                 if (cur->name == &allocation_is_string) {
                     snprintf(name, sizeof(name), "'%.*s'",
-                             (int)cur->size, (char *)PTR_FROM_HEADER(cur));
+                             (int)header_size(cur), (char *)PTR_FROM_HEADER(cur));
                 }
                 for (int n = 0; n < sizeof(name); n++) {
                     if (name[n] && name[n] < 0x20)
                         name[n] = '.';
                 }
                 fprintf(stderr, "  %-20p %10zu %10zu  %s\n",
-                        cur, cur->size, c_size, name);
+                        cur, header_size(cur), c_size, name);
             }
-            size += cur->size;
+            size += header_size(cur);
             num_blocks += 1;
             // Unlink, and don't confuse valgrind by leaving live pointers.
             cur->leak_next->leak_prev = cur->leak_prev;
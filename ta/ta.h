@@ -54,6 +54,15 @@ void ta_set_destructor(void *ptr, void (*destructor)(void *));
 void ta_set_parent(void *ptr, void *ta_parent);
 void *ta_get_parent(void *ptr);
 
+// Arenas
+struct ta_arena_stats {
+    size_t allocs;      // number of allocations taken from the arena
+    size_t chunks;      // number of chunks currently allocated with malloc()
+    size_t bytes;       // total size of these chunks
+};
+void *ta_new_arena(void *ta_parent);
+bool ta_get_arena_stats(void *ptr, struct ta_arena_stats *st);
+
 // Utility functions
 size_t ta_calc_array_size(size_t element_size, size_t count);
 size_t ta_calc_prealloc_elems(size_t nextidx);
@@ -117,6 +126,7 @@ bool ta_vasprintf_append_buffer(char **str, const char *fmt, va_list ap) TA_PRF(
 #define ta_xalloc_size(...)             ta_oom_p(ta_alloc_size(__VA_ARGS__))
 #define ta_xzalloc_size(...)            ta_oom_p(ta_zalloc_size(__VA_ARGS__))
 #define ta_xnew_context(...)            ta_oom_p(ta_new_context(__VA_ARGS__))
+#define ta_xnew_arena(...)              ta_oom_p(ta_new_arena(__VA_ARGS__))
 #define ta_xstrdup_append(...)          ta_oom_b(ta_strdup_append(__VA_ARGS__))
 #define ta_xstrdup_append_buffer(...)   ta_oom_b(ta_strdup_append_buffer(__VA_ARGS__))
 #define ta_xstrndup_append(...)         ta_oom_b(ta_strndup_append(__VA_ARGS__))
@@ -0,0 +1,413 @@
+#include "config.h"
+
+#include "common/global.h"
+#include "common/stats.h"
+#include "input/cmd.h"
+#include "input/input.h"
+#include "input/keycodes.h"
+#include "misc/node.h"
+#include "options/m_config_frontend.h"
+#include "options/m_option.h"
+#include "options/path.h"
+#include "osdep/timer.h"
+#include "stream/stream.h"
+#include "test_utils.h"
+
+#define NUM_SECTIONS 20
+#define NUM_BINDS 100
+#define NUM_KEYS 130
+#define AREA_WIDTH 50
+
+// The player's commands are defined in player/command.c.
+#define OPT_BASE_STRUCT struct mp_cmd_arg
+const struct mp_cmd_def mp_cmds[] = {
+    { "ignore", .is_ignore = true },
+    { "script-binding", .args = {
+        {"name", OPT_STRING(v.s)},
+        {"arg", OPT_STRING(v.s), OPTDEF_STR(""), .flags = MP_CMD_OPT_ARG},
+    }},
+    {0}
+};
+
+const struct mp_cmd_def mp_cmd_list = { "list" };
+
+// Referenced by input.c for loading input.conf, which the tests don't use.
+char **mp_find_all_config_files(void *talloc_ctx, struct mpv_global *global,
+                                const char *filename)
+{
+    return NULL;
+}
+
+char *mp_get_user_path(void *talloc_ctx, struct mpv_global *global,
+                       const char *path)
+{
+    return talloc_strdup(talloc_ctx, path);
+}
+
+struct bstr stream_read_file2(const char *filename, void *talloc_ctx,
+                              int flags, struct mpv_global *global, int max_size)
+{
+    return (struct bstr){0};
+}
+
+// Input sources of optional features, which the tests don't use either.
+#if HAVE_SDL2_GAMEPAD
+void mp_input_sdl_gamepad_add(struct input_ctx *ictx)
+{
+}
+#endif
+
+#if HAVE_COCOA
+#include "osdep/mac/app_bridge.h"
+
+void cocoa_init_media_keys(void)
+{
+}
+
+void cocoa_uninit_media_keys(void)
+{
+}
+#endif
+
+extern const struct m_sub_options input_config;
+
+struct test_opts {
+    struct input_opts *input_opts;
+};
+
+#undef OPT_BASE_STRUCT
+#define OPT_BASE_STRUCT struct test_opts
+
+static const struct m_sub_options root = {
+    .opts = (const struct m_option[]) {
+        {"", OPT_SUBSTRUCT(input_opts, input_config)},
+        {0}
+    },
+    .size = sizeof(struct test_opts),
+};
+
+// Number of times the input context woke up the consumer.
+static int wakeups;
+
+static void wakeup(void *ctx)
+{
+    wakeups++;
+}
+
+// Free global after the input context.
+static struct input_ctx *create_input(struct mpv_global **global)
+{
+    *global = talloc_zero(NULL, struct mpv_global);
+    struct m_config *config = m_config_new(*global, NULL, &root);
+    (*global)->config = config->shadow;
+    stats_global_init(*global);
+    return mp_input_init(*global, wakeup, NULL);
+}
+
+static int test_key(int n)
+{
+    static const int mods[] = {0, MP_KEY_MODIFIER_CTRL, MP_KEY_MODIFIER_ALT,
+                               MP_KEY_MODIFIER_META,
+                               MP_KEY_MODIFIER_CTRL | MP_KEY_MODIFIER_ALT};
+    return ('a' + n % 26) | mods[n / 26 % MP_ARRAY_SIZE(mods)];
+}
+
+// Check that the next command is the script binding name, or that there is
+// no command if name is NULL.
+static void check_cmd(struct input_ctx *ictx, const char *name)
+{
+    struct mp_cmd *cmd = mp_input_read_cmd(ictx);
+    if (name) {
+        assert_true(cmd);
+        assert_string_equal(cmd->name, "script-binding");
+        assert_string_equal(cmd->args[0].v.s, name);
+    } else {
+        assert_false(cmd);
+    }
+    talloc_free(cmd);
+}
+
+static void press(struct input_ctx *ictx, int key, const char *name)
+{
+    mp_input_put_key(ictx, key);
+    check_cmd(ictx, name);
+}
+
+static void test_keys(void)
+{
+    struct mpv_global *global;
+    struct input_ctx *ictx = create_input(&global);
+
+    mp_input_define_section(ictx, "test", "test",
+                            "x script-binding user-x\n"
+                            "g-l script-binding gl\n"
+                            "Ctrl+g-l script-binding ctrl-gl\n", false, NULL);
+    mp_input_define_section(ictx, "test", "test",
+                            "x script-binding builtin-x\n"
+                            "y script-binding builtin-y\n"
+                            "l script-binding builtin-l\n", true, NULL);
+    mp_input_enable_section(ictx, "test", 0);
+
+    // User bindings are preferred over builtin ones.
+    press(ictx, 'x', "user-x");
+    press(ictx, 'y', "builtin-y");
+
+    // The longest key sequence wins.
+    press(ictx, 'g', NULL);
+    press(ictx, 'l', "gl");
+    press(ictx, 'l', "builtin-l");
+    press(ictx, 'g' | MP_KEY_MODIFIER_CTRL, NULL);
+    press(ictx, 'l', "ctrl-gl");
+
+    // Higher sections are searched first.
+    mp_input_define_section(ictx, "top", "test",
+                            "y script-binding top-y\n", false, NULL);
+    mp_input_enable_section(ictx, "top", 0);
+    press(ictx, 'y', "top-y");
+    press(ictx, 'x', "user-x");
+    mp_input_disable_section(ictx, "top");
+    press(ictx, 'y', "builtin-y");
+
+    // Redefining a section replaces its bindings.
+    mp_input_define_section(ictx, "test", "test",
+                            "x script-binding user-x2\n", false, NULL);
+    press(ictx, 'x', "user-x2");
+    press(ictx, 'g', NULL);
+    press(ictx, 'l', "builtin-l");
+
+    // Bindings added to an existing section.
+    bool ok = mp_input_bind_key(ictx, "z", bstr0("script-binding z"), NULL);
+    assert_true(ok);
+    press(ictx, 'z', "z");
+    ok = mp_input_bind_key(ictx, "z", bstr0("script-binding z2"), NULL);
+    assert_true(ok);
+    press(ictx, 'z', "z2");
+
+    mp_input_uninit(ictx);
+    talloc_free(global);
+}
+
+// Read the next mouse move, waiting for its delivery like the playloop.
+static struct mp_cmd *read_move(struct input_ctx *ictx)
+{
+    while (1) {
+        struct mp_cmd *cmd = mp_input_read_cmd(ictx);
+        if (cmd && cmd->mouse_move)
+            return cmd;
+        talloc_free(cmd);
+        if (!cmd) {
+            double delay = mp_input_get_delay(ictx);
+            assert_true(delay < INFINITY);
+            mp_sleep_ns(delay * 1e9);
+        }
+    }
+}
+
+static void move(struct input_ctx *ictx, int x, int y, const char *name)
+{
+    mp_input_set_mouse_pos(ictx, x, y);
+    struct mp_cmd *cmd = read_move(ictx);
+    if (name) {
+        assert_string_equal(cmd->name, "script-binding");
+        assert_string_equal(cmd->args[0].v.s, name);
+    } else {
+        assert_string_equal(cmd->name, "ignore");
+    }
+    talloc_free(cmd);
+}
+
+static void test_mouse(void)
+{
+    struct mpv_global *global;
+    struct input_ctx *ictx = create_input(&global);
+
+    mp_input_define_section(ictx, "left", "test",
+                            "MOUSE_MOVE script-binding left\n", false, NULL);
+    mp_input_define_section(ictx, "right", "test",
+                            "MOUSE_MOVE script-binding right\n", false, NULL);
+    mp_input_enable_section(ictx, "left", 0);
+    mp_input_enable_section(ictx, "right", 0);
+    mp_input_set_section_mouse_area(ictx, "left", 0, 0, 100, 100);
+    mp_input_set_section_mouse_area(ictx, "right", 100, 0, 200, 100);
+
+    move(ictx, 50, 50, "left");
+    move(ictx, 150, 50, "right");
+    move(ictx, 300, 300, NULL);
+    move(ictx, 10, 10, "left");
+
+    mp_input_uninit(ictx);
+    talloc_free(global);
+}
+
+static double get_stat(struct mpv_node *stats, const char *name)
+{
+    for (int n = 0; n < stats->u.list->num; n++) {
+        struct mpv_node *e = &stats->u.list->values[n];
+        struct mpv_node *e_name = node_map_get(e, "name");
+        if (strcmp(e_name->u.string, name) == 0)
+            return node_map_get(e, "value")->u.double_;
+    }
+    return 0;
+}
+
+static void check_move(struct input_ctx *ictx, int x)
+{
+    struct mp_cmd *cmd = read_move(ictx);
+    assert_string_equal(cmd->args[0].v.s, "move");
+    assert_int_equal(cmd->mouse_x, x);
+    talloc_free(cmd);
+}
+
+static void test_coalesce(void)
+{
+    struct mpv_global *global;
+    struct input_ctx *ictx = create_input(&global);
+    struct mpv_node stats;
+    stats_global_query(global, &stats); // start collecting
+    talloc_free(stats.u.list);
+
+    mp_input_define_section(ictx, "test", "test",
+                            "MOUSE_MOVE script-binding move\n"
+                            "MBTN_LEFT script-binding click\n", false, NULL);
+    mp_input_enable_section(ictx, "test", 0);
+
+    // Moves before and after a click are merged, but not across it.
+    for (int n = 1; n <= 100; n++)
+        mp_input_set_mouse_pos(ictx, n, 10);
+    mp_input_put_key(ictx, MP_MBTN_LEFT);
+    for (int n = 1; n <= 50; n++)
+        mp_input_set_mouse_pos(ictx, 200 + n, 10);
+    check_move(ictx, 100);
+    check_cmd(ictx, "click");
+    check_move(ictx, 250);
+    check_cmd(ictx, NULL);
+
+    // Motion right after a delivery doesn't wake up the consumer, which comes
+    // back for it after a delay instead. A click is delivered immediately.
+    wakeups = 0;
+    mp_input_set_mouse_pos(ictx, 300, 10);
+    assert_int_equal(wakeups, 0);
+    check_cmd(ictx, NULL);
+    double delay = mp_input_get_delay(ictx);
+    assert_true(delay > 0 && delay <= 0.1);
+    mp_input_put_key(ictx, MP_MBTN_LEFT);
+    assert_true(wakeups > 0);
+    check_move(ictx, 300);
+    check_cmd(ictx, "click");
+    mp_input_set_mouse_pos(ictx, 310, 10);
+    check_move(ictx, 310);
+
+    stats_global_query(global, &stats);
+    assert_int_equal(get_stat(&stats, "input/mouse-move-received"), 152);
+    assert_int_equal(get_stat(&stats, "input/mouse-move-delivered"), 4);
+    talloc_free(stats.u.list);
+
+    mp_input_uninit(ictx);
+    talloc_free(global);
+}
+
+// Many sections with forced bindings and mouse areas, like a script drawing
+// its own controls.
+static struct input_ctx *create_bench_input(struct mpv_global **global)
+{
+    struct input_ctx *ictx = create_input(global);
+    for (int s = 0; s < NUM_SECTIONS; s++) {
+        char name[16];
+        snprintf(name, sizeof(name), "s%d", s);
+        char *contents = talloc_strdup(NULL, "");
+        for (int n = 0; n < NUM_BINDS; n++) {
+            int key = test_key((s * 5 + n) % NUM_KEYS);
+            char *key_name = mp_input_get_key_name(key);
+            contents = talloc_asprintf_append(contents,
+                "%s script-binding %s/%d\n", key_name, name, n);
+            talloc_free(key_name);
+        }
+        contents = talloc_asprintf_append(contents,
+            "MOUSE_MOVE script-binding %s/move\n", name);
+        mp_input_define_section(ictx, name, "bench", contents, false, NULL);
+        mp_input_enable_section(ictx, name, 0);
+        mp_input_set_section_mouse_area(ictx, name, s * AREA_WIDTH, 0,
+                                        (s + 1) * AREA_WIDTH, 100);
+        talloc_free(contents);
+    }
+    return ictx;
+}
+
+static void drain(struct input_ctx *ictx)
+{
+    struct mp_cmd *cmd;
+    while ((cmd = mp_input_read_cmd(ictx)))
+        talloc_free(cmd);
+}
+
+// Run the consumer like the playloop of an idle player: read all input, then
+// sleep until the next wakeup or timeout. Returns the timeout.
+static int64_t run_consumer(struct input_ctx *ictx)
+{
+    drain(ictx);
+    double delay = mp_input_get_delay(ictx);
+    return delay < INFINITY ? mp_time_ns_add(mp_time_ns(), delay) : INT64_MAX;
+}
+
+static void bench(void)
+{
+    struct mpv_global *global;
+    struct input_ctx *ictx = create_bench_input(&global);
+    const int events = 100000;
+
+    int64_t start = mp_time_ns();
+    for (int n = 0; n < events; n++) {
+        mp_input_put_key(ictx, test_key(n % NUM_BINDS));
+        drain(ictx);
+    }
+    double key_us = (mp_time_ns() - start) / 1e3 / events;
+
+    printf("%d sections with %d bindings: %.2f us per key press\n",
+           NUM_SECTIONS, NUM_BINDS, key_us);
+
+    // One second of a 1000 Hz mouse. The consumer runs whenever it is woken
+    // up or its timeout expires.
+    struct mpv_node stats;
+    stats_global_query(global, &stats);
+    double delivered = get_stat(&stats, "input/mouse-move-delivered");
+    talloc_free(stats.u.list);
+    int runs = 0;
+    int64_t timeout = run_consumer(ictx);
+    start = mp_time_ns();
+    for (int n = 0; n < 1000; n++) {
+        int64_t next = start + MP_TIME_MS_TO_NS(n);
+        int64_t now;
+        while ((now = mp_time_ns()) < next) {
+            if (now >= timeout) {
+                timeout = run_consumer(ictx);
+                runs++;
+            } else {
+                mp_sleep_ns(MPMIN(next, timeout) - now);
+            }
+        }
+        wakeups = 0;
+        mp_input_set_mouse_pos(ictx, n * 37 % (NUM_SECTIONS * AREA_WIDTH), 50);
+        if (wakeups) {
+            timeout = run_consumer(ictx);
+            runs++;
+        }
+    }
+    stats_global_query(global, &stats);
+    delivered = get_stat(&stats, "input/mouse-move-delivered") - delivered;
+    talloc_free(stats.u.list);
+
+    printf("1000 mouse moves in 1 second: %d consumer wakeups, "
+           "%d moves delivered\n", runs, (int)delivered);
+    mp_input_uninit(ictx);
+    talloc_free(global);
+}
+
+int main(int argc, char *argv[])
+{
+    test_keys();
+    test_mouse();
+    test_coalesce();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        bench();
+    return 0;
+}
@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "misc/kvdb.h"
+#include "misc/path_utils.h"
+#include "osdep/io.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+static char *db_path;
+
+static void check_value(struct kvdb *db, const char *key, const char *val)
+{
+    char *res = kvdb_get(NULL, db, key);
+    if (val) {
+        assert_true(kvdb_has(db, key));
+        assert_string_equal(res, val);
+    } else {
+        assert_false(kvdb_has(db, key));
+        assert_false(res);
+    }
+    talloc_free(res);
+}
+
+static void put(struct kvdb *db, const char *key, const char *val)
+{
+    bool ok = kvdb_put(db, key, bstr0(val));
+    assert_true(ok);
+}
+
+static struct kvdb *open_db(void)
+{
+    struct kvdb *db = kvdb_open(NULL, NULL, db_path);
+    assert_true(db);
+    return db;
+}
+
+static int64_t file_size(void)
+{
+    struct stat st;
+    int r = stat(db_path, &st);
+    assert_int_equal(r, 0);
+    return st.st_size;
+}
+
+static void append_bytes(const char *data, size_t size)
+{
+    FILE *f = fopen(db_path, "ab");
+    assert_true(f);
+    assert_int_equal(fwrite(data, 1, size, f), size);
+    fclose(f);
+}
+
+static void test_basic(void)
+{
+    unlink(db_path);
+    struct kvdb *db = open_db();
+    check_value(db, "a", NULL);
+    // Nothing is written before the first put.
+    assert_false(mp_path_exists(db_path));
+
+    put(db, "a", "1");
+    put(db, "b", "");
+    put(db, "c", "3");
+    put(db, "a", "one");
+    bool ok = kvdb_delete(db, "c");
+    assert_true(ok);
+    check_value(db, "a", "one");
+    check_value(db, "b", "");
+    check_value(db, "c", NULL);
+    talloc_free(db);
+
+    db = open_db();
+    check_value(db, "a", "one");
+    check_value(db, "b", "");
+    check_value(db, "c", NULL);
+    struct kvdb_stats st;
+    kvdb_get_stats(db, &st);
+    assert_int_equal(st.entries, 2);
+    assert_int_equal(st.file_size, file_size());
+    talloc_free(db);
+
+    // Not a database file.
+    FILE *f = fopen(db_path, "wb");
+    fprintf(f, "start=10\n");
+    fclose(f);
+    assert_false(kvdb_open(NULL, NULL, db_path));
+}
+
+static void test_crash(void)
+{
+    unlink(db_path);
+    struct kvdb *db = open_db();
+    put(db, "a", "1");
+    put(db, "b", "2");
+    talloc_free(db);
+
+    // A record cut off by a crash.
+    static const char cut[] = "mpvr\x10\0\0\0\x20\0\0\0\0\0\0\0key";
+    append_bytes(cut, sizeof(cut) - 1);
+    db = open_db();
+    check_value(db, "a", "1");
+    check_value(db, "b", "2");
+    put(db, "c", "3");
+    check_value(db, "c", "3");
+    talloc_free(db);
+
+    // Garbage in the middle of the file.
+    append_bytes("mpvrmpvr1234", 12);
+    db = open_db();
+    put(db, "b", "two");
+    talloc_free(db);
+    db = open_db();
+    check_value(db, "a", "1");
+    check_value(db, "b", "two");
+    check_value(db, "c", "3");
+    struct kvdb_stats st;
+    kvdb_get_stats(db, &st);
+    assert_int_equal(st.entries, 3);
+    assert_true(st.dead_bytes > sizeof(cut) - 1 + 12);
+    talloc_free(db);
+}
+
+static void test_concurrent(void)
+{
+    unlink(db_path);
+    struct kvdb *db1 = open_db();
+    struct kvdb *db2 = open_db();
+    put(db1, "a", "1");
+    put(db2, "b", "2");
+    check_value(db1, "a", "1");
+    check_value(db1, "b", NULL);
+    kvdb_refresh(db1);
+    check_value(db1, "b", "2");
+
+    bool ok = kvdb_compact(db2);
+    assert_true(ok);
+    kvdb_refresh(db1);
+    put(db1, "c", "3");
+    kvdb_refresh(db2);
+    check_value(db2, "a", "1");
+    check_value(db2, "c", "3");
+
+    // Writes go to the new file after a compaction by somebody else, even
+    // without a refresh.
+    ok = kvdb_compact(db1);
+    assert_true(ok);
+    put(db2, "d", "4");
+    kvdb_refresh(db1);
+    check_value(db1, "d", "4");
+    talloc_free(db2);
+    db2 = open_db();
+    check_value(db2, "a", "1");
+    check_value(db2, "d", "4");
+    talloc_free(db1);
+    talloc_free(db2);
+}
+
+#if HAVE_POSIX
+// Other processes append while this one compacts the file all the time.
+static void test_processes(void)
+{
+    const int num_procs = 4, num_keys = 500;
+    unlink(db_path);
+    pid_t pids[4];
+    for (int p = 0; p < num_procs; p++) {
+        pids[p] = fork();
+        assert_true(pids[p] >= 0);
+        if (!pids[p]) {
+            struct kvdb *db = open_db();
+            for (int n = 0; n < num_keys; n++) {
+                char key[16];
+                snprintf(key, sizeof(key), "%d-%d", p, n);
+                if (!kvdb_put(db, key, bstr0(key)))
+                    _exit(1);
+            }
+            talloc_free(db);
+            _exit(0);
+        }
+    }
+    struct kvdb *db = open_db();
+    int running = num_procs;
+    while (running) {
+        kvdb_compact(db);
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid > 0) {
+            assert_true(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+            running -= 1;
+        }
+    }
+    kvdb_refresh(db);
+    for (int p = 0; p < num_procs; p++) {
+        for (int n = 0; n < num_keys; n++) {
+            char key[16];
+            snprintf(key, sizeof(key), "%d-%d", p, n);
+            check_value(db, key, key);
+        }
+    }
+    talloc_free(db);
+}
+#endif
+
+static void test_compact(void)
+{
+    unlink(db_path);
+    struct kvdb *db = open_db();
+    char val[64];
+    for (int i = 0; i < 100; i++) {
+        for (int n = 0; n < 100; n++) {
+            char key[16];
+            snprintf(key, sizeof(key), "%d", n);
+            snprintf(val, sizeof(val), "value %d %d", n, i);
+            put(db, key, val);
+        }
+    }
+    // Compacted automatically after some time.
+    struct kvdb_stats st;
+    kvdb_get_stats(db, &st);
+    assert_int_equal(st.entries, 100);
+    assert_true(st.file_size < 200 * 1024);
+    assert_true(st.dead_bytes < st.file_size);
+    assert_int_equal(st.file_size, file_size());
+
+    bool ok = kvdb_compact(db);
+    assert_true(ok);
+    kvdb_get_stats(db, &st);
+    assert_int_equal(st.dead_bytes, 0);
+    talloc_free(db);
+
+    db = open_db();
+    check_value(db, "42", "value 42 99");
+    talloc_free(db);
+}
+
+static void bench(const char *outdir)
+{
+    const int num = 50000;
+    unlink(db_path);
+    struct kvdb *db = open_db();
+    for (int n = 0; n < num; n += 2) {
+        char key[40];
+        snprintf(key, sizeof(key), "%032X", n);
+        put(db, key, "start=123.456000\n");
+    }
+    talloc_free(db);
+
+    // What looking up a playlist with separate files costs.
+    int64_t start = mp_time_ns();
+    int found = 0;
+    for (int n = 0; n < num; n++) {
+        char *path = mp_tprintf(4096, "%s/%032X", outdir, n);
+        found += mp_path_exists(path);
+    }
+    double files_ms = (mp_time_ns() - start) / 1e6;
+
+    start = mp_time_ns();
+    db = open_db();
+    int found_db = 0;
+    for (int n = 0; n < num; n++) {
+        char key[40];
+        snprintf(key, sizeof(key), "%032X", n);
+        found_db += kvdb_has(db, key);
+    }
+    double db_ms = (mp_time_ns() - start) / 1e6;
+    talloc_free(db);
+    assert_int_equal(found_db, num / 2);
+    printf("%d lookups: files %.2f ms (%d found), database %.2f ms\n",
+           num, files_ms, found, db_ms);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        return 1;
+    mp_mkdirp(argv[1]);
+    db_path = mp_path_join(NULL, argv[1], "kvdb.db");
+    test_basic();
+    test_crash();
+    test_concurrent();
+#if HAVE_POSIX
+    test_processes();
+#endif
+    test_compact();
+    if (argc > 2 && strcmp(argv[2], "bench") == 0)
+        bench(argv[1]);
+    unlink(db_path);
+    talloc_free(db_path);
+    return 0;
+}
@@ -223,6 +223,62 @@ static void test_lavfi_complex(char *file)
         fail("Lavfi complex failed!\n");
 }
 
+// Play two entries with --prefetch-playlist=preroll, and toggle hwdec while
+// the second one uses the prerolled video decoder, which must recreate it.
+static void test_preroll_hwdec(void)
+{
+    mpv_node list;
+    check_api_error(mpv_get_property(ctx, "demuxer-lavf-list", MPV_FORMAT_NODE, &list));
+    int have_lavfi = 0;
+    for (int n = 0; n < list.u.list->num; n++) {
+        mpv_node *e = &list.u.list->values[n];
+        if (e->format == MPV_FORMAT_STRING && strcmp(e->u.string, "lavfi") == 0)
+            have_lavfi = 1;
+    }
+    mpv_free_node_contents(&list);
+    if (!have_lavfi) {
+        printf("lavfi demuxer not available, skipping\n");
+        return;
+    }
+
+    check_api_error(mpv_set_property_string(ctx, "prefetch-playlist", "preroll"));
+    const char *url = "av://lavfi:testsrc=duration=2:size=64x64:rate=25";
+    const char *cmd1[] = {"loadfile", url, NULL};
+    const char *cmd2[] = {"loadfile", url, "append", NULL};
+    check_api_error(mpv_command(ctx, cmd1));
+    check_api_error(mpv_command(ctx, cmd2));
+
+    int loaded = 0, toggled = 0, prerolled = 0;
+    while (1) {
+        mpv_event *event = mpv_wait_event(ctx, 1);
+        if (event->event_id == MPV_EVENT_LOG_MESSAGE) {
+            mpv_event_log_message *msg = event->data;
+            printf("[%s:%s] %s", msg->prefix, msg->level, msg->text);
+            if (strstr(msg->text, "Using prerolled video decoder"))
+                prerolled = 1;
+        } else if (event->event_id == MPV_EVENT_FILE_LOADED) {
+            loaded += 1;
+        } else if (event->event_id == MPV_EVENT_PLAYBACK_RESTART &&
+                   loaded == 2 && !toggled)
+        {
+            check_api_error(mpv_set_property_string(ctx, "hwdec", "auto-copy"));
+            check_api_error(mpv_set_property_string(ctx, "hwdec", "no"));
+            toggled = 1;
+        } else if (event->event_id == MPV_EVENT_END_FILE) {
+            mpv_event_end_file *ef = event->data;
+            if (ef->reason != MPV_END_FILE_REASON_EOF)
+                fail("Playback failed: %s\n", mpv_error_string(ef->error));
+            if (loaded == 2)
+                break;
+        }
+    }
+    if (!prerolled)
+        fail("The prerolled video decoder was not used!\n");
+    if (!toggled)
+        fail("Could not toggle hwdec!\n");
+    check_api_error(mpv_set_property_string(ctx, "prefetch-playlist", "no"));
+}
+
 // Ensure that setting options/properties work correctly and
 // have the expected values.
 static void test_options_and_properties(void)
@@ -294,6 +350,8 @@ int main(int argc, char *argv[])
     test_file_loading(argv[1]);
     printf(fmt, "test_lavfi_complex");
     test_lavfi_complex(argv[1]);
+    printf(fmt, "test_preroll_hwdec");
+    test_preroll_hwdec();
 
     printf("================ SHUTDOWN ================\n");
     mpv_command_string(ctx, "quit");
@@ -0,0 +1,266 @@
+#include "options/m_config_frontend.h"
+#include "options/m_option.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+#define NUM_OPTS 2000
+#define NUM_PROFILES 1000
+#define NUM_CACHES 64
+
+struct sub_opts {
+    int a;
+    char *s;
+};
+
+#define OPT_BASE_STRUCT struct sub_opts
+
+static const struct m_sub_options sub_conf = {
+    .opts = (const struct m_option[]) {
+        {"a", OPT_INT(a)},
+        {"s", OPT_STRING(s)},
+        {0}
+    },
+    .size = sizeof(struct sub_opts),
+    .change_flags = UPDATE_OSD,
+};
+
+struct test_opts {
+    char **list;
+    struct sub_opts *sub;
+    int values[NUM_OPTS];
+};
+
+#undef OPT_BASE_STRUCT
+#define OPT_BASE_STRUCT struct test_opts
+
+static struct m_option options[NUM_OPTS + 4];
+
+static const struct m_sub_options root = {
+    .opts = options,
+    .size = sizeof(struct test_opts),
+};
+
+static void init_options(void)
+{
+    static char names[NUM_OPTS][16];
+    options[0] = (struct m_option){"list", OPT_STRINGLIST(list)};
+    options[1] = (struct m_option){"old-name", OPT_ALIAS("opt-0")};
+    options[2] = (struct m_option){"sub", OPT_SUBSTRUCT(sub, sub_conf)};
+    for (int n = 0; n < NUM_OPTS; n++) {
+        snprintf(names[n], sizeof(names[n]), "opt-%d", n);
+        options[n + 3] = (struct m_option){names[n], OPT_INT(values[n])};
+    }
+}
+
+static int get_value(struct m_config *config, int n)
+{
+    return ((struct test_opts *)config->optstruct)->values[n];
+}
+
+static void set_value(struct m_config *config, const char *name, int v)
+{
+    char val[16];
+    snprintf(val, sizeof(val), "%d", v);
+    int r = m_config_set_option_cli(config, bstr0(name), bstr0(val), 0);
+    assert_true(r >= 0);
+}
+
+// Roughly what happens on startup: parse a large config file with many
+// profiles, and apply one of them.
+static struct m_config *load_config(void)
+{
+    struct m_config *config = m_config_new(NULL, NULL, &root);
+    for (int n = 0; n < NUM_OPTS; n++) {
+        char name[16], val[16];
+        snprintf(name, sizeof(name), "opt-%d", n);
+        snprintf(val, sizeof(val), "%d", n * 2);
+        int r = m_config_set_option_cli(config, bstr0(name), bstr0(val),
+                                        M_SETOPT_FROM_CONFIG_FILE);
+        assert_true(r >= 0);
+    }
+    for (int n = 0; n < NUM_PROFILES; n++) {
+        struct m_profile *p =
+            m_config_add_profile(config, talloc_asprintf(config, "p-%d", n));
+        for (int i = 0; i < 10; i++) {
+            char name[16], val[16];
+            snprintf(name, sizeof(name), "opt-%d", (n * 10 + i) % NUM_OPTS);
+            snprintf(val, sizeof(val), "%d", -n);
+            int r = m_config_set_profile_option(config, p, bstr0(name),
+                                                bstr0(val));
+            assert_int_equal(r, 1);
+        }
+    }
+    int r = m_config_set_profile(config, "p-123", 0);
+    assert_int_equal(r, 0);
+    return config;
+}
+
+static void test_lookup(void)
+{
+    struct m_config *config = m_config_new(NULL, NULL, &root);
+    for (int n = 0; n < NUM_OPTS; n++) {
+        char name[16];
+        snprintf(name, sizeof(name), "opt-%d", n);
+        struct m_config_option *co = m_config_get_co(config, bstr0(name));
+        assert_true(co);
+        assert_string_equal(co->name, name);
+    }
+    assert_false(m_config_get_co(config, bstr0("opt-")));
+    assert_false(m_config_get_co(config, bstr0("opt-1-add")));
+    assert_false(m_config_get_co(config, bstr0("")));
+
+    // Aliases resolve to the new option.
+    struct m_config_option *co = m_config_get_co(config, bstr0("old-name"));
+    assert_true(co);
+    assert_string_equal(co->name, "opt-0");
+
+    // Suffix actions.
+    int r = m_config_set_option_cli(config, bstr0("list-append"),
+                                    bstr0("a"), 0);
+    assert_true(r >= 0);
+    r = m_config_set_option_cli(config, bstr0("list-append"), bstr0("b"), 0);
+    assert_true(r >= 0);
+    char **list = ((struct test_opts *)config->optstruct)->list;
+    assert_string_equal(list[0], "a");
+    assert_string_equal(list[1], "b");
+    assert_false(list[2]);
+    r = m_config_set_option_cli(config, bstr0("opt-1-append"), bstr0("1"), 0);
+    assert_true(r < 0);
+    r = m_config_set_option_cli(config, bstr0("list-foo"), bstr0("1"), 0);
+    assert_true(r < 0);
+    r = m_config_set_option_cli(config, bstr0("-append"), bstr0("1"), 0);
+    assert_true(r < 0);
+
+    talloc_free(config);
+}
+
+static void test_profiles(void)
+{
+    struct m_config *config = load_config();
+    for (int n = 0; n < NUM_PROFILES; n++) {
+        char name[16];
+        snprintf(name, sizeof(name), "p-%d", n);
+        struct m_profile *p = m_config_get_profile0(config, name);
+        assert_true(p);
+        assert_true(p == m_config_add_profile(config, name));
+    }
+    assert_false(m_config_get_profile0(config, "p-"));
+
+    for (int n = 0; n < NUM_OPTS; n++) {
+        bool in_profile = n >= 1230 && n < 1240;
+        assert_int_equal(get_value(config, n), in_profile ? -123 : n * 2);
+    }
+    talloc_free(config);
+}
+
+static void test_caches(void)
+{
+    struct m_config *config = m_config_new(NULL, NULL, &root);
+    // Caches must be freed before the shadow.
+    void *tmp = talloc_new(NULL);
+    struct m_config_cache *caches[4], *sub_caches[4];
+    for (int n = 0; n < 4; n++) {
+        caches[n] = m_config_cache_from_shadow(tmp, config->shadow, &root);
+        sub_caches[n] =
+            m_config_cache_from_shadow(tmp, config->shadow, &sub_conf);
+        assert_false(m_config_cache_update(caches[n]));
+    }
+
+    set_value(config, "opt-5", 10);
+    set_value(config, "sub-a", 3);
+    for (int n = 0; n < 4; n++) {
+        struct test_opts *opts = caches[n]->opts;
+        struct sub_opts *sub_opts = sub_caches[n]->opts;
+        assert_true(m_config_cache_update(caches[n]));
+        assert_int_equal(opts->values[5], 10);
+        assert_int_equal(opts->sub->a, 3);
+        assert_true(caches[n]->change_flags & UPDATE_OSD);
+        assert_false(m_config_cache_update(caches[n]));
+        assert_true(m_config_cache_update(sub_caches[n]));
+        assert_int_equal(sub_opts->a, 3);
+    }
+
+    // Writes from a cache are seen by the others, but are not a change for
+    // the cache itself.
+    struct test_opts *opts = caches[0]->opts;
+    opts->values[7] = 42;
+    assert_true(m_config_cache_write_opt(caches[0], &opts->values[7]));
+    assert_false(m_config_cache_update(caches[0]));
+    assert_true(m_config_cache_update(caches[1]));
+    assert_int_equal(((struct test_opts *)caches[1]->opts)->values[7], 42);
+    assert_true(m_config_cache_update(config->cache));
+    assert_int_equal(get_value(config, 7), 42);
+
+    // More changes than remembered by the shadow.
+    for (int n = 0; n < NUM_OPTS; n++)
+        set_value(config, options[n + 3].name, n + 100);
+    set_value(config, "sub-a", 4);
+    for (int n = 0; n < 4; n++) {
+        struct test_opts *o = caches[n]->opts;
+        assert_true(m_config_cache_update(caches[n]));
+        for (int i = 0; i < NUM_OPTS; i++)
+            assert_int_equal(o->values[i], i + 100);
+        assert_int_equal(o->sub->a, 4);
+        assert_true(m_config_cache_update(sub_caches[n]));
+        assert_int_equal(((struct sub_opts *)sub_caches[n]->opts)->a, 4);
+    }
+
+    // Each changed option is returned once, also with writes in between.
+    set_value(config, "opt-1", 1);
+    set_value(config, "opt-2", 2);
+    set_value(config, "opt-1", 3);
+    void *ptr;
+    opts = caches[2]->opts;
+    assert_true(m_config_cache_get_next_changed(caches[2], &ptr));
+    assert_true(ptr == &opts->values[1]);
+    set_value(config, "opt-3", 3);
+    assert_true(m_config_cache_get_next_changed(caches[2], &ptr));
+    assert_true(ptr == &opts->values[2]);
+    assert_true(m_config_cache_get_next_changed(caches[2], &ptr));
+    assert_true(ptr == &opts->values[3]);
+    assert_false(m_config_cache_get_next_changed(caches[2], &ptr));
+    assert_int_equal(opts->values[1], 3);
+
+    talloc_free(tmp);
+    talloc_free(config);
+}
+
+static void bench(void)
+{
+    const int iterations = 20;
+    int64_t start = mp_time_ns();
+    for (int n = 0; n < iterations; n++)
+        talloc_free(load_config());
+    double ms = (mp_time_ns() - start) / 1e6 / iterations;
+    printf("%d options, %d profiles: %.2f ms per config\n",
+           NUM_OPTS, NUM_PROFILES, ms);
+
+    // A script animating a property, with many threads using the options.
+    struct m_config *config = m_config_new(NULL, NULL, &root);
+    void *tmp = talloc_new(NULL);
+    struct m_config_cache *caches[NUM_CACHES];
+    for (int n = 0; n < NUM_CACHES; n++)
+        caches[n] = m_config_cache_from_shadow(tmp, config->shadow, &root);
+    const int sets = 2000;
+    start = mp_time_ns();
+    for (int n = 0; n < sets; n++) {
+        set_value(config, "opt-5", n);
+        for (int i = 0; i < NUM_CACHES; i++)
+            m_config_cache_update(caches[i]);
+    }
+    double us = (mp_time_ns() - start) / 1e3 / sets;
+    printf("%d caches: %.2f us per set\n", NUM_CACHES, us);
+    talloc_free(tmp);
+    talloc_free(config);
+}
+
+int main(int argc, char *argv[])
+{
+    init_options();
+    test_lookup();
+    test_profiles();
+    test_caches();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        bench();
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include <libavutil/mem.h>
+
+#include "osdep/timer.h"
+#include "test_utils.h"
+#include "video/memcpy_pic.h"
+
+struct format {
+    const char *name;
+    int num_planes;
+    int bpp[3];         // bits per pixel of each plane
+    int ys[3];          // vertical subsampling shift of each plane
+};
+
+static const struct format formats[] = {
+    {"yuv420p", 3, {8, 4, 4},    {0, 1, 1}},
+    {"nv12",    2, {8, 8},       {0, 1}},
+    {"p010",    2, {16, 16},     {0, 1}},
+    {"rgba",    1, {32},         {0}},
+};
+
+static const struct {
+    const char *name;
+    int w, h;
+} sizes[] = {
+    {"1080p", 1920, 1080},
+    {"4K",    3840, 2160},
+    {"8K",    7680, 4320},
+};
+
+struct frame {
+    struct memcpy_pic_plane planes[3];
+    void *data[2][3];
+    size_t size;
+};
+
+static void frame_init(struct frame *f, const struct format *fmt, int w, int h,
+                       int pad)
+{
+    *f = (struct frame){0};
+    for (int n = 0; n < fmt->num_planes; n++) {
+        int bytes = w * fmt->bpp[n] / 8;
+        int height = h >> fmt->ys[n];
+        int stride = MP_ALIGN_UP(bytes + pad, 64);
+        for (int i = 0; i < 2; i++) {
+            f->data[i][n] = av_malloc((size_t)stride * height);
+            assert_true(f->data[i][n]);
+        }
+        f->planes[n] = (struct memcpy_pic_plane){
+            .dst = f->data[0][n],
+            .src = f->data[1][n],
+            .bytes = bytes,
+            .height = height,
+            .dst_stride = stride,
+            .src_stride = stride,
+        };
+        memset(f->data[0][n], 0, (size_t)stride * height);
+        uint8_t *src = f->data[1][n];
+        for (size_t i = 0; i < (size_t)stride * height; i++)
+            src[i] = i * 7 + n;
+        f->size += (size_t)bytes * height;
+    }
+}
+
+static void frame_uninit(struct frame *f, const struct format *fmt)
+{
+    for (int n = 0; n < fmt->num_planes; n++) {
+        av_free(f->data[0][n]);
+        av_free(f->data[1][n]);
+    }
+}
+
+static void check_copy(struct frame *f, const struct format *fmt)
+{
+    for (int n = 0; n < fmt->num_planes; n++) {
+        struct memcpy_pic_plane *p = &f->planes[n];
+        for (int y = 0; y < p->height; y++) {
+            assert_memcmp((uint8_t *)p->dst + y * (ptrdiff_t)p->dst_stride,
+                          (uint8_t *)p->src + y * (ptrdiff_t)p->src_stride,
+                          p->bytes);
+        }
+    }
+}
+
+// Sum the destination, like a filter using the copied frame.
+static uint64_t read_dst(struct frame *f, const struct format *fmt)
+{
+    uint64_t sum = 0;
+    for (int n = 0; n < fmt->num_planes; n++) {
+        struct memcpy_pic_plane *p = &f->planes[n];
+        for (int y = 0; y < p->height; y++) {
+            const uint64_t *line = (const uint64_t *)
+                ((uint8_t *)p->dst + y * (ptrdiff_t)p->dst_stride);
+            for (int x = 0; x < p->bytes / 8; x++)
+                sum += line[x];
+        }
+    }
+    return sum;
+}
+
+static void test_copy(void)
+{
+    int owner_a, owner_b;
+    static const int threads[][2] = {{1, 1}, {4, 1}, {1, 3}, {64, 2}};
+
+    for (int t = 0; t < MP_ARRAY_SIZE(threads); t++) {
+        memcpy_pic_configure(&owner_a, threads[t][0]);
+        memcpy_pic_configure(&owner_b, threads[t][1]);
+        for (int n = 0; n < MP_ARRAY_SIZE(formats); n++) {
+            const struct format *fmt = &formats[n];
+            for (int stream = 0; stream < 2; stream++) {
+                struct frame f;
+                // Padded strides copy line by line, and the 4K size is large
+                // enough to be split into bands and use streaming stores.
+                frame_init(&f, fmt, 3840 - 2, 2160, stream ? 32 : 0);
+                memcpy_pic_planes(f.planes, fmt->num_planes, stream);
+                check_copy(&f, fmt);
+                frame_uninit(&f, fmt);
+            }
+        }
+    }
+    memcpy_pic_unconfigure(&owner_a);
+    memcpy_pic_unconfigure(&owner_b);
+
+    // Negative strides copy the image upside down.
+    uint8_t src[4][5], dst[4][5];
+    for (int y = 0; y < 4; y++) {
+        for (int x = 0; x < 5; x++)
+            src[y][x] = y * 5 + x;
+    }
+    struct memcpy_pic_plane plane = {
+        .dst = &dst[3][0],
+        .src = &src[3][0],
+        .bytes = 5,
+        .height = 4,
+        .dst_stride = -5,
+        .src_stride = -5,
+    };
+    memcpy_pic_planes(&plane, 1, false);
+    assert_memcmp(dst, src, sizeof(src));
+}
+
+#define RUNS 20
+
+static double bench_frame(const struct format *fmt, int w, int h, bool stream,
+                          bool read)
+{
+    struct frame f;
+    frame_init(&f, fmt, w, h, 0);
+    volatile uint64_t sum = 0;
+    int64_t start = mp_time_ns();
+    for (int i = 0; i < RUNS; i++) {
+        memcpy_pic_planes(f.planes, fmt->num_planes, stream);
+        if (read)
+            sum += read_dst(&f, fmt);
+    }
+    double ms = (mp_time_ns() - start) / 1e6 / RUNS;
+    frame_uninit(&f, fmt);
+    return ms;
+}
+
+static void bench(void)
+{
+    int owner;
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        memcpy_pic_configure(&owner, threads);
+        printf("%d thread(s), ms per frame: copy (stream), copy+read (stream)\n",
+               threads);
+        for (int s = 0; s < MP_ARRAY_SIZE(sizes); s++) {
+            for (int n = 0; n < MP_ARRAY_SIZE(formats); n++) {
+                const struct format *fmt = &formats[n];
+                int w = sizes[s].w, h = sizes[s].h;
+                printf("  %-5s %-7s: %6.2f (%6.2f) %6.2f (%6.2f)\n",
+                       sizes[s].name, fmt->name,
+                       bench_frame(fmt, w, h, false, false),
+                       bench_frame(fmt, w, h, true, false),
+                       bench_frame(fmt, w, h, false, true),
+                       bench_frame(fmt, w, h, true, true));
+            }
+        }
+    }
+    memcpy_pic_unconfigure(&owner);
+}
+
+int main(int argc, char *argv[])
+{
+    test_copy();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        bench();
+    return 0;
+}
@@ -4,11 +4,14 @@
 
 #include "common/common.h"
 #include "img_utils.h"
+#include "misc/random.h"
+#include "osdep/timer.h"
 #include "sub/draw_bmp.h"
 #include "sub/osd.h"
 #include "test_utils.h"
 #include "video/fmt-conversion.h"
 #include "video/mp_image.h"
+#include "video/mp_image_buffers.h"
 #include "video/img_format.h"
 #include "video/repack.h"
 #include "video/sws_utils.h"
@@ -434,6 +437,218 @@ static void check_float_repack(int imgfmt, enum pl_color_system csp,
     talloc_free(from_f);
 }
 
+static void fill_random(struct mp_image *img)
+{
+    bool is_float = img->fmt.flags & MP_IMGFLAG_TYPE_FLOAT;
+    for (int p = 0; p < img->num_planes; p++) {
+        int bytes = mp_image_plane_bytes(img, p, 0, img->w);
+        for (int y = 0; y < mp_image_plane_h(img, p); y++) {
+            uint8_t *line = img->planes[p] + img->stride[p] * (ptrdiff_t)y;
+            if (is_float) {
+                // Include some out of range values to test clipping.
+                for (int x = 0; x < bytes / 4; x++)
+                    ((float *)line)[x] = mp_rand_next_double() * 1.2 - 0.1;
+            } else {
+                for (int x = 0; x < bytes; x++)
+                    line[x] = mp_rand_next();
+            }
+        }
+    }
+}
+
+static void run_repack(struct mp_repack *rp, struct mp_image *dst,
+                       struct mp_image *src)
+{
+    bool r = repack_config_buffers(rp, 0, dst, 0, src, NULL);
+    assert(r);
+    int ay = mp_repack_get_align_y(rp);
+    for (int y = 0; y < src->h; y += ay)
+        repack_line(rp, 0, y, 0, y, src->w);
+}
+
+static struct mp_image *alloc_repack_image(int imgfmt, int w, int h,
+                                           struct mp_image_params *params)
+{
+    struct mp_image *img = mp_image_alloc(imgfmt, w, h);
+    assert(img);
+    img->params.repr = params->repr;
+    img->params.color = params->color;
+    return img;
+}
+
+// Check that the vectorized fast paths produce the same output as the C code.
+static void check_simd_repack(int imgfmt, int flags)
+{
+    for (int pack = 0; pack < 2; pack++) {
+        struct mp_repack *rp = mp_repack_create_planar(imgfmt, pack, flags);
+        struct mp_repack *ref =
+            mp_repack_create_planar(imgfmt, pack, flags | REPACK_CREATE_NO_SIMD);
+        assert(!rp == !ref);
+        if (!rp)
+            continue;
+
+        // A width which is not a multiple of the vector size, to test the
+        // scalar code at the end of each line.
+        int ax = mp_repack_get_align_x(rp);
+        int ay = mp_repack_get_align_y(rp);
+        int w = MP_ALIGN_UP(517, ax);
+
+        struct mp_image_params params = {.imgfmt = imgfmt, .w = w, .h = ay};
+        mp_image_params_guess_csp(&params);
+
+        int src_fmt = mp_repack_get_format_src(rp);
+        int dst_fmt = mp_repack_get_format_dst(rp);
+        struct mp_image *src = alloc_repack_image(src_fmt, w, ay, &params);
+        struct mp_image *dst = alloc_repack_image(dst_fmt, w, ay, &params);
+        struct mp_image *dst_ref = alloc_repack_image(dst_fmt, w, ay, &params);
+        fill_random(src);
+        // Bytes not written by the repacker must compare equal.
+        mp_image_clear(dst, 0, 0, w, ay);
+        mp_image_clear(dst_ref, 0, 0, w, ay);
+
+        run_repack(rp, dst, src);
+        run_repack(ref, dst_ref, src);
+
+        bool is_float = dst->fmt.flags & MP_IMGFLAG_TYPE_FLOAT;
+        for (int p = 0; p < dst->num_planes; p++) {
+            int bytes = mp_image_plane_bytes(dst, p, 0, w);
+            for (int y = 0; y < mp_image_plane_h(dst, p); y++) {
+                uint8_t *a = dst->planes[p] + dst->stride[p] * (ptrdiff_t)y;
+                uint8_t *b = dst_ref->planes[p] + dst_ref->stride[p] * (ptrdiff_t)y;
+                if (is_float) {
+                    // Allow for FMA contraction in either implementation.
+                    for (int x = 0; x < bytes / 4; x++)
+                        assert_float_equal(((float *)a)[x], ((float *)b)[x], 1e-6);
+                } else {
+                    assert_memcmp(a, b, bytes);
+                }
+            }
+        }
+
+        talloc_free(src);
+        talloc_free(dst);
+        talloc_free(dst_ref);
+        talloc_free(rp);
+        talloc_free(ref);
+    }
+}
+
+// Print the throughput of the repackers for some common formats, with and
+// without the vectorized fast paths. Not run by default.
+static void bench_repack(void)
+{
+    static const struct {
+        int imgfmt;
+        int flags;
+    } formats[] = {
+        {IMGFMT_NV12},
+        {IMGFMT_P010},
+        {IMGFMT_RGBA},
+        {IMGFMT_BGR0},
+        {IMGFMT_0RGB},
+        {IMGFMT_RGB24},
+        {IMGFMT_420P, REPACK_CREATE_PLANAR_F32},
+        {-AV_PIX_FMT_YUV420P10, REPACK_CREATE_PLANAR_F32},
+        {IMGFMT_RGBA, REPACK_CREATE_PLANAR_F32},
+    };
+
+    static const int sizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+
+    for (int n = 0; n < MP_ARRAY_SIZE(formats); n++) {
+        int imgfmt = UNFUCK(formats[n].imgfmt);
+        for (int s = 0; s < MP_ARRAY_SIZE(sizes); s++) {
+            int w = sizes[s][0], h = sizes[s][1];
+            printf("%-12s %s %5dx%-5d", mp_imgfmt_to_name(imgfmt),
+                   formats[n].flags ? "f32" : "   ", w, h);
+            for (int pack = 0; pack < 2; pack++) {
+                for (int simd = 1; simd >= 0; simd--) {
+                    int flags = formats[n].flags |
+                                (simd ? 0 : REPACK_CREATE_NO_SIMD);
+                    struct mp_repack *rp =
+                        mp_repack_create_planar(imgfmt, pack, flags);
+                    assert(rp);
+                    struct mp_image_params params = {.imgfmt = imgfmt};
+                    mp_image_params_guess_csp(&params);
+                    struct mp_image *src = alloc_repack_image(
+                        mp_repack_get_format_src(rp), w, h, &params);
+                    struct mp_image *dst = alloc_repack_image(
+                        mp_repack_get_format_dst(rp), w, h, &params);
+                    fill_random(src);
+
+                    const int runs = 10;
+                    run_repack(rp, dst, src);
+                    int64_t start = mp_time_ns();
+                    for (int r = 0; r < runs; r++)
+                        run_repack(rp, dst, src);
+                    double secs = MP_TIME_NS_TO_S(mp_time_ns() - start);
+
+                    printf(" | %s %s %8.1f MPix/s", pack ? "pa" : "un",
+                           simd ? "simd" : "c   ", w * (double)h * runs / secs / 1e6);
+
+                    talloc_free(src);
+                    talloc_free(dst);
+                    talloc_free(rp);
+                }
+            }
+            printf("\n");
+        }
+    }
+}
+
+// Compare the allocation methods of --image-buffer-alloc: the cost of
+// allocating and writing a new frame (like a decoder without buffer reuse), and
+// the repack throughput on frames allocated that way. Not run by default.
+static void bench_alloc(void)
+{
+    static const char *const names[] = {"default", "thp", "hugetlb"};
+    static const int sizes[][2] = {{1920, 1080}, {3840, 2160}, {7680, 4320}};
+    static int owner;
+
+    for (int s = 0; s < MP_ARRAY_SIZE(sizes); s++) {
+        int w = sizes[s][0], h = sizes[s][1];
+        for (int a = 0; a < MP_ARRAY_SIZE(names); a++) {
+            mp_image_buffers_configure(&owner, 0, 0, a, false);
+
+            const int frames = 20;
+            int64_t start = mp_time_ns();
+            for (int n = 0; n < frames; n++) {
+                struct mp_image *img = mp_image_alloc(IMGFMT_NV12, w, h);
+                assert(img);
+                mp_image_clear(img, 0, 0, w, h);
+                talloc_free(img);
+            }
+            double alloc_ms = MP_TIME_NS_TO_MS(mp_time_ns() - start) / frames;
+
+            struct mp_repack *rp = mp_repack_create_planar(IMGFMT_NV12, false, 0);
+            assert(rp);
+            struct mp_image_params params = {.imgfmt = IMGFMT_NV12};
+            mp_image_params_guess_csp(&params);
+            struct mp_image *src = alloc_repack_image(
+                mp_repack_get_format_src(rp), w, h, &params);
+            struct mp_image *dst = alloc_repack_image(
+                mp_repack_get_format_dst(rp), w, h, &params);
+            mp_image_clear(src, 0, 0, w, h);
+
+            const int runs = 10;
+            run_repack(rp, dst, src);
+            start = mp_time_ns();
+            for (int r = 0; r < runs; r++)
+                run_repack(rp, dst, src);
+            double secs = MP_TIME_NS_TO_S(mp_time_ns() - start);
+
+            printf("%-8s %5dx%-5d alloc+clear %7.2f ms/frame | nv12 unpack "
+                   "%8.1f MPix/s\n", names[a], w, h, alloc_ms,
+                   w * (double)h * runs / secs / 1e6);
+
+            talloc_free(src);
+            talloc_free(dst);
+            talloc_free(rp);
+        }
+    }
+
+    mp_image_buffers_unconfigure(&owner);
+}
+
 static bool try_draw_bmp(FILE *f, int imgfmt)
 {
     bool ok = false;
@@ -489,6 +704,9 @@ int main(int argc, char *argv[])
     const char *outdir = argv[2];
     FILE *f = test_open_out(outdir, "repack.txt");
 
+    mp_time_init();
+    mp_rand_seed(1);
+
     init_imgfmts_list();
     for (int n = 0; n < num_imgfmts; n++) {
         int imgfmt = imgfmts[n];
@@ -514,6 +732,17 @@ int main(int argc, char *argv[])
     check_float_repack(-AV_PIX_FMT_YUVA444P16, PL_COLOR_SYSTEM_BT_709, PL_COLOR_LEVELS_FULL);
     check_float_repack(-AV_PIX_FMT_YUVA444P16, PL_COLOR_SYSTEM_BT_709, PL_COLOR_LEVELS_LIMITED);
 
+    for (int n = 0; n < num_imgfmts; n++) {
+        check_simd_repack(imgfmts[n], 0);
+        check_simd_repack(imgfmts[n], REPACK_CREATE_PLANAR_F32);
+    }
+
+    // Run with "bench" as third argument to measure performance.
+    if (argc > 3 && strcmp(argv[3], "bench") == 0) {
+        bench_repack();
+        bench_alloc();
+    }
+
     // Determine the list of possible draw_bmp input formats. Do this here
     // because it mostly depends on repack and imgformat stuff.
     f = test_open_out(outdir, "draw_bmp.txt");
@@ -0,0 +1,100 @@
+#include "osdep/timer.h"
+#include "sub/seen_packets.h"
+#include "test_utils.h"
+
+#define NUM_EVENTS 200000
+
+static bool add(struct seen_packets *s, int64_t pos, double pts, int index)
+{
+    int n = -1;
+    bool seen = seen_packets_add(s, pos, pts, &n);
+    assert_int_equal(n, index);
+    return seen;
+}
+
+static void test_basic(void)
+{
+    struct seen_packets *s = seen_packets_create(NULL);
+    assert_false(add(s, 100, 1.0, 0));
+    assert_false(add(s, 50, 2.0, 1));
+    assert_false(add(s, 100, 2.0, 2));
+    assert_true(add(s, 100, 1.0, 0));
+    assert_true(add(s, 50, 2.0, 1));
+
+    // -0.0 and 0.0 are the same pts.
+    assert_false(add(s, 0, 0.0, 3));
+    assert_true(add(s, 0, -0.0, 3));
+    assert_int_equal(seen_packets_count(s), 4);
+
+    seen_packets_clear(s);
+    assert_int_equal(seen_packets_count(s), 0);
+    assert_false(add(s, 100, 2.0, 0));
+    assert_false(add(s, 100, 1.0, 1));
+    talloc_free(s);
+}
+
+// Packets of a heavily typeset track: many events share a pts.
+static void track_packet(int n, int64_t *pos, double *pts)
+{
+    *pos = 1000 + n * 200LL;
+    *pts = (n / 20) * 0.04;
+}
+
+static void test_large(void)
+{
+    struct seen_packets *s = seen_packets_create(NULL);
+    for (int n = 0; n < NUM_EVENTS; n++) {
+        int64_t pos;
+        double pts;
+        track_packet(n, &pos, &pts);
+        assert_false(add(s, pos, pts, n));
+    }
+    for (int n = NUM_EVENTS - 1; n >= 0; n -= 7) {
+        int64_t pos;
+        double pts;
+        track_packet(n, &pos, &pts);
+        assert_true(add(s, pos, pts, n));
+    }
+    assert_int_equal(seen_packets_count(s), NUM_EVENTS);
+    talloc_free(s);
+}
+
+// Preload a track, then decode parts of it again like after seeks.
+static double preload(int num_events)
+{
+    int64_t start = mp_time_ns();
+    struct seen_packets *s = seen_packets_create(NULL);
+    for (int n = 0; n < num_events; n++) {
+        int64_t pos;
+        double pts;
+        track_packet(n, &pos, &pts);
+        int index;
+        seen_packets_add(s, pos, pts, &index);
+    }
+    for (int i = 0; i < 10; i++) {
+        for (int n = i * num_events / 10; n < (i + 1) * num_events / 10; n++) {
+            int64_t pos;
+            double pts;
+            track_packet(n, &pos, &pts);
+            int index;
+            seen_packets_add(s, pos, pts, &index);
+        }
+    }
+    talloc_free(s);
+    return (mp_time_ns() - start) / 1e6;
+}
+
+static void bench(void)
+{
+    for (int num = NUM_EVENTS / 4; num <= NUM_EVENTS; num *= 2)
+        printf("%d events: %.2f ms\n", num, preload(num));
+}
+
+int main(int argc, char *argv[])
+{
+    test_basic();
+    test_large();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        bench();
+    return 0;
+}
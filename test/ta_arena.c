@@ -0,0 +1,195 @@
+#include "misc/json.h"
+#include "misc/node.h"
+#include "osdep/timer.h"
+#include "test_utils.h"
+
+static const char json_src[] =
+    "{\"command\": [\"set_property\", \"volume\", 50], \"request_id\": 123, "
+    "\"async\": false, \"list\": [1, 2.5, \"three\", null, {\"a\": \"b\"}]}";
+
+static int destroyed;
+
+static void destructor(void *ptr)
+{
+    destroyed += 1;
+}
+
+static char *parse_and_write(void *ta_parent)
+{
+    char *s = talloc_strdup(ta_parent, json_src);
+    struct mpv_node node;
+    int r = json_parse(ta_parent, &node, &s, MAX_JSON_DEPTH);
+    assert_true(r >= 0);
+    char *d = talloc_strdup(ta_parent, "");
+    r = json_write(&d, &node);
+    assert_true(r >= 0);
+    return d;
+}
+
+static struct ta_arena_stats get_stats(void *arena)
+{
+    struct ta_arena_stats st;
+    bool ok = ta_get_arena_stats(arena, &st);
+    assert_true(ok);
+    return st;
+}
+
+static void test_basic(void)
+{
+    void *arena = talloc_new_arena(NULL);
+    struct ta_arena_stats st = get_stats(arena);
+    assert_int_equal(st.allocs, 0);
+    assert_int_equal(st.chunks, 0);
+
+    destroyed = 0;
+    char **strs = talloc_zero_array(arena, char *, 1000);
+    for (int n = 0; n < 1000; n++) {
+        strs[n] = talloc_asprintf(strs, "string %d", n);
+        talloc_set_destructor(strs[n], destructor);
+    }
+    for (int n = 0; n < 1000; n++)
+        assert_string_equal(strs[n], talloc_asprintf(arena, "string %d", n));
+
+    // Few large allocations from malloc() instead of thousands of small ones.
+    st = get_stats(arena);
+    assert_int_equal(st.allocs, 2001);
+    assert_true(st.chunks <= 8);
+
+    // Not an arena context.
+    bool ok = ta_get_arena_stats(strs, &st);
+    assert_false(ok);
+
+    talloc_free(strs[0]);
+    assert_int_equal(destroyed, 1);
+    talloc_free(arena);
+    assert_int_equal(destroyed, 1000);
+}
+
+static void test_realloc(void)
+{
+    void *arena = talloc_new_arena(NULL);
+    int *arr = NULL;
+    int num = 0;
+    for (int n = 0; n < 100000; n++)
+        MP_TARRAY_APPEND(arena, arr, num, n);
+    for (int n = 0; n < num; n++)
+        assert_int_equal(arr[n], n);
+    arr = talloc_realloc(arena, arr, int, 10);
+    assert_int_equal(arr[9], 9);
+    assert_int_equal(talloc_get_size(arr), 10 * sizeof(int));
+
+    // Children are relinked when the allocation moves.
+    destroyed = 0;
+    char *child = talloc_strdup(arr, "child");
+    talloc_set_destructor(child, destructor);
+    arr = talloc_realloc(arena, arr, int, 100000);
+    talloc_free(arr);
+    assert_int_equal(destroyed, 1);
+    talloc_free(arena);
+}
+
+static void test_steal(void)
+{
+    void *arena = talloc_new_arena(NULL);
+    char *s = talloc_strdup(arena, "escaped");
+    char *child = talloc_strdup(s, "child");
+    talloc_steal(NULL, s);
+
+    // Allocations moved out of the arena context keep the arena alive.
+    talloc_free_children(arena);
+    struct ta_arena_stats st = get_stats(arena);
+    assert_int_equal(st.chunks, 1);
+    talloc_free(arena);
+    assert_string_equal(s, "escaped");
+    assert_string_equal(child, "child");
+    s = talloc_strdup_append(s, " and extended");
+    assert_string_equal(s, "escaped and extended");
+    char *child2 = talloc_strdup(s, "child2");
+    assert_string_equal(child2, "child2");
+    talloc_free(s);
+
+    // Moving normal allocations into the arena context and back.
+    arena = talloc_new_arena(NULL);
+    void *ctx = talloc_new(NULL);
+    char *a = talloc_strdup(ctx, "a");
+    talloc_steal(arena, a);
+    char *b = talloc_strdup(a, "b");
+    talloc_steal(ctx, b);
+    talloc_free(arena);
+    assert_string_equal(b, "b");
+    talloc_free(ctx);
+
+    // Arena contexts as children of other allocations.
+    ctx = talloc_new(NULL);
+    arena = talloc_new_arena(ctx);
+    void *arena2 = talloc_new_arena(arena);
+    char *c = talloc_strdup(arena2, "c");
+    talloc_steal(arena, c);
+    talloc_free(arena2);
+    assert_string_equal(c, "c");
+    talloc_free(ctx);
+}
+
+static void test_reuse(void)
+{
+    void *arena = talloc_new_arena(NULL);
+    struct ta_arena_stats st;
+    for (int i = 0; i < 10; i++) {
+        for (int n = 0; n < 10000; n++)
+            talloc_size(arena, 64);
+        talloc_free_children(arena);
+        st = get_stats(arena);
+        assert_int_equal(st.chunks, 1);
+    }
+    assert_true(st.bytes <= 64 * 1024);
+    talloc_free(arena);
+}
+
+static void test_json(void)
+{
+    void *ctx = talloc_new(NULL);
+    void *arena = talloc_new_arena(NULL);
+    assert_string_equal(parse_and_write(ctx), parse_and_write(arena));
+    talloc_free(arena);
+    talloc_free(ctx);
+}
+
+static void bench(void)
+{
+    const int iterations = 100000;
+    for (int arena = 0; arena < 2; arena++) {
+        int64_t start = mp_time_ns();
+        struct ta_arena_stats total = {0};
+        for (int n = 0; n < iterations; n++) {
+            void *tmp = arena ? talloc_new_arena(NULL) : talloc_new(NULL);
+            parse_and_write(tmp);
+            struct ta_arena_stats st;
+            if (ta_get_arena_stats(tmp, &st)) {
+                total.allocs += st.allocs;
+                total.chunks += st.chunks;
+            }
+            talloc_free(tmp);
+        }
+        double ns = (mp_time_ns() - start) / (double)iterations;
+        printf("%s: %.0f ns per request", arena ? "arena" : "malloc", ns);
+        if (arena) {
+            // Without the arena, each allocation is a malloc() call.
+            printf(", %.1f allocations from %.1f chunks",
+                   total.allocs / (double)iterations,
+                   total.chunks / (double)iterations);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    test_basic();
+    test_realloc();
+    test_steal();
+    test_reuse();
+    test_json();
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+        bench();
+    return 0;
+}
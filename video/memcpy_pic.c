@@ -0,0 +1,296 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_NT_STORES 1
+#else
+#define HAVE_NT_STORES 0
+#endif
+
+#include "mpv_talloc.h"
+
+#include "common/common.h"
+#include "memcpy_pic.h"
+#include "misc/thread_pool.h"
+#include "mp_image.h"
+#include "osdep/threads.h"
+
+// Streaming copies of at least this many bytes use non-temporal stores. Such
+// frames hardly fit into the CPU caches anyway, and writing them through the
+// caches would only evict more useful data.
+#define NT_MIN_SIZE (8 * 1024 * 1024)
+
+// Other copies use non-temporal stores only from this size on. The data is
+// usually read right after the copy, which is much slower if it was not left
+// in the last level cache. Only frames well beyond its size (8K) gain from
+// non-temporal stores in "test/memcpy_pic bench".
+#define NT_READ_MIN_SIZE (40 * 1024 * 1024)
+
+// Minimum number of bytes copied by each thread.
+#define BAND_MIN_SIZE (1024 * 1024)
+
+#define MAX_BANDS 64
+
+static mp_static_mutex pool_lock = MP_STATIC_MUTEX_INITIALIZER;
+static mp_cond pool_wakeup = MP_STATIC_COND_INITIALIZER;
+
+struct owner_threads {
+    void *owner;
+    int threads;
+};
+
+// All protected by pool_lock.
+static struct owner_threads *owners;
+static int num_owners;
+static struct mp_thread_pool *pool;
+static int pool_threads = 1;    // including the thread calling the copy
+static int pool_users;          // copies currently using the pool
+
+struct copy_job {
+    const struct memcpy_pic_plane *planes;
+    int num_planes;
+    int num_bands;
+    bool nt;
+    int pending;                // bands not done yet (protected by pool_lock)
+};
+
+struct copy_band {
+    struct copy_job *job;
+    int index;
+};
+
+#if HAVE_NT_STORES
+static void copy_line_nt(uint8_t *dst, const uint8_t *src, size_t size)
+{
+    size_t head = -(uintptr_t)dst & 15;
+    if (head >= size) {
+        memcpy(dst, src, size);
+        return;
+    }
+    memcpy(dst, src, head);
+    dst += head;
+    src += head;
+    size -= head;
+
+    size_t body = size & ~(size_t)63;
+    for (size_t i = 0; i < body; i += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i + 0));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *)(src + i + 48));
+        _mm_stream_si128((__m128i *)(dst + i + 0), a);
+        _mm_stream_si128((__m128i *)(dst + i + 16), b);
+        _mm_stream_si128((__m128i *)(dst + i + 32), c);
+        _mm_stream_si128((__m128i *)(dst + i + 48), d);
+    }
+    memcpy(dst + body, src + body, size - body);
+}
+#endif
+
+static void copy_line(uint8_t *dst, const uint8_t *src, size_t size, bool nt)
+{
+#if HAVE_NT_STORES
+    if (nt) {
+        copy_line_nt(dst, src, size);
+        return;
+    }
+#endif
+    memcpy(dst, src, size);
+}
+
+static void copy_pic(uint8_t *dst, const uint8_t *src, int bytes, int height,
+                     int dst_stride, int src_stride, bool nt)
+{
+    if (bytes == dst_stride && dst_stride == src_stride && height) {
+        if (src_stride < 0) {
+            src = src + (height - 1) * (ptrdiff_t)src_stride;
+            dst = dst + (height - 1) * (ptrdiff_t)dst_stride;
+            src_stride = -src_stride;
+        }
+
+        copy_line(dst, src, src_stride * (size_t)(height - 1) + bytes, nt);
+    } else {
+        for (int i = 0; i < height; i++) {
+            copy_line(dst, src, bytes, nt);
+            src += src_stride;
+            dst += dst_stride;
+        }
+    }
+}
+
+// Copy rows [h*index/num_bands, h*(index+1)/num_bands) of each plane.
+static void copy_band(struct copy_job *job, int index)
+{
+    for (int n = 0; n < job->num_planes; n++) {
+        const struct memcpy_pic_plane *p = &job->planes[n];
+        int y0 = (int64_t)p->height * index / job->num_bands;
+        int y1 = (int64_t)p->height * (index + 1) / job->num_bands;
+        copy_pic((uint8_t *)p->dst + y0 * (ptrdiff_t)p->dst_stride,
+                 (const uint8_t *)p->src + y0 * (ptrdiff_t)p->src_stride,
+                 p->bytes, y1 - y0, p->dst_stride, p->src_stride, job->nt);
+    }
+#if HAVE_NT_STORES
+    // Non-temporal stores are weakly ordered; make them visible before the
+    // data is used by anyone else.
+    if (job->nt)
+        _mm_sfence();
+#endif
+}
+
+static void run_band(void *ctx)
+{
+    struct copy_band *band = ctx;
+    struct copy_job *job = band->job;
+
+    copy_band(job, band->index);
+
+    mp_mutex_lock(&pool_lock);
+    job->pending -= 1;
+    mp_cond_broadcast(&pool_wakeup);
+    mp_mutex_unlock(&pool_lock);
+}
+
+void memcpy_pic_planes(const struct memcpy_pic_plane *planes, int num_planes,
+                       bool stream)
+{
+    size_t total = 0;
+    for (int n = 0; n < num_planes; n++)
+        total += (size_t)planes[n].bytes * planes[n].height;
+
+    struct copy_job job = {
+        .planes = planes,
+        .num_planes = num_planes,
+        .num_bands = 1,
+        .nt = HAVE_NT_STORES &&
+              total >= (stream ? NT_MIN_SIZE : NT_READ_MIN_SIZE),
+    };
+
+    struct mp_thread_pool *p = NULL;
+    if (total >= 2 * BAND_MIN_SIZE) {
+        mp_mutex_lock(&pool_lock);
+        if (pool) {
+            p = pool;
+            pool_users += 1;
+            job.num_bands = MPMIN(total / BAND_MIN_SIZE, pool_threads);
+        }
+        mp_mutex_unlock(&pool_lock);
+    }
+
+    // Band 0 is copied by the calling thread.
+    struct copy_band bands[MAX_BANDS];
+    job.pending = job.num_bands - 1;
+    for (int n = 1; n < job.num_bands; n++) {
+        bands[n] = (struct copy_band){&job, n};
+        // Cannot fail, as the pool was created with all of its threads.
+        mp_thread_pool_queue(p, run_band, &bands[n]);
+    }
+
+    copy_band(&job, 0);
+
+    if (p) {
+        mp_mutex_lock(&pool_lock);
+        while (job.pending)
+            mp_cond_wait(&pool_wakeup, &pool_lock);
+        pool_users -= 1;
+        mp_cond_broadcast(&pool_wakeup);
+        mp_mutex_unlock(&pool_lock);
+    }
+}
+
+// Resize the pool to the largest number of threads requested by any owner.
+static void update_threads(void)
+{
+    mp_mutex_lock(&pool_lock);
+    int threads = 1;
+    for (int n = 0; n < num_owners; n++)
+        threads = MPMAX(threads, owners[n].threads);
+    threads = MPCLAMP(threads, 1, MAX_BANDS);
+    if (!num_owners)
+        TA_FREEP(&owners);
+
+    if (threads == pool_threads) {
+        mp_mutex_unlock(&pool_lock);
+        return;
+    }
+
+    while (pool_users)
+        mp_cond_wait(&pool_wakeup, &pool_lock);
+
+    struct mp_thread_pool *old = pool;
+    pool = NULL;
+    pool_threads = 1;
+    if (threads > 1) {
+        int n = threads - 1;
+        pool = mp_thread_pool_create(NULL, n, n, n);
+        if (pool)
+            pool_threads = threads;
+    }
+    mp_mutex_unlock(&pool_lock);
+
+    talloc_free(old);
+}
+
+void memcpy_pic_configure(void *owner, int threads)
+{
+    struct owner_threads t = {owner, threads};
+
+    mp_mutex_lock(&pool_lock);
+    int n = 0;
+    while (n < num_owners && owners[n].owner != owner)
+        n++;
+    if (n == num_owners) {
+        MP_TARRAY_APPEND(NULL, owners, num_owners, t);
+    } else {
+        owners[n] = t;
+    }
+    mp_mutex_unlock(&pool_lock);
+
+    update_threads();
+}
+
+void memcpy_pic_unconfigure(void *owner)
+{
+    mp_mutex_lock(&pool_lock);
+    for (int n = 0; n < num_owners; n++) {
+        if (owners[n].owner == owner) {
+            MP_TARRAY_REMOVE_AT(owners, num_owners, n);
+            break;
+        }
+    }
+    mp_mutex_unlock(&pool_lock);
+
+    update_threads();
+}
+
+void memcpy_pic(void *dst, const void *src, int bytesPerLine, int height,
+                int dstStride, int srcStride)
+{
+    struct memcpy_pic_plane plane = {
+        .dst = dst,
+        .src = src,
+        .bytes = bytesPerLine,
+        .height = height,
+        .dst_stride = dstStride,
+        .src_stride = srcStride,
+    };
+    memcpy_pic_planes(&plane, 1, false);
+}
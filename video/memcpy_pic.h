@@ -0,0 +1,31 @@
+#pragma once
+
+// Copy engine used by memcpy_pic() and mp_image_copy(). Large copies can be
+// split into bands of rows which are copied in parallel, and very large
+// copies use non-temporal stores where supported. All functions are
+// thread-safe.
+
+#include <stdbool.h>
+
+struct memcpy_pic_plane {
+    void *dst;
+    const void *src;
+    int bytes;          // bytes per line
+    int height;
+    int dst_stride;
+    int src_stride;
+};
+
+// Copy all planes. Returns once all data was copied. Set stream if the CPU
+// will not read the destination again soon (e.g. it is mapped GPU memory), so
+// that smaller copies bypass the CPU caches as well.
+void memcpy_pic_planes(const struct memcpy_pic_plane *planes, int num_planes,
+                       bool stream);
+
+// Set the number of threads (including the calling thread) large copies are
+// split across, on behalf of owner, which is an arbitrary unique pointer. The
+// thread pool is shared, and uses the largest value set by any owner.
+void memcpy_pic_configure(void *owner, int threads);
+
+// Remove the setting of owner. If no owner is left, copies are single-threaded.
+void memcpy_pic_unconfigure(void *owner);
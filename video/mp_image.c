@@ -36,7 +36,9 @@
 #include "common/common.h"
 #include "fmt-conversion.h"
 #include "hwdec.h"
+#include "memcpy_pic.h"
 #include "mp_image.h"
+#include "mp_image_buffers.h"
 #include "osdep/threads.h"
 #include "sws_utils.h"
 #include "out/placebo/utils.h"
@@ -175,7 +177,7 @@ static bool mp_image_alloc_planes(struct mp_image *mpi)
         return false;
 
     // Note: mp_image_pool assumes this creates only 1 AVBufferRef.
-    mpi->bufs[0] = av_buffer_alloc(size + align);
+    mpi->bufs[0] = mp_image_buffers_alloc(size + align);
     if (!mpi->bufs[0])
         return false;
 
@@ -450,41 +452,40 @@ void mp_image_unrefp(struct mp_image **p_img)
     *p_img = NULL;
 }
 
-void memcpy_pic(void *dst, const void *src, int bytesPerLine, int height,
-                int dstStride, int srcStride)
-{
-    if (bytesPerLine == dstStride && dstStride == srcStride && height) {
-        if (srcStride < 0) {
-            src = (uint8_t*)src + (height - 1) * srcStride;
-            dst = (uint8_t*)dst + (height - 1) * dstStride;
-            srcStride = -srcStride;
-        }
-
-        memcpy(dst, src, srcStride * (height - 1) + bytesPerLine);
-    } else {
-        for (int i = 0; i < height; i++) {
-            memcpy(dst, src, bytesPerLine);
-            src = (uint8_t*)src + srcStride;
-            dst = (uint8_t*)dst + dstStride;
-        }
-    }
-}
-
-void mp_image_copy(struct mp_image *dst, struct mp_image *src)
+static void copy_image(struct mp_image *dst, struct mp_image *src, bool stream)
 {
     assert(dst->imgfmt == src->imgfmt);
     assert(dst->w == src->w && dst->h == src->h);
     assert(mp_image_is_writeable(dst));
+    // Copy all planes at once, so that they can be split across threads.
+    struct memcpy_pic_plane planes[MP_MAX_PLANES];
     for (int n = 0; n < dst->num_planes; n++) {
-        int line_bytes = (mp_image_plane_w(dst, n) * dst->fmt.bpp[n] + 7) / 8;
-        int plane_h = mp_image_plane_h(dst, n);
-        memcpy_pic(dst->planes[n], src->planes[n], line_bytes, plane_h,
-                   dst->stride[n], src->stride[n]);
+        planes[n] = (struct memcpy_pic_plane){
+            .dst = dst->planes[n],
+            .src = src->planes[n],
+            .bytes = (mp_image_plane_w(dst, n) * dst->fmt.bpp[n] + 7) / 8,
+            .height = mp_image_plane_h(dst, n),
+            .dst_stride = dst->stride[n],
+            .src_stride = src->stride[n],
+        };
     }
+    memcpy_pic_planes(planes, dst->num_planes, stream);
     if (dst->fmt.flags & MP_IMGFLAG_PAL)
         memcpy(dst->planes[1], src->planes[1], AVPALETTE_SIZE);
 }
 
+void mp_image_copy(struct mp_image *dst, struct mp_image *src)
+{
+    copy_image(dst, src, false);
+}
+
+// Like mp_image_copy(), for destinations the CPU does not read again soon,
+// such as mapped video memory. Large frames bypass the CPU caches.
+void mp_image_copy_stream(struct mp_image *dst, struct mp_image *src)
+{
+    copy_image(dst, src, true);
+}
+
 static enum pl_color_system mp_image_params_get_forced_csp(struct mp_image_params *params)
 {
     int imgfmt = params->hw_subfmt ? params->hw_subfmt : params->imgfmt;
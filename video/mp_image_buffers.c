@@ -0,0 +1,395 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "config.h"
+
+#if HAVE_POSIX
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <libavutil/buffer.h>
+#include <libavutil/mem.h>
+
+#include "mpv_talloc.h"
+
+#include "common/common.h"
+#include "mp_image_buffers.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
+
+// Smaller allocations are cheap enough, and not worth caching.
+#define MIN_SIZE (64 * 1024)
+
+// Maximum number of unused buffers kept.
+#define MAX_BUFFERS 64
+
+// Sizes are rounded up to classes, with 8 classes per power of 2. This lets
+// images of slightly different size share buffers, and wastes at most 12.5%.
+#define CLASS_BITS 3
+
+// Hugepages are used for buffers of at least this size only. Sizes are rounded
+// up to HUGE_PAGE_SIZE, which wastes less than 25% of memory this way.
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HUGE_MIN_SIZE (4 * HUGE_PAGE_SIZE)
+
+// How a buffer was allocated.
+enum {
+    METHOD_MALLOC,      // av_malloc()
+    METHOD_MMAP,        // mmap(), possibly with MADV_HUGEPAGE
+    METHOD_MASK = 3,
+};
+
+// The free callback's opaque value is the allocated size, which is always a
+// multiple of 1 << 13, with the method and the NUMA node + 1 in the low bits.
+#define OPAQUE_NODE_SHIFT 2
+#define OPAQUE_MASK ((1 << 13) - 1)
+
+struct cached_buffer {
+    uint8_t *data;
+    size_t size;            // allocated size (a size class)
+    int method;
+    int node;               // NUMA node of the allocating thread, or -1
+    int64_t last_used;      // mp_time_ns() when it was freed
+};
+
+struct owner_config {
+    void *owner;
+    int64_t max_bytes;
+    double max_age;
+    enum mp_image_buffers_alloc alloc;
+    bool numa;
+};
+
+static mp_static_mutex cache_lock = MP_STATIC_MUTEX_INITIALIZER;
+
+// All fields protected by cache_lock.
+static struct {
+    struct owner_config *owners;
+    int num_owners;
+
+    // Combined configuration of all owners.
+    int64_t max_bytes;
+    int64_t max_age_ns;
+    enum mp_image_buffers_alloc alloc;
+    bool numa;
+
+    // Unused buffers, from least to most recently used.
+    struct cached_buffer buffers[MAX_BUFFERS];
+    int num_buffers;
+
+    struct mp_image_buffers_stats stats;
+} cache;
+
+static size_t size_class(size_t size)
+{
+    int bits = (int)mp_log2(size) - CLASS_BITS;
+    size_t step = (size_t)1 << MPMAX(bits, 0);
+    return (size + step - 1) & ~(step - 1);
+}
+
+static int current_numa_node(void)
+{
+#if HAVE_POSIX && defined(SYS_getcpu)
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+        return node;
+#endif
+    return -1;
+}
+
+static uint8_t *alloc_memory(size_t size, enum mp_image_buffers_alloc alloc,
+                             int *method)
+{
+#if HAVE_POSIX && defined(MAP_ANONYMOUS)
+    if (*method == METHOD_MMAP) {
+        int prot = PROT_READ | PROT_WRITE;
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        // Fails if no hugepages are reserved (vm.nr_hugepages).
+        if (alloc == MP_IMAGE_BUFFERS_ALLOC_HUGETLB)
+            p = mmap(NULL, size, prot, flags | MAP_HUGETLB, -1, 0);
+#endif
+        if (p == MAP_FAILED) {
+            p = mmap(NULL, size, prot, flags, -1, 0);
+#ifdef MADV_HUGEPAGE
+            if (p != MAP_FAILED)
+                madvise(p, size, MADV_HUGEPAGE);
+#endif
+        }
+        // Note that pages are not touched here. With the kernel's default
+        // first-touch policy, they are placed on the NUMA node of the thread
+        // that writes the frame first.
+        if (p != MAP_FAILED)
+            return p;
+    }
+#endif
+    *method = METHOD_MALLOC;
+    return av_malloc(size);
+}
+
+static void free_memory(uint8_t *data, size_t size, int method)
+{
+#if HAVE_POSIX && defined(MAP_ANONYMOUS)
+    if (method == METHOD_MMAP) {
+        munmap(data, size);
+        return;
+    }
+#endif
+    av_free(data);
+}
+
+// Free callback for buffers allocated while the cache was disabled.
+static void free_uncached(void *opaque, uint8_t *data)
+{
+    uintptr_t v = (uintptr_t)opaque;
+    free_memory(data, v & ~(uintptr_t)OPAQUE_MASK, v & METHOD_MASK);
+}
+
+// Remove the oldest buffer. The caller must free_memory() the returned buffer.
+static struct cached_buffer evict_oldest(void)
+{
+    assert(cache.num_buffers > 0);
+    struct cached_buffer b = cache.buffers[0];
+    cache.stats.retained -= b.size;
+    MP_TARRAY_REMOVE_AT(cache.buffers, cache.num_buffers, 0);
+    return b;
+}
+
+// Evict buffers until extra bytes fit into the cache, and buffers which were
+// not used for too long. Evicted buffers are appended to victims.
+static void trim(int64_t extra, struct cached_buffer *victims, int *num_victims)
+{
+    int64_t now = mp_time_ns();
+    while (cache.num_buffers &&
+           (cache.stats.retained + extra > cache.max_bytes ||
+            now - cache.buffers[0].last_used > cache.max_age_ns))
+    {
+        victims[(*num_victims)++] = evict_oldest();
+    }
+}
+
+static void free_victims(struct cached_buffer *victims, int num_victims)
+{
+    for (int n = 0; n < num_victims; n++)
+        free_memory(victims[n].data, victims[n].size, victims[n].method);
+}
+
+static void *make_opaque(size_t size, int method, int node)
+{
+    assert(!(size & OPAQUE_MASK));
+    node = node >= 0 && node < 255 ? node + 1 : 0;
+    return (void *)(uintptr_t)(size | method | (node << OPAQUE_NODE_SHIFT));
+}
+
+static void free_buffer(void *opaque, uint8_t *data)
+{
+    uintptr_t v = (uintptr_t)opaque;
+    size_t size = v & ~(uintptr_t)OPAQUE_MASK;
+    int method = v & METHOD_MASK;
+    int node = (int)((v & OPAQUE_MASK) >> OPAQUE_NODE_SHIFT) - 1;
+    struct cached_buffer victims[MAX_BUFFERS + 1];
+    int num_victims = 0;
+
+    mp_mutex_lock(&cache_lock);
+    cache.stats.in_use -= size;
+    if ((int64_t)size <= cache.max_bytes) {
+        trim(size, victims, &num_victims);
+        if (cache.num_buffers == MAX_BUFFERS)
+            victims[num_victims++] = evict_oldest();
+        cache.buffers[cache.num_buffers++] = (struct cached_buffer){
+            .data = data,
+            .size = size,
+            .method = method,
+            .node = node,
+            .last_used = mp_time_ns(),
+        };
+        cache.stats.retained += size;
+        data = NULL;
+    } else {
+        trim(0, victims, &num_victims);
+    }
+    mp_mutex_unlock(&cache_lock);
+
+    free_victims(victims, num_victims);
+    if (data)
+        free_memory(data, size, method);
+}
+
+struct AVBufferRef *mp_image_buffers_alloc(size_t size)
+{
+    if (size < MIN_SIZE || size > UINT32_MAX)
+        return av_buffer_alloc(size);
+
+    size_t alloc_size = size_class(size);
+    struct cached_buffer buf = {0};
+    struct cached_buffer victims[MAX_BUFFERS];
+    int num_victims = 0;
+
+    mp_mutex_lock(&cache_lock);
+    bool enabled = cache.max_bytes > 0;
+    enum mp_image_buffers_alloc alloc = cache.alloc;
+    bool huge = alloc != MP_IMAGE_BUFFERS_ALLOC_DEFAULT && size >= HUGE_MIN_SIZE;
+    if (huge)
+        alloc_size = MP_ALIGN_UP(alloc_size, HUGE_PAGE_SIZE);
+    int node = cache.numa ? current_numa_node() : -1;
+    if (enabled) {
+        trim(0, victims, &num_victims);
+        // Prefer the most recently used buffer, which is more likely to be
+        // still in the CPU cache. Memory from other NUMA nodes is not reused,
+        // because accessing it would be slower.
+        for (int n = cache.num_buffers - 1; n >= 0; n--) {
+            struct cached_buffer *b = &cache.buffers[n];
+            if (b->size == alloc_size && (node < 0 || b->node == node)) {
+                buf = *b;
+                cache.stats.retained -= b->size;
+                MP_TARRAY_REMOVE_AT(cache.buffers, cache.num_buffers, n);
+                break;
+            }
+        }
+        if (buf.data) {
+            cache.stats.hits += 1;
+        } else {
+            cache.stats.misses += 1;
+        }
+        cache.stats.in_use += alloc_size;
+    }
+    mp_mutex_unlock(&cache_lock);
+
+    free_victims(victims, num_victims);
+
+    if (!enabled && !huge)
+        return av_buffer_alloc(size);
+
+    if (!buf.data) {
+        buf.size = alloc_size;
+        buf.method = huge ? METHOD_MMAP : METHOD_MALLOC;
+        buf.node = node;
+        buf.data = alloc_memory(alloc_size, alloc, &buf.method);
+    }
+
+    void *opaque = make_opaque(buf.size, buf.method, buf.node);
+    AVBufferRef *ref = NULL;
+    if (buf.data) {
+        ref = av_buffer_create(buf.data, size,
+                               enabled ? free_buffer : free_uncached, opaque, 0);
+    }
+    if (!ref) {
+        if (buf.data) {
+            free_memory(buf.data, buf.size, buf.method);
+        }
+        if (enabled) {
+            mp_mutex_lock(&cache_lock);
+            cache.stats.in_use -= alloc_size;
+            mp_mutex_unlock(&cache_lock);
+        }
+    }
+    return ref;
+}
+
+// Combine the owner configurations, and free buffers exceeding the new limits.
+static void update_config(void)
+{
+    struct cached_buffer victims[MAX_BUFFERS];
+    int num_victims = 0;
+
+    mp_mutex_lock(&cache_lock);
+    cache.max_bytes = 0;
+    cache.max_age_ns = 0;
+    cache.alloc = MP_IMAGE_BUFFERS_ALLOC_DEFAULT;
+    cache.numa = false;
+    for (int n = 0; n < cache.num_owners; n++) {
+        struct owner_config *c = &cache.owners[n];
+        cache.max_bytes = MPMAX(cache.max_bytes, c->max_bytes);
+        cache.max_age_ns = MPMAX(cache.max_age_ns, MP_TIME_S_TO_NS(c->max_age));
+        cache.alloc = MPMAX(cache.alloc, c->alloc);
+        cache.numa |= c->numa;
+    }
+    trim(0, victims, &num_victims);
+    if (!cache.num_owners) {
+        TA_FREEP(&cache.owners);
+        while (cache.num_buffers)
+            victims[num_victims++] = evict_oldest();
+    }
+    mp_mutex_unlock(&cache_lock);
+
+    free_victims(victims, num_victims);
+}
+
+void mp_image_buffers_configure(void *owner, int64_t max_bytes, double max_age,
+                                enum mp_image_buffers_alloc alloc, bool numa)
+{
+    struct owner_config c = {
+        .owner = owner,
+        .max_bytes = MPMAX(max_bytes, 0),
+        .max_age = MPMAX(max_age, 0),
+        .alloc = alloc,
+        .numa = numa,
+    };
+
+    mp_mutex_lock(&cache_lock);
+    int n = 0;
+    while (n < cache.num_owners && cache.owners[n].owner != owner)
+        n++;
+    if (n == cache.num_owners) {
+        MP_TARRAY_APPEND(NULL, cache.owners, cache.num_owners, c);
+    } else {
+        cache.owners[n] = c;
+    }
+    mp_mutex_unlock(&cache_lock);
+
+    update_config();
+}
+
+void mp_image_buffers_unconfigure(void *owner)
+{
+    mp_mutex_lock(&cache_lock);
+    for (int n = 0; n < cache.num_owners; n++) {
+        if (cache.owners[n].owner == owner) {
+            MP_TARRAY_REMOVE_AT(cache.owners, cache.num_owners, n);
+            break;
+        }
+    }
+    mp_mutex_unlock(&cache_lock);
+
+    update_config();
+}
+
+void mp_image_buffers_flush(void)
+{
+    struct cached_buffer victims[MAX_BUFFERS];
+    int num_victims = 0;
+
+    mp_mutex_lock(&cache_lock);
+    while (cache.num_buffers)
+        victims[num_victims++] = evict_oldest();
+    mp_mutex_unlock(&cache_lock);
+
+    free_victims(victims, num_victims);
+}
+
+void mp_image_buffers_get_stats(struct mp_image_buffers_stats *st)
+{
+    mp_mutex_lock(&cache_lock);
+    *st = cache.stats;
+    mp_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Process-wide cache of image data buffers, used by mp_image_alloc(). Freed
+// buffers are kept around for reuse by later allocations of a similar size,
+// which avoids repeated allocation and page fault costs with large frames.
+// The cache is disabled unless an owner (such as a player instance) enables it.
+// All functions are thread-safe.
+
+struct AVBufferRef;
+
+struct mp_image_buffers_stats {
+    uint64_t hits;          // allocations served from the cache
+    uint64_t misses;        // allocations while the cache was enabled
+    int64_t retained;       // bytes of unused buffers kept in the cache
+    int64_t in_use;         // bytes of buffers allocated via the cache
+};
+
+enum mp_image_buffers_alloc {
+    MP_IMAGE_BUFFERS_ALLOC_DEFAULT, // av_malloc()
+    MP_IMAGE_BUFFERS_ALLOC_THP,     // mmap() with MADV_HUGEPAGE for large frames
+    MP_IMAGE_BUFFERS_ALLOC_HUGETLB, // try MAP_HUGETLB first, then like THP
+};
+
+// Set the configuration requested by owner, which is an arbitrary unique
+// pointer. max_bytes is the maximum total size of unused buffers kept in the
+// cache, and max_age the maximum time they are kept. max_bytes==0 requests no
+// cache. alloc selects how large buffers are allocated. If numa is set, cached
+// buffers are only reused on the NUMA node of the thread that allocated them.
+// With multiple owners, the largest limits, the last alloc value in the enum,
+// and numa if any owner sets it are used.
+void mp_image_buffers_configure(void *owner, int64_t max_bytes, double max_age,
+                                enum mp_image_buffers_alloc alloc, bool numa);
+
+// Remove the configuration of owner. If no owner is left, the cache is
+// disabled, and all unused buffers are freed.
+void mp_image_buffers_unconfigure(void *owner);
+
+// Allocate a buffer of at least the given size (like av_buffer_alloc()).
+struct AVBufferRef *mp_image_buffers_alloc(size_t size);
+
+// Free all unused buffers.
+void mp_image_buffers_flush(void);
+
+void mp_image_buffers_get_stats(struct mp_image_buffers_stats *st);
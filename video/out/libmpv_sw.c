@@ -1,5 +1,6 @@
 #include "libmpv/render_gl.h"
 #include "libmpv.h"
+#include "sub/draw_bmp.h"
 #include "sub/osd.h"
 #include "video/sws_utils.h"
 
@@ -13,8 +14,126 @@ struct priv {
     struct mp_rect src_rc, dst_rc;
     struct mp_osd_res osd_rc;
     bool anything_changed;
+
+    // For blending OSD while scaling (see blend_osd()).
+    bool can_blend;                 // dst_params is supported by blend_osd()
+    int blend_bpp;                  // bytes per pixel
+    int blend_offsets[3];           // byte offsets of R, G, B in a pixel
+    struct mp_draw_sub_cache *osd_cache;
+    struct mp_image *osd_overlay;   // overlay for the current frame, or NULL
+    struct mp_rect osd_act_rcs[64];
+    int num_osd_act_rcs;
+    struct mp_image *target;        // full target image during render()
 };
 
+// Check whether blend_osd() supports the format: packed 8 bit RGB without alpha.
+static bool setup_blend(struct priv *p, struct mp_imgfmt_desc *desc)
+{
+    if (!(desc->flags & MP_IMGFLAG_HAS_COMPS) || !(desc->flags & MP_IMGFLAG_NE) ||
+        !(desc->flags & MP_IMGFLAG_TYPE_UINT) || desc->comps[3].size ||
+        (desc->bpp[0] != 24 && desc->bpp[0] != 32))
+        return false;
+
+    for (int n = 0; n < 3; n++) {
+        struct mp_imgfmt_comp_desc *c = &desc->comps[n];
+        if (c->plane != 0 || c->size != 8 || c->pad || c->offset % 8)
+            return false;
+        p->blend_offsets[n] = c->offset / 8;
+    }
+
+    p->blend_bpp = desc->bpp[0] / 8;
+    return true;
+}
+
+// Blend the OSD overlay (premultiplied BGRA) onto the part rc of the target.
+// This is the same operation as mp_draw_sub_bitmaps() performs for such
+// formats, but can be done on any part of the image at any time.
+static void blend_osd(struct priv *p, struct mp_image *dst, struct mp_rect rc)
+{
+    struct mp_image *ov = p->osd_overlay;
+    int bpp = p->blend_bpp;
+    int r_o = p->blend_offsets[0], g_o = p->blend_offsets[1],
+        b_o = p->blend_offsets[2];
+
+    for (int n = 0; n < p->num_osd_act_rcs; n++) {
+        struct mp_rect brc = rc;
+        if (!mp_rect_intersection(&brc, &p->osd_act_rcs[n]))
+            continue;
+
+        for (int y = brc.y0; y < brc.y1; y++) {
+            uint8_t *d = mp_image_pixel_ptr(dst, 0, brc.x0, y);
+            uint8_t *s = mp_image_pixel_ptr(ov, 0, brc.x0, y);
+
+            for (int x = brc.x0; x < brc.x1; x++) {
+                unsigned a = 255u - s[3];
+                d[r_o] = s[2] + d[r_o] * a / 255u;
+                d[g_o] = s[1] + d[g_o] * a / 255u;
+                d[b_o] = s[0] + d[b_o] * a / 255u;
+                d += bpp;
+                s += 4;
+            }
+        }
+    }
+}
+
+// Called by mp_sws_scale() for each part of the video written to dst (which is
+// cropped to dst_rc), possibly from multiple threads.
+static void video_written(void *opaque, struct mp_image *dst, struct mp_rect rc)
+{
+    struct priv *p = opaque;
+
+    rc.x0 += p->dst_rc.x0;
+    rc.y0 += p->dst_rc.y0;
+    rc.x1 += p->dst_rc.x0;
+    rc.y1 += p->dst_rc.y0;
+    blend_osd(p, p->target, rc);
+}
+
+// Render the OSD overlay for the current frame. Returns false if there is no
+// visible OSD.
+static bool render_osd_overlay(struct render_backend *ctx, double pts)
+{
+    struct priv *p = ctx->priv;
+
+    p->osd_overlay = NULL;
+    p->num_osd_act_rcs = 0;
+
+    struct sub_bitmap_list *sbs =
+        osd_render(p->osd, p->osd_rc, pts, 0, mp_draw_sub_formats);
+
+    if (sbs->num_items) {
+        if (!p->osd_cache)
+            p->osd_cache = mp_draw_sub_alloc(p, ctx->global);
+
+        struct mp_rect mod_rc[1];
+        int num_mod_rc = 0;
+
+        p->osd_overlay = mp_draw_sub_overlay(p->osd_cache, sbs,
+                            p->osd_act_rcs, MP_ARRAY_SIZE(p->osd_act_rcs),
+                            &p->num_osd_act_rcs,
+                            mod_rc, MP_ARRAY_SIZE(mod_rc), &num_mod_rc);
+        if (!p->osd_overlay) {
+            MP_WARN(ctx, "Failed rendering OSD.\n");
+            p->num_osd_act_rcs = 0;
+        }
+    }
+
+    talloc_free(sbs);
+
+    // Rectangles outside of the target image or overlay are never blended.
+    struct mp_rect clip = {0, 0, MPMIN(p->dst_params.w, p->osd_rc.w),
+                                 MPMIN(p->dst_params.h, p->osd_rc.h)};
+    int num_rcs = 0;
+    for (int n = 0; n < p->num_osd_act_rcs; n++) {
+        struct mp_rect rc = p->osd_act_rcs[n];
+        if (mp_rect_intersection(&rc, &clip))
+            p->osd_act_rcs[num_rcs++] = rc;
+    }
+    p->num_osd_act_rcs = num_rcs;
+
+    return num_rcs > 0;
+}
+
 static int init(struct render_backend *ctx, mpv_render_param *params)
 {
     ctx->priv = talloc_zero(NULL, struct priv);
@@ -131,6 +250,8 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
             desc.num_planes != 1)
             return MPV_ERROR_UNSUPPORTED;
 
+        p->can_blend = setup_blend(p, &desc);
+
         mp_image_params_guess_csp(&p->dst_params);
 
         // Can be unset if rendering before any video was loaded.
@@ -161,6 +282,15 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
     wrap_img.stride[0] = *stride;
 
     struct mp_image *img = frame->current;
+    double pts = img ? img->pts : 0;
+
+    // If possible, blend the OSD onto each part of the video as soon as the
+    // scaler has written it, instead of in a separate pass over the image.
+    bool blend = p->osd && p->can_blend && render_osd_overlay(ctx, pts);
+    p->target = &wrap_img;
+    p->sws->dst_written = blend ? video_written : NULL;
+    p->sws->dst_written_opaque = p;
+
     if (img) {
         assert(p->src_params.imgfmt);
 
@@ -176,15 +306,32 @@ static int render(struct render_backend *ctx, mpv_render_param *params,
         mp_image_crop_rc(&dst, p->dst_rc);
 
         if (mp_sws_scale(p->sws, &dst, &src) < 0) {
+            p->sws->dst_written = NULL;
             mp_image_clear(&wrap_img, 0, 0, wrap_img.w, wrap_img.h);
             return MPV_ERROR_GENERIC;
         }
+
+        if (blend) {
+            // Borders outside of the video.
+            struct mp_rect rc = p->dst_rc;
+            int w = wrap_img.w, h = wrap_img.h;
+            blend_osd(p, &wrap_img, (struct mp_rect){0, 0, w, rc.y0});
+            blend_osd(p, &wrap_img, (struct mp_rect){0, rc.y1, w, h});
+            blend_osd(p, &wrap_img, (struct mp_rect){0, rc.y0, rc.x0, rc.y1});
+            blend_osd(p, &wrap_img, (struct mp_rect){rc.x1, rc.y0, w, rc.y1});
+        }
     } else {
         mp_image_clear(&wrap_img, 0, 0, wrap_img.w, wrap_img.h);
+
+        if (blend)
+            blend_osd(p, &wrap_img, (struct mp_rect){0, 0, wrap_img.w, wrap_img.h});
     }
 
-    if (p->osd)
-        osd_draw_on_image(p->osd, p->osd_rc, img ? img->pts : 0, 0, &wrap_img);
+    p->sws->dst_written = NULL;
+    p->target = NULL;
+
+    if (p->osd && !p->can_blend)
+        osd_draw_on_image(p->osd, p->osd_rc, pts, 0, &wrap_img);
 
     return 0;
 }
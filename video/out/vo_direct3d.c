@@ -1016,7 +1016,7 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
     if (!frame->current)
         return;
 
-    mp_image_copy(&buffer, frame->current);
+    mp_image_copy_stream(&buffer, frame->current);
 
     d3d_unlock_video_objects(priv);
 
@@ -896,7 +896,7 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
         if (!lock_texture(vo, &texmpi))
             return;
 
-        mp_image_copy(&texmpi, frame->current);
+        mp_image_copy_stream(&texmpi, frame->current);
 
         SDL_UnlockTexture(vc->tex);
     }
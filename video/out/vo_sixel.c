@@ -28,6 +28,8 @@
 #include <sixel.h>
 
 #include "config.h"
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
 #include "options/m_config.h"
 #include "osdep/terminal.h"
 #include "sub/osd.h"
@@ -44,6 +46,9 @@
 #define TERMINAL_FALLBACK_PX_WIDTH  320
 #define TERMINAL_FALLBACK_PX_HEIGHT 240
 
+// Palette change threshold used by incremental mode if none is set.
+#define INCREMENTAL_THRESHOLD 10
+
 struct vo_sixel_opts {
     int diffuse;
     int reqcolors;
@@ -54,6 +59,7 @@ struct vo_sixel_opts {
     int rows, cols;
     bool config_clear, alt_screen;
     bool buffered;
+    bool incremental;
 };
 
 struct priv {
@@ -80,6 +86,15 @@ struct priv {
     struct mp_osd_res osd;
     struct mp_image *frame;
     struct mp_sws_context *sws;
+
+    // For incremental mode.
+    int cell_height;        // terminal cell height in px, 0 if unknown
+    int encode_cell_height; // cell_height used by encode_image()
+    uint8_t *prev_buffer;   // image currently on the terminal
+    bool full_frame;        // prev_buffer is invalid, or the palette changed
+    struct mp_thread_pool *encoder;
+    struct mp_waiter encode_done;
+    bool encoding;          // encode_image() is running on the encoder
 };
 
 static const unsigned int depth = 3;
@@ -90,8 +105,14 @@ static int detect_scene_change(struct vo* vo)
     int previous_histogram_colors = priv->previous_histogram_colors;
     int histogram_colors = 0;
 
+    // Incremental mode can only skip unchanged parts of the image as long as
+    // the palette is kept.
+    int threshold = priv->opts.threshold;
+    if (threshold < 0 && priv->opts.incremental)
+        threshold = INCREMENTAL_THRESHOLD;
+
     // If threshold is set negative, then every frame must be a scene change
-    if (priv->dither == NULL || priv->opts.threshold < 0)
+    if (priv->dither == NULL || threshold < 0)
         return 1;
 
     histogram_colors = sixel_dither_get_num_of_histogram_colors(priv->testdither);
@@ -101,7 +122,7 @@ static int detect_scene_change(struct vo* vo)
                               color_difference_count : -color_difference_count;
 
     if (100 * color_difference_count >
-        priv->opts.threshold * previous_histogram_colors)
+        threshold * previous_histogram_colors)
     {
         priv->previous_histogram_colors = histogram_colors; // update history
         return 1;
@@ -120,6 +141,8 @@ static void dealloc_dithers_and_buffers(struct vo* vo)
         priv->buffer = NULL;
     }
 
+    TA_FREEP(&priv->prev_buffer);
+
     if (priv->frame) {
         talloc_free(priv->frame);
         priv->frame = NULL;
@@ -146,6 +169,7 @@ static SIXELSTATUS prepare_static_palette(struct vo* vo)
             return SIXEL_FALSE;
 
         sixel_dither_set_diffusion_type(priv->dither, priv->opts.diffuse);
+        priv->full_frame = true;
     }
 
     sixel_dither_set_body_only(priv->dither, 0);
@@ -174,6 +198,7 @@ static SIXELSTATUS prepare_dynamic_palette(struct vo *vo)
         }
 
         priv->dither = priv->testdither;
+        priv->full_frame = true;
         status = sixel_dither_new(&priv->testdither, priv->opts.reqcolors, NULL);
 
         if (SIXEL_FAILED(status))
@@ -198,6 +223,7 @@ static void update_canvas_dimensions(struct vo *vo)
     int num_cols        = TERMINAL_FALLBACK_COLS;
     int total_px_width  = 0;
     int total_px_height = 0;
+    bool px_known       = true;
 
     terminal_get_size2(&num_rows, &num_cols, &total_px_width, &total_px_height);
 
@@ -234,6 +260,7 @@ static void update_canvas_dimensions(struct vo *vo)
     } else {
         if (total_px_height <= 0) {
             total_px_height = TERMINAL_FALLBACK_PX_HEIGHT;
+            px_known = false;
         } else {
             if (priv->opts.pad_y >= 0 && priv->opts.pad_y < total_px_height / 2) {
                 total_px_height -= (2 * priv->opts.pad_y);
@@ -252,6 +279,9 @@ static void update_canvas_dimensions(struct vo *vo)
     vo->dheight = total_px_height * (num_rows - 1) / num_rows / 6 * 6;
     vo->dwidth  = total_px_width;
 
+    // Needed to position partial images in incremental mode.
+    priv->cell_height = px_known ? total_px_height / num_rows : 0;
+
     priv->num_rows = num_rows;
     priv->num_cols = num_cols;
 
@@ -318,6 +348,11 @@ static int update_sixel_swscaler(struct vo *vo, struct mp_image_params *params)
 
     priv->buffer =
         talloc_array(NULL, uint8_t, depth * priv->width * priv->height);
+    if (priv->opts.incremental) {
+        priv->prev_buffer =
+            talloc_array(NULL, uint8_t, depth * priv->width * priv->height);
+    }
+    priv->full_frame = true;
 
     return 0;
 }
@@ -361,10 +396,122 @@ static inline void sixel_strwrite(char *s)
     sixel_write(s, strlen(s), stdout);
 }
 
+static void goto_cell(struct vo *vo, int row, int col)
+{
+    struct priv *priv = vo->priv;
+    char *s = talloc_asprintf(NULL, TERM_ESC_GOTO_YX, row, col);
+    if (priv->opts.buffered) {
+        priv->sixel_output_buf =
+            talloc_strdup_append_buffer(priv->sixel_output_buf, s);
+    } else {
+        sixel_strwrite(s);
+    }
+    talloc_free(s);
+}
+
+static int gcd(int a, int b)
+{
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static bool band_changed(struct priv *priv, int y0, int y1)
+{
+    size_t stride = depth * priv->width;
+    return memcmp(priv->buffer + y0 * stride, priv->prev_buffer + y0 * stride,
+                  (y1 - y0) * stride) != 0;
+}
+
+// Encode priv->buffer and write it to the terminal. In incremental mode, only
+// the bands which changed since the previous image are sent, each as separate
+// image positioned at the start of its cell row. Bands are multiples of both
+// the cell height and the sixel height, so that each image starts at a cell
+// and does not overwrite pixels below it.
+static void encode_image(struct vo *vo)
+{
+    struct priv *priv = vo->priv;
+    int cell_h = priv->encode_cell_height;
+    size_t stride = depth * priv->width;
+
+    if (priv->opts.buffered)
+        priv->sixel_output_buf = talloc_strdup(NULL, "");
+
+    if (!priv->prev_buffer || !cell_h || priv->full_frame) {
+        goto_cell(vo, priv->top, priv->left);
+        sixel_encode(priv->buffer, priv->width, priv->height,
+                     depth, priv->dither, priv->output);
+    } else {
+        int band_h = cell_h / gcd(cell_h, 6) * 6;
+        int y = 0;
+        while (y < priv->height) {
+            int y1 = MPMIN(y + band_h, priv->height);
+            if (!band_changed(priv, y, y1)) {
+                y = y1;
+                continue;
+            }
+            // Merge with following changed bands, and single unchanged bands
+            // between them (sending them is cheaper than a new image).
+            int end = y1;
+            while (end < priv->height) {
+                int e1 = MPMIN(end + band_h, priv->height);
+                int e2 = MPMIN(e1 + band_h, priv->height);
+                if (band_changed(priv, end, e1)) {
+                    end = e1;
+                } else if (e1 < priv->height && band_changed(priv, e1, e2)) {
+                    end = e2;
+                } else {
+                    break;
+                }
+            }
+            goto_cell(vo, priv->top + y / cell_h, priv->left);
+            sixel_encode(priv->buffer + y * stride, priv->width, end - y,
+                         depth, priv->dither, priv->output);
+            y = end;
+        }
+    }
+
+    if (priv->opts.buffered) {
+        sixel_write(priv->sixel_output_buf,
+                    ta_get_size(priv->sixel_output_buf), stdout);
+        TA_FREEP(&priv->sixel_output_buf);
+    }
+
+    if (priv->prev_buffer) {
+        MPSWAP(uint8_t *, priv->buffer, priv->prev_buffer);
+        priv->full_frame = false;
+    }
+}
+
+static void encode_thread(void *ptr)
+{
+    struct vo *vo = ptr;
+    struct priv *priv = vo->priv;
+
+    encode_image(vo);
+    mp_waiter_wakeup(&priv->encode_done, 0);
+}
+
+// Wait until the encoder is done with the previous image. Must be called
+// before touching any state used by encode_image() (and writing to stdout).
+static void wait_encode(struct vo *vo)
+{
+    struct priv *priv = vo->priv;
+
+    if (priv->encoding) {
+        mp_waiter_wait(&priv->encode_done);
+        priv->encoding = false;
+    }
+}
+
 static int reconfig(struct vo *vo, struct mp_image_params *params)
 {
     struct priv *priv = vo->priv;
     int ret = 0;
+    wait_encode(vo);
     update_canvas_dimensions(vo);
     if (priv->canvas_ok) {  // if too small - succeed but skip the rendering
         set_sixel_output_parameters(vo);
@@ -396,6 +543,7 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
     if (prev_rows != priv->num_rows || prev_cols != priv->num_cols ||
         prev_width != vo->dwidth || prev_height != vo->dheight)
     {
+        wait_encode(vo);
         set_sixel_output_parameters(vo);
         // Not checking for vo->config_ok because draw_frame is never called
         // with a failed reconfig.
@@ -436,6 +584,9 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
     };
     osd_draw_on_image(vo->osd, dim, mpi ? mpi->pts : 0, 0, priv->frame);
 
+    // The previous image may still be encoded up to this point.
+    wait_encode(vo);
+
     // Copy from mpv to RGB format as required by libsixel
     memcpy_pic(priv->buffer, priv->frame->planes[0], priv->width * depth,
                priv->height, priv->width * depth, priv->frame->stride[0]);
@@ -473,20 +624,19 @@ static void flip_page(struct vo *vo)
     if (priv->buffer == NULL || priv->dither == NULL)
         return;
 
-    // Go to the offset row and column, then display the image
-    priv->sixel_output_buf = talloc_asprintf(NULL, TERM_ESC_GOTO_YX,
-                                             priv->top, priv->left);
-    if (!priv->opts.buffered)
-        sixel_strwrite(priv->sixel_output_buf);
-
-    sixel_encode(priv->buffer, priv->width, priv->height,
-                 depth, priv->dither, priv->output);
+    wait_encode(vo);
 
-    if (priv->opts.buffered)
-        sixel_write(priv->sixel_output_buf,
-                    ta_get_size(priv->sixel_output_buf), stdout);
+    // draw_frame() updates cell_height before it waits for the encoder.
+    priv->encode_cell_height = priv->cell_height;
 
-    talloc_free(priv->sixel_output_buf);
+    // In incremental mode, encode while the next frame is rendered.
+    if (priv->encoder) {
+        priv->encode_done = (struct mp_waiter)MP_WAITER_INITIALIZER;
+        priv->encoding = true;
+        mp_thread_pool_queue(priv->encoder, encode_thread, vo);
+    } else {
+        encode_image(vo);
+    }
 }
 
 static int preinit(struct vo *vo)
@@ -512,6 +662,12 @@ static int preinit(struct vo *vo)
 
     sixel_output_set_encode_policy(priv->output, SIXEL_ENCODEPOLICY_FAST);
 
+    if (priv->opts.incremental) {
+        priv->encoder = mp_thread_pool_create(vo, 1, 1, 1);
+        if (!priv->encoder)
+            MP_WARN(vo, "preinit: Failed to create encoder thread.\n");
+    }
+
     if (priv->opts.alt_screen)
         sixel_strwrite(TERM_ESC_ALT_SCREEN);
 
@@ -555,6 +711,9 @@ static void uninit(struct vo *vo)
 {
     struct priv *priv = vo->priv;
 
+    wait_encode(vo);
+    TA_FREEP(&priv->encoder);
+
     sixel_strwrite(TERM_ESC_RESTORE_CURSOR);
     terminal_set_mouse_input(false);
 
@@ -618,6 +777,7 @@ const struct vo_driver video_out_sixel = {
         {"config-clear", OPT_BOOL(opts.config_clear), },
         {"alt-screen", OPT_BOOL(opts.alt_screen), },
         {"buffered", OPT_BOOL(opts.buffered), },
+        {"incremental", OPT_BOOL(opts.incremental), },
         {0}
     },
     .options_prefix = "vo-sixel",
@@ -22,12 +22,17 @@
 #include <sys/ioctl.h>
 #endif
 
+#include <libavutil/cpu.h>
 #include <libswscale/swscale.h>
 
+#include "misc/thread_pool.h"
+#include "misc/thread_tools.h"
 #include "options/m_config.h"
+#include "options/m_option.h"
 #include "config.h"
 #include "osdep/terminal.h"
 #include "osdep/io.h"
+#include "osdep/timer.h"
 #include "vo.h"
 #include "sub/osd.h"
 #include "video/sws_utils.h"
@@ -41,6 +46,25 @@
 #define DEFAULT_WIDTH 80
 #define DEFAULT_HEIGHT 25
 
+#define MAX_THREADS 64
+
+// Minimum number of rows per thread.
+#define MIN_BAND_ROWS 8
+
+// If there are at most this many unchanged cells between two changed cells,
+// rewrite them instead of moving the cursor.
+#define MAX_GAP 4
+
+// Maximum number of bytes written per cell: cursor movement, 2 colors, glyph.
+#define MAX_CELL_BYTES (24 + 2 * 19 + 3)
+
+// With delta output, send a full frame at least this often, so that cells
+// overwritten by other terminal output don't stay broken.
+#define FULL_FRAME_NS MP_TIME_S_TO_NS(1)
+
+// Never a valid cell color.
+#define NO_COLOR UINT32_MAX
+
 static const bstr TERM_ESC_COLOR256_BG     = bstr0_lit("\033[48;5");
 static const bstr TERM_ESC_COLOR256_FG     = bstr0_lit("\033[38;5");
 static const bstr TERM_ESC_COLOR24BIT_BG   = bstr0_lit("\033[48;2");
@@ -62,6 +86,8 @@ struct vo_tct_opts {
     int width;   // 0 -> default
     int height;  // 0 -> default
     bool term256;  // 0 -> true color
+    bool delta;
+    int threads; // 0 -> auto
 };
 
 struct lut_item {
@@ -69,6 +95,17 @@ struct lut_item {
     uint8_t width;
 };
 
+struct row_buf {
+    char *start;
+    size_t len;
+};
+
+struct band {
+    struct vo *vo;
+    int y0, y1;
+    struct mp_waiter waiter;
+};
+
 struct priv {
     struct vo_tct_opts opts;
     size_t buffer_size;
@@ -80,6 +117,18 @@ struct priv {
     struct mp_sws_context *sws;
     bstr frame_buf;
     struct lut_item lut[256];
+
+    // Colors of each cell (background and foreground) for the current and
+    // the previous frame, swidth * sheight * 2 entries.
+    uint32_t *cells, *prev_cells;
+    bool prev_valid;                // prev_cells matches the terminal
+    int64_t last_full;              // time of the last full frame
+    struct row_buf *rows;           // sheight entries
+    int tx, ty;                     // position of the image on the terminal
+
+    struct mp_thread_pool *tp;
+    int threads;                    // including the VO thread
+    struct band bands[MAX_THREADS];
 };
 
 // Convert RGB24 to xterm-256 8-bit value
@@ -111,95 +160,163 @@ static int rgb_to_x256(uint8_t r, uint8_t g, uint8_t b)
     return color_err <= gray_err ? 16 + color_index() : 232 + gray_index;
 }
 
-static void print_seq3(bstr *frame, struct lut_item *lut, bstr prefix,
-                       uint8_t r, uint8_t g, uint8_t b)
+static void print_buffer(bstr *frame)
 {
-    bstr_xappend(NULL, frame, prefix);
-    bstr_xappend(NULL, frame, (bstr){ lut[r].str, lut[r].width });
-    bstr_xappend(NULL, frame, (bstr){ lut[g].str, lut[g].width });
-    bstr_xappend(NULL, frame, (bstr){ lut[b].str, lut[b].width });
-    bstr_xappend0(NULL, frame, "m");
+    fwrite(frame->start, frame->len, 1, stdout);
+    frame->len = 0;
 }
 
-static void print_seq1(bstr *frame, struct lut_item *lut, bstr prefix, uint8_t c)
+static char *put_str(char *d, bstr s)
 {
-    bstr_xappend(NULL, frame, prefix);
-    bstr_xappend(NULL, frame, (bstr){ lut[c].str, lut[c].width });
-    bstr_xappend0(NULL, frame, "m");
+    memcpy(d, s.start, s.len);
+    return d + s.len;
 }
 
-static void print_buffer(bstr *frame)
+static char *put_uint(char *d, unsigned int v)
 {
-    fwrite(frame->start, frame->len, 1, stdout);
-    frame->len = 0;
+    char tmp[10];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *d++ = tmp[--n];
+    return d;
 }
 
-static void write_plain(bstr *frame,
-    const int dwidth, const int dheight,
-    const int swidth, const int sheight,
-    const unsigned char *source, const int source_stride,
-    bool term256, struct lut_item *lut, enum vo_tct_buffering buffering)
+static char *put_color(char *d, struct priv *p, bstr prefix, uint32_t c)
 {
-    assert(source);
-    const int tx = (dwidth - swidth) / 2;
-    const int ty = (dheight - sheight) / 2;
-    for (int y = 0; y < sheight; y++) {
-        const unsigned char *row = source + y * source_stride;
-        bstr_xappend_asprintf(NULL, frame, TERM_ESC_GOTO_YX, ty + y, tx);
-        for (int x = 0; x < swidth; x++) {
-            unsigned char b = *row++;
-            unsigned char g = *row++;
-            unsigned char r = *row++;
-            if (term256) {
-                print_seq1(frame, lut, TERM_ESC_COLOR256_BG, rgb_to_x256(r, g, b));
-            } else {
-                print_seq3(frame, lut, TERM_ESC_COLOR24BIT_BG, r, g, b);
-            }
-            bstr_xappend0(NULL, frame, " ");
-            if (buffering <= VO_TCT_BUFFER_PIXEL)
-                print_buffer(frame);
-        }
-        bstr_xappend0(NULL, frame, TERM_ESC_CLEAR_COLORS);
-        if (buffering <= VO_TCT_BUFFER_LINE)
-            print_buffer(frame);
+    struct lut_item *lut = p->lut;
+    d = put_str(d, prefix);
+    if (p->opts.term256) {
+        d = put_str(d, (bstr){ lut[c].str, lut[c].width });
+    } else {
+        uint8_t r = c >> 16, g = c >> 8, b = c;
+        d = put_str(d, (bstr){ lut[r].str, lut[r].width });
+        d = put_str(d, (bstr){ lut[g].str, lut[g].width });
+        d = put_str(d, (bstr){ lut[b].str, lut[b].width });
+    }
+    *d++ = 'm';
+    return d;
+}
+
+static uint32_t get_color(struct priv *p, const unsigned char *px)
+{
+    unsigned char b = px[0], g = px[1], r = px[2];
+    if (p->opts.term256)
+        return rgb_to_x256(r, g, b);
+    return ((uint32_t)r << 16) | (g << 8) | b;
+}
+
+// Write a cell with the given colors. bg/fg are the colors currently set on
+// the terminal, and are updated.
+static char *put_cell(char *d, struct priv *p, const uint32_t *cell,
+                      uint32_t *bg, uint32_t *fg)
+{
+    if (cell[0] != *bg) {
+        d = put_color(d, p, p->opts.term256 ? TERM_ESC_COLOR256_BG
+                                            : TERM_ESC_COLOR24BIT_BG, cell[0]);
+        *bg = cell[0];
+    }
+    // With half-blocks, a cell with the same color for both halves is written
+    // as a space, which avoids setting the foreground color.
+    if (p->opts.algo == ALGO_PLAIN || cell[1] == cell[0]) {
+        *d++ = ' ';
+        return d;
     }
+    if (cell[1] != *fg) {
+        d = put_color(d, p, p->opts.term256 ? TERM_ESC_COLOR256_FG
+                                            : TERM_ESC_COLOR24BIT_FG, cell[1]);
+        *fg = cell[1];
+    }
+    return put_str(d, UNICODE_LOWER_HALF_BLOCK);
 }
 
-static void write_half_blocks(bstr *frame,
-    const int dwidth, const int dheight,
-    const int swidth, const int sheight,
-    unsigned char *source, int source_stride,
-    bool term256, struct lut_item *lut, enum vo_tct_buffering buffering)
+// Write the terminal output for row y of the image to p->rows[y], skipping
+// cells which did not change since the previous frame. If print_cells is set,
+// print the output after each cell instead.
+static void write_row(struct priv *p, int y, bool print_cells)
 {
-    assert(source);
-    const int tx = (dwidth - swidth) / 2;
-    const int ty = (dheight - sheight) / 2;
-    for (int y = 0; y < sheight * 2; y += 2) {
-        const unsigned char *row_up = source + y * source_stride;
-        const unsigned char *row_down = source + (y + 1) * source_stride;
-        bstr_xappend_asprintf(NULL, frame, TERM_ESC_GOTO_YX, ty + y / 2, tx);
-        for (int x = 0; x < swidth; x++) {
-            unsigned char b_up = *row_up++;
-            unsigned char g_up = *row_up++;
-            unsigned char r_up = *row_up++;
-            unsigned char b_down = *row_down++;
-            unsigned char g_down = *row_down++;
-            unsigned char r_down = *row_down++;
-            if (term256) {
-                print_seq1(frame, lut, TERM_ESC_COLOR256_BG, rgb_to_x256(r_up, g_up, b_up));
-                print_seq1(frame, lut, TERM_ESC_COLOR256_FG, rgb_to_x256(r_down, g_down, b_down));
-            } else {
-                print_seq3(frame, lut, TERM_ESC_COLOR24BIT_BG, r_up, g_up, b_up);
-                print_seq3(frame, lut, TERM_ESC_COLOR24BIT_FG, r_down, g_down, b_down);
-            }
-            bstr_xappend(NULL, frame, UNICODE_LOWER_HALF_BLOCK);
-            if (buffering <= VO_TCT_BUFFER_PIXEL)
-                print_buffer(frame);
+    const int mul = p->opts.algo == ALGO_PLAIN ? 1 : 2;
+    const unsigned char *row_up = mp_image_pixel_ptr(p->frame, 0, 0, y * mul);
+    const unsigned char *row_down = row_up + p->frame->stride[0] * (mul - 1);
+    uint32_t *cells = p->cells + (size_t)y * p->swidth * 2;
+    uint32_t *prev = p->prev_cells + (size_t)y * p->swidth * 2;
+
+    for (int x = 0; x < p->swidth; x++) {
+        cells[x * 2 + 0] = get_color(p, row_up + x * 3);
+        cells[x * 2 + 1] = mul == 2 ? get_color(p, row_down + x * 3) : 0;
+    }
+
+    bool full = !p->opts.delta || !p->prev_valid;
+    uint32_t bg = NO_COLOR, fg = NO_COLOR;
+    int pos = -1; // cursor column, -1 if not on this row
+    char *start = p->rows[y].start;
+    char *d = start;
+
+    for (int x = 0; x < p->swidth; x++) {
+        uint32_t *cell = &cells[x * 2];
+        if (!full && cell[0] == prev[x * 2] && cell[1] == prev[x * 2 + 1])
+            continue;
+        if (pos < 0 || x - pos > MAX_GAP) {
+            // TERM_ESC_GOTO_YX; terminal coordinates are 1-based.
+            d = put_str(d, bstr0("\033["));
+            d = put_uint(d, p->ty + y + 1);
+            *d++ = ';';
+            d = put_uint(d, p->tx + x + 1);
+            *d++ = 'f';
+        } else {
+            for (; pos < x; pos++)
+                d = put_cell(d, p, &cells[pos * 2], &bg, &fg);
+        }
+        d = put_cell(d, p, cell, &bg, &fg);
+        pos = x + 1;
+        if (print_cells) {
+            fwrite(start, d - start, 1, stdout);
+            d = start;
         }
-        bstr_xappend0(NULL, frame, TERM_ESC_CLEAR_COLORS);
-        if (buffering <= VO_TCT_BUFFER_LINE)
-            print_buffer(frame);
     }
+
+    if (pos >= 0)
+        d = put_str(d, bstr0(TERM_ESC_CLEAR_COLORS));
+
+    p->rows[y].len = d - start;
+}
+
+static void write_band(void *ptr)
+{
+    struct band *band = ptr;
+    struct priv *p = band->vo->priv;
+
+    for (int y = band->y0; y < band->y1; y++)
+        write_row(p, y, false);
+
+    mp_waiter_wakeup(&band->waiter, 0);
+}
+
+// Write all rows to p->rows[], using multiple threads if possible.
+static void write_rows(struct priv *p, struct vo *vo)
+{
+    int num_bands = MPCLAMP(p->sheight / MIN_BAND_ROWS, 1, p->threads);
+
+    for (int n = 0; n < num_bands; n++) {
+        p->bands[n] = (struct band){
+            .vo = vo,
+            .y0 = p->sheight * n / num_bands,
+            .y1 = p->sheight * (n + 1) / num_bands,
+            .waiter = MP_WAITER_INITIALIZER,
+        };
+    }
+
+    for (int n = 1; n < num_bands; n++)
+        mp_thread_pool_queue(p->tp, write_band, &p->bands[n]);
+
+    for (int y = p->bands[0].y0; y < p->bands[0].y1; y++)
+        write_row(p, y, false);
+
+    for (int n = 1; n < num_bands; n++)
+        mp_waiter_wait(&p->bands[n].waiter);
 }
 
 static void get_win_size(struct vo *vo, int *out_width, int *out_height) {
@@ -244,6 +361,18 @@ static int reconfig(struct vo *vo, struct mp_image_params *params)
 
     mp_image_clear(p->frame, 0, 0, p->frame->w, p->frame->h);
 
+    size_t num_cells = (size_t)p->swidth * p->sheight * 2;
+    p->cells = talloc_realloc(p, p->cells, uint32_t, num_cells);
+    p->prev_cells = talloc_realloc(p, p->prev_cells, uint32_t, num_cells);
+    p->prev_valid = false;
+
+    talloc_free(p->rows);
+    p->rows = talloc_zero_array(p, struct row_buf, p->sheight);
+    for (int y = 0; y < p->sheight; y++) {
+        p->rows[y].start = talloc_size(p->rows,
+            (size_t)p->swidth * MAX_CELL_BYTES + strlen(TERM_ESC_CLEAR_COLORS) + 1);
+    }
+
     if (mp_sws_reinit(p->sws) < 0)
         return -1;
 
@@ -257,6 +386,9 @@ static void draw_frame(struct vo *vo, struct vo_frame *frame)
 {
     struct priv *p = vo->priv;
     struct mp_image *src = frame->current;
+    // Redraws are requested when the terminal contents may be damaged.
+    if (frame->redraw)
+        p->prev_valid = false;
     if (!src)
         return;
     // XXX: pan, crop etc.
@@ -275,22 +407,36 @@ static void flip_page(struct vo *vo)
 
     WRITE_STR(TERM_ESC_SYNC_UPDATE_BEGIN);
 
-    p->frame_buf.len = 0;
-    if (p->opts.algo == ALGO_PLAIN) {
-        write_plain(&p->frame_buf,
-            vo->dwidth, vo->dheight, p->swidth, p->sheight,
-            p->frame->planes[0], p->frame->stride[0],
-            p->opts.term256, p->lut, p->opts.buffering);
+    p->tx = (vo->dwidth - p->swidth) / 2;
+    p->ty = (vo->dheight - p->sheight) / 2;
+
+    int64_t now = mp_time_ns();
+    if (now - p->last_full >= FULL_FRAME_NS)
+        p->prev_valid = false;
+    if (!p->prev_valid)
+        p->last_full = now;
+
+    // With pixel buffering, cells are printed while the rows are generated,
+    // which can't be done in parallel.
+    bool print_cells = p->opts.buffering <= VO_TCT_BUFFER_PIXEL;
+    if (print_cells) {
+        for (int y = 0; y < p->sheight; y++)
+            write_row(p, y, true);
     } else {
-        write_half_blocks(&p->frame_buf,
-            vo->dwidth, vo->dheight, p->swidth, p->sheight,
-            p->frame->planes[0], p->frame->stride[0],
-            p->opts.term256, p->lut, p->opts.buffering);
+        write_rows(p, vo);
+    }
+
+    p->frame_buf.len = 0;
+    for (int y = 0; y < p->sheight; y++) {
+        struct row_buf *row = &p->rows[y];
+        bstr_xappend(NULL, &p->frame_buf, (bstr){row->start, row->len});
+        if (p->opts.buffering <= VO_TCT_BUFFER_LINE)
+            print_buffer(&p->frame_buf);
     }
+    print_buffer(&p->frame_buf);
 
-    bstr_xappend0(NULL, &p->frame_buf, "\n");
-    if (p->opts.buffering <= VO_TCT_BUFFER_FRAME)
-        print_buffer(&p->frame_buf);
+    MPSWAP(uint32_t *, p->cells, p->prev_cells);
+    p->prev_valid = true;
 
     WRITE_STR(TERM_ESC_SYNC_UPDATE_END);
     fflush(stdout);
@@ -302,6 +448,7 @@ static void uninit(struct vo *vo)
     terminal_set_mouse_input(false);
     WRITE_STR(TERM_ESC_NORMAL_SCREEN);
     struct priv *p = vo->priv;
+    talloc_free(p->tp);
     talloc_free(p->frame);
     talloc_free(p->frame_buf.start);
 }
@@ -328,6 +475,18 @@ static int preinit(struct vo *vo)
         p->lut[i].width = out - p->lut[i].str;
     }
 
+    p->threads = p->opts.threads ? p->opts.threads : av_cpu_count();
+    p->threads = MPCLAMP(p->threads, 1, MAX_THREADS);
+    // Pixel buffering generates the output on the VO thread only.
+    if (p->opts.buffering <= VO_TCT_BUFFER_PIXEL)
+        p->threads = 1;
+    if (p->threads > 1) {
+        int n = p->threads - 1;
+        p->tp = mp_thread_pool_create(NULL, n, n, n);
+        if (!p->tp)
+            p->threads = 1;
+    }
+
     WRITE_STR(TERM_ESC_HIDE_CURSOR);
     terminal_set_mouse_input(true);
     WRITE_STR(TERM_ESC_ALT_SCREEN);
@@ -361,6 +520,7 @@ const struct vo_driver video_out_tct = {
     .priv_defaults = &(const struct priv) {
         .opts.algo = ALGO_HALF_BLOCKS,
         .opts.buffering = VO_TCT_BUFFER_LINE,
+        .opts.delta = true,
     },
     .options = (const m_option_t[]) {
         {"algo", OPT_CHOICE(opts.algo,
@@ -373,6 +533,8 @@ const struct vo_driver video_out_tct = {
             {"pixel", VO_TCT_BUFFER_PIXEL},
             {"line", VO_TCT_BUFFER_LINE},
             {"frame", VO_TCT_BUFFER_FRAME})},
+        {"delta", OPT_BOOL(opts.delta)},
+        {"threads", OPT_CHOICE(opts.threads, {"auto", 0}), M_RANGE(1, 64)},
         {0}
     },
     .options_prefix = "vo-tct",
@@ -22,6 +22,7 @@
 
 #include "common/common.h"
 #include "repack.h"
+#include "repack_simd.h"
 #include "video/csputils.h"
 #include "video/fmt-conversion.h"
 #include "video/img_format.h"
@@ -74,6 +75,7 @@ struct mp_repack {
 
     // F32 repacking.
     int f32_comp_size;
+    repack_f32_cb f32_repack;
     float f32_m[4], f32_o[4];
     uint32_t f32_pmax[4];
     enum pl_color_system f32_csp_space;
@@ -319,6 +321,28 @@ static const struct regular_repacker regular_repackers[] = {
     {32, 10, 0, 3, pa_ccc10z2,  un_ccc10x2},
 };
 
+// Return a vectorized version of the given scanline function, if available.
+static repack_scanline_cb select_simd(struct mp_repack *rp, repack_scanline_cb cb)
+{
+    if (rp->flags & REPACK_CREATE_NO_SIMD)
+        return cb;
+
+    const struct repack_simd *simd = repack_get_simd();
+    const repack_scanline_cb map[][2] = {
+        {un_cc8,    simd->un_cc8},      {pa_cc8,    simd->pa_cc8},
+        {un_cc16,   simd->un_cc16},     {pa_cc16,   simd->pa_cc16},
+        {un_cccc8,  simd->un_cccc8},    {pa_cccc8,  simd->pa_cccc8},
+        {un_ccc8x8, simd->un_ccc8x8},   {pa_ccc8z8, simd->pa_ccc8z8},
+        {un_x8ccc8, simd->un_x8ccc8},   {pa_z8ccc8, simd->pa_z8ccc8},
+        {un_ccc8,   simd->un_ccc8},     {pa_ccc8,   simd->pa_ccc8},
+    };
+    for (int n = 0; n < MP_ARRAY_SIZE(map); n++) {
+        if (map[n][0] == cb && map[n][1])
+            return map[n][1];
+    }
+    return cb;
+}
+
 static void packed_repack(struct mp_repack *rp,
                           struct mp_image *a, int a_x, int a_y,
                           struct mp_image *b, int b_x, int b_y, int w)
@@ -395,7 +419,7 @@ static void setup_packed_packer(struct mp_repack *rp)
             continue;
 
         rp->repack = packed_repack;
-        rp->packed_repack_scanline = repack_cb;
+        rp->packed_repack_scanline = select_simd(rp, repack_cb);
         rp->imgfmt_b = planar_fmt;
         for (int n = 0; n < num_real_components; n++) {
             // Determine permutation that maps component order between the two
@@ -785,7 +809,7 @@ static void setup_nv_packer(struct mp_repack *rp)
 
         rp->repack = repack_nv;
         rp->passthrough_y = true;
-        rp->packed_repack_scanline = repack_cb;
+        rp->packed_repack_scanline = select_simd(rp, repack_cb);
         rp->imgfmt_b = planar_fmt;
         rp->components[0] = desc.planes[1].components[0] - 1;
         rp->components[1] = desc.planes[1].components[1] - 1;
@@ -819,11 +843,7 @@ static void repack_float(struct mp_repack *rp,
                          struct mp_image *a, int a_x, int a_y,
                          struct mp_image *b, int b_x, int b_y, int w)
 {
-    assert(rp->f32_comp_size == 1 || rp->f32_comp_size == 2);
-
-    void (*packer)(void *restrict a, float *restrict b, int w, float fm, float fb, uint32_t max)
-        = rp->pack ? (rp->f32_comp_size == 1 ? pa_f32_8 : pa_f32_16)
-                   : (rp->f32_comp_size == 1 ? un_f32_8 : un_f32_16);
+    repack_f32_cb packer = rp->f32_repack;
 
     for (int p = 0; p < b->num_planes; p++) {
         int h = (1 << b->fmt.chroma_ys) - (1 << b->fmt.ys[p]) + 1;
@@ -837,6 +857,24 @@ static void repack_float(struct mp_repack *rp,
     }
 }
 
+static void setup_repack_float(struct mp_repack *rp)
+{
+    assert(rp->f32_comp_size == 1 || rp->f32_comp_size == 2);
+
+    bool c8 = rp->f32_comp_size == 1;
+    rp->f32_repack = rp->pack ? (c8 ? pa_f32_8 : pa_f32_16)
+                              : (c8 ? un_f32_8 : un_f32_16);
+
+    if (rp->flags & REPACK_CREATE_NO_SIMD)
+        return;
+
+    const struct repack_simd *simd = repack_get_simd();
+    repack_f32_cb fast = rp->pack ? (c8 ? simd->pa_f32_8 : simd->pa_f32_16)
+                                  : (c8 ? simd->un_f32_8 : simd->un_f32_16);
+    if (fast)
+        rp->f32_repack = fast;
+}
+
 static void update_repack_float(struct mp_repack *rp)
 {
     if (!rp->f32_comp_size)
@@ -989,6 +1027,7 @@ static bool setup_format_ne(struct mp_repack *rp)
                 (desc.component_size != 1 && desc.component_size != 2))
                 return false;
             rp->f32_comp_size = desc.component_size;
+            setup_repack_float(rp);
             rp->f32_csp_space = PL_COLOR_SYSTEM_COUNT;
             rp->f32_csp_levels = PL_COLOR_LEVELS_COUNT;
             rp->steps[rp->num_steps++] = (struct repack_step) {
@@ -14,6 +14,10 @@ enum {
     // For mp_repack_create_planar(). If specified, the planar format uses a
     // float 32 bit sample format. No range expansion is done.
     REPACK_CREATE_PLANAR_F32    = (1 << 2),
+
+    // Do not use the vectorized fast paths for some formats (if available on
+    // the running CPU). The result is the same. Mostly for testing.
+    REPACK_CREATE_NO_SIMD       = (1 << 3),
 };
 
 struct mp_repack;
@@ -0,0 +1,677 @@
+/*
+ * This file is part of mpv.
+ *
+ * mpv is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * mpv is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libavutil/cpu.h>
+
+#include "common/common.h"
+#include "osdep/endian.h"
+#include "osdep/threads.h"
+#include "repack_simd.h"
+
+// The x86 code is compiled for the target CPU with function attributes, and
+// selected at runtime. This requires GCC or clang.
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define HAVE_X86 0
+#endif
+
+// NEON is always available on aarch64.
+#if defined(__aarch64__) && defined(__ARM_NEON) && BYTE_ORDER == LITTLE_ENDIAN
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#else
+#define HAVE_NEON 0
+#endif
+
+// Scalar code for the remaining pixels at the end of a line. These must match
+// the functions in repack.c. (Like those, they assume little endian.)
+
+static inline void un_cc8_tail(const uint8_t *s, uint8_t *d[], int x, int w)
+{
+    for (; x < w; x++) {
+        d[0][x] = s[x * 2 + 0];
+        d[1][x] = s[x * 2 + 1];
+    }
+}
+
+static inline void pa_cc8_tail(uint8_t *d, uint8_t *s[], int x, int w)
+{
+    for (; x < w; x++) {
+        d[x * 2 + 0] = s[0][x];
+        d[x * 2 + 1] = s[1][x];
+    }
+}
+
+static inline void un_cc16_tail(const uint16_t *s, uint16_t *d[], int x, int w)
+{
+    for (; x < w; x++) {
+        d[0][x] = s[x * 2 + 0];
+        d[1][x] = s[x * 2 + 1];
+    }
+}
+
+static inline void pa_cc16_tail(uint16_t *d, uint16_t *s[], int x, int w)
+{
+    for (; x < w; x++) {
+        d[x * 2 + 0] = s[0][x];
+        d[x * 2 + 1] = s[1][x];
+    }
+}
+
+// 4 bytes per pixel; components [first, first + num) map to the planes.
+static inline void un_4x8_tail(const uint8_t *s, uint8_t *d[], int x, int w,
+                               int first, int num)
+{
+    for (; x < w; x++) {
+        for (int n = 0; n < num; n++)
+            d[n][x] = s[x * 4 + first + n];
+    }
+}
+
+// Like un_4x8_tail(), but the other bytes are set to 0.
+static inline void pa_4x8_tail(uint8_t *d, uint8_t *s[], int x, int w,
+                               int first, int num)
+{
+    for (; x < w; x++) {
+        for (int n = 0; n < 4; n++) {
+            d[x * 4 + n] = n >= first && n < first + num ? s[n - first][x] : 0;
+        }
+    }
+}
+
+static inline void un_f32_tail(const void *s, int size, float *d, int x, int w,
+                               float m, float o)
+{
+    for (; x < w; x++) {
+        uint32_t v = size == 1 ? ((const uint8_t *)s)[x] : ((const uint16_t *)s)[x];
+        d[x] = v * m + o;
+    }
+}
+
+static inline void pa_f32_tail(void *d, int size, const float *s, int x, int w,
+                               float m, float o, uint32_t p_max)
+{
+    for (; x < w; x++) {
+        long v = MPCLAMP(lrint((s[x] + o) * m), 0, (long)p_max);
+        if (size == 1) {
+            ((uint8_t *)d)[x] = v;
+        } else {
+            ((uint16_t *)d)[x] = v;
+        }
+    }
+}
+
+#if HAVE_X86
+
+TARGET_SSE4 static void un_cc8_sse4(void *restrict src, void *restrict dst[], int w)
+{
+    const uint8_t *s = src;
+    uint8_t **d = (uint8_t **)dst;
+    const __m128i mask = _mm_set1_epi16(0xFF);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + x * 2 + 16));
+        __m128i c0 = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+        __m128i c1 = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128((__m128i *)(d[0] + x), c0);
+        _mm_storeu_si128((__m128i *)(d[1] + x), c1);
+    }
+    un_cc8_tail(s, d, x, w);
+}
+
+TARGET_SSE4 static void pa_cc8_sse4(void *restrict dst, void *restrict src[], int w)
+{
+    uint8_t *d = dst;
+    uint8_t **s = (uint8_t **)src;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i c0 = _mm_loadu_si128((const __m128i *)(s[0] + x));
+        __m128i c1 = _mm_loadu_si128((const __m128i *)(s[1] + x));
+        _mm_storeu_si128((__m128i *)(d + x * 2), _mm_unpacklo_epi8(c0, c1));
+        _mm_storeu_si128((__m128i *)(d + x * 2 + 16), _mm_unpackhi_epi8(c0, c1));
+    }
+    pa_cc8_tail(d, s, x, w);
+}
+
+TARGET_SSE4 static void un_cc16_sse4(void *restrict src, void *restrict dst[], int w)
+{
+    const uint16_t *s = src;
+    uint16_t **d = (uint16_t **)dst;
+    const __m128i mask = _mm_set1_epi32(0xFFFF);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(s + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *)(s + x * 2 + 8));
+        __m128i c0 = _mm_packus_epi32(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+        __m128i c1 = _mm_packus_epi32(_mm_srli_epi32(a, 16), _mm_srli_epi32(b, 16));
+        _mm_storeu_si128((__m128i *)(d[0] + x), c0);
+        _mm_storeu_si128((__m128i *)(d[1] + x), c1);
+    }
+    un_cc16_tail(s, d, x, w);
+}
+
+TARGET_SSE4 static void pa_cc16_sse4(void *restrict dst, void *restrict src[], int w)
+{
+    uint16_t *d = dst;
+    uint16_t **s = (uint16_t **)src;
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i c0 = _mm_loadu_si128((const __m128i *)(s[0] + x));
+        __m128i c1 = _mm_loadu_si128((const __m128i *)(s[1] + x));
+        _mm_storeu_si128((__m128i *)(d + x * 2), _mm_unpacklo_epi16(c0, c1));
+        _mm_storeu_si128((__m128i *)(d + x * 2 + 8), _mm_unpackhi_epi16(c0, c1));
+    }
+    pa_cc16_tail(d, s, x, w);
+}
+
+TARGET_SSE4 static inline void un_4x8_sse4(const uint8_t *s, uint8_t *d[], int w,
+                                           int first, int num)
+{
+    // Group each component of 4 pixels into a 32 bit lane.
+    const __m128i shuf = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13,
+                                       2, 6, 10, 14, 3, 7, 11, 15);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        const __m128i *p = (const __m128i *)(s + x * 4);
+        __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(p + 0), shuf);
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(p + 1), shuf);
+        __m128i c = _mm_shuffle_epi8(_mm_loadu_si128(p + 2), shuf);
+        __m128i e = _mm_shuffle_epi8(_mm_loadu_si128(p + 3), shuf);
+        // Transpose the 4x4 matrix of 32 bit lanes.
+        __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+        __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+        __m128i ce_lo = _mm_unpacklo_epi32(c, e);
+        __m128i ce_hi = _mm_unpackhi_epi32(c, e);
+        __m128i comp[4] = {
+            _mm_unpacklo_epi64(ab_lo, ce_lo),
+            _mm_unpackhi_epi64(ab_lo, ce_lo),
+            _mm_unpacklo_epi64(ab_hi, ce_hi),
+            _mm_unpackhi_epi64(ab_hi, ce_hi),
+        };
+        for (int n = 0; n < num; n++)
+            _mm_storeu_si128((__m128i *)(d[n] + x), comp[first + n]);
+    }
+    un_4x8_tail(s, d, x, w, first, num);
+}
+
+TARGET_SSE4 static inline void pa_4x8_sse4(uint8_t *d, uint8_t *s[], int w,
+                                           int first, int num)
+{
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i c[4];
+        for (int n = 0; n < 4; n++) {
+            c[n] = n >= first && n < first + num
+                 ? _mm_loadu_si128((const __m128i *)(s[n - first] + x))
+                 : _mm_setzero_si128();
+        }
+        __m128i lo01 = _mm_unpacklo_epi8(c[0], c[1]);
+        __m128i hi01 = _mm_unpackhi_epi8(c[0], c[1]);
+        __m128i lo23 = _mm_unpacklo_epi8(c[2], c[3]);
+        __m128i hi23 = _mm_unpackhi_epi8(c[2], c[3]);
+        __m128i *p = (__m128i *)(d + x * 4);
+        _mm_storeu_si128(p + 0, _mm_unpacklo_epi16(lo01, lo23));
+        _mm_storeu_si128(p + 1, _mm_unpackhi_epi16(lo01, lo23));
+        _mm_storeu_si128(p + 2, _mm_unpacklo_epi16(hi01, hi23));
+        _mm_storeu_si128(p + 3, _mm_unpackhi_epi16(hi01, hi23));
+    }
+    pa_4x8_tail(d, s, x, w, first, num);
+}
+
+#define SSE4_4X8(name, first, num)                                          \
+    TARGET_SSE4 static void un_##name##_sse4(void *restrict src,            \
+                                             void *restrict dst[], int w) { \
+        un_4x8_sse4(src, (uint8_t **)dst, w, first, num);                   \
+    }
+
+#define SSE4_4X8_PA(name, first, num)                                       \
+    TARGET_SSE4 static void pa_##name##_sse4(void *restrict dst,            \
+                                             void *restrict src[], int w) { \
+        pa_4x8_sse4(dst, (uint8_t **)src, w, first, num);                   \
+    }
+
+SSE4_4X8(cccc8, 0, 4)
+SSE4_4X8_PA(cccc8, 0, 4)
+SSE4_4X8(ccc8x8, 0, 3)
+SSE4_4X8_PA(ccc8z8, 0, 3)
+SSE4_4X8(x8ccc8, 1, 3)
+SSE4_4X8_PA(z8ccc8, 1, 3)
+
+TARGET_SSE4 static void un_f32_8_sse4(void *restrict src, float *restrict dst,
+                                      int w, float m, float o, uint32_t unused)
+{
+    const uint8_t *s = src;
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+        for (int n = 0; n < 4; n++) {
+            __m128 f = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(v));
+            _mm_storeu_ps(dst + x + n * 4, _mm_add_ps(_mm_mul_ps(f, vm), vo));
+            v = _mm_srli_si128(v, 4);
+        }
+    }
+    un_f32_tail(s, 1, dst, x, w, m, o);
+}
+
+TARGET_SSE4 static void un_f32_16_sse4(void *restrict src, float *restrict dst,
+                                       int w, float m, float o, uint32_t unused)
+{
+    const uint16_t *s = src;
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+        __m128 f0 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(v));
+        __m128 f1 = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_srli_si128(v, 8)));
+        _mm_storeu_ps(dst + x + 0, _mm_add_ps(_mm_mul_ps(f0, vm), vo));
+        _mm_storeu_ps(dst + x + 4, _mm_add_ps(_mm_mul_ps(f1, vm), vo));
+    }
+    un_f32_tail(s, 2, dst, x, w, m, o);
+}
+
+// Compute (src + o) * m, clamp it to [0, p_max], and round to integer. The
+// clamping is done before the conversion, which is equivalent to clamping
+// after lrint(), but avoids overflows. _mm_max_ps() returns its second operand
+// for NaN input, which maps NaN to 0 (like lrint() + MPCLAMP() does on x86).
+#define SSE_F32_TO_INT(v, vo, vm, vmax) \
+    _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(v, vo), vm), \
+                                          _mm_setzero_ps()), vmax))
+
+TARGET_SSE4 static void pa_f32_8_sse4(void *restrict dst, float *restrict src,
+                                      int w, float m, float o, uint32_t p_max)
+{
+    uint8_t *d = dst;
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    const __m128 vmax = _mm_set1_ps(p_max);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i i[4];
+        for (int n = 0; n < 4; n++) {
+            __m128 v = _mm_loadu_ps(src + x + n * 4);
+            i[n] = SSE_F32_TO_INT(v, vo, vm, vmax);
+        }
+        __m128i lo = _mm_packus_epi32(i[0], i[1]);
+        __m128i hi = _mm_packus_epi32(i[2], i[3]);
+        _mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(lo, hi));
+    }
+    pa_f32_tail(d, 1, src, x, w, m, o, p_max);
+}
+
+TARGET_SSE4 static void pa_f32_16_sse4(void *restrict dst, float *restrict src,
+                                       int w, float m, float o, uint32_t p_max)
+{
+    uint16_t *d = dst;
+    const __m128 vm = _mm_set1_ps(m), vo = _mm_set1_ps(o);
+    const __m128 vmax = _mm_set1_ps(p_max);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i i0 = SSE_F32_TO_INT(_mm_loadu_ps(src + x + 0), vo, vm, vmax);
+        __m128i i1 = SSE_F32_TO_INT(_mm_loadu_ps(src + x + 4), vo, vm, vmax);
+        _mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi32(i0, i1));
+    }
+    pa_f32_tail(d, 2, src, x, w, m, o, p_max);
+}
+
+TARGET_AVX2 static void un_f32_8_avx2(void *restrict src, float *restrict dst,
+                                      int w, float m, float o, uint32_t unused)
+{
+    const uint8_t *s = src;
+    const __m256 vm = _mm256_set1_ps(m), vo = _mm256_set1_ps(o);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + x));
+        __m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v));
+        __m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+        _mm256_storeu_ps(dst + x + 0, _mm256_add_ps(_mm256_mul_ps(f0, vm), vo));
+        _mm256_storeu_ps(dst + x + 8, _mm256_add_ps(_mm256_mul_ps(f1, vm), vo));
+    }
+    un_f32_tail(s, 1, dst, x, w, m, o);
+}
+
+TARGET_AVX2 static void un_f32_16_avx2(void *restrict src, float *restrict dst,
+                                       int w, float m, float o, uint32_t unused)
+{
+    const uint16_t *s = src;
+    const __m256 vm = _mm256_set1_ps(m), vo = _mm256_set1_ps(o);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(s + x + 0));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(s + x + 8));
+        __m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v0));
+        __m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v1));
+        _mm256_storeu_ps(dst + x + 0, _mm256_add_ps(_mm256_mul_ps(f0, vm), vo));
+        _mm256_storeu_ps(dst + x + 8, _mm256_add_ps(_mm256_mul_ps(f1, vm), vo));
+    }
+    un_f32_tail(s, 2, dst, x, w, m, o);
+}
+
+// See SSE_F32_TO_INT(). Returns the 16 bit results in a 128 bit register.
+TARGET_AVX2 static inline __m128i avx2_f32_to_u16(const float *src, __m256 vo,
+                                                  __m256 vm, __m256 vmax)
+{
+    __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(src), vo), vm);
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), vmax);
+    __m256i i = _mm256_cvtps_epi32(v);
+    return _mm_packus_epi32(_mm256_castsi256_si128(i),
+                            _mm256_extracti128_si256(i, 1));
+}
+
+TARGET_AVX2 static void pa_f32_8_avx2(void *restrict dst, float *restrict src,
+                                      int w, float m, float o, uint32_t p_max)
+{
+    uint8_t *d = dst;
+    const __m256 vm = _mm256_set1_ps(m), vo = _mm256_set1_ps(o);
+    const __m256 vmax = _mm256_set1_ps(p_max);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i lo = avx2_f32_to_u16(src + x + 0, vo, vm, vmax);
+        __m128i hi = avx2_f32_to_u16(src + x + 8, vo, vm, vmax);
+        _mm_storeu_si128((__m128i *)(d + x), _mm_packus_epi16(lo, hi));
+    }
+    pa_f32_tail(d, 1, src, x, w, m, o, p_max);
+}
+
+TARGET_AVX2 static void pa_f32_16_avx2(void *restrict dst, float *restrict src,
+                                       int w, float m, float o, uint32_t p_max)
+{
+    uint16_t *d = dst;
+    const __m256 vm = _mm256_set1_ps(m), vo = _mm256_set1_ps(o);
+    const __m256 vmax = _mm256_set1_ps(p_max);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i v = avx2_f32_to_u16(src + x, vo, vm, vmax);
+        _mm_storeu_si128((__m128i *)(d + x), v);
+    }
+    pa_f32_tail(d, 2, src, x, w, m, o, p_max);
+}
+
+#endif /* HAVE_X86 */
+
+#if HAVE_NEON
+
+static void un_cc8_neon(void *restrict src, void *restrict dst[], int w)
+{
+    const uint8_t *s = src;
+    uint8_t **d = (uint8_t **)dst;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x2_t v = vld2q_u8(s + x * 2);
+        vst1q_u8(d[0] + x, v.val[0]);
+        vst1q_u8(d[1] + x, v.val[1]);
+    }
+    un_cc8_tail(s, d, x, w);
+}
+
+static void pa_cc8_neon(void *restrict dst, void *restrict src[], int w)
+{
+    uint8_t *d = dst;
+    uint8_t **s = (uint8_t **)src;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x2_t v = {{vld1q_u8(s[0] + x), vld1q_u8(s[1] + x)}};
+        vst2q_u8(d + x * 2, v);
+    }
+    pa_cc8_tail(d, s, x, w);
+}
+
+static void un_cc16_neon(void *restrict src, void *restrict dst[], int w)
+{
+    const uint16_t *s = src;
+    uint16_t **d = (uint16_t **)dst;
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8x2_t v = vld2q_u16(s + x * 2);
+        vst1q_u16(d[0] + x, v.val[0]);
+        vst1q_u16(d[1] + x, v.val[1]);
+    }
+    un_cc16_tail(s, d, x, w);
+}
+
+static void pa_cc16_neon(void *restrict dst, void *restrict src[], int w)
+{
+    uint16_t *d = dst;
+    uint16_t **s = (uint16_t **)src;
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8x2_t v = {{vld1q_u16(s[0] + x), vld1q_u16(s[1] + x)}};
+        vst2q_u16(d + x * 2, v);
+    }
+    pa_cc16_tail(d, s, x, w);
+}
+
+static inline void un_4x8_neon(const uint8_t *s, uint8_t *d[], int w,
+                               int first, int num)
+{
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x4_t v = vld4q_u8(s + x * 4);
+        for (int n = 0; n < num; n++)
+            vst1q_u8(d[n] + x, v.val[first + n]);
+    }
+    un_4x8_tail(s, d, x, w, first, num);
+}
+
+static inline void pa_4x8_neon(uint8_t *d, uint8_t *s[], int w,
+                               int first, int num)
+{
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x4_t v;
+        for (int n = 0; n < 4; n++) {
+            v.val[n] = n >= first && n < first + num ? vld1q_u8(s[n - first] + x)
+                                                     : vdupq_n_u8(0);
+        }
+        vst4q_u8(d + x * 4, v);
+    }
+    pa_4x8_tail(d, s, x, w, first, num);
+}
+
+#define NEON_4X8(name, first, num)                                          \
+    static void un_##name##_neon(void *restrict src, void *restrict dst[],  \
+                                 int w) {                                   \
+        un_4x8_neon(src, (uint8_t **)dst, w, first, num);                   \
+    }
+
+#define NEON_4X8_PA(name, first, num)                                       \
+    static void pa_##name##_neon(void *restrict dst, void *restrict src[],  \
+                                 int w) {                                   \
+        pa_4x8_neon(dst, (uint8_t **)src, w, first, num);                   \
+    }
+
+NEON_4X8(cccc8, 0, 4)
+NEON_4X8_PA(cccc8, 0, 4)
+NEON_4X8(ccc8x8, 0, 3)
+NEON_4X8_PA(ccc8z8, 0, 3)
+NEON_4X8(x8ccc8, 1, 3)
+NEON_4X8_PA(z8ccc8, 1, 3)
+
+static void un_ccc8_neon(void *restrict src, void *restrict dst[], int w)
+{
+    const uint8_t *s = src;
+    uint8_t **d = (uint8_t **)dst;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x3_t v = vld3q_u8(s + x * 3);
+        vst1q_u8(d[0] + x, v.val[0]);
+        vst1q_u8(d[1] + x, v.val[1]);
+        vst1q_u8(d[2] + x, v.val[2]);
+    }
+    for (; x < w; x++) {
+        d[0][x] = s[x * 3 + 0];
+        d[1][x] = s[x * 3 + 1];
+        d[2][x] = s[x * 3 + 2];
+    }
+}
+
+static void pa_ccc8_neon(void *restrict dst, void *restrict src[], int w)
+{
+    uint8_t *d = dst;
+    uint8_t **s = (uint8_t **)src;
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16x3_t v = {{vld1q_u8(s[0] + x), vld1q_u8(s[1] + x),
+                           vld1q_u8(s[2] + x)}};
+        vst3q_u8(d + x * 3, v);
+    }
+    for (; x < w; x++) {
+        d[x * 3 + 0] = s[0][x];
+        d[x * 3 + 1] = s[1][x];
+        d[x * 3 + 2] = s[2][x];
+    }
+}
+
+static inline float32x4_t neon_u32_to_f32(uint32x4_t v, float32x4_t vm,
+                                          float32x4_t vo)
+{
+    return vaddq_f32(vmulq_f32(vcvtq_f32_u32(v), vm), vo);
+}
+
+static void un_f32_8_neon(void *restrict src, float *restrict dst,
+                          int w, float m, float o, uint32_t unused)
+{
+    const uint8_t *s = src;
+    const float32x4_t vm = vdupq_n_f32(m), vo = vdupq_n_f32(o);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        uint8x16_t v = vld1q_u8(s + x);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v));
+        uint16x8_t hi = vmovl_u8(vget_high_u8(v));
+        vst1q_f32(dst + x + 0, neon_u32_to_f32(vmovl_u16(vget_low_u16(lo)), vm, vo));
+        vst1q_f32(dst + x + 4, neon_u32_to_f32(vmovl_u16(vget_high_u16(lo)), vm, vo));
+        vst1q_f32(dst + x + 8, neon_u32_to_f32(vmovl_u16(vget_low_u16(hi)), vm, vo));
+        vst1q_f32(dst + x + 12, neon_u32_to_f32(vmovl_u16(vget_high_u16(hi)), vm, vo));
+    }
+    un_f32_tail(s, 1, dst, x, w, m, o);
+}
+
+static void un_f32_16_neon(void *restrict src, float *restrict dst,
+                           int w, float m, float o, uint32_t unused)
+{
+    const uint16_t *s = src;
+    const float32x4_t vm = vdupq_n_f32(m), vo = vdupq_n_f32(o);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8_t v = vld1q_u16(s + x);
+        vst1q_f32(dst + x + 0, neon_u32_to_f32(vmovl_u16(vget_low_u16(v)), vm, vo));
+        vst1q_f32(dst + x + 4, neon_u32_to_f32(vmovl_u16(vget_high_u16(v)), vm, vo));
+    }
+    un_f32_tail(s, 2, dst, x, w, m, o);
+}
+
+// Like SSE_F32_TO_INT(). vmaxnmq_f32() maps NaN to 0.
+static inline uint16x4_t neon_f32_to_u16(const float *src, float32x4_t vo,
+                                         float32x4_t vm, float32x4_t vmax)
+{
+    float32x4_t v = vmulq_f32(vaddq_f32(vld1q_f32(src), vo), vm);
+    v = vminq_f32(vmaxnmq_f32(v, vdupq_n_f32(0)), vmax);
+    return vmovn_u32(vcvtnq_u32_f32(v));
+}
+
+static void pa_f32_8_neon(void *restrict dst, float *restrict src,
+                          int w, float m, float o, uint32_t p_max)
+{
+    uint8_t *d = dst;
+    const float32x4_t vm = vdupq_n_f32(m), vo = vdupq_n_f32(o);
+    const float32x4_t vmax = vdupq_n_f32(p_max);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8_t v = vcombine_u16(neon_f32_to_u16(src + x + 0, vo, vm, vmax),
+                                    neon_f32_to_u16(src + x + 4, vo, vm, vmax));
+        vst1_u8(d + x, vmovn_u16(v));
+    }
+    pa_f32_tail(d, 1, src, x, w, m, o, p_max);
+}
+
+static void pa_f32_16_neon(void *restrict dst, float *restrict src,
+                           int w, float m, float o, uint32_t p_max)
+{
+    uint16_t *d = dst;
+    const float32x4_t vm = vdupq_n_f32(m), vo = vdupq_n_f32(o);
+    const float32x4_t vmax = vdupq_n_f32(p_max);
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        uint16x8_t v = vcombine_u16(neon_f32_to_u16(src + x + 0, vo, vm, vmax),
+                                    neon_f32_to_u16(src + x + 4, vo, vm, vmax));
+        vst1q_u16(d + x, v);
+    }
+    pa_f32_tail(d, 2, src, x, w, m, o, p_max);
+}
+
+#endif /* HAVE_NEON */
+
+static struct repack_simd simd;
+static mp_once simd_once = MP_STATIC_ONCE_INITIALIZER;
+
+static void init_simd(void)
+{
+    int flags = av_get_cpu_flags();
+    (void)flags;
+
+#if HAVE_X86
+    if (flags & AV_CPU_FLAG_SSE4) {
+        simd = (struct repack_simd){
+            .un_cc8 = un_cc8_sse4,          .pa_cc8 = pa_cc8_sse4,
+            .un_cc16 = un_cc16_sse4,        .pa_cc16 = pa_cc16_sse4,
+            .un_cccc8 = un_cccc8_sse4,      .pa_cccc8 = pa_cccc8_sse4,
+            .un_ccc8x8 = un_ccc8x8_sse4,    .pa_ccc8z8 = pa_ccc8z8_sse4,
+            .un_x8ccc8 = un_x8ccc8_sse4,    .pa_z8ccc8 = pa_z8ccc8_sse4,
+            .un_f32_8 = un_f32_8_sse4,      .pa_f32_8 = pa_f32_8_sse4,
+            .un_f32_16 = un_f32_16_sse4,    .pa_f32_16 = pa_f32_16_sse4,
+        };
+    }
+    // The integer repackers are limited by memory bandwidth, so only the float
+    // conversions benefit from 256 bit vectors.
+    if (flags & AV_CPU_FLAG_AVX2) {
+        simd.un_f32_8 = un_f32_8_avx2;
+        simd.pa_f32_8 = pa_f32_8_avx2;
+        simd.un_f32_16 = un_f32_16_avx2;
+        simd.pa_f32_16 = pa_f32_16_avx2;
+    }
+#endif
+
+#if HAVE_NEON
+    if (flags & AV_CPU_FLAG_NEON) {
+        simd = (struct repack_simd){
+            .un_cc8 = un_cc8_neon,          .pa_cc8 = pa_cc8_neon,
+            .un_cc16 = un_cc16_neon,        .pa_cc16 = pa_cc16_neon,
+            .un_cccc8 = un_cccc8_neon,      .pa_cccc8 = pa_cccc8_neon,
+            .un_ccc8x8 = un_ccc8x8_neon,    .pa_ccc8z8 = pa_ccc8z8_neon,
+            .un_x8ccc8 = un_x8ccc8_neon,    .pa_z8ccc8 = pa_z8ccc8_neon,
+            .un_ccc8 = un_ccc8_neon,        .pa_ccc8 = pa_ccc8_neon,
+            .un_f32_8 = un_f32_8_neon,      .pa_f32_8 = pa_f32_8_neon,
+            .un_f32_16 = un_f32_16_neon,    .pa_f32_16 = pa_f32_16_neon,
+        };
+    }
+#endif
+}
+
+const struct repack_simd *repack_get_simd(void)
+{
+    mp_exec_once(&simd_once, init_simd);
+    return &simd;
+}
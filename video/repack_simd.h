@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// Scanline functions as used by repack.c.
+//  pack:   a is dst, b is src
+//  unpack: a is src, b is dst
+typedef void (*repack_scanline_cb)(void *restrict a, void *restrict b[], int w);
+typedef void (*repack_f32_cb)(void *restrict a, float *restrict b, int w,
+                              float m, float o, uint32_t p_max);
+
+// Vectorized versions of some of the scanline functions in repack.c. Each one
+// has the same semantics (and produces the same output) as the C function of
+// the same name. Entries are NULL if the running CPU has no fast path.
+struct repack_simd {
+    repack_scanline_cb un_cc8, pa_cc8;              // NV12
+    repack_scanline_cb un_cc16, pa_cc16;            // P010, P016
+    repack_scanline_cb un_cccc8, pa_cccc8;          // RGBA etc.
+    repack_scanline_cb un_ccc8x8, pa_ccc8z8;        // RGB0 etc.
+    repack_scanline_cb un_x8ccc8, pa_z8ccc8;        // 0RGB etc.
+    repack_scanline_cb un_ccc8, pa_ccc8;            // RGB24
+    repack_f32_cb un_f32_8, pa_f32_8;
+    repack_f32_cb un_f32_16, pa_f32_16;
+};
+
+// Return the fast paths for the running CPU. Thread-safe.
+const struct repack_simd *repack_get_simd(void);
@@ -391,8 +391,11 @@ int mp_sws_scale(struct mp_sws_context *ctx, struct mp_image *dst,
     }
 
 #if HAVE_ZIMG
-    if (ctx->zimg_ok)
+    if (ctx->zimg_ok) {
+        ctx->zimg->dst_written = ctx->dst_written;
+        ctx->zimg->dst_written_opaque = ctx->dst_written_opaque;
         return mp_zimg_convert(ctx->zimg, dst, src) ? 0 : -1;
+    }
 #endif
 
     if (src->params.repr.sys == PL_COLOR_SYSTEM_XYZ && dst->params.repr.sys != PL_COLOR_SYSTEM_XYZ) {
@@ -421,6 +424,11 @@ int mp_sws_scale(struct mp_sws_context *ctx, struct mp_image *dst,
     if (a_dst != dst)
         mp_image_copy(dst, a_dst);
 
+    if (ctx->dst_written) {
+        struct mp_rect rc = {0, 0, dst->w, dst->h};
+        ctx->dst_written(ctx->dst_written_opaque, dst, rc);
+    }
+
     return 0;
 }
 
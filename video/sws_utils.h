@@ -44,6 +44,13 @@ struct mp_sws_context {
     // This is unfortunately a hack: bypass command line choice
     enum mp_sws_scaler force_scaler;
 
+    // Optional. Called by mp_sws_scale() after parts of dst were written, with
+    // rc in dst pixel coordinates. With zimg, this happens per slice while the
+    // data is likely still in the CPU cache (possibly concurrently on worker
+    // threads), otherwise once for the whole image.
+    void (*dst_written)(void *opaque, struct mp_image *dst, struct mp_rect rc);
+    void *dst_written_opaque;
+
     // If zimg is used. Need to manually invalidate cache (set force_reload).
     // Conflicts with enabling command line opts.
     struct zimg_opts *zimg_opts;
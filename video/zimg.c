@@ -15,6 +15,7 @@
  * License along with mpv.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <assert.h>
 #include <math.h>
 
 #include <libavutil/cpu.h>
@@ -26,6 +27,8 @@
 #include "misc/thread_tools.h"
 #include "options/m_config.h"
 #include "options/m_option.h"
+#include "osdep/threads.h"
+#include "osdep/timer.h"
 #include "repack.h"
 #include "video/fmt-conversion.h"
 #include "video/img_format.h"
@@ -111,8 +114,38 @@ struct mp_zimg_repack {
     struct mp_image cropped_tmp;
 
     int real_w, real_h;         // aligned size
+
+    // Set by mp_zimg_convert() on the pack side, for ctx->dst_written.
+    struct mp_zimg_context *ctx;
+    struct mp_image *user_mpi;  // uncropped target image
+    int user_y;                 // position of the slice in user_mpi
+};
+
+#define MAX_SLICES 64
+
+// Process-wide cache of unused conversion states. When a context is destroyed
+// or reconfigured, its states are moved to the cache, and a context configured
+// with the same parameters later takes them instead of building new ones. This
+// helps with code that creates a new context per image (like screenshots).
+#define CACHE_MAX_ENTRIES 8
+#define CACHE_MAX_AGE_NS MP_TIME_S_TO_NS(10)
+
+struct cache_entry {
+    struct mp_image_params src, dst;
+    struct zimg_opts opts;
+    struct mp_zimg_state *states[MAX_SLICES];
+    int num_states;
+    int64_t last_used;
 };
 
+static mp_static_mutex cache_lock = MP_STATIC_MUTEX_INITIALIZER;
+
+// All protected by cache_lock. Ordered from least to most recently used.
+static struct cache_entry cache[CACHE_MAX_ENTRIES];
+static int num_cache;
+static struct mp_zimg_cache_stats cache_stats;
+static int cache_users;     // mp_zimg_cache_ref() calls not undone yet
+
 static void mp_zimg_update_from_cmdline(struct mp_zimg_context *ctx)
 {
     m_config_cache_update(ctx->opts_cache);
@@ -198,17 +231,160 @@ static zimg_color_primaries_e mp_to_z_prim(enum pl_color_primaries prim)
     }
 }
 
-static void destroy_zimg(struct mp_zimg_context *ctx)
+static void free_states(struct mp_zimg_state **states, int num_states)
 {
-    for (int n = 0; n < ctx->num_states; n++) {
-        struct mp_zimg_state *st = ctx->states[n];
+    for (int n = 0; n < num_states; n++) {
+        struct mp_zimg_state *st = states[n];
         talloc_free(st->tmp_alloc);
         zimg_filter_graph_free(st->graph);
         TA_FREEP(&st->src);
         TA_FREEP(&st->dst);
         talloc_free(st);
     }
+}
+
+static void free_entries(struct cache_entry *entries, int num_entries)
+{
+    for (int n = 0; n < num_entries; n++)
+        free_states(entries[n].states, entries[n].num_states);
+}
+
+static bool param_equal(double a, double b)
+{
+    return a == b || (isnan(a) && isnan(b));
+}
+
+static bool opts_equal(const struct zimg_opts *a, const struct zimg_opts *b)
+{
+    return a->scaler == b->scaler &&
+           param_equal(a->scaler_params[0], b->scaler_params[0]) &&
+           param_equal(a->scaler_params[1], b->scaler_params[1]) &&
+           a->scaler_chroma == b->scaler_chroma &&
+           param_equal(a->scaler_chroma_params[0], b->scaler_chroma_params[0]) &&
+           param_equal(a->scaler_chroma_params[1], b->scaler_chroma_params[1]) &&
+           a->dither == b->dither &&
+           a->fast == b->fast &&
+           a->threads == b->threads;
+}
+
+// Remove entries which were not used for too long. Must hold cache_lock.
+static void cache_expire(struct cache_entry *victims, int *num_victims)
+{
+    int64_t now = mp_time_ns();
+    while (num_cache && now - cache[0].last_used > CACHE_MAX_AGE_NS) {
+        victims[(*num_victims)++] = cache[0];
+        MP_TARRAY_REMOVE_AT(cache, num_cache, 0);
+    }
+}
+
+// Move the states of ctx to the cache.
+static void cache_put(struct mp_zimg_context *ctx)
+{
+    assert(ctx->num_states <= MAX_SLICES);
+
+    struct cache_entry entry = {
+        .src = ctx->states[0]->src->fmt,
+        .dst = ctx->states[0]->dst->fmt,
+        .opts = ctx->states_opts,
+        .num_states = ctx->num_states,
+        .last_used = mp_time_ns(),
+    };
+    for (int n = 0; n < ctx->num_states; n++)
+        entry.states[n] = ctx->states[n];
+    ctx->num_states = 0;
+
+    struct cache_entry victims[CACHE_MAX_ENTRIES];
+    int num_victims = 0;
+
+    mp_mutex_lock(&cache_lock);
+    cache_expire(victims, &num_victims);
+    if (num_cache == CACHE_MAX_ENTRIES) {
+        victims[num_victims++] = cache[0];
+        MP_TARRAY_REMOVE_AT(cache, num_cache, 0);
+    }
+    cache[num_cache++] = entry;
+    mp_mutex_unlock(&cache_lock);
+
+    free_entries(victims, num_victims);
+}
+
+// Take states matching the parameters of ctx from the cache.
+static bool cache_take(struct mp_zimg_context *ctx, int slices)
+{
+    struct cache_entry found = {0};
+    struct cache_entry victims[CACHE_MAX_ENTRIES];
+    int num_victims = 0;
+
+    mp_mutex_lock(&cache_lock);
+    cache_expire(victims, &num_victims);
+    for (int n = num_cache - 1; n >= 0; n--) {
+        struct cache_entry *e = &cache[n];
+        if (e->num_states == slices &&
+            mp_image_params_equal(&e->src, &ctx->src) &&
+            mp_image_params_equal(&e->dst, &ctx->dst) &&
+            opts_equal(&e->opts, &ctx->opts))
+        {
+            found = *e;
+            MP_TARRAY_REMOVE_AT(cache, num_cache, n);
+            break;
+        }
+    }
+    if (found.num_states) {
+        cache_stats.hits += 1;
+    } else {
+        cache_stats.misses += 1;
+    }
+    mp_mutex_unlock(&cache_lock);
+
+    free_entries(victims, num_victims);
+
+    for (int n = 0; n < found.num_states; n++)
+        MP_TARRAY_APPEND(ctx, ctx->states, ctx->num_states, found.states[n]);
+    return found.num_states > 0;
+}
+
+void mp_zimg_cache_ref(void)
+{
+    mp_mutex_lock(&cache_lock);
+    cache_users += 1;
+    mp_mutex_unlock(&cache_lock);
+}
+
+void mp_zimg_cache_unref(void)
+{
+    struct cache_entry victims[CACHE_MAX_ENTRIES];
+    int num_victims = 0;
+
+    mp_mutex_lock(&cache_lock);
+    assert(cache_users > 0);
+    cache_users -= 1;
+    if (!cache_users) {
+        for (int n = 0; n < num_cache; n++)
+            victims[num_victims++] = cache[n];
+        num_cache = 0;
+    }
+    mp_mutex_unlock(&cache_lock);
+
+    free_entries(victims, num_victims);
+}
+
+void mp_zimg_cache_get_stats(struct mp_zimg_cache_stats *st)
+{
+    mp_mutex_lock(&cache_lock);
+    *st = cache_stats;
+    st->entries = num_cache;
+    mp_mutex_unlock(&cache_lock);
+}
+
+static void destroy_zimg(struct mp_zimg_context *ctx)
+{
+    if (ctx->states_complete && ctx->num_states) {
+        cache_put(ctx);
+    } else {
+        free_states(ctx->states, ctx->num_states);
+    }
     ctx->num_states = 0;
+    ctx->states_complete = false;
 }
 
 static void free_mp_zimg(void *p)
@@ -258,6 +434,15 @@ static int repack_entrypoint(void *user, unsigned i, unsigned x0, unsigned x1)
 
     repack_line(r->repack, x0, i_dst, x0, i_src, x1 - x0);
 
+    if (r->pack && r->ctx->dst_written) {
+        struct mp_image *mpi = r->user_mpi;
+        int y = r->user_y + i;
+        int h = mp_repack_get_align_y(r->repack);
+        struct mp_rect rc = {x0, y, MPMIN(x1, mpi->w), MPMIN(y + h, mpi->h)};
+        if (rc.x1 > rc.x0 && rc.y1 > rc.y0)
+            r->ctx->dst_written(r->ctx->dst_written_opaque, mpi, rc);
+    }
+
     return 0;
 }
 
@@ -271,6 +456,8 @@ static bool wrap_buffer(struct mp_zimg_state *st, struct mp_zimg_repack *r,
     if (r->pack) {
         mpi = &r->cropped_tmp;
         *mpi = *a_mpi;
+        r->user_mpi = a_mpi;
+        r->user_y = st->slice_y;
         int y1 = st->slice_y + st->slice_h;
         // Due to subsampling we may assume the image to be bigger than it
         // actually is (see real_h in setup_format).
@@ -589,7 +776,7 @@ bool mp_zimg_config(struct mp_zimg_context *ctx)
     int slices = ctx->opts.threads;
     if (slices < 1)
         slices = av_cpu_count();
-    slices = MPCLAMP(slices, 1, 64);
+    slices = MPCLAMP(slices, 1, MAX_SLICES);
 
     struct mp_imgfmt_desc dstfmt = mp_imgfmt_get_desc(ctx->dst.imgfmt);
     if (!dstfmt.align_y)
@@ -614,16 +801,20 @@ bool mp_zimg_config(struct mp_zimg_context *ctx)
         }
     }
 
-    for (int n = 0; n < slices; n++) {
-        struct mp_zimg_state *st = talloc_zero(NULL, struct mp_zimg_state);
-        MP_TARRAY_APPEND(ctx, ctx->states, ctx->num_states, st);
+    if (!cache_take(ctx, slices)) {
+        for (int n = 0; n < slices; n++) {
+            struct mp_zimg_state *st = talloc_zero(NULL, struct mp_zimg_state);
+            MP_TARRAY_APPEND(ctx, ctx->states, ctx->num_states, st);
 
-        if (!mp_zimg_state_init(ctx, st, n * slice_h, slice_h))
-            goto fail;
+            if (!mp_zimg_state_init(ctx, st, n * slice_h, slice_h))
+                goto fail;
+        }
     }
 
     assert(ctx->num_states == slices);
 
+    ctx->states_opts = ctx->opts;
+    ctx->states_complete = true;
     return true;
 
 fail:
@@ -691,6 +882,7 @@ bool mp_zimg_convert(struct mp_zimg_context *ctx, struct mp_image *dst,
             MP_ERR(ctx, "zimg repacker initialization failed.\n");
             return false;
         }
+        st->dst->ctx = ctx;
     }
 
     for (int n = 1; n < ctx->num_states; n++) {
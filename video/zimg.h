@@ -39,10 +39,20 @@ struct mp_zimg_context {
     // automatically.
     struct mp_image_params src, dst;
 
+    // Optional. If set, mp_zimg_convert() calls this after each part of the
+    // target image was written, with rc in dst pixel coordinates. This happens
+    // while the data is likely still in the CPU cache, and may happen
+    // concurrently on worker threads (for disjoint parts). Changing this does
+    // not require calling mp_zimg_config().
+    void (*dst_written)(void *opaque, struct mp_image *dst, struct mp_rect rc);
+    void *dst_written_opaque;
+
     // Cached zimg state (if any). Private, do not touch.
     struct m_config_cache *opts_cache;
     struct mp_zimg_state **states;
     int num_states;
+    bool states_complete;
+    struct zimg_opts states_opts;
     struct mp_thread_pool *tp;
     int current_thread_count;
 };
@@ -71,3 +81,19 @@ bool mp_zimg_config_image_params(struct mp_zimg_context *ctx);
 // Convert/scale src to dst. On failure, the data in dst is not touched.
 bool mp_zimg_convert(struct mp_zimg_context *ctx, struct mp_image *dst,
                      struct mp_image *src);
+
+struct mp_zimg_cache_stats {
+    uint64_t hits;          // mp_zimg_config() calls which reused a graph
+    uint64_t misses;        // mp_zimg_config() calls which built a new graph
+    int entries;            // number of unused graphs kept
+};
+
+// Unused conversion graphs are kept in a process-wide cache, and reused by
+// contexts configured with the same parameters. These functions are
+// thread-safe.
+void mp_zimg_cache_get_stats(struct mp_zimg_cache_stats *st);
+
+// Register a user of the cache, such as a player instance. When the last one
+// calls mp_zimg_cache_unref(), all unused graphs are freed.
+void mp_zimg_cache_ref(void);
+void mp_zimg_cache_unref(void);